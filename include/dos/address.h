@@ -7,6 +7,8 @@
 
 #include "dos/types.h"
 
+class TextBuffer;
+
 static constexpr Size MEM_TOTAL = 1_MB;
 static constexpr Size SEGMENT_SIZE = 64_kB;
 static constexpr int SEGMENT_MASK = 0xf0000;
@@ -60,6 +62,7 @@ struct Address {
 
     void set(const Offset linear);
     std::string toString(const bool brief = false) const;
+    void format(TextBuffer &out, const bool brief = false) const;
     inline Offset toLinear() const { return SEG_TO_OFFSET(segment) + offset; }
     bool isNull() const { return segment == 0 && offset == 0; }
     bool isValid() const { return segment != ADDR_INVALID || offset != ADDR_INVALID; }
@@ -15,6 +15,7 @@
 #include "dos/scanq.h"
 #include "dos/codemap.h"
 #include "dos/signature.h"
+#include "dos/coverage.h"
 
 class Executable;
 
@@ -119,15 +120,18 @@ private:
     Size refSkipCount, tgtSkipCount;
     Address refSkipOrigin, tgtSkipOrigin;
     std::set<Variable> vars;
+    const Coverage *coverage;
 
 public:
-    Analyzer(const Options &options, const Size maxData = 0) : options(options), offMap(maxData), comparedSize(0) {}
+    Analyzer(const Options &options, const Size maxData = 0) : options(options), offMap(maxData), comparedSize(0), coverage(nullptr) {}
     void exploreCode(Executable &exe);
     bool compareCode(const Executable &ref, Executable &tgt);
     bool compareData(const Executable &ref, const Executable &tgt, const std::string &segment, std::string tsegment);
-    bool findDuplicates(const SignatureLibrary signatures, Executable &tgt);
+    bool findDuplicates(const SignatureLibrary &signatures, Executable &tgt);
     void findDataRefs(const Executable &exe);
     void seedQueue(Executable &exe, const bool seedStart = true);
+    // use the coverage from running the executable to resolve indirect branches and reach code missed by the exploration
+    void seedCoverage(const Coverage &cov) { coverage = &cov; }
 
 private:
     bool skipAllowed(const Instruction &refInstr, Instruction tgtInstr);
@@ -147,6 +151,8 @@ private:
     void comparisonSummary(const Executable &ref, const bool showMissed);
     void processDataReference(const Executable &exe, const Instruction i, const CpuState &regs);
     void claimNops(const Instruction &i, const Executable &exe);
+    bool seedObservedBranch(const Executable &exe);
+    bool seedExecuted(const Executable &exe);
 };
 
 #endif // ANALYSIS_H
\ No newline at end of file
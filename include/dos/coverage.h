@@ -0,0 +1,34 @@
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <vector>
+#include <string>
+
+#include "dos/types.h"
+#include "dos/address.h"
+#include "dos/profile.h"
+
+// Code coverage of an executable gathered by running it on the emulated CPU, for guiding the static exploration of the code
+// into places which it is unable to reach by itself: the runs of executed code, and the observed destinations of calls
+// and jumps through a register or memory. Saved as a text file with addresses relative to the load segment, like a map.
+class Coverage {
+public:
+    using IndirectBranch = ExecProfile::IndirectBranch;
+
+private:
+    std::vector<Block> executed_;
+    std::vector<IndirectBranch> branches_;
+
+public:
+    Coverage() {}
+    explicit Coverage(const ExecProfile &profile);
+    Coverage(const std::string &path, const Word reloc);
+    void save(const std::string &path, const Word reloc, const bool overwrite = false) const;
+    bool empty() const { return executed_.empty() && branches_.empty(); }
+    const std::vector<Block>& executed() const { return executed_; }
+    const std::vector<IndirectBranch>& branches() const { return branches_; }
+    // observed destinations of the indirect branch at the address
+    std::vector<IndirectBranch> branchesFrom(const Address &source) const;
+};
+
+#endif // COVERAGE_H
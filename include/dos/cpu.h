@@ -3,10 +3,17 @@
 
 #include <string>
 #include <queue>
+#include <array>
+#include <vector>
+#include <map>
+#include <optional>
 #include "dos/types.h"
 #include "dos/registers.h"
 #include "dos/memory.h"
 #include "dos/instruction.h"
+#include "dos/profile.h"
+#include "dos/trace.h"
+#include "dos/watch.h"
 
 class Cpu {
 public:
@@ -19,28 +26,130 @@ public:
 
 class InterruptInterface;
 
+// How the emulator gets from a decoded instruction to its implementation:
+// DISPATCH_SWITCH goes through switches over the instruction class and the group bits of the ModR/M byte, and evaluates
+// the memory operand of a ModR/M instruction from the ModR/M byte when it is reached;
+// DISPATCH_TABLE jumps straight through a table of handlers indexed by the opcode, with the operand locations resolved
+// from the decoded instruction before the handler runs.
+enum CpuDispatch { DISPATCH_SWITCH, DISPATCH_TABLE };
+
+// state of the emulated machine between instructions, the memory pages are shared with the instance it was taken from
+// and any other snapshot until written, so forking execution from it does not copy the whole memory
+struct CpuSnapshot {
+    Registers regs;
+    MemorySnapshot memory;
+    Block codeExtents;
+    Size executed, skipped, synced;
+    bool done; // the program had ended
+    // progress of the idle loop detection, so that execution resumed from the snapshot goes the same way
+    Offset pollBegin, pollEnd;
+    Registers pollRegs;
+};
+
 class Cpu_8086 : public Cpu {
     friend class CpuTest;
+
+    using Handler = void (Cpu_8086::*)();
+    static const std::array<Handler, INS_IDIV + 1> CLASS_HANDLER;
+    static const std::array<Handler, 0x100> OPCODE_HANDLER;
+
+    // flag computation which the result of the last arithmetic or logic operation calls for,
+    // the flags are only computed from the recorded operation when something reads them
+    enum FlagOp : Byte { FLAGOP_ADD, FLAGOP_ADC, FLAGOP_SUB, FLAGOP_SBB, FLAGOP_LOGIC, FLAGOP_INC, FLAGOP_DEC };
+    // where an instruction operand lives, resolved before the instruction is executed
+    enum OperandLocation : Byte { LOC_NONE, LOC_REG, LOC_MEM, LOC_IMM };
+    struct OperandRef {
+        OperandLocation loc;
+        Register reg; // register operand or segment of a memory operand
+        Word offset; // effective address of a memory operand within its segment
+        Offset addr; // linear address of a memory operand
+        Word value; // immediate value, sign-extended from a byte
+    };
+    // an instruction translated ahead of its execution, with everything the pipeline would otherwise work out
+    // from the code bytes each time it runs
+    struct MicroOp {
+        Instruction instr;
+        Size length; // including any prefixes not folded into the instruction
+        Register segOverride;
+        InstructionPrefix chainPrefix;
+        Byte modrm;
+        Handler handler; // for the table dispatch, with group opcodes already resolved to their class
+    };
+    // straight-line run of instructions up to a control transfer, cached by the linear address of its start
+    struct CodeBlock {
+        Word segment;
+        Offset begin, end; // linear extent of the code bytes, end exclusive
+        std::vector<MicroOp> ops;
+        bool poll; // a loop onto itself which only reads ports or memory into registers and tests them
+    };
+    static constexpr Size BLOCK_OPS_MAX = 32;
+    static constexpr Size BLOCK_SPAN_MAX = 64; // upper bound on the extent of a block in bytes
+    // how often the time is passed to the rest of the machine, it is also done whenever the program can observe it
+    static constexpr Size SYNC_INSTRUCTIONS = 256;
     
 private:
     Memory *mem_;
     InterruptInterface *int_;
+    CpuDispatch dispatch_;
     Registers regs_;
     const Byte *memBase_, *code_;
+    Instruction instr_;
+    Size length_;
     Byte opcode_, modrm_;
     Register segOverride_;
-    Byte byteOperand1_, byteOperand2_, byteResult_;
-    Word wordOperand1_, wordOperand2_, wordResult_;
+    InstructionPrefix chainPrefix_;
+    OperandRef ops_[2];
+    std::map<Offset, CodeBlock> blocks_;
+    bool wide_;
+    FlagOp flagOp_;
+    bool flagWide_, flagCarry_;
+    Word flagOperand1_, flagOperand2_, flagResult_;
+    Word flagsLazy_; // flags whose value is defined by the recorded operation instead of the flags register
     Block codeExtents_;
     bool done_, step_;
+    Size stopAt_; // instruction count where the current run ends early
+    Size executed_, skipped_, synced_;
+    // polling loop which went around last, with the registers at its start
+    Offset pollBegin_, pollEnd_;
+    Registers pollRegs_;
+    ExecProfile *profile_;
+    TraceInterface *trace_;
+    std::vector<MemoryWrite> writes_;
+    const Watchpoints *watch_;
+    WatchInterface *watchHandler_;
+    // accesses to watched memory by the current instruction, reported once it is done; collected from the const read path
+    mutable std::vector<WatchHit> watchHits_;
+    Offset breakAt_; // breakpoint where the execution was stopped, passed over once when it resumes
+    bool stopped_;
 
 public:
-    Cpu_8086(Memory *memory, InterruptInterface *inthandler);
+    Cpu_8086(Memory *memory, InterruptInterface *inthandler, const CpuDispatch dispatch = DISPATCH_SWITCH);
     std::string type() const override { return "8086"; };
     std::string info() const override;
     void init(const Address &codeAddr, const Address &stackAddr, const Size codeSize) override;
     void step() override;
     void run() override;
+    // run for at most the number of instructions
+    void run(const Size count);
+    CpuDispatch dispatchMode() const { return dispatch_; }
+    const Registers& registers() const { return regs_; }
+    Size executed() const { return executed_; }
+    // instructions which idle polling loops would have executed, had they not been fast-forwarded
+    Size skipped() const { return skipped_; }
+    bool done() const { return done_; }
+    Size blockCount() const { return blocks_.size(); }
+    // count the instructions executed and the branches taken into the profile, disabled with nullptr
+    void setProfile(ExecProfile *profile) { profile_ = profile; }
+    // pass the effects of every instruction executed to the trace, disabled with nullptr
+    void setTrace(TraceInterface *trace);
+    // report the breakpoints and memory watchpoints to the handler as they are hit, disabled with nullptr;
+    // accesses made by the interrupt handler on behalf of the program are not watched
+    void setWatch(const Watchpoints *watch, WatchInterface *handler);
+    // whether the last run ended because the watch handler asked for it, running again continues from there;
+    // running out of the instruction count does not count as stopped
+    bool stopped() const { return stopped_; }
+    CpuSnapshot snapshot();
+    void restore(const CpuSnapshot &snap);
 
 private:
     // utility
@@ -56,20 +165,73 @@ private:
 
     inline Byte memByte(const Offset offset) const { return memBase_[offset]; }
     inline Word memWord(const Offset offset) const { return *WORD_PTR(memBase_, offset); }
+    template<typename T> T memRead(const Offset offset) const;
+    template<typename T> void memWrite(const Offset offset, const T value);
 
     // ModR/M byte and evaluation
-    Offset modrmMemAddress() const;
+    void modrmMemOperand(OperandRef &ref) const;
 
     std::string opcodeStr() const;
-    void preProcessOpcode();
+    void translate(const Address &csip, MicroOp &op) const;
+    void loadMicroOp(const MicroOp &op);
     size_t instructionLength() const;
 
+    // translation cache
+    const CodeBlock& fetchBlock();
+    void invalidateCode();
+    void flushBlocks();
+    static bool pollLoop(const CodeBlock &block, const Word start);
+
+    // operand resolution and access
+    void bindOperands();
+    void bindOperand(OperandRef &ref, const Instruction::Operand &op, const bool modrm);
+    void operandAddress(OperandRef &ref, const Instruction::Operand &op) const;
+    template<typename T> T load(const int idx) const;
+    template<typename T> void store(const int idx, const T value);
+    Address loadFarPointer(const int idx) const;
+    void push(const Word value);
+    Word pop();
+    void interrupt(const Byte num);
+    Word portNumber(const int idx) const;
+    void syncTime();
+    void checkIdle(const CodeBlock &block);
+    inline void watchAccess(const WatchKind kind, const Offset addr, const Size size) const {
+        if (watch_ && watch_->test(kind, addr, size)) watchHits_.push_back({kind, {}, addr, size});
+    }
+    bool breakpoint(const Address &csip, const Offset linear);
+    bool watchReport(const Address &csip);
+
     // instruction execution pipeline
     void pipeline();
     void dispatch();
     void groupDispatch();
+    void groupClassDispatch();
     void unknown(const std::string &stage) const;
     void updateFlags();
+    bool lazyFlag(const Flag flag) const;
+    inline bool getFlag(const Flag flag) const { return (flagsLazy_ & flag) ? lazyFlag(flag) : regs_.getFlag(flag); }
+    inline void setFlag(const Flag flag, const bool value) { flagsLazy_ &= ~flag; regs_.setFlag(flag, value); }
+    Word getFlags();
+    void setFlags(const Word value);
+    template<typename T> void setFlagOperands(const FlagOp op, const T op1, const T op2, const T result, const bool carry = false);
+    template<typename T> void setResultFlags(const T result);
+    bool condition(const Byte opcode) const;
+
+    // generic forms of the instruction implementations, over the operand size
+    template<typename T> void arith(const FlagOp op, const bool writeback);
+    template<typename T> void logic(const InstructionClass iclass);
+    template<typename T> void incdec(const bool inc);
+    template<typename T> void shift(const InstructionClass iclass);
+    template<typename T> void multiply(const bool sign);
+    template<typename T> void divide(const bool sign);
+
+    // string instructions, all repeat counts are handled in one step
+    Word stringCount() const;
+    void stringAdvance(const Word count, const Size elemSize, const bool src, const bool dst);
+    template<typename T> void stringMove();
+    template<typename T> void stringStore();
+    template<typename T> void stringLoad();
+    template<typename T> void stringCompare(const bool scan);
 
     // instructions 
     void instr_mov();
@@ -150,7 +312,7 @@ private:
     void instr_sti();
     void instr_cld();
     void instr_std();
-
+    void instr_invalid();
 };
 
 #endif // CPU_H
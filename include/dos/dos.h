@@ -3,6 +3,9 @@
 
 #include <string>
 #include <ostream>
+#include <fstream>
+#include <map>
+#include <vector>
 #include "dos/types.h"
 #include "dos/address.h"
 #include "dos/mz.h"
@@ -12,17 +15,126 @@ class Memory;
 struct LoadModule {
     Address code, stack;
     Size size;
+    Word segment; // start of the load module, right past the PSP
 };
 
+// error codes which the DOS functions return in ax with the carry flag set
+enum DosErrorCode : Word {
+    DOSERR_NONE = 0,
+    DOSERR_FUNCTION = 0x1,
+    DOSERR_FILE_NOT_FOUND = 0x2,
+    DOSERR_PATH_NOT_FOUND = 0x3,
+    DOSERR_TOO_MANY_FILES = 0x4,
+    DOSERR_ACCESS_DENIED = 0x5,
+    DOSERR_INVALID_HANDLE = 0x6,
+    DOSERR_NO_MEMORY = 0x8,
+    DOSERR_INVALID_BLOCK = 0x9,
+    DOSERR_INVALID_ACCESS = 0xc,
+    DOSERR_NO_MORE_FILES = 0x12,
+};
+
+// State of the DOS services apart from the memory, for going back to it later. Open files are recorded by their host path
+// and position, to be opened again if they have been closed since; what was written into them is not undone.
+struct DosSnapshot {
+    struct File {
+        std::string path;
+        std::ios::openmode mode;
+        std::streamoff pos;
+    };
+    Word pspSegment;
+    Address dta;
+    Byte exitCode;
+    std::string cwd;
+    std::map<Word, File> files;
+    std::map<Word, Word> blocks;
+    std::vector<std::string> found;
+    Size foundIdx;
+    Byte foundAttr;
+    std::streamoff consolePos; // of the console input, if it can seek
+};
+
+// The operating system services for a program running on the emulated CPU. Files are served from a directory
+// of the host, which the program sees as the root of its current drive; DOS paths are matched to host files
+// case-insensitively, new files are created with upper case names, like DOS would store them.
 class Dos {
+public:
+    static constexpr Word HANDLE_STDIN = 0, HANDLE_STDOUT = 1, HANDLE_STDERR = 2, HANDLE_STDAUX = 3, HANDLE_STDPRN = 4;
+    static constexpr Size HANDLE_MAX = 20; // size of the job file table in the PSP
+
 private:
+    struct OpenFile {
+        std::fstream stream;
+        std::string path; // on the host
+        std::ios::openmode mode; // for opening it again, without truncating
+    };
+
     Memory* memory_;
+    std::istream *conIn_;
+    std::ostream *conOut_, *conErr_;
+    std::string hostDir_;
+    std::string cwd_; // current DOS directory below the host directory, backslash separated, without leading backslash
+    Word pspSegment_;
+    Address dta_;
+    Byte exitCode_;
+    std::map<Word, OpenFile> files_;
+    // allocated memory blocks, by segment of the block to its size in paragraphs;
+    // each block is preceded by a paragraph reserved for its MCB, like on the real thing
+    std::map<Word, Word> blocks_;
+    Word arenaStart_, arenaEnd_;
+    // host paths of the files matched by the last find first call, and the next one to report
+    std::vector<std::string> found_;
+    Size foundIdx_;
+    Byte foundAttr_;
 
 public:
-    Dos(Memory *memory);
+    Dos(Memory *memory, const std::string &hostDir = ".");
     std::string name() const { return "NinjaDOS 1.0"; };
-    LoadModule loadExe(MzImage &mz);
+    Memory* memory() const { return memory_; }
+    // the console is the standard streams of the host unless redirected, standard error goes to the output unless given
+    void setConsole(std::istream &in, std::ostream &out, std::ostream *err = nullptr) { conIn_ = &in; conOut_ = &out; conErr_ = err ? err : &out; }
+    std::istream& consoleIn() const { return *conIn_; }
+    std::ostream& consoleOut() const { return *conOut_; }
+    std::ostream& consoleErr() const { return *conErr_; }
+    DosSnapshot snapshot();
+    void restore(const DosSnapshot &snap);
+    LoadModule loadExe(MzImage &mz, const std::string &cmdline = "");
     int version() const { return 2; }
+    Word pspSegment() const { return pspSegment_; }
+    Address dta() const { return dta_; }
+    void setDta(const Address &addr) { dta_ = addr; }
+    Byte exitCode() const { return exitCode_; }
+    void setExitCode(const Byte code) { exitCode_ = code; }
+    Address getVector(const Byte num) const;
+    void setVector(const Byte num, const Address &addr);
+    std::string readString(const Address &addr, const char term = '\0', const Size maxLen = 0x100) const;
+    void writeString(const Address &addr, const std::string &str);
+
+    // file services, these return a DOS error code or DOSERR_NONE
+    Word createFile(const std::string &path, Word &handle);
+    Word openFile(const std::string &path, const Byte mode, Word &handle);
+    Word closeFile(const Word handle);
+    Word readFile(const Word handle, const Address &buf, const Word size, Word &count);
+    Word writeFile(const Word handle, const Address &buf, const Word size, Word &count);
+    Word seekFile(const Word handle, const Byte origin, const DWord offset, DWord &pos);
+    Word removeFile(const std::string &path);
+    Word fileAttributes(const std::string &path, Word &attr);
+    Word deviceInfo(const Word handle, Word &info) const;
+    Word findFirst(const std::string &pattern, const Byte attr);
+    Word findNext();
+    Word changeDir(const std::string &path);
+    std::string currentDir() const { return cwd_; }
+
+    // memory services, sizes are in paragraphs, largest is the biggest size that would have succeeded
+    Word allocMemory(const Word size, Word &segment, Word &largest);
+    Word freeMemory(const Word segment);
+    Word resizeMemory(const Word segment, const Word size, Word &largest);
+
+private:
+    std::string hostPath(const std::string &dosPath, const bool mustExist) const;
+    Word newHandle() const;
+    Word largestFree() const;
+    Word blockLimit(const Word segment) const;
+    void foundEntry(const std::string &path);
 };
 
 #endif // SYSCALL_H
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <set>
+#include <memory>
 
 #include "dos/types.h"
 #include "dos/address.h"
@@ -10,6 +11,9 @@
 #include "dos/routine.h"
 #include "dos/codemap.h"
 #include "dos/mz.h"
+#include "dos/instruction.h"
+
+class SupersetIndex;
 
 class Executable {
     friend class AnalysisTest;
@@ -23,6 +27,10 @@ class Executable {
     std::vector<Segment> segments;
     std::string origPath;
     CodeMap codeMap;
+    // decoded instructions indexed by the linear offset from the load address, populated on first access of each location
+    mutable std::vector<PackedInstruction> decodeCache;
+    // built on first request, shared between copies since the code does not change
+    mutable std::shared_ptr<const SupersetIndex> supersetIndex;
 
 public:
     explicit Executable(const MzImage &mz);
@@ -42,10 +50,14 @@ public:
     void clearSegments() { segments.clear(); }
     const Memory& getCode() const { return code; }
     const Byte* codePointer(const Address &addr) const { return code.pointer(addr); }
+    PackedInstruction decoded(const Address &addr) const;
+    Instruction instruction(const Address &addr) const { return Instruction{addr, decoded(addr), code.pointer(addr)}; }
+    const SupersetIndex& superset() const;
     const std::vector<Segment>& getSegments() const { return segments; }
     Word getLoadSegment() const { return loadSegment; }
-    Address find(const ByteString &pattern, Block where = {}) const;
+    Address find(const BytePattern &pattern, Block where = {}) const;
     std::vector<Signature> getSignatures(const Block &range) const;
+    std::vector<Signature16> getSignatures16(const Block &range) const;
     CodeMap& map() { return codeMap; }
     const CodeMap& map() const { return codeMap; }
 
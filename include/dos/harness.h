@@ -0,0 +1,77 @@
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "dos/types.h"
+#include "dos/address.h"
+#include "dos/registers.h"
+#include "dos/memory.h"
+#include "dos/dos.h"
+#include "dos/interrupt.h"
+#include "dos/cpu.h"
+#include "dos/routine.h"
+
+// arguments for a single call of a routine in isolation
+struct HarnessInput {
+    // pushed on the stack from the last one, like in the C calling convention, so the first one ends up on top
+    std::vector<Word> args;
+    Word ax, bx, cx, dx, si, di;
+    HarnessInput() : ax(0), bx(0), cx(0), dx(0), si(0), di(0) {}
+    std::string toString() const;
+};
+
+// Observable effects of a call: the registers which the caller can rely on, and the memory written which outlives the call.
+// The writes are kept apart by the area they went into, with their addresses relative to the data segment, to the first
+// argument on the stack, or linear for anything else, so that they compare equal between builds with a different layout
+// of the code. Writes below the arguments, into the locals and the return address, are dropped.
+struct HarnessResult {
+    bool returned;
+    std::string error;
+    Registers regs;
+    SWord stackDelta; // difference of the stack pointer after the return from where the arguments start, nonzero if the callee pops them
+    Size instructions;
+    std::map<Offset, Byte> dataWrites, stackWrites, otherWrites;
+    HarnessResult() : returned(false), stackDelta(0), instructions(0) {}
+    // describe the differences from the result of another run, empty if there are none
+    std::string compare(const HarnessResult &other) const;
+};
+
+// An executable set up to call a single routine of its map in isolation, over and over with different inputs.
+// The starting state is captured by running the program up to the first call of the routine, so that the data
+// the routine relies on has been initialized, or right after loading the program if the routine is not reached.
+// Every call starts from a copy-on-write snapshot of that state, which makes restoring it cheap, along with the state of the DOS
+// services (open files and their positions, allocated memory) and of the timer and ports, so that the calls do not depend
+// on each other. What the calls write into host files is not undone.
+class RoutineHarness {
+public:
+    static constexpr Size WARMUP_LIMIT = 10'000'000;
+    static constexpr Size CALL_LIMIT = 1'000'000;
+
+private:
+    Memory mem_;
+    Dos dos_;
+    InterruptHandler ints_;
+    Cpu_8086 cpu_;
+    Routine routine_;
+    LoadModule lm_;
+    CpuSnapshot start_;
+    DosSnapshot dosStart_;
+    InterruptSnapshot intsStart_;
+    Word callerSp_; // stack pointer of the caller before it pushed the arguments
+    bool reached_;
+    std::vector<MemoryWrite> writes_;
+
+public:
+    RoutineHarness(const std::string &exePath, const std::string &mapPath, const std::string &name, const Size warmup = WARMUP_LIMIT, const std::string &hostDir = ".");
+    const Routine& routine() const { return routine_; }
+    // whether the starting state was captured at an actual call of the routine
+    bool reached() const { return reached_; }
+    // where the console input and output of the routine go, the standard streams of the host by default
+    void setConsole(std::istream &in, std::ostream &out) { dos_.setConsole(in, out); }
+    HarnessResult call(const HarnessInput &input, const Size limit = CALL_LIMIT);
+};
+
+#endif // HARNESS_H
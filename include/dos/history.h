@@ -0,0 +1,72 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <vector>
+#include <optional>
+
+#include "dos/types.h"
+#include "dos/address.h"
+#include "dos/cpu.h"
+#include "dos/dos.h"
+#include "dos/interrupt.h"
+#include "dos/watch.h"
+
+// state of the whole emulated system at some point of the execution
+struct ExecCheckpoint {
+    CpuSnapshot cpu;
+    DosSnapshot dos;
+    InterruptSnapshot ints;
+};
+
+// the most recent instruction which wrote into a byte of memory
+struct LastWrite {
+    Size instruction; // number of instructions executed before it
+    Address csip;
+    Offset addr; // linear start of the write, which can begin before the byte asked about
+    Size size;
+    std::string toString() const;
+};
+
+// Execution of a program which can be queried about its past and stepped backwards. Checkpoints of the whole system are taken
+// every few instructions while it runs forward, and any earlier point is reached again by restoring the closest checkpoint
+// before it and replaying the execution from there, which is deterministic as long as the console input can be rewound.
+// The memory pages of the checkpoints are shared copy-on-write, so each one only holds on to the pages written since
+// the previous one. Once there are more checkpoints than the capacity, every other one is dropped and the interval doubled,
+// which keeps the memory bounded at the cost of longer replays for the older parts of the history.
+// The console output of the replays is discarded, writes into host files are not undone.
+class ExecHistory {
+public:
+    static constexpr Size INTERVAL_DEFAULT = 100'000;
+    static constexpr Size CAPACITY_DEFAULT = 256;
+
+private:
+    Cpu_8086 &cpu_;
+    Dos &dos_;
+    InterruptHandler &ints_;
+    Size interval_, capacity_;
+    std::vector<ExecCheckpoint> checkpoints_; // ordered by the instruction count, the first one is where the history starts
+    const Watchpoints *watch_;
+    WatchInterface *watchHandler_;
+
+public:
+    ExecHistory(Cpu_8086 &cpu, Dos &dos, InterruptHandler &ints, const Size interval = INTERVAL_DEFAULT, const Size capacity = CAPACITY_DEFAULT);
+    Size interval() const { return interval_; }
+    Size checkpointCount() const { return checkpoints_.size(); }
+    // watchpoints for running forward, the replays go on without them
+    void setWatch(const Watchpoints *watch, WatchInterface *handler);
+    // run forward until the program ends, a breakpoint stops it or the limit of instructions is reached;
+    // running after stepping back starts a new future, the checkpoints past the current point are dropped
+    void run(const Size limit = SIZE_MAX);
+    // go back by a number of instructions, but not past the start of the history
+    void stepBack(const Size count);
+    // look for the last instruction before the current point which wrote into a byte at a linear address,
+    // writes made by the DOS services on behalf of the program (e.g. the buffer of a file read) are not seen
+    std::optional<LastWrite> lastWrite(const Offset addr);
+
+private:
+    ExecCheckpoint checkpoint();
+    void restore(const ExecCheckpoint &cp);
+    void replay(const Size count, const Watchpoints *watch, WatchInterface *handler);
+};
+
+#endif // HISTORY_H
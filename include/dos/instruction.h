@@ -6,9 +6,11 @@
 #include "dos/modrm.h"
 #include "dos/address.h"
 #include "dos/opcodes.h"
+#include "dos/pattern.h"
 
 #include <string>
 #include <vector>
+#include <type_traits>
 
 // TODO: rep and repnz are not used as instructions, but prefixes, remove
 #define INSTRUCTION_CLASS \
@@ -120,8 +122,20 @@ INSTRUCTION_PREFIX
 #undef X
 };
 
-inline bool prefixIsSegment(const InstructionPrefix p) { return p >= PRF_SEG_ES && p <= PRF_SEG_DS; }
-inline bool prefixIsChain(const InstructionPrefix p) { return p >= PRF_CHAIN_REPNZ && p <= PRF_CHAIN_REPZ; }
+constexpr bool prefixIsSegment(const InstructionPrefix p) { return p >= PRF_SEG_ES && p <= PRF_SEG_DS; }
+constexpr bool prefixIsChain(const InstructionPrefix p) { return p >= PRF_CHAIN_REPNZ && p <= PRF_CHAIN_REPZ; }
+// the prefix which an opcode byte stands for, PRF_NONE if it is not one
+constexpr InstructionPrefix opcodePrefix(const Byte opcode) {
+    switch (opcode) {
+    case OP_PREFIX_ES: return PRF_SEG_ES;
+    case OP_PREFIX_CS: return PRF_SEG_CS;
+    case OP_PREFIX_SS: return PRF_SEG_SS;
+    case OP_PREFIX_DS: return PRF_SEG_DS;
+    case OP_REPNZ:     return PRF_CHAIN_REPNZ;
+    case OP_REPZ:      return PRF_CHAIN_REPZ;
+    default:           return PRF_NONE;
+    }
+}
 Register prefixRegId(const InstructionPrefix p);
 const char* prefixName(const InstructionPrefix p);
 
@@ -186,40 +200,40 @@ OPERAND_TYPE
 #undef X
 };
 
-inline bool operandIsReg(const OperandType type) {
+constexpr bool operandIsReg(const OperandType type) {
     return type >= OPR_REG_AX && type <= OPR_REG_SS;
 }
 
-inline bool operandIsMem(const OperandType type) {
+constexpr bool operandIsMem(const OperandType type) {
     return type >= OPR_MEM_BX_SI && type <= OPR_MEM_BX_OFF16;
 }
 
-inline bool operandIsMemWithOffset(const OperandType type) {
+constexpr bool operandIsMemWithOffset(const OperandType type) {
     return type >= OPR_MEM_OFF8 && type <= OPR_MEM_BX_OFF16;
 }
 
-inline bool operandIsMemNoOffset(const OperandType type) {
+constexpr bool operandIsMemNoOffset(const OperandType type) {
     return type >= OPR_MEM_BX_SI && type <= OPR_MEM_BX;
 }
 
-inline bool operandIsMemImmediate(const OperandType ot) {
+constexpr bool operandIsMemImmediate(const OperandType ot) {
     return ot == OPR_MEM_OFF8 || ot == OPR_MEM_OFF16;
 }
 
-inline bool operandIsMemWithByteOffset(const OperandType type) {
+constexpr bool operandIsMemWithByteOffset(const OperandType type) {
     return type >= OPR_MEM_OFF8 && type <= OPR_MEM_BX_OFF8;
 }
 
-inline bool operandIsMemWithWordOffset(const OperandType type) {
+constexpr bool operandIsMemWithWordOffset(const OperandType type) {
     return type >= OPR_MEM_OFF16 && type <= OPR_MEM_BX_OFF16;
 }
 
-inline bool operandIsImmediate(const OperandType ot) {
+constexpr bool operandIsImmediate(const OperandType ot) {
     return ot >= OPR_IMM0 && ot <= OPR_IMM32;
 }
 
 // not an implicit immediate, i.e. not OPR_IMM0 or OPR_IMM1
-inline bool operandIsExplicitImmediate(const OperandType ot) {
+constexpr bool operandIsExplicitImmediate(const OperandType ot) {
     return ot >= OPR_IMM8 && ot <= OPR_IMM32;
 }
 
@@ -227,6 +241,34 @@ OperandType operandTypeToWord(const OperandType ot);
 Register defaultMemSegment(const OperandType ot);
 const char* operandName(const OperandType t);
 
+// Operand kinds of the compact 16bit signature, which only keeps as much of the operand type as can be squeezed into 4 bits:
+// the general purpose register families, the base of a memory operand and the presence of an immediate value
+#define SIGNATURE_OPERAND \
+    X(SOP_NONE) \
+    X(SOP_REG_A) \
+    X(SOP_REG_B) \
+    X(SOP_REG_C) \
+    X(SOP_REG_D) \
+    X(SOP_REG_SI) \
+    X(SOP_REG_DI) \
+    X(SOP_REG_BP) \
+    X(SOP_REG_SP) \
+    X(SOP_REG_SEG) \
+    X(SOP_REG_HIGH) \
+    X(SOP_MEM_BX) \
+    X(SOP_MEM_BP) \
+    X(SOP_MEM_INDEX) \
+    X(SOP_MEM_DIRECT) \
+    X(SOP_IMM)
+enum SignatureOperand : Byte {
+#define X(x) x,
+SIGNATURE_OPERAND
+#undef X
+};
+
+const char* signatureOperandName(const SignatureOperand so);
+Signature16 compactSignature(const Signature sig);
+
 #define OPERAND_SIZE \
     X(OPRSZ_UNK) \
     X(OPRSZ_NONE) \
@@ -239,6 +281,16 @@ OPERAND_SIZE
 #undef X
 };
 
+// number of encoded bytes for a value of the given size
+constexpr Size operandSizeBytes(const OperandSize sz) {
+    switch (sz) {
+    case OPRSZ_BYTE:  return sizeof(Byte);
+    case OPRSZ_WORD:  return sizeof(Word);
+    case OPRSZ_DWORD: return sizeof(DWord);
+    default:          return 0;
+    }
+}
+
 #define INS_GROUP_IDX \
     X(IGRP_1) \
     X(IGRP_2) \
@@ -266,6 +318,34 @@ INSTRUCTION_MATCH
 #undef X
 };
 
+class Instruction;
+class TextBuffer;
+
+// enough for the longest instruction text, including the extended branch distance
+static constexpr Size INSTRUCTION_TEXT_MAX = 80;
+
+// Compact, trivially copyable record of a decoded instruction for use in caches and hot loops. It does not carry the address
+// or a pointer to the instruction bytes, these are known to the owner of the record. Convert to Instruction for the full interface,
+// text is only rendered on demand.
+struct PackedInstruction {
+    Byte opcode;
+    Byte length; // zero for a record not holding a decoded instruction
+    Byte iclass;
+    Byte prefix;
+    OperandType type1, type2;
+    Byte sizes; // size of op1 in the low nibble, op2 in the high nibble
+    Byte immsizes; // same for the immediate sizes
+    DWord imm1;
+    Word imm2; // the second operand never has a 32bit immediate
+
+    PackedInstruction() = default;
+    explicit PackedInstruction(const Instruction &i);
+    bool isValid() const { return length != 0; }
+    Signature signature() const;
+    Signature16 signature16() const;
+    Size render(const Address &addr, char *buf, const Size bufSize, const bool extended = false) const;
+};
+
 class Instruction {
 public:
     Address addr;
@@ -285,26 +365,31 @@ public:
         } immval; // optional immediate offset or literal value
 
         std::string toString() const;
+        void format(TextBuffer &out) const;
         InstructionMatch match(const Operand &other) const;
         Register regId() const;
         Word wordValue() const;
         DWord dwordValue() const;
         Address farAddr() const;
-        ByteString immediateValue() const;
+        std::vector<Byte> immediateValue() const;
     } op1, op2;
     const Byte* data;
 
     Instruction();
     Instruction(const Address &addr, const Byte *data);
+    Instruction(const Address &addr, const PackedInstruction &packed, const Byte *data);
     std::string toString(const bool extended = false) const;
-    ByteString pattern() const;
+    void format(TextBuffer &out, const bool extended = false) const;
+    BytePattern pattern() const;
     Signature signature() const;
+    Signature16 signature16() const;
     InstructionMatch match(const Instruction &other) const;
     void load(const Byte *data);
     Word absoluteOffset() const;
     Address destinationAddress() const;
     SWord relativeOffset() const;
-    std::vector<Register> touchedRegs() const;
+    RegisterMask regsRead() const;
+    RegisterMask regsWritten() const;
     SOffset memOffset() const;
     Register memSegmentId() const;
 
@@ -324,9 +409,11 @@ public:
     }
 
 private:
-    OperandType getModrmOperand(const Byte modrm, const ModrmOperand op);
     Size loadImmediate(Operand &op, const Byte *data);
     const Operand* memOperand() const;
 };
 
+static_assert(sizeof(PackedInstruction) <= 16, "Packed instruction record too large");
+static_assert(std::is_trivially_copyable_v<PackedInstruction>, "Packed instruction record not trivially copyable");
+
 #endif // INSTRUCTION_H
\ No newline at end of file
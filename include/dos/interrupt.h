@@ -1,6 +1,9 @@
 #ifndef INTERRUPT_H
 #define INTERRUPT_H
 
+#include <map>
+#include <optional>
+
 #include "dos/types.h"
 #include "dos/memory.h"
 #include "dos/registers.h"
@@ -9,28 +12,75 @@ enum IntStatus {
     INT_OK, INT_FAIL, INT_EXIT, INT_TERMINATE
 };
 
+// Besides the interrupts, the CPU reaches the rest of the machine through the I/O ports, and tells it how much time
+// has passed, measured in executed instructions. The defaults are for a machine without any hardware to speak of.
 class InterruptInterface {
 public:
     virtual IntStatus interrupt(const Byte num, Registers &regs) = 0;
+    virtual Byte portIn(const Word port);
+    virtual void portOut(const Word port, const Byte value);
+    virtual void elapse(const Size) {}
+    // The CPU is stuck in a loop polling a port, or memory if there is no port, which will go on until the hardware
+    // changes its state. Move the time forward to the next change and return how many instructions that took.
+    virtual Size skipIdle(const std::optional<Word>) { return 0; }
 };
 
 class Dos;
 
+// state of the simulated hardware behind the interrupt handler
+struct InterruptSnapshot {
+    DWord ticks;
+    Size clock;
+    std::map<Word, Byte> ports;
+    bool pitHigh;
+};
+
 // an adapter class for dispatching interrupt requests from the CPU to other system components,
 // whose aim is to decouple the CPU from these components. This class is a friend of the Cpu class
 // so it can set the CPU registers according to the contract of the various interrupt functions,
 // without the Cpu needing to be aware of the components, or the components being aware of 
 // and/or poking at the Cpu.
+// The BIOS services are stubs which never block: there is no screen apart from teletype output going to the standard output,
+// no keys are ever pressed, and the timer is virtual, advancing by one tick on every query, so that the runs are
+// reproducible and loops waiting for the time to pass terminate.
+// The timer also advances with the instructions executed, at the pace of an original PC, and its count is kept
+// in the BIOS data area. Of the hardware, only the vertical retrace of the video card and the counter of the timer
+// are simulated, the other ports read back whatever was last written to them.
 class InterruptHandler : public InterruptInterface {
+public:
+    // a 4.77 MHz 8088 gets through an instruction in about 15 clocks, one timer tick is 65536 periods of the 1.19 MHz PIT clock
+    static constexpr Size TICK_INSTRUCTIONS = 17476;
+    // the video refreshes at 70 Hz, with the retrace taking up about 6% of each frame
+    static constexpr Size FRAME_INSTRUCTIONS = 4540;
+    static constexpr Size RETRACE_INSTRUCTIONS = 280;
+    // where the BIOS keeps the timer count
+    static constexpr Offset BDA_TICKS = 0x46c;
+
 protected:
     Dos *dos_;
+    DWord ticks_;
+    Size clock_; // instructions since the start
+    std::map<Word, Byte> ports_; // last values written
+    bool pitHigh_; // which byte of the counter the next read returns
 
 public:
-    InterruptHandler(Dos *dos) : dos_(dos) {}
+    InterruptHandler(Dos *dos) : dos_(dos), ticks_(0), clock_(0), pitHigh_(false) {}
     IntStatus interrupt(const Byte num, Registers &regs) override;
+    Byte portIn(const Word port) override;
+    void portOut(const Word port, const Byte value) override;
+    void elapse(const Size instructions) override;
+    Size skipIdle(const std::optional<Word> port) override;
+    Size clock() const { return clock_; }
+    InterruptSnapshot snapshot() const { return { ticks_, clock_, ports_, pitHigh_ }; }
+    void restore(const InterruptSnapshot &snap) { ticks_ = snap.ticks; clock_ = snap.clock; ports_ = snap.ports; pitHigh_ = snap.pitHigh; }
 
 private:
-    void dosFunction(const Byte funcHi, const Byte funcLo, Registers &regs);
+    void setTicks(const DWord ticks);
+    IntStatus dosFunction(const Byte funcHi, const Byte funcLo, Registers &regs);
+    void videoFunction(const Byte funcHi, const Byte funcLo, Registers &regs);
+    void keyboardFunction(const Byte funcHi, Registers &regs);
+    void timerFunction(const Byte funcHi, Registers &regs);
+    void dosResult(const Word error, Registers &regs) const;
 };
 
 #endif // INTERRUPT_H
\ No newline at end of file
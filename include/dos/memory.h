@@ -3,8 +3,13 @@
 
 #include <ostream>
 #include <array>
+#include <vector>
+#include <bitset>
+#include <memory>
+#include <cstdint>
 #include "dos/types.h"
 #include "dos/address.h"
+#include "dos/pattern.h"
 
 // TODO: 
 // - implement MCBs
@@ -29,18 +34,57 @@
 0x100000 - 0x10FFEF: (64KiB - 16)
 --- extended memory available from protected mode only
 */
+static constexpr Size MEM_PAGE_SIZE = 4_kB;
+static constexpr Size MEM_PAGE_COUNT = MEM_TOTAL / MEM_PAGE_SIZE;
+using MemoryPage = std::array<Byte, MEM_PAGE_SIZE>;
+
+// Immutable image of the memory contents, shared page by page between the snapshots and memory instances
+// which have not changed a page since. Cheap to copy around.
+class MemorySnapshot {
+    friend class Memory;
+    std::vector<std::shared_ptr<const MemoryPage>> pages_;
+    Offset break_ = 0;
+
+public:
+    bool isValid() const { return !pages_.empty(); }
+};
+
+// extent of a single write into memory
+struct MemoryWrite {
+    Offset addr;
+    Size size;
+};
+
+// The emulated address space, as one contiguous block of host memory so that any part of it can be accessed through a plain pointer.
+// On POSIX hosts, it is mapped copy-on-write over a file holding the initial fill pattern, which all instances share, so an instance
+// only takes up host memory for the pages it has written into, and creating one does not touch the pages at all. Elsewhere, it is
+// a plain buffer filled with the pattern. Copies do not inherit the write log.
 class Memory {
 private:
     static constexpr Offset INIT_BREAK = 0x500; // beginning of free conventional memory block
     static constexpr Offset MEM_END = 0xa0000; // end of usable memory, start of UMA
 
 private:
-    std::array<Byte, MEM_TOTAL> data_;
+    Byte *data_;
     Offset break_;
+    std::bitset<MEM_PAGE_COUNT> touched_; // pages which might differ from the fill pattern
+    // one bit per byte of memory holding code which somebody translated and needs to know about writes into,
+    // empty until something is tracked so plain memory users do not pay for the checks
+    std::vector<uint64_t> codeBits_;
+    // extent of the tracked bytes which were written since the last clear, low above high if none
+    Offset codeWriteLow_, codeWriteHigh_;
+    // snapshot page which the contents of each page are identical to, unless written since (or never snapshotted)
+    std::array<std::shared_ptr<const MemoryPage>, MEM_PAGE_COUNT> origin_;
+    std::bitset<MEM_PAGE_COUNT> dirty_;
+    std::vector<MemoryWrite> *writeLog_;
 
 public:
     Memory();
     Memory(const Word segment, const Byte *data, const Size size);
+    explicit Memory(const MemorySnapshot &snap);
+    Memory(const Memory &other);
+    Memory& operator=(const Memory &other);
+    ~Memory();
     Size size() const { return MEM_TOTAL; }
     Size availableBlock() const { return BYTES_TO_PARA(MEM_END - break_); }
     Size availableBytes() const { return availableBlock() * PARAGRAPH_SIZE; }
@@ -56,12 +100,43 @@ public:
     void writeByte(const Offset addr, const Byte value);
     void writeWord(const Offset addr, const Word value);
     void writeBuf(const Offset addr, const Byte *data, const Size size);
-    const Byte* pointer(const Offset addr) const { return data_.cbegin() + addr; }
-    const Byte* pointer(const Address &addr) const { return data_.cbegin() + addr.toLinear(); }
+    void copyBuf(const Offset dest, const Offset src, const Size size);
+    void fillBytes(const Offset addr, const Byte value, const Size count);
+    void fillWords(const Offset addr, const Word value, const Size count);
+    const Byte* pointer(const Offset addr) const { return data_ + addr; }
+    const Byte* pointer(const Address &addr) const { return data_ + addr.toLinear(); }
     const Byte* base() const { return pointer(0); }
-    Address find(const ByteString &pattern, Block where = {}) const;
+    Address find(const BytePattern &pattern, Block where = {}) const;
+    MemorySnapshot snapshot();
+    void restore(const MemorySnapshot &snap);
+    Size dirtyPages() const { return dirty_.count(); }
+    // pages which took up host memory of their own
+    Size touchedPages() const { return touched_.count(); }
+    void trackCode(const Offset addr, const Size size);
+    void untrackCode(const Offset addr, const Size size);
+    bool codeTracked(const Offset addr) const { return !codeBits_.empty() && (codeBits_[addr / 64] >> (addr % 64) & 1); }
+    bool codeWritten() const { return codeWriteLow_ <= codeWriteHigh_; }
+    Offset codeWriteLow() const { return codeWriteLow_; }
+    Offset codeWriteHigh() const { return codeWriteHigh_; }
+    void clearCodeWrites() { codeWriteLow_ = MEM_TOTAL; codeWriteHigh_ = 0; }
+    // append the extent of every write to the log, disabled with nullptr
+    void logWrites(std::vector<MemoryWrite> *log) { writeLog_ = log; }
     std::string info() const;
     void dump(const Block &range, const std::string &path) const;
+
+private:
+    // bookkeeping for every write into memory
+    void written(const Offset addr, const Size size) {
+        if (size == 0) return;
+        for (Size page = addr / MEM_PAGE_SIZE; page <= (addr + size - 1) / MEM_PAGE_SIZE; ++page) {
+            dirty_.set(page);
+            touched_.set(page);
+        }
+        if (!codeBits_.empty()) codeWrite(addr, size);
+        if (writeLog_) writeLog_->push_back({addr, size});
+    }
+    void codeWrite(const Offset addr, const Size size);
+    void copyPages(const Memory &other);
 };
 
 #endif // MEMORY_H
\ No newline at end of file
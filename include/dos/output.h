@@ -2,6 +2,10 @@
 #define OUTPUT_H
 
 #include <string>
+#include <ostream>
+#include <vector>
+#include <array>
+#include <mutex>
 
 enum LogModule {
     LOG_SYSTEM,
@@ -34,6 +38,42 @@ enum Color {
     OUT_BRIGHTBLACK,
 };
 
+// Where the messages go and which of them are shown. The output functions below work on the context which is current
+// for the calling thread: the global one going to the standard output, unless a LogScope made another one current,
+// so that emulations running on different threads each log into their own sink without stepping on each other.
+// A context can be written from several threads at once.
+class LogContext {
+    LogPriority priority_;
+    std::array<bool, LOG_OTHER + 1> visible_;
+    std::ostream *out_;
+    std::vector<std::string> buffer_; // hidden messages, for showing them after the fact
+    std::mutex mutex_;
+
+public:
+    // starts out with the level and module visibility of the context current at the time
+    explicit LogContext(std::ostream &out);
+    LogContext(std::ostream &out, const LogPriority priority);
+    void write(const std::string &msg, const LogModule mod, const LogPriority pri, const Color color, const bool suppressNewline);
+    LogPriority priority() const { return priority_; }
+    void setPriority(const LogPriority priority) { priority_ = priority; }
+    bool visible(const LogModule mod) const { return visible_[mod]; }
+    void setVisible(const LogModule mod, const bool visible) { visible_[mod] = visible; }
+    void clearBuffer();
+    void flushBuffer();
+};
+
+// makes a context current for the calling thread while it exists
+class LogScope {
+    LogContext *prev_;
+
+public:
+    explicit LogScope(LogContext &ctx);
+    ~LogScope();
+    LogScope(const LogScope&) = delete;
+    LogScope& operator=(const LogScope&) = delete;
+};
+
+LogContext& logContext();
 void output(const std::string &msg, const LogModule mod, const LogPriority pri = LOG_INFO, const Color color = OUT_DEFAULT, const bool suppressNewline = false);
 LogPriority getOutputLevel();
 void setOutputLevel(const LogPriority minPriority);
@@ -0,0 +1,46 @@
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "dos/types.h"
+
+// A byte search pattern with wildcards, kept as the literal bytes plus a bitset of the positions which need to match.
+// Matching compares 8 bytes of data at a time against the pattern under the mask.
+class BytePattern {
+    std::vector<Byte> bytes_; // zero at wildcard positions
+    std::vector<uint64_t> mask_; // bit set for a position that must match, unused bits past the end are clear
+
+public:
+    static constexpr Size npos = static_cast<Size>(-1);
+
+    BytePattern() = default;
+    // all bytes must match
+    BytePattern(const Byte *data, const Size size);
+    // from a string of hex digit pairs, with "??" standing for a wildcard byte, e.g. "ab12??ea"
+    explicit BytePattern(const std::string &hexa);
+
+    Size size() const { return bytes_.size(); }
+    bool empty() const { return bytes_.empty(); }
+    bool isWildcard(const Size idx) const { return ((mask_[idx / 64] >> (idx % 64)) & 1) == 0; }
+    Byte byte(const Size idx) const { return bytes_[idx]; }
+    const Byte* bytes() const { return bytes_.data(); }
+    Size fixedCount() const;
+
+    void append(const Byte b);
+    void appendWildcard(const Size count = 1);
+    void append(const BytePattern &other);
+    void wildcard(const Size idx, const Size count = 1);
+
+    bool matches(const Byte *data) const;
+    Size find(const Byte *data, const Size size) const;
+    std::string toString() const;
+    bool operator==(const BytePattern &other) const = default;
+
+private:
+    void grow(const Size count);
+};
+
+#endif // PATTERN_H
@@ -0,0 +1,41 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+#include "dos/types.h"
+
+// A fixed set of threads working through a queue of tasks, for running independent emulations side by side.
+// The emulator keeps no global state apart from the logging, and that goes to the context current for the thread,
+// so each task can build its own machine and optionally log into its own LogContext through a LogScope.
+class ThreadPool {
+    std::vector<std::thread> threads_;
+    std::queue<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable wake_, idle_;
+    Size busy_;
+    bool stop_;
+    std::exception_ptr error_;
+
+public:
+    // zero threads means as many as the host can run at once
+    explicit ThreadPool(const Size threads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    Size size() const { return threads_.size(); }
+    void submit(std::function<void()> task);
+    // block until all the submitted tasks are done, then rethrow the first exception one of them ended with
+    void wait();
+
+private:
+    void work();
+};
+
+#endif // POOL_H
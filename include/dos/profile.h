@@ -0,0 +1,89 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <vector>
+#include <string>
+#include <set>
+#include <cstdint>
+
+#include "dos/types.h"
+#include "dos/address.h"
+
+class CodeMap;
+
+// Execution counters collected by the CPU over an area of memory, kept in flat arrays indexed by the linear address
+// relative to the start of the area. Besides the number of times an instruction was executed, for conditional branches
+// (including loops and jcxz) the counts of the branch being taken and falling through are recorded at the branch location.
+// The destinations of calls and jumps through a register or memory are collected as they are observed.
+// The length of the instruction is kept along with its count, so that the runs of executed code span whole instructions.
+class ExecProfile {
+public:
+    struct IndirectBranch {
+        Address source, destination;
+        bool isCall, isNear;
+        bool operator<(const IndirectBranch &other) const;
+    };
+    struct BlockStats {
+        Block block;
+        Size instructions, taken, notTaken;
+    };
+    // counters summed over the blocks of a routine, the routine name is empty for executed code not claimed by any routine
+    struct RoutineStats {
+        std::string name;
+        Address entrypoint;
+        Size instructions, taken, notTaken;
+        std::vector<BlockStats> blocks;
+    };
+
+private:
+    Offset base_;
+    std::vector<uint32_t> hits_, taken_, notTaken_;
+    std::vector<Byte> lengths_;
+    Size outside_;
+    std::set<IndirectBranch> indirect_;
+
+public:
+    explicit ExecProfile(const Block &area);
+    Block area() const;
+    void clear();
+
+    inline void hit(const Offset linear, const Byte length = 1) {
+        if (linear - base_ < hits_.size()) {
+            hits_[linear - base_]++;
+            lengths_[linear - base_] = length;
+        }
+        else outside_++;
+    }
+    inline void branch(const Offset linear, const bool taken) {
+        if (linear - base_ >= hits_.size()) return;
+        if (taken) taken_[linear - base_]++;
+        else notTaken_[linear - base_]++;
+    }
+
+    void indirect(const Address &source, const Address &destination, const bool call, const bool near) {
+        indirect_.insert({source, destination, call, near});
+    }
+
+    Size hits(const Address &addr) const { return counter(hits_, addr); }
+    Size taken(const Address &addr) const { return counter(taken_, addr); }
+    Size notTaken(const Address &addr) const { return counter(notTaken_, addr); }
+    Size total() const;
+    // instructions executed outside of the profiled area
+    Size outside() const { return outside_; }
+    const std::set<IndirectBranch>& indirectBranches() const { return indirect_; }
+    // runs of consecutive instructions which were executed, every one starts and ends at an instruction boundary
+    std::vector<Block> executed() const;
+    BlockStats blockStats(const Block &block) const;
+    // routines of the map with any instructions executed, hottest first
+    std::vector<RoutineStats> routineStats(const CodeMap &map) const;
+    std::string report(const CodeMap &map, const Size top = 0) const;
+    // compare against the profile of another build of the same program, with routines paired by name
+    std::string compare(const CodeMap &map, const ExecProfile &other, const CodeMap &otherMap) const;
+
+private:
+    // end of the run of back to back executed instructions starting at an index, inclusive; it stops before an unclaimed index if given
+    Offset runEnd(const Offset start, const std::vector<bool> *claimed = nullptr) const;
+    Size counter(const std::vector<uint32_t> &counters, const Address &addr) const;
+};
+
+#endif // PROFILE_H
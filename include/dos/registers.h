@@ -23,6 +23,22 @@ std::string regName(const Register r);
 Register regHigh(const Register r);
 Register regLow(const Register r);
 
+// a set of registers, with one bit for each value of the Register enum
+using RegisterMask = DWord;
+constexpr RegisterMask regMask(const Register r) { return r == REG_NONE ? 0 : RegisterMask{1} << r; }
+constexpr RegisterMask REGMASK_NONE = 0;
+// word registers with addressable halves are considered as the combination of both halves
+constexpr RegisterMask regHalves(const RegisterMask mask) {
+    RegisterMask ret = mask;
+    if (mask & regMask(REG_AX)) ret |= regMask(REG_AL) | regMask(REG_AH);
+    if (mask & regMask(REG_BX)) ret |= regMask(REG_BL) | regMask(REG_BH);
+    if (mask & regMask(REG_CX)) ret |= regMask(REG_CL) | regMask(REG_CH);
+    if (mask & regMask(REG_DX)) ret |= regMask(REG_DL) | regMask(REG_DH);
+    return ret;
+}
+static_assert(REG_FLAGS < sizeof(RegisterMask) * 8, "Register mask too small");
+std::string regMaskString(const RegisterMask mask);
+
 // flag word bits: XXXXODITSZXAXPXC
 enum Flag : Word {
     FLAG_CARRY  = 0b0000000000000001, // carry
@@ -58,9 +74,10 @@ public:
         if (val) reg(REG_FLAGS) |= flag; 
         else reg(REG_FLAGS) &= ~flag; 
     }
-    inline Address csip() const { return { values[REG_CS], values[REG_IP]}; }
+    inline Address csip() const { return { reg(REG_CS), reg(REG_IP) }; }
     std::string dump() const;
     void reset();
+    bool operator==(const Registers &other) const = default;
 private:
     inline Word& reg(const Register r) { return values[r - REG_AX]; }
     inline const Word& reg(const Register r) const { return values[r - REG_AX]; }
@@ -69,10 +86,9 @@ private:
 // TODO: implement CPU logic, execute arithmetic instructions and update register state in a more complete way than what is done now
 class CpuState {
 private:
-    static constexpr Word WORD_KNOWN = 0xffff;
-    static constexpr Word BYTE_KNOWN = 0xff;
     Registers regs_;
-    Registers known_;
+    // the general purpose registers are tracked as their halves, so a word is known when both its bytes are
+    RegisterMask known_;
     std::list<Word> stack_;
 
 public:
@@ -82,13 +98,14 @@ public:
     Word getValue(const Register r) const;
     void setValue(const Register r, const Word value);
     void setUnknown(const Register r);
+    void setUnknown(const RegisterMask mask) { known_ &= ~regHalves(mask); }
     std::string regString(const Register r) const;
     std::string toString() const;
     void push(const Word val) { stack_.push_front(val); }
     Word pop() { Word ret = stack_.front(); stack_.pop_front(); return ret; }
     bool stackEmpty() const { return stack_.empty(); }
     void clearStack() { stack_.clear(); }
-    void reset() { regs_.reset(); known_.reset(); clearStack(); }
+    void reset() { regs_.reset(); known_ = REGMASK_NONE; clearStack(); }
 
 private:
     void setState(const Register r, const Word value, const bool known);
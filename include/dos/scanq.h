@@ -49,7 +49,8 @@ public:
     Destination nextPoint();
     bool hasPoint(const Address &dest, const bool call) const;
     bool saveCall(const Address &dest, const CpuState &regs, const bool near, const std::string name = {});
-    bool saveJump(const Address &dest, const CpuState &regs);
+    // a jump from the routine being scanned, or into another one if given
+    bool saveJump(const Address &dest, const CpuState &regs, const RoutineIdx routineIdx = NULL_ROUTINE);
     bool saveBranch(const Branch &branch, const CpuState &regs, const Block &codeExtents);
     // discovered locations operations
     Size routineCount() const { return entrypoints.size(); }
@@ -8,26 +8,39 @@
 #include <string>
 
 using SignatureString = std::vector<Signature>;
+using SignatureString16 = std::vector<Signature16>;
 class CodeMap;
 class Executable;
 
+enum SignatureFormat {
+    SIG_FULL,    // 32bit signatures, exact instruction class, prefix and operand types
+    SIG_COMPACT, // 16bit signatures, operand types reduced to kinds, see compactSignature()
+};
+
 struct SignatureItem {
     std::string routineName;
     Block routineExtents;
+    // only one of these is populated, depending on the format of the library
     SignatureString signature;
+    SignatureString16 signature16;
     SignatureItem(const std::string &routineName, const Block &routineExtents, SignatureString &&signature) : 
         routineName(routineName), routineExtents(routineExtents), signature(signature) {}
-    Size size() const { return signature.size(); }
+    SignatureItem(const std::string &routineName, const Block &routineExtents, SignatureString16 &&signature16) : 
+        routineName(routineName), routineExtents(routineExtents), signature16(signature16) {}
+    Size size() const { return signature.empty() ? signature16.size() : signature.size(); }
 };
 
 class SignatureLibrary {
     std::vector<SignatureItem> sigs;
+    SignatureFormat format_;
 public:
-    SignatureLibrary(const CodeMap &map, const Executable &exe, const Size minInstructions, const Size maxInstructions = 0);
+    SignatureLibrary(const CodeMap &map, const Executable &exe, const Size minInstructions, const Size maxInstructions = 0, const SignatureFormat format = SIG_FULL);
     SignatureLibrary(const std::string &path);
     bool empty() const { return sigs.empty(); }
+    SignatureFormat format() const { return format_; }
     Size signatureCount() const { return sigs.size(); }
     const SignatureItem& getSignature(const Size idx) const { return sigs[idx]; }
+    void compact();
     void save(const std::string &path) const;
     void dump() const;
 };
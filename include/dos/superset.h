@@ -0,0 +1,41 @@
+#ifndef SUPERSET_H
+#define SUPERSET_H
+
+#include <vector>
+#include <span>
+
+#include "dos/types.h"
+#include "dos/address.h"
+
+class Executable;
+
+// Superset disassembly of a load module: an instruction is decoded starting at every byte offset, once.
+// Answers whether a location is a valid instruction start, where the decode chain starting at a location ends up,
+// and which other locations decode into it, all in constant time.
+class SupersetIndex {
+    Offset base_; // linear address of the load module
+    std::vector<Byte> lengths_; // indexed by offset from base, zero if no valid instruction starts there
+    // offset past the unconditional jump or return which terminates the chain of consecutive decodes starting at a location,
+    // zero if the chain runs into an invalid opcode or out of the load module first
+    std::vector<Offset> chainEnd_;
+    // predecessors of each location, i.e. locations whose decoded instruction ends right there, in compressed row format
+    std::vector<Offset> predBegin_, preds_;
+    Size validCount_;
+
+public:
+    explicit SupersetIndex(const Executable &exe);
+    Size size() const { return lengths_.size(); }
+    Size validCount() const { return validCount_; }
+    bool contains(const Address &addr) const;
+    bool isValid(const Address &addr) const { return length(addr) != 0; }
+    Size length(const Address &addr) const;
+    bool isPlausible(const Address &addr) const { return chainEnd(addr).isValid(); }
+    Address chainEnd(const Address &addr) const;
+    std::span<const Offset> predecessors(const Address &addr) const;
+    std::vector<Address> seeds(const Block &block) const;
+
+private:
+    Offset index(const Address &addr) const { return addr.toLinear() - base_; }
+};
+
+#endif // SUPERSET_H
@@ -0,0 +1,52 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <vector>
+
+#include "dos/types.h"
+#include "dos/address.h"
+#include "dos/instruction.h"
+#include "dos/pattern.h"
+
+class Executable;
+
+// Decodes a block of code in a single linear pass and keeps the results column-wise (struct of arrays),
+// so that batch passes over the instructions can run as tight loops over contiguous data.
+class InstructionSweep {
+    const Executable *exe_;
+    Block block_;
+    Size invalid_;
+    std::vector<Offset> offsets_; // linear
+    std::vector<Byte> lengths_;
+    std::vector<Byte> immLengths_; // total size of immediates and displacements, always at the end of the instruction bytes
+    std::vector<InstructionClass> classes_;
+    std::vector<InstructionPrefix> prefixes_;
+    std::vector<OperandType> types1_, types2_;
+    std::vector<DWord> imm1_;
+    std::vector<Word> imm2_;
+    std::vector<Signature> signatures_;
+
+public:
+    // with skipInvalid, an undecodable byte is recorded as a 1-byte INS_ERR entry and the sweep continues, otherwise the CpuError is propagated
+    InstructionSweep(const Executable &exe, const Block &range, const bool skipInvalid = false);
+    Size size() const { return offsets_.size(); }
+    bool empty() const { return offsets_.empty(); }
+    Size invalidCount() const { return invalid_; }
+    const Block& block() const { return block_; }
+
+    const std::vector<Offset>& offsets() const { return offsets_; }
+    const std::vector<Byte>& lengths() const { return lengths_; }
+    const std::vector<InstructionClass>& classes() const { return classes_; }
+    const std::vector<InstructionPrefix>& prefixes() const { return prefixes_; }
+    const std::vector<OperandType>& types1() const { return types1_; }
+    const std::vector<OperandType>& types2() const { return types2_; }
+    const std::vector<DWord>& immediates1() const { return imm1_; }
+    const std::vector<Word>& immediates2() const { return imm2_; }
+    const std::vector<Signature>& signatures() const { return signatures_; }
+
+    Address address(const Size idx) const;
+    Instruction instruction(const Size idx) const;
+    BytePattern pattern(const Size idx, const Size count = 1) const;
+};
+
+#endif // SWEEP_H
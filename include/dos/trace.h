@@ -0,0 +1,103 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <istream>
+#include <ostream>
+#include <vector>
+#include <string>
+
+#include "dos/types.h"
+#include "dos/address.h"
+#include "dos/registers.h"
+#include "dos/memory.h"
+
+class Cpu_8086;
+class CodeMap;
+
+// Effects of one executed instruction: where it was, the registers after it was executed, and what it wrote into memory.
+// The instruction pointer after execution is not recorded, it is the location of the next instruction.
+struct TraceRecord {
+    Address csip;
+    Registers regs;
+    std::vector<MemoryWrite> writes;
+    std::vector<Byte> data; // contents of all the writes, one after another
+};
+
+// receives the effects of every instruction executed by the CPU, after its flags are settled
+class TraceInterface {
+public:
+    virtual void record(const Address &csip, const Registers &regs, const std::vector<MemoryWrite> &writes, const Memory &mem) = 0;
+};
+
+// Writes a compact binary trace of the execution to a stream, through a buffer of fixed size so that arbitrarily long runs
+// take up constant memory. Each record starts with a tag byte saying what follows: the code segment if it changed,
+// the offset of the instruction as a byte delta from the previous one or a whole word, a mask of the registers
+// which changed along with their new values, and the written memory extents with their contents, as varints.
+class TraceWriter : public TraceInterface {
+public:
+    static constexpr Size BUFFER_DEFAULT = 64_kB;
+
+private:
+    std::ostream &out_;
+    std::vector<Byte> buf_;
+    Size len_;
+    Address prev_;
+    Registers regs_;
+    Size records_, bytes_;
+
+public:
+    TraceWriter(std::ostream &out, const Size bufSize = BUFFER_DEFAULT);
+    ~TraceWriter();
+    void record(const Address &csip, const Registers &regs, const std::vector<MemoryWrite> &writes, const Memory &mem) override;
+    void flush();
+    Size records() const { return records_; }
+    Size bytes() const { return bytes_ + len_; }
+
+private:
+    void put(const Byte *data, const Size size);
+    void putByte(const Byte b) { put(&b, 1); }
+    void putWord(const Word w);
+    void putVarint(DWord v);
+};
+
+// Reads back a trace written by TraceWriter, through a buffer of fixed size.
+class TraceReader {
+    std::istream &in_;
+    std::vector<Byte> buf_;
+    Size pos_, len_;
+    Address prev_;
+    Registers regs_;
+    Size records_;
+
+public:
+    TraceReader(std::istream &in, const Size bufSize = TraceWriter::BUFFER_DEFAULT);
+    // false at the end of the trace
+    bool next(TraceRecord &rec);
+    Size records() const { return records_; }
+
+private:
+    bool get(Byte *data, const Size size);
+    Byte getByte();
+    Word getWord();
+    DWord getVarint();
+};
+
+// first point where two executions stop behaving the same, if any
+struct TraceDivergence {
+    bool found = false;
+    Size index = 0; // instruction count where the divergence was found
+    TraceRecord ref, tgt;
+    std::string reason;
+    std::string toString(const CodeMap *refMap = nullptr, const CodeMap *tgtMap = nullptr) const;
+};
+
+// describe the differences between the effects of two instructions, empty if there are none
+std::string traceCompare(const TraceRecord &ref, const TraceRecord &tgt);
+// Run two machines one instruction at a time until they both finish, or the effects of an instruction differ.
+// Both need to be loaded at the same address, the locations of the instructions and anything derived from them
+// (like return addresses on the stack) are expected to be the same.
+TraceDivergence traceLockstep(Cpu_8086 &ref, Cpu_8086 &tgt, const Size limit = 0);
+// run a machine and compare it against a previously recorded trace, under the same conditions
+TraceDivergence traceReplay(TraceReader &ref, Cpu_8086 &tgt, const Size limit = 0);
+
+#endif // TRACE_H
@@ -16,7 +16,7 @@ using Size   = size_t;
 using Offset = size_t;
 using SOffset = ssize_t;
 using Signature = uint32_t;
-using ByteString = std::vector<SWord>;
+using Signature16 = uint16_t;
 
 // TODO: assumes LE
 inline Byte lowByte(const Word word) { return static_cast<Byte>(word & 0xff); }
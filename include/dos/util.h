@@ -7,6 +7,8 @@
 #include <iomanip>
 #include <vector>
 #include <regex>
+#include <algorithm>
+#include <cstdint>
 
 #include "dos/types.h"
 
@@ -25,6 +27,24 @@ template<typename T, Size size = sizeof(T)> std::string hexString(const T &obj)
     return str.str();
 }
 
+// stream buffer which discards whatever is written into it, and has nothing to read
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+};
+
+// apply an operation to the bits of a range in a bitmap, a 64bit word of the bitmap at a time
+template<typename F> void bitRange(const Offset addr, const Size size, F func) {
+    Offset i = addr;
+    const Offset end = addr + size;
+    while (i < end) {
+        const Size bit = i % 64, count = std::min<Size>(64 - bit, end - i);
+        const uint64_t mask = (count == 64 ? ~0ULL : ((1ULL << count) - 1)) << bit;
+        func(i / 64, mask);
+        i += count;
+    }
+}
+
 template<typename T> std::string hexJoin(const std::vector<T> &items) {
     std::ostringstream str;
     str << "[ ";
@@ -65,11 +85,32 @@ void writeBinaryFile(const std::string &path, const Byte *buf, const Size size);
 std::string binString(const Word &value);
 std::string binString(const DWord &value);
 std::string bytesToHex(const std::vector<Byte> &bytes);
-std::vector<SWord> hexaToNumeric(const std::string &hexa);
-std::string numericToHexa(const ByteString &pattern);
 std::vector<std::string> splitString(const std::string &str, char delim);
-void erasePattern(ByteString &str, const ByteString &pat);
 bool regexMatch(const std::regex &re, const std::string &str);
 std::vector<std::string> extractRegex(const std::regex &re, const std::string &str);
 
+// Builds text inside a caller-provided fixed size buffer without any heap allocations, for formatting in hot paths.
+// The contents are always null-terminated, anything that does not fit is dropped and the buffer is marked as truncated.
+class TextBuffer {
+    char *buf_;
+    Size cap_, len_;
+    bool truncated_;
+
+public:
+    TextBuffer(char *buf, const Size cap);
+    const char* c_str() const { return buf_; }
+    Size size() const { return len_; }
+    bool truncated() const { return truncated_; }
+    void clear();
+    TextBuffer& operator<<(const char c);
+    TextBuffer& operator<<(const char *str);
+    TextBuffer& operator<<(const std::string &str) { return append(str.data(), str.size()); }
+    TextBuffer& append(const char *str, const Size len);
+    TextBuffer& pad(const Size width, const char c = ' ');
+    // lowercase hex with optional 0x prefix and zero padding to a minimal number of digits, like hexVal()
+    TextBuffer& hex(const DWord val, const Size digits = 0, const bool prefix = true);
+    // explicitly signed hex with zero padding, like signedHexVal()
+    TextBuffer& signedHex(const SOffset val, const Size digits, const bool plus = true);
+};
+
 #endif // UTIL_H
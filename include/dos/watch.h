@@ -0,0 +1,57 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "dos/types.h"
+#include "dos/address.h"
+#include "dos/registers.h"
+#include "dos/memory.h"
+
+enum WatchKind : Byte { WATCH_EXEC, WATCH_READ, WATCH_WRITE, WATCH_KINDS };
+
+// an instruction about to be executed at a breakpoint, or an access by an instruction to a watched range of memory
+struct WatchHit {
+    WatchKind kind;
+    Address csip; // of the instruction
+    Offset addr; // linear start of the access
+    Size size;
+    std::string toString() const;
+};
+
+// receives the hits of the watchpoints as they happen, with the state of the machine: before the instruction
+// for a breakpoint, after the instruction for memory accesses; the execution stops if it returns true
+class WatchInterface {
+public:
+    virtual bool hit(const WatchHit &hit, const Registers &regs, const Memory &mem) = 0;
+};
+
+// Breakpoints and memory watchpoints, as bitmaps over the whole address space with a bit for every byte,
+// so that checking an instruction or a memory access against them takes a bit test regardless of how many there are.
+// The bitmap of a kind is only allocated once something is added to it.
+class Watchpoints {
+    std::vector<uint64_t> bits_[WATCH_KINDS];
+
+public:
+    void add(const WatchKind kind, const Block &range);
+    void remove(const WatchKind kind, const Block &range);
+    void clear();
+    bool empty(const WatchKind kind) const { return bits_[kind].empty(); }
+    inline bool test(const WatchKind kind, const Offset addr) const {
+        const std::vector<uint64_t> &bits = bits_[kind];
+        return !bits.empty() && (bits[addr / 64] >> (addr % 64) & 1);
+    }
+    // whether any byte of the range is watched
+    inline bool test(const WatchKind kind, const Offset addr, const Size size) const {
+        if (bits_[kind].empty() || size == 0) return false;
+        if (size <= 2) return test(kind, addr) || (size == 2 && test(kind, addr + 1));
+        return testRange(kind, addr, size);
+    }
+
+private:
+    bool testRange(const WatchKind kind, const Offset addr, const Size size) const;
+};
+
+#endif // WATCH_H
@@ -57,13 +57,19 @@ void Address::set(const Offset linear) {
 }
 
 std::string Address::toString(const bool brief) const {
-    ostringstream str;
+    char buf[32];
+    TextBuffer out{buf, sizeof(buf)};
+    format(out, brief);
+    return buf;
+}
+
+void Address::format(TextBuffer &out, const bool brief) const {
     if (isValid()) {
-        str << std::hex << std::setw(WORD_STRLEN) << std::setfill('0') << segment << ":" << std::setw(WORD_STRLEN) << std::setfill('0') << offset;
-        if (!brief) str << "/" << setw(OFFSET_STRLEN) << toLinear();
+        out.hex(segment, WORD_STRLEN, false) << ":";
+        out.hex(offset, WORD_STRLEN, false);
+        if (!brief) (out << "/").hex(toLinear(), OFFSET_STRLEN, false);
     }
-    else str << "(invalid)";
-    return str.str();
+    else out << "(invalid)";
 }
 
 // move bulk of the offset to the segment part, limit offset to the modulus of a paragraph
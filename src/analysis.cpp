@@ -5,6 +5,7 @@
 #include "dos/error.h"
 #include "dos/executable.h"
 #include "dos/editdistance.h"
+#include "dos/superset.h"
 
 #include <iostream>
 #include <istream>
@@ -342,26 +343,32 @@ static void applyPop(const Instruction &i, CpuState &regs, Executable &exe) {
 // TODO: make jump instructions compare the match with the relative offset value
 static string compareStatus(const Instruction &i1, const Instruction &i2, const bool align, InstructionMatch match = INS_MATCH_ERROR) {
     static const int ALIGN = 50;
-    string status;
+    // two addresses and instructions plus the separators, formatted in place to avoid churning through temporary strings
+    char buf[2 * (INSTRUCTION_TEXT_MAX + 32)];
+    TextBuffer status{buf, sizeof(buf)};
     if (i1.isValid()) {
-        status = i1.addr.toString() + ": " + i1.toString(align);
+        i1.addr.format(status);
+        status << ": ";
+        i1.format(status, align);
     }
-    if (!i2.isValid()) return status;
+    if (!i2.isValid()) return buf;
 
-    if (align && status.length() < ALIGN) status.append(ALIGN - status.length(), ' ');
+    if (align) status.pad(ALIGN);
     if (i1.isValid()) {
         if (match == INS_MATCH_ERROR) match = i1.match(i2);
         switch (match) {
-        case INS_MATCH_FULL:     status += " == "; break;
-        case INS_MATCH_DIFF:     status += " ~~ "; break;
-        case INS_MATCH_DIFFOP1:  status += " ~= "; break;
-        case INS_MATCH_DIFFOP2:  status += " =~ "; break;
-        case INS_MATCH_MISMATCH: status += " != "; break; 
-        }
-    }
-    else status.append(4, ' ');
-    status += i2.addr.toString() + ": " + i2.toString(align);
-    return status;
+        case INS_MATCH_FULL:     status << " == "; break;
+        case INS_MATCH_DIFF:     status << " ~~ "; break;
+        case INS_MATCH_DIFFOP1:  status << " ~= "; break;
+        case INS_MATCH_DIFFOP2:  status << " =~ "; break;
+        case INS_MATCH_MISMATCH: status << " != "; break; 
+        }
+    }
+    else status << "    ";
+    i2.addr.format(status);
+    status << ": ";
+    i2.format(status, align);
+    return buf;
 }
 
 // for executables whose layout is known in advance (but we still want to determine the routine boundaries), like when we built it ourselves
@@ -406,7 +413,7 @@ void Analyzer::claimNops(const Instruction &i, const Executable &exe) {
         curAddr = i.addr,
         nextAddr{curAddr + static_cast<SByte>(i.length)};
     try {
-        while (nextAddr > curAddr && exe.extents().contains(nextAddr) && Instruction{nextAddr, exe.codePointer(nextAddr)}.iclass == INS_NOP) {
+        while (nextAddr > curAddr && exe.extents().contains(nextAddr) && exe.instruction(nextAddr).iclass == INS_NOP) {
             scanQueue.setRoutineIdx(nextAddr.toLinear(), 1);
             curAddr = nextAddr;
             nextAddr++;
@@ -418,6 +425,70 @@ void Analyzer::claimNops(const Instruction &i, const Executable &exe) {
     }
 }
 
+// The destination of a call or jump through a register or memory is not known statically, queue one observed while running
+// the executable instead. This waits until the scan has claimed everything it could reach on its own, and only takes destinations
+// which are still unclaimed, so that the routines found without the coverage stay the way they are. A jump is scanned
+// as a continuation of the routine it came from.
+bool Analyzer::seedObservedBranch(const Executable &exe) {
+    const CpuState initRegs{exe.entrypoint(), exe.stackAddr()};
+    for (const auto &b : coverage->branches()) {
+        if (!exe.contains(b.source) || !exe.contains(b.destination)) continue;
+        const RoutineIdx source = scanQueue.getRoutineIdx(b.source.toLinear());
+        if (source == NULL_ROUTINE || source == BAD_ROUTINE) continue;
+        if (scanQueue.getRoutineIdx(b.destination.toLinear()) != NULL_ROUTINE || scanQueue.isEntrypoint(b.destination) != NULL_ROUTINE) continue;
+        if (b.isCall ? scanQueue.saveCall(b.destination, initRegs, b.isNear) : scanQueue.saveJump(b.destination, initRegs, source)) {
+            searchMessage(b.source, "observed destination of indirect "s + (b.isCall ? "call" : "jump") + ": " + b.destination.toString());
+            return true;
+        }
+    }
+    return false;
+}
+
+// Queue the first executed instruction which is still unclaimed, one at a time because exploring one is likely to claim others.
+// The instructions of a run were executed back to back, so one which follows a claimed instruction of the same run was reached
+// from that routine, typically by returning from a call which the scan did not expect to return, and is scanned as its continuation.
+// Only an unclaimed start of a run becomes the entrypoint of a new routine, near as nothing is known about how it is called.
+bool Analyzer::seedExecuted(const Executable &exe) {
+    if (!coverage) return false;
+    if (seedObservedBranch(exe)) return true;
+    const CpuState initRegs{exe.entrypoint(), exe.stackAddr()};
+    for (const Block &b : coverage->executed()) {
+        if (!exe.contains(b.begin)) continue;
+        const Segment seg = exe.getSegment(b.begin);
+        if (seg.type == Segment::SEG_NONE) {
+            debug("Unable to find segment for executed block " + b.toString());
+            continue;
+        }
+        Address addr{b.begin};
+        addr.move(seg.address);
+        // skip over the claimed instructions at the start of the run
+        RoutineIdx owner = NULL_ROUTINE, rid;
+        try {
+            while ((rid = scanQueue.getRoutineIdx(addr.toLinear())) != NULL_ROUTINE && rid != BAD_ROUTINE) {
+                owner = rid;
+                const Word next = addr.offset + exe.instruction(addr).length;
+                if (next <= addr.offset) break;
+                addr.offset = next;
+                if (addr.toLinear() > b.end.toLinear() || !exe.contains(addr)) break;
+            }
+        }
+        catch (CpuError &e) {
+            debug("Unable to decode executed block " + b.toString() + ": " + e.why());
+            continue;
+        }
+        if (rid != NULL_ROUTINE) continue;
+        if (owner != NULL_ROUTINE && scanQueue.saveJump(addr, initRegs, owner)) {
+            searchMessage(addr, "seeding executed code not reached by the scan as a continuation of routine " + to_string(owner) + ": " + b.toString());
+            return true;
+        }
+        if (owner == NULL_ROUTINE && scanQueue.saveCall(addr, initRegs, true)) {
+            searchMessage(addr, "seeding executed code not reached by the scan: " + b.toString());
+            return true;
+        }
+    }
+    return false;
+}
+
 // explore the code without actually executing instructions, discover routine boundaries
 // TODO: identify routines through signatures generated from OMF libraries
 // TODO: trace usage of bp register (sub/add) to determine stack frame size of routines
@@ -433,8 +504,8 @@ void Analyzer::exploreCode(Executable &exe) {
     info("Analyzing code within extents: "s + exe.extents());
     Size locations = 0;
  
-    // iterate over entries in the search queue
-    while (!scanQueue.empty()) {
+    // iterate over entries in the search queue, when it runs out try executed code which was not reached yet
+    while (!scanQueue.empty() || seedExecuted(exe)) {
         // get a location from the queue and jump to it
         const Destination search = scanQueue.nextPoint();
         const RoutineEntrypoint ep = scanQueue.getEntrypoint(search.routineIdx);
@@ -467,7 +538,7 @@ void Analyzer::exploreCode(Executable &exe) {
                     searchMessage(csip, "Location marked as entrypoint for routine "s + to_string(atEntrypoint) + " while scanning from " + to_string(search.routineIdx) + ", halting scan");
                     break;
                 }
-                Instruction i(csip, exe.codePointer(csip));
+                Instruction i = exe.instruction(csip);
                 regs.setValue(REG_IP, csip.offset);
                 // mark memory map items corresponding to the current instruction as belonging to the current routine 
                 // (routine id is tracked by the queue, no need to provide)
@@ -539,11 +610,7 @@ void Analyzer::exploreCode(Executable &exe) {
                     searchMessage(csip, "routine scan interrupted by non-returning interrupt");
                     break;
                 }
-                else {
-                    for (Register r : i.touchedRegs()) {
-                        regs.setUnknown(r);
-                    }
-                }
+                else regs.setUnknown(i.regsWritten());
                 // advance to next instruction
                 csip.advanceGuard(i.length);
             } // next instruction at current search location
@@ -585,11 +652,15 @@ void Analyzer::checkMissedRoutines(const CodeMap &refMap) {
     }
 }
 
+static bool patternMatches(const Executable &exe, const BytePattern &pattern, const Offset linear) {
+    return pattern.matches(exe.codePointer(Address{linear}));
+}
+
 Address Analyzer::findTargetLocation(const Executable &ref, const Executable &tgt) {
     Address ret;
     Address seqEnd = refCsip;
     std::vector<Address> matchLocations;
-    ByteString searchString;
+    BytePattern searchString;
 
     if (!compareBlock.isValid()) {
         error("Current comparison block is invalid");
@@ -602,27 +673,48 @@ Address Analyzer::findTargetLocation(const Executable &ref, const Executable &tg
     }
 
     debug("Trying to find equivalent target location of reference address " + refCsip.toString() + " across " + to_string(unvisited.size()) + " unvisited target blocks");
+    // locations in the unvisited blocks that match the search string so far, as pairs of block index and linear address
+    std::vector<std::pair<Size, Offset>> candidates;
     while (true) {
         // get next instruction, extract its pattern
-        Instruction curInstr{seqEnd, ref.codePointer(seqEnd)};
+        const Instruction curInstr = ref.instruction(seqEnd);
         if (!compareBlock.contains(seqEnd + static_cast<Offset>(curInstr.length - 1))) {
             error("Instruction at " + seqEnd.toString() + " exceeds bounds of current reference routine block: " + compareBlock.toString());
             break;
         }
         const auto curPattern = curInstr.pattern();
+        const bool first = searchString.empty();
         // append current instruction's pattern to the search string
-        std::move(curPattern.begin(), curPattern.end(), std::back_inserter(searchString));
-        debug("Current instruction at " + seqEnd.toString() + ": " + curInstr.toString() + ", search pattern now: " + numericToHexa(searchString));
-        // try to find the search string across all unvisited blocks of target executable
-        matchLocations.clear();
-        for (const auto &u : unvisited) {
-            debug("Searching in block " + u.toString());
-            const auto found = tgt.find(searchString, u);
-            if (found.isValid()) {
-                debug("Found pattern at " + found.toString());
-                matchLocations.push_back(found);
+        searchString.append(curPattern);
+        debug("Current instruction at " + seqEnd.toString() + ": " + curInstr.toString() + ", search pattern now: " + searchString.toString());
+        const Size patSize = searchString.size();
+        if (first) {
+            // the pattern only wildcards immediates at the end of the instruction, so a match can only start at a location where the target decodes
+            // into an instruction of the same length, use the superset index to skip all the others without looking at the data
+            const SupersetIndex &superset = tgt.superset();
+            for (Size ui = 0; ui < unvisited.size(); ++ui) {
+                const Block &u = unvisited[ui];
+                debug("Searching in block " + u.toString());
+                const Offset end = u.end.toLinear();
+                for (Offset linear = u.begin.toLinear(); linear + patSize - 1 <= end; ++linear) {
+                    if (superset.length(Address{linear}) == curInstr.length && patternMatches(tgt, searchString, linear))
+                        candidates.emplace_back(ui, linear);
+                }
             }
         }
+        else {
+            // the extended search string can only match where the previous one did
+            std::erase_if(candidates, [&](const std::pair<Size, Offset> &c) {
+                return c.second + patSize - 1 > unvisited[c.first].end.toLinear() || !patternMatches(tgt, searchString, c.second);
+            });
+        }
+        // only the first match within each block counts as a distinct location
+        matchLocations.clear();
+        for (Size i = 0; i < candidates.size(); ++i) {
+            if (i > 0 && candidates[i].first == candidates[i - 1].first) continue;
+            debug("Found pattern at " + Address{candidates[i].second}.toString());
+            matchLocations.push_back(Address{candidates[i].second});
+        }
         const auto matchCount = matchLocations.size();
         if (matchCount == 0) {
             // TODO: if there are addresses from the previous iteration, return multiple, but would need support for multiple destinations in Analyzer
@@ -1135,9 +1227,9 @@ bool Analyzer::comparisonLoop(const Executable &ref, Executable &tgt, const Code
         }
 
         // decode instructions
-        Instruction 
-            refInstr{refCsip, ref.codePointer(refCsip)}, 
-            tgtInstr{tgtCsip, tgt.codePointer(tgtCsip)};
+        const Instruction 
+            refInstr = ref.instruction(refCsip), 
+            tgtInstr = tgt.instruction(tgtCsip);
         
         // mark this instruction as visited
         scanQueue.setRoutineIdx(refCsip.toLinear(), refInstr.length, VISITED_ID);
@@ -1302,7 +1394,8 @@ Branch Analyzer::getBranch(const Executable &exe, const Instruction &i, const Cp
 // TODO: do not hardcode, place in text file
 // TODO: automatic reverse match generation
 // TODO: replace strings with Instruction-s/Signature-s, support more flexible matching?
-static const map<string, vector<vector<string>>> INSTR_VARIANT = {
+// keyed with a transparent comparator, so that the lookup can be done with the instruction text formatted into a stack buffer
+static const map<string, vector<vector<string>>, less<>> INSTR_VARIANT = {
     { "add sp, 0x2", { 
             { "pop cx" }, 
             { "inc sp", "inc sp" },
@@ -1319,12 +1412,17 @@ static const map<string, vector<vector<string>>> INSTR_VARIANT = {
 };
 
 Analyzer::ComparisonResult Analyzer::variantMatch(const Executable &tgt, const Instruction &refInstr, Instruction tgtInstr) {
+    if (!options.variant) return CMP_MISMATCH;
     bool match = false;
+    char refBuf[INSTRUCTION_TEXT_MAX], tgtBuf[INSTRUCTION_TEXT_MAX];
+    TextBuffer refText{refBuf, sizeof(refBuf)}, tgtText{tgtBuf, sizeof(tgtBuf)};
+    refInstr.format(refText);
     // check for a variant match if allowed by options
-    if (options.variant && INSTR_VARIANT.count(refInstr.toString())) {
+    const auto found = INSTR_VARIANT.find(string_view{refText.c_str(), refText.size()});
+    if (found != INSTR_VARIANT.end()) {
         // get vector of allowed variants (themselves vectors of strings)
-        const auto &variants = INSTR_VARIANT.at(refInstr.toString());
-        debug("Found "s + to_string(variants.size()) + " variants for instruction '" + refInstr.toString() + "'");
+        const auto &variants = found->second;
+        debug("Found "s + to_string(variants.size()) + " variants for instruction '" + refText.c_str() + "'");
         // compose string for showing the variant comparison instructions
         string statusStr = compareStatus(refInstr, tgtInstr, true, INS_MATCH_DIFF);
         string variantStr;
@@ -1337,13 +1435,16 @@ Analyzer::ComparisonResult Analyzer::variantMatch(const Executable &tgt, const I
             int idx = 0;
             // iterate over instructions inside this variant
             for (auto &istr: v) {
-                debug(tmpCsip.toString() + ": " + tgtInstr.toString() + " == " + istr + " ? (" + to_string(idx+1) + "/" + to_string(v.size()) + ")");
+                tgtText.clear();
+                tgtInstr.format(tgtText);
+                if (getOutputLevel() <= LOG_DEBUG)
+                    debug(tmpCsip.toString() + ": " + tgtText.c_str() + " == " + istr + " ? (" + to_string(idx+1) + "/" + to_string(v.size()) + ")");
                 // stringwise compare the next instruction in the variant to the current instruction
-                if (tgtInstr.toString() != istr) { match = false; break; }
+                if (istr != tgtText.c_str()) { match = false; break; }
                 // if this is not the last instruction in the variant, read the next instruction from the target binary
                 tmpCsip.advanceGuard(tgtInstr.length);
                 if (++idx < v.size()) {
-                    tgtInstr = Instruction{tmpCsip, tgt.codePointer(tmpCsip)};
+                    tgtInstr = tgt.instruction(tmpCsip);
                     variantStr += "\n" + compareStatus(Instruction(), tgtInstr, true);
                 }
             }
@@ -1464,8 +1565,8 @@ void Analyzer::diffContext(const Executable &ref, const Executable &tgt) const {
     for (int i = 0; i <= CONTEXT_COUNT; ++i) {
         // make sure we are within code extents in both executables
         if (!ref.contains(a1) || !tgt.contains(a2)) break;
-        i1 = Instruction{a1, ref.codePointer(a1)},
-        i2 = Instruction{a2, tgt.codePointer(a2)};
+        i1 = ref.instruction(a1);
+        i2 = tgt.instruction(a2);
         if (i != 0) verbose(compareStatus(i1, i2, true));
         a1 += i1.length;
         a2 += i2.length;
@@ -1484,12 +1585,12 @@ void Analyzer::skipContext(const Executable &ref, const Executable &tgt) const {
     while (refSkipped > 0 || tgtSkipped > 0) {
         Instruction refInstr, tgtInstr;
         if (refSkipped > 0) {
-            refInstr = {refAddr, ref.codePointer(refAddr)};
+            refInstr = ref.instruction(refAddr);
             refSkipped--;
             refAddr += refInstr.length;
         }
         if (tgtSkipped > 0) {
-            tgtInstr = {tgtAddr, tgt.codePointer(tgtAddr)};
+            tgtInstr = tgt.instruction(tgtAddr);
             tgtSkipped--;
             tgtAddr += tgtInstr.length;
         }
@@ -1623,7 +1724,7 @@ struct Duplicate {
     }
 };
 
-bool Analyzer::findDuplicates(const SignatureLibrary signatures, Executable &tgt) {
+bool Analyzer::findDuplicates(const SignatureLibrary &signatures, Executable &tgt) {
     CodeMap &tgtMap = tgt.map();
     if (signatures.empty()) throw ArgError("Empty signature library provided for duplicate search");
     if (tgtMap.empty()) throw ArgError("Empty routine map provided for duplicate search");
@@ -1632,6 +1733,7 @@ bool Analyzer::findDuplicates(const SignatureLibrary signatures, Executable &tgt
     map<RoutineIdx, Duplicate> duplicates;
     Size ignoreCount = 0, ignoreTotalInstr = 0, missCount = 0, sigTotalInstr = 0, tgtTotalInstr = 0, missTotalInstr = 0;
     bool collision = false;
+    const bool compact = signatures.format() == SIG_COMPACT;
     // iterate over routines to find duplicates for
     for (Size sigIdx = 0; sigIdx < signatures.signatureCount(); ++sigIdx) {
         const SignatureItem &sig = signatures.getSignature(sigIdx);
@@ -1660,9 +1762,12 @@ bool Analyzer::findDuplicates(const SignatureLibrary signatures, Executable &tgt
                 debug("Routine has no valid block: " + tgtRoutine.toString());
                 continue;
             }
-            // extract string of signatures for target routine
-            vector<Signature> tgtSigs = tgt.getSignatures(tgtBlock);
-            const auto tgtSigSize = tgtSigs.size();
+            // extract string of signatures for target routine in the format of the library
+            vector<Signature> tgtSigs;
+            vector<Signature16> tgtSigs16;
+            if (compact) tgtSigs16 = tgt.getSignatures16(tgtBlock);
+            else tgtSigs = tgt.getSignatures(tgtBlock);
+            const Size tgtSigSize = compact ? tgtSigs16.size() : tgtSigs.size();
             if (tgtTotalInstr == 0) tgtTotalTemp += tgtSigSize;
             const Size sigDelta = sigSize > tgtSigSize ? sigSize - tgtSigSize : tgtSigSize - sigSize;
             // ignore candidate if we know in advance the distance will be too high based on instruction count alone
@@ -1671,7 +1776,9 @@ bool Analyzer::findDuplicates(const SignatureLibrary signatures, Executable &tgt
                 continue;
             }
             // calculate edit distance between reference and target signature strings
-            const auto distance = edit_distance_dp_thr(sig.signature.data(), sigSize, tgtSigs.data(), tgtSigSize, distanceThresh);
+            const auto distance = compact 
+                ? edit_distance_dp_thr(sig.signature16.data(), sigSize, tgtSigs16.data(), tgtSigSize, distanceThresh)
+                : edit_distance_dp_thr(sig.signature.data(), sigSize, tgtSigs.data(), tgtSigSize, distanceThresh);
             if (distance > distanceThresh) {
                 debug("\tIgnoring target routine " + tgtRoutine.name + " (" + to_string(tgtSigSize) + " instructions), distance above threshold");
                 continue;
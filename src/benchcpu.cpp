@@ -0,0 +1,164 @@
+#include "dos/output.h"
+#include "dos/error.h"
+#include "dos/cpu.h"
+#include "dos/memory.h"
+#include "dos/interrupt.h"
+#include "dos/util.h"
+
+#include <chrono>
+#include <vector>
+
+using namespace std;
+
+OUTPUT_CONF(LOG_SYSTEM)
+
+const Size
+    LOOPS_DEFAULT = 1000,
+    ITER_DEFAULT = 5;
+const Address
+    CODE_ADDR{0x1000, 0},
+    STACK_ADDR{0x3000, 0xfffe};
+const Word DATA_SEGMENT = 0x2000;
+const Size DATA_SIZE = 0x800;
+
+void usage() {
+    ostringstream str;
+    str << "benchcpu v" << VERSION << endl
+        << "Usage: " << endl
+        << "benchcpu [options]" << endl
+        << "    Measures the emulation throughput of the CPU with each of its dispatch engines on a built-in workload" << endl
+        << "    of arithmetic, memory accesses, calls, loops and string instructions." << endl
+        << "    The final state of the registers and the data area is compared between the engines, any difference is reported as an error." << endl
+        << "Options:" << endl
+        << "--loops count   number of passes of the outer loop of the workload, up to 65535 (default: " << to_string(LOOPS_DEFAULT) << ")" << endl
+        << "--iter count    number of timed runs with each engine, best one is reported (default: " << to_string(ITER_DEFAULT) << ")";
+    output(str.str(), LOG_OTHER, LOG_ERROR);
+    exit(1);
+}
+
+void fatal(const string &msg) {
+    error(msg);
+    exit(1);
+}
+
+// the data segment and the outer loop count go into the immediates of the first instructions
+static vector<Byte> workload(const Word loops) {
+    vector<Byte> code = {
+        0xb8, 0x00, 0x00,   // mov ax, DATA_SEGMENT
+        0x8e, 0xd8,         // mov ds, ax
+        0x8e, 0xc0,         // mov es, ax
+        0xbd, 0x00, 0x00,   // mov bp, loops
+        0xbb, 0x00, 0x01,   // outer: mov bx, 0x100
+        0xb9, 0x00, 0x01,   // mov cx, 0x100
+        0x31, 0xc0,         // xor ax, ax
+        0x01, 0xc8,         // inner: add ax, cx
+        0x89, 0x07,         // mov [bx], ax
+        0x83, 0xc3, 0x02,   // add bx, 2
+        0xd1, 0xe0,         // shl ax, 1
+        0x35, 0x55, 0xaa,   // xor ax, 0xaa55
+        0xe8, 0x12, 0x00,   // call sub
+        0xe2, 0xef,         // loop inner
+        0xbe, 0x00, 0x01,   // mov si, 0x100
+        0xbf, 0x00, 0x04,   // mov di, 0x400
+        0xb9, 0x00, 0x01,   // mov cx, 0x100
+        0xf3, 0xa5,         // rep movsw
+        0x4d,               // dec bp
+        0x75, 0xd9,         // jnz outer
+        0xcd, 0x20,         // int 0x20
+        0x50,               // sub: push ax
+        0x8b, 0x17,         // mov dx, [bx]
+        0xf7, 0xe2,         // mul dx
+        0x58,               // pop ax
+        0xc3,               // ret
+    };
+    code[1] = DATA_SEGMENT & 0xff;
+    code[2] = DATA_SEGMENT >> 8;
+    code[8] = loops & 0xff;
+    code[9] = loops >> 8;
+    return code;
+}
+
+class BenchInterrupts : public InterruptInterface {
+public:
+    IntStatus interrupt(const Byte num, Registers &) override {
+        if (num == 0x20) return INT_TERMINATE;
+        throw InterruptError("Unexpected interrupt in workload: " + hexVal(num));
+    }
+};
+
+struct RunResult {
+    Size instructions;
+    double seconds;
+    string regs;
+    vector<Byte> data;
+};
+
+static RunResult run(const vector<Byte> &code, const CpuDispatch dispatch) {
+    Memory mem;
+    BenchInterrupts ints;
+    Cpu_8086 cpu{&mem, &ints, dispatch};
+    mem.writeBuf(CODE_ADDR.toLinear(), code.data(), code.size());
+    cpu.init(CODE_ADDR, STACK_ADDR, code.size());
+    const auto start = chrono::steady_clock::now();
+    cpu.run();
+    RunResult ret;
+    ret.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    ret.instructions = cpu.executed();
+    ret.regs = cpu.registers().dump();
+    const Byte *data = mem.pointer(SEG_TO_OFFSET(DATA_SEGMENT));
+    ret.data.assign(data, data + DATA_SIZE);
+    return ret;
+}
+
+static RunResult benchmark(const string &name, const vector<Byte> &code, const CpuDispatch dispatch, const Size iterations) {
+    RunResult best;
+    for (Size iter = 0; iter < iterations; ++iter) {
+        RunResult r = run(code, dispatch);
+        if (iter == 0 || r.seconds < best.seconds) best = std::move(r);
+    }
+    ostringstream str;
+    str << fixed << setprecision(4) << name << ": " << best.instructions << " instructions, " << best.seconds << " s, "
+        << setprecision(0) << (best.seconds > 0 ? best.instructions / best.seconds : 0) << " instructions/s";
+    info(str.str());
+    return best;
+}
+
+int main(int argc, char *argv[]) {
+    setOutputLevel(LOG_INFO);
+    setModuleVisibility(LOG_CPU, false);
+    Size loops = LOOPS_DEFAULT, iterations = ITER_DEFAULT;
+    for (int aidx = 1; aidx < argc; ++aidx) {
+        string arg(argv[aidx]);
+        if (arg == "--loops" && ++aidx < argc) loops = stoi(string{argv[aidx]}, nullptr, 10);
+        else if (arg == "--iter" && ++aidx < argc) iterations = stoi(string{argv[aidx]}, nullptr, 10);
+        else if (arg == "--help") usage();
+        else fatal("Unrecognized option: "s + arg);
+    }
+    if (iterations == 0) fatal("Iteration count must be positive");
+    if (loops == 0 || loops > OFFSET_MAX) fatal("Loop count out of range: " + to_string(loops));
+    try {
+        const vector<Byte> code = workload(loops);
+        const RunResult
+            sw = benchmark("switch dispatch", code, DISPATCH_SWITCH, iterations),
+            table = benchmark("table dispatch", code, DISPATCH_TABLE, iterations);
+        if (sw.instructions != table.instructions)
+            throw LogicError("Instruction count differs between engines: " + to_string(sw.instructions) + " vs " + to_string(table.instructions));
+        if (sw.regs != table.regs) throw LogicError("Register state differs between engines:\n" + sw.regs + "\n" + table.regs);
+        if (sw.data != table.data) throw LogicError("Memory contents differ between engines");
+        if (table.seconds > 0) {
+            ostringstream str;
+            str << fixed << setprecision(2) << "table/switch speedup: " << sw.seconds / table.seconds << "x";
+            info(str.str());
+        }
+    }
+    catch (Error &e) {
+        fatal(e.why());
+    }
+    catch (std::exception &e) {
+        fatal(string(e.what()));
+    }
+    catch (...) {
+        fatal("Unknown exception");
+    }
+    return 0;
+}
@@ -0,0 +1,329 @@
+#include "dos/output.h"
+#include "dos/error.h"
+#include "dos/executable.h"
+#include "dos/instruction.h"
+#include "dos/sweep.h"
+#include "dos/pattern.h"
+#include "dos/mz.h"
+#include "dos/util.h"
+
+#include <chrono>
+#include <random>
+#include <vector>
+#include <unordered_map>
+
+using namespace std;
+
+OUTPUT_CONF(LOG_SYSTEM)
+
+const Size
+    SYNTH_DEFAULT = 256, // kB
+    RANDOM_DEFAULT = 64, // kB
+    ITER_DEFAULT = 5;
+// segment prefix, opcode, modrm, 16bit displacement and 16bit immediate
+const Size MAX_INSTRUCTION_LENGTH = 7;
+const Word LOAD_SEGMENT = 0x1000;
+
+void usage() {
+    ostringstream str;
+    str << "benchdecode v" << VERSION << endl
+        << "Usage: " << endl
+        << "benchdecode [options] [exe_file...]" << endl
+        << "    Measures instruction decoding throughput with a linear sweep over the load module of each exe_file," << endl
+        << "    over a synthetic image made up of randomly generated valid instructions, and over an image of purely random bytes." << endl
+        << "    Also measures the throughput of search pattern, signature and instruction match computation on the decoded instructions," << endl
+        << "    and compares formatting them as text through toString() against formatting into a reused buffer." << endl
+        << "    Before timing anything, an instruction is decoded at every offset of each image and the results are cross-checked for consistency," << endl
+        << "    any discrepancy is reported as an error." << endl
+        << "Options:" << endl
+        << "--synth size    size of the synthetic image in kB (0: skip, default: " << to_string(SYNTH_DEFAULT) << ")" << endl
+        << "--random size   size of the random byte image in kB (0: skip, default: " << to_string(RANDOM_DEFAULT) << ")" << endl
+        << "--iter count    number of timed passes over each image, best one is reported (default: " << to_string(ITER_DEFAULT) << ")" << endl
+        << "--seed value    random seed for the synthetic image (default: 0)";
+    output(str.str(), LOG_OTHER, LOG_ERROR);
+    exit(1);
+}
+
+void fatal(const string &msg) {
+    error(msg);
+    exit(1);
+}
+
+// generate a stream of valid instructions by repeatedly decoding random bytes and keeping the ones that decode without error
+static vector<Byte> synthImage(const Size size, const unsigned seed) {
+    mt19937 rng{seed};
+    uniform_int_distribution<int> byteDist{0, 0xff};
+    vector<Byte> ret;
+    ret.reserve(size);
+    Byte buf[16];
+    while (ret.size() < size) {
+        for (auto &b : buf) b = static_cast<Byte>(byteDist(rng));
+        try {
+            Instruction i{Address{}, buf};
+            if (ret.size() + i.length > size) break;
+            ret.insert(ret.end(), buf, buf + i.length);
+        }
+        catch (CpuError &e) {}
+    }
+    // pad the remainder with nops so the sweep does not run into garbage
+    ret.resize(size, OP_NOP);
+    return ret;
+}
+
+// random bytes without any regard for validity, exercises the error paths of the decoder
+static vector<Byte> randomImage(const Size size, const unsigned seed) {
+    mt19937 rng{seed};
+    uniform_int_distribution<int> byteDist{0, 0xff};
+    vector<Byte> ret(size);
+    for (auto &b : ret) b = static_cast<Byte>(byteDist(rng));
+    return ret;
+}
+
+// run a pass several times, return the duration of the fastest run in seconds
+template<typename F> static double bestTime(const Size iterations, F pass) {
+    double best = 0;
+    for (Size iter = 0; iter < iterations; ++iter) {
+        const auto start = chrono::steady_clock::now();
+        pass();
+        const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (iter == 0 || seconds < best) best = seconds;
+    }
+    return best;
+}
+
+static string rateStr(const Size count, const double seconds) {
+    ostringstream str;
+    str << fixed << setprecision(0) << (seconds > 0 ? count / seconds : 0) << "/s";
+    return str.str();
+}
+
+static void checkFailed(const Instruction &i, const string &what) {
+    throw LogicError("Consistency check failed at " + i.addr.toString() + " (" + i.toString() + "): " + what);
+}
+
+// Decode an instruction at every offset of the load module, and verify that the different views of the same instruction agree with each other:
+// the decode cache and the packed record against a fresh decode, the search pattern against the instruction bytes, the compact signature 
+// against the full one, and the instruction matching itself. Instructions with identical search patterns only differ in their immediate values,
+// so they also need to have identical signatures and cannot be a mismatch.
+static void crossCheck(const Executable &exe) {
+    const Offset
+        begin = exe.extents().begin.toLinear(),
+        end = exe.extents().end.toLinear();
+    Size valid = 0, invalid = 0, pairs = 0;
+    unordered_map<string, Offset> patterns;
+    for (Offset linear = begin; linear <= end; ++linear) {
+        const Address addr{linear};
+        const Byte *data = exe.codePointer(addr);
+        Instruction i;
+        try {
+            i = Instruction{addr, data};
+        }
+        catch (CpuError &e) {
+            invalid++;
+            continue;
+        }
+        valid++;
+        if (i.length == 0 || i.length > MAX_INSTRUCTION_LENGTH) checkFailed(i, "length out of range: " + to_string(i.length));
+        // decode cache and packed record
+        const PackedInstruction packed{i}, cached = exe.decoded(addr);
+        if (cached.length != i.length || cached.signature() != packed.signature()) checkFailed(i, "decode cache does not agree with decoder");
+        const Instruction unpacked = exe.instruction(addr);
+        if (unpacked.toString(true) != i.toString(true)) checkFailed(i, "unpacked instruction text differs: " + unpacked.toString(true));
+        if (unpacked.match(i) != INS_MATCH_FULL || i.match(i) != INS_MATCH_FULL) checkFailed(i, "instruction does not match itself");
+        // search pattern
+        const BytePattern pattern = i.pattern();
+        if (pattern.size() != i.length) checkFailed(i, "pattern length " + to_string(pattern.size()) + " differs from instruction length");
+        if (!pattern.matches(data)) checkFailed(i, "pattern " + pattern.toString() + " does not match instruction bytes");
+        if (unpacked.pattern() != pattern) checkFailed(i, "unpacked instruction pattern differs: " + unpacked.pattern().toString());
+        for (Size b = 1; b < pattern.size(); ++b) {
+            if (pattern.isWildcard(b - 1) && !pattern.isWildcard(b)) checkFailed(i, "pattern " + pattern.toString() + " has wildcards before fixed bytes");
+        }
+        // signatures
+        const Signature sig = i.signature();
+        if (packed.signature() != sig) checkFailed(i, "packed signature differs");
+        if (compactSignature(sig) != i.signature16() || packed.signature16() != i.signature16()) checkFailed(i, "compact signature differs");
+        // instructions sharing a pattern
+        const auto [it, inserted] = patterns.try_emplace(pattern.toString(), linear);
+        if (inserted) continue;
+        pairs++;
+        const Instruction other{Address{it->second}, exe.codePointer(Address{it->second})};
+        if (other.signature() != sig) checkFailed(i, "signature differs from " + other.toString() + " @ " + other.addr.toString() + " with the same pattern");
+        if (other.match(i) == INS_MATCH_MISMATCH) checkFailed(i, "mismatch against " + other.toString() + " @ " + other.addr.toString() + " with the same pattern");
+    }
+    info("    cross-checked " + to_string(valid) + " instructions at every offset (" + to_string(invalid) + " invalid), " 
+        + to_string(pairs) + " sharing a pattern with another, " + to_string(patterns.size()) + " distinct patterns");
+}
+
+// throughput of the operations performed on decoded instructions by the analysis
+static void operationBenchmark(const InstructionSweep &sweep, const Size iterations) {
+    vector<Instruction> instructions;
+    instructions.reserve(sweep.size());
+    for (Size i = 0; i < sweep.size(); ++i) {
+        if (sweep.classes()[i] != INS_ERR) instructions.push_back(sweep.instruction(i));
+    }
+    const Size count = instructions.size();
+    if (count == 0) return;
+    // accumulate the results and print them so the work cannot be skipped
+    Size sink = 0;
+    const double patternTime = bestTime(iterations, [&]{
+        for (const auto &i : instructions) sink += i.pattern().fixedCount();
+    });
+    const double signatureTime = bestTime(iterations, [&]{
+        for (const auto &i : instructions) sink += i.signature();
+    });
+    const double signature16Time = bestTime(iterations, [&]{
+        for (const auto &i : instructions) sink += i.signature16();
+    });
+    // each instruction against its successor, mostly mismatches with some partial matches
+    const double matchTime = bestTime(iterations, [&]{
+        for (Size i = 0; i + 1 < count; ++i) sink += instructions[i].match(instructions[i + 1]);
+    });
+    info("    " + to_string(count) + " instructions: pattern() " + rateStr(count, patternTime) + ", signature() " + rateStr(count, signatureTime)
+        + ", signature16() " + rateStr(count, signature16Time) + ", match() " + rateStr(count - 1, matchTime) + " (checksum " + hexVal(static_cast<DWord>(sink)) + ")");
+}
+
+struct SweepResult {
+    Size instructions, invalid;
+    double seconds;
+};
+
+// decode the entire load module linearly, skipping one byte forward on invalid opcodes
+static SweepResult sweep(const Executable &exe) {
+    SweepResult ret{0, 0, 0};
+    const Block extents = exe.extents();
+    // walk linear offsets, the synthetic image can be larger than a single segment
+    const Offset end = extents.end.toLinear();
+    Offset linear = extents.begin.toLinear();
+    const auto start = chrono::steady_clock::now();
+    while (linear <= end) {
+        const Address a{linear};
+        try {
+            Instruction i{a, exe.codePointer(a)};
+            linear += i.length;
+            ret.instructions++;
+        }
+        catch (CpuError &e) {
+            linear += 1;
+            ret.invalid++;
+        }
+    }
+    ret.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return ret;
+}
+
+struct FormatResult {
+    Size chars;
+    double seconds;
+};
+
+// format every instruction in the sweep, either going through a string for each one or into a single reused buffer
+static FormatResult format(const InstructionSweep &sweep, const bool buffered) {
+    FormatResult ret{0, 0};
+    char buf[INSTRUCTION_TEXT_MAX];
+    TextBuffer out{buf, sizeof(buf)};
+    const auto start = chrono::steady_clock::now();
+    for (Size i = 0; i < sweep.size(); ++i) {
+        if (sweep.classes()[i] == INS_ERR) continue;
+        const Instruction ins = sweep.instruction(i);
+        if (buffered) {
+            out.clear();
+            ins.format(out, true);
+            ret.chars += out.size();
+        }
+        else ret.chars += ins.toString(true).size();
+    }
+    ret.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return ret;
+}
+
+static void formatBenchmark(const Executable &exe, const Size iterations) {
+    const InstructionSweep sweep{exe, exe.extents(), true};
+    // make sure both ways produce identical text before timing them
+    char buf[INSTRUCTION_TEXT_MAX];
+    TextBuffer out{buf, sizeof(buf)};
+    for (Size i = 0; i < sweep.size(); ++i) {
+        if (sweep.classes()[i] == INS_ERR) continue;
+        const Instruction ins = sweep.instruction(i);
+        out.clear();
+        ins.format(out, true);
+        if (out.truncated() || ins.toString(true) != out.c_str()) 
+            throw LogicError("Formatting mismatch at " + ins.addr.toString() + ": '" + ins.toString(true) + "' vs '" + out.c_str() + "'");
+    }
+    FormatResult best[2];
+    for (int buffered = 0; buffered < 2; ++buffered) {
+        for (Size iter = 0; iter < iterations; ++iter) {
+            const FormatResult r = format(sweep, buffered);
+            if (iter == 0 || r.seconds < best[buffered].seconds) best[buffered] = r;
+        }
+    }
+    const Size count = sweep.size() - sweep.invalidCount();
+    ostringstream str;
+    str << fixed << setprecision(0) << "    formatting " << count << " instructions: toString() " 
+        << (best[0].seconds > 0 ? count / best[0].seconds : 0) << " instructions/s, buffer " 
+        << (best[1].seconds > 0 ? count / best[1].seconds : 0) << " instructions/s";
+    if (best[1].seconds > 0) str << setprecision(2) << " (" << best[0].seconds / best[1].seconds << "x)";
+    info(str.str());
+}
+
+static void benchmark(const string &name, const Executable &exe, const Size iterations) {
+    SweepResult best{0, 0, 0};
+    for (Size iter = 0; iter < iterations; ++iter) {
+        const SweepResult r = sweep(exe);
+        if (iter == 0 || r.seconds < best.seconds) best = r;
+    }
+    const double
+        ips = best.seconds > 0 ? best.instructions / best.seconds : 0,
+        mbps = best.seconds > 0 ? exe.size() / best.seconds / MB : 0;
+    ostringstream str;
+    str << fixed << setprecision(2) << name << ": " << sizeStr(exe.size()) << ", " << best.instructions << " instructions, " << best.invalid << " invalid bytes, "
+        << setprecision(4) << best.seconds << " s, " << setprecision(0) << ips << " instructions/s, " << setprecision(2) << mbps << " MB/s";
+    info(str.str());
+    crossCheck(exe);
+    operationBenchmark(InstructionSweep{exe, exe.extents(), true}, iterations);
+    formatBenchmark(exe, iterations);
+}
+
+int main(int argc, char *argv[]) {
+    setOutputLevel(LOG_INFO);
+    setModuleVisibility(LOG_CPU, false);
+    vector<string> paths;
+    Size synthSize = SYNTH_DEFAULT, randomSize = RANDOM_DEFAULT, iterations = ITER_DEFAULT;
+    unsigned seed = 0;
+    for (int aidx = 1; aidx < argc; ++aidx) {
+        string arg(argv[aidx]);
+        if (arg == "--synth" && ++aidx < argc) synthSize = stoi(string{argv[aidx]}, nullptr, 10);
+        else if (arg == "--random" && ++aidx < argc) randomSize = stoi(string{argv[aidx]}, nullptr, 10);
+        else if (arg == "--iter" && ++aidx < argc) iterations = stoi(string{argv[aidx]}, nullptr, 10);
+        else if (arg == "--seed" && ++aidx < argc) seed = stoul(string{argv[aidx]}, nullptr, 10);
+        else if (arg == "--help") usage();
+        else if (arg.starts_with("--")) fatal("Unrecognized option: "s + arg);
+        else paths.push_back(arg);
+    }
+    if (iterations == 0) fatal("Iteration count must be positive");
+    try {
+        for (const auto &path : paths) {
+            if (!checkFile(path).exists) fatal("Executable file does not exist: " + path);
+            MzImage mz{path, LOAD_SEGMENT};
+            Executable exe{mz};
+            benchmark(path, exe, iterations);
+        }
+        if (synthSize) {
+            const Executable exe{0, synthImage(synthSize * 1_kB, seed)};
+            benchmark("synthetic", exe, iterations);
+        }
+        if (randomSize) {
+            const Executable exe{0, randomImage(randomSize * 1_kB, seed)};
+            benchmark("random", exe, iterations);
+        }
+    }
+    catch (Error &e) {
+        fatal(e.why());
+    }
+    catch (std::exception &e) {
+        fatal(string(e.what()));
+    }
+    catch (...) {
+        fatal("Unknown exception");
+    }
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include "dos/coverage.h"
+#include "dos/error.h"
+#include "dos/util.h"
+#include "dos/output.h"
+
+#include <fstream>
+#include <regex>
+#include <algorithm>
+
+using namespace std;
+
+OUTPUT_CONF(LOG_ANALYSIS)
+
+Coverage::Coverage(const ExecProfile &profile) : executed_(profile.executed()), branches_(profile.indirectBranches().begin(), profile.indirectBranches().end()) {
+}
+
+Coverage::Coverage(const std::string &path, const Word reloc) {
+    static const regex
+        EXEC_RE{"Executed\\s+([0-9a-fA-F]+)-([0-9a-fA-F]+)"},
+        BRANCH_RE{"(Call|Jump)\\s+([0-9a-fA-F]{1,4}:[0-9a-fA-F]{1,4})\\s+([0-9a-fA-F]{1,4}:[0-9a-fA-F]{1,4})\\s+(NEAR|FAR)"};
+    if (!checkFile(path).exists) throw ArgError("Coverage file does not exist: "s + path);
+    debug("Loading coverage from "s + path + ", relocating to " + hexVal(reloc));
+    ifstream file{path};
+    string line;
+    Size lineno = 0;
+    smatch match;
+    const Offset base = SEG_TO_OFFSET(reloc);
+    while (safeGetline(file, line)) {
+        lineno++;
+        if (line.empty() || line[0] == '#') continue;
+        else if (regex_match(line, match, EXEC_RE)) {
+            const Offset 
+                begin = stoi(match.str(1), nullptr, 16),
+                end = stoi(match.str(2), nullptr, 16);
+            if (end < begin) throw ParseError("Line " + to_string(lineno) + ": invalid executed block '" + line + "'");
+            executed_.emplace_back(base + begin, base + end);
+        }
+        else if (regex_match(line, match, BRANCH_RE)) {
+            IndirectBranch b{Address{match.str(2)}, Address{match.str(3)}, match.str(1) == "Call", match.str(4) == "NEAR"};
+            b.source.relocate(reloc);
+            b.destination.relocate(reloc);
+            branches_.push_back(b);
+        }
+        else throw ParseError("Line " + to_string(lineno) + ": invalid coverage entry '" + line + "'");
+    }
+    debug("Loaded coverage: " + to_string(executed_.size()) + " executed blocks, " + to_string(branches_.size()) + " indirect branches");
+}
+
+void Coverage::save(const std::string &path, const Word reloc, const bool overwrite) const {
+    if (checkFile(path).exists && !overwrite) throw ArgError("Coverage file already exists: " + path);
+    ofstream file{path};
+    if (!file) throw IoError("Unable to open coverage file for writing: " + path);
+    const Offset base = SEG_TO_OFFSET(reloc);
+    file << "#" << endl
+         << "# Runs of executed code, one per line, syntax is \"Executed Begin-End\"" << endl
+         << "# Blocks are linear offsets relative to the start of the load module, spanning the consecutive executed instructions." << endl
+         << "#" << endl;
+    for (const Block &b : executed_) {
+        if (b.begin.toLinear() < base) continue;
+        file << "Executed " << hexVal(b.begin.toLinear() - base, false) << "-" << hexVal(b.end.toLinear() - base, false) << endl;
+    }
+    file << "#" << endl
+         << "# Observed destinations of calls and jumps through a register or memory, syntax is \"Call/Jump Source Destination NEAR/FAR\"" << endl
+         << "# The addresses are relative to the load segment." << endl
+         << "#" << endl;
+    for (IndirectBranch b : branches_) {
+        try {
+            b.source.rebase(reloc);
+            b.destination.rebase(reloc);
+        }
+        catch (MemoryError &e) {
+            debug("Skipping branch outside of the load module: " + b.source.toString() + " -> " + b.destination.toString());
+            continue;
+        }
+        file << (b.isCall ? "Call " : "Jump ") << b.source.toString(true) << " " << b.destination.toString(true) << (b.isNear ? " NEAR" : " FAR") << endl;
+    }
+}
+
+std::vector<Coverage::IndirectBranch> Coverage::branchesFrom(const Address &source) const {
+    vector<IndirectBranch> ret;
+    copy_if(branches_.begin(), branches_.end(), back_inserter(ret), [&](const IndirectBranch &b) { return b.source == source; });
+    return ret;
+}
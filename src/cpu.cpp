@@ -6,6 +6,7 @@
 #include <cassert>
 #include <vector>
 #include <stack>
+#include <cstring>
 
 #include "dos/cpu.h"
 #include "dos/psp.h"
@@ -20,19 +21,104 @@ using namespace std;
 
 #define UNKNOWN_DISPATCH unknown("dispatch")
 #define UNKNOWN_ILEN unknown("instr_length")
+// call the byte or word variant of a generic instruction implementation, according to the operand size of the current instruction
+#define SIZED(func, ...) (wide_ ? func<Word>(__VA_ARGS__) : func<Byte>(__VA_ARGS__))
 
 static void cpuMessage(const string &msg, const LogPriority pri = LOG_INFO) {
     output(msg, LOG_CPU, pri);
 }
 
-Cpu_8086::Cpu_8086(Memory *memory, InterruptInterface *inthandler) : 
-    mem_(memory), int_(inthandler), 
-    memBase_(nullptr), code_(nullptr),
+// handlers of the instruction classes for the table dispatch
+const array<Cpu_8086::Handler, INS_IDIV + 1> Cpu_8086::CLASS_HANDLER = [] {
+    array<Handler, INS_IDIV + 1> ret;
+    ret.fill(&Cpu_8086::instr_invalid);
+    ret[INS_ADD] = &Cpu_8086::instr_add;       ret[INS_PUSH] = &Cpu_8086::instr_push;     ret[INS_POP] = &Cpu_8086::instr_pop;
+    ret[INS_OR] = &Cpu_8086::instr_or;         ret[INS_ADC] = &Cpu_8086::instr_adc;       ret[INS_SBB] = &Cpu_8086::instr_sbb;
+    ret[INS_AND] = &Cpu_8086::instr_and;       ret[INS_DAA] = &Cpu_8086::instr_daa;       ret[INS_SUB] = &Cpu_8086::instr_sub;
+    ret[INS_DAS] = &Cpu_8086::instr_das;       ret[INS_XOR] = &Cpu_8086::instr_xor;       ret[INS_AAA] = &Cpu_8086::instr_aaa;
+    ret[INS_CMP] = &Cpu_8086::instr_cmp;       ret[INS_AAS] = &Cpu_8086::instr_aas;       ret[INS_INC] = &Cpu_8086::instr_inc;
+    ret[INS_DEC] = &Cpu_8086::instr_dec;       ret[INS_JMP] = &Cpu_8086::instr_jmp;       ret[INS_JMP_IF] = &Cpu_8086::instr_jmp;
+    ret[INS_JMP_FAR] = &Cpu_8086::instr_jmp;   ret[INS_TEST] = &Cpu_8086::instr_test;     ret[INS_XCHG] = &Cpu_8086::instr_xchg;
+    ret[INS_MOV] = &Cpu_8086::instr_mov;       ret[INS_LEA] = &Cpu_8086::instr_lea;       ret[INS_NOP] = &Cpu_8086::instr_nop;
+    ret[INS_CBW] = &Cpu_8086::instr_cbw;       ret[INS_CWD] = &Cpu_8086::instr_cwd;       ret[INS_CALL] = &Cpu_8086::instr_call;
+    ret[INS_CALL_FAR] = &Cpu_8086::instr_call; ret[INS_WAIT] = &Cpu_8086::instr_wait;     ret[INS_PUSHF] = &Cpu_8086::instr_pushf;
+    ret[INS_POPF] = &Cpu_8086::instr_popf;     ret[INS_SAHF] = &Cpu_8086::instr_sahf;     ret[INS_LAHF] = &Cpu_8086::instr_lahf;
+    ret[INS_MOVSB] = &Cpu_8086::instr_movsb;   ret[INS_MOVSW] = &Cpu_8086::instr_movsw;   ret[INS_CMPSB] = &Cpu_8086::instr_cmpsb;
+    ret[INS_CMPSW] = &Cpu_8086::instr_cmpsw;   ret[INS_STOSB] = &Cpu_8086::instr_stosb;   ret[INS_STOSW] = &Cpu_8086::instr_stosw;
+    ret[INS_LODSB] = &Cpu_8086::instr_lodsb;   ret[INS_LODSW] = &Cpu_8086::instr_lodsw;   ret[INS_SCASB] = &Cpu_8086::instr_scasb;
+    ret[INS_SCASW] = &Cpu_8086::instr_scasw;   ret[INS_RET] = &Cpu_8086::instr_ret;       ret[INS_LES] = &Cpu_8086::instr_les;
+    ret[INS_LDS] = &Cpu_8086::instr_lds;       ret[INS_RETF] = &Cpu_8086::instr_retf;     ret[INS_INT] = &Cpu_8086::instr_int;
+    ret[INS_INT3] = &Cpu_8086::instr_int;      ret[INS_INTO] = &Cpu_8086::instr_int;      ret[INS_IRET] = &Cpu_8086::instr_iret;
+    ret[INS_AAM] = &Cpu_8086::instr_aam;       ret[INS_AAD] = &Cpu_8086::instr_aad;       ret[INS_XLAT] = &Cpu_8086::instr_xlat;
+    ret[INS_LOOPNZ] = &Cpu_8086::instr_loopnz; ret[INS_LOOPZ] = &Cpu_8086::instr_loopz;   ret[INS_LOOP] = &Cpu_8086::instr_loop;
+    ret[INS_IN] = &Cpu_8086::instr_in;         ret[INS_OUT] = &Cpu_8086::instr_out;       ret[INS_LOCK] = &Cpu_8086::instr_lock;
+    ret[INS_REPNZ] = &Cpu_8086::instr_repnz;   ret[INS_REPZ] = &Cpu_8086::instr_repz;     ret[INS_HLT] = &Cpu_8086::instr_hlt;
+    ret[INS_CMC] = &Cpu_8086::instr_cmc;       ret[INS_CLC] = &Cpu_8086::instr_clc;       ret[INS_STC] = &Cpu_8086::instr_stc;
+    ret[INS_CLI] = &Cpu_8086::instr_cli;       ret[INS_STI] = &Cpu_8086::instr_sti;       ret[INS_CLD] = &Cpu_8086::instr_cld;
+    ret[INS_STD] = &Cpu_8086::instr_std;       ret[INS_ROL] = &Cpu_8086::instr_rol;       ret[INS_ROR] = &Cpu_8086::instr_ror;
+    ret[INS_RCL] = &Cpu_8086::instr_rcl;       ret[INS_RCR] = &Cpu_8086::instr_rcr;       ret[INS_SHL] = &Cpu_8086::instr_shl;
+    ret[INS_SHR] = &Cpu_8086::instr_shr;       ret[INS_SAR] = &Cpu_8086::instr_sar;       ret[INS_NOT] = &Cpu_8086::instr_not;
+    ret[INS_NEG] = &Cpu_8086::instr_neg;       ret[INS_MUL] = &Cpu_8086::instr_mul;       ret[INS_IMUL] = &Cpu_8086::instr_imul;
+    ret[INS_DIV] = &Cpu_8086::instr_div;       ret[INS_IDIV] = &Cpu_8086::instr_idiv;
+    return ret;
+}();
+
+// handlers indexed by opcode, the operation of a group opcode depends on the ModR/M byte,
+// so it goes through the handler of the class which the decoder assigned to the instruction
+const array<Cpu_8086::Handler, 0x100> Cpu_8086::OPCODE_HANDLER = [] {
+    array<Handler, 0x100> ret;
+    for (Size opcode = 0; opcode < ret.size(); ++opcode) {
+        const Byte op = static_cast<Byte>(opcode);
+        ret[opcode] = opcodeIsGroup(op) ? &Cpu_8086::groupClassDispatch : CLASS_HANDLER[instr_class(op)];
+    }
+    return ret;
+}();
+
+// instructions whose outcome goes into the taken/not taken counters of the profile
+static bool conditionalBranch(const InstructionClass iclass) {
+    return iclass == INS_JMP_IF || iclass == INS_LOOP || iclass == INS_LOOPZ || iclass == INS_LOOPNZ;
+}
+
+// calls and jumps through a register or memory, their destinations are only known at runtime
+static bool indirectBranch(const Byte opcode, const InstructionClass iclass) {
+    return opcode == OP_GRP5_Ev && (iclass == INS_CALL || iclass == INS_CALL_FAR || iclass == INS_JMP || iclass == INS_JMP_FAR);
+}
+
+// parity flag values for all possible 8-bit results, used as a lookup table
+// to avoid counting 1 bits after an arithmetic instruction 
+// (8086 only checks the lower 8 bits, even for 16bit results)
+static const bool PARITY[256] = {
+    1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1,
+    0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0,
+    0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0,
+    1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1,
+    0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0,
+    1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1,
+    1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1,
+    0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0,
+    0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0,
+    1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1,
+    1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1,
+    0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0,
+    1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1,
+    0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0,
+    0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0,
+    1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1
+};
+
+// the reserved upper bits of the flags register always read as set on the 8086
+static constexpr Word FLAGS_RESERVED = FLAG_B12 | FLAG_B13 | FLAG_B14 | FLAG_B15;
+
+Cpu_8086::Cpu_8086(Memory *memory, InterruptInterface *inthandler, const CpuDispatch dispatch) : 
+    mem_(memory), int_(inthandler), dispatch_(dispatch),
+    memBase_(nullptr), code_(nullptr), length_(0),
     opcode_(OP_NOP), modrm_(0),
-    segOverride_(REG_NONE),
-    byteOperand1_(0), byteOperand2_(0), byteResult_(0),
-    wordOperand1_(0), wordOperand2_(0), wordResult_(0),
-    done_(false), step_(false)
+    segOverride_(REG_NONE), chainPrefix_(PRF_NONE),
+    ops_{}, wide_(false),
+    flagOp_(FLAGOP_LOGIC), flagWide_(false), flagCarry_(false),
+    flagOperand1_(0), flagOperand2_(0), flagResult_(0), flagsLazy_(0),
+    done_(false), step_(false), stopAt_(SIZE_MAX), executed_(0), skipped_(0), synced_(0), pollBegin_(0), pollEnd_(0),
+    profile_(nullptr), trace_(nullptr), watch_(nullptr), watchHandler_(nullptr), breakAt_(MEM_TOTAL), stopped_(false)
 {
     memBase_ = mem_->base();
     regs_.reset();
@@ -63,16 +149,16 @@ void Cpu_8086::setCodeSegment(const Word seg) {
 
 // calculate memory address to be used for the MEM operand of a ModR/M instruction, 
 // the value of the MEM bits together with the MOD bits indicates the formula to use when calculating the address
-Offset Cpu_8086::modrmMemAddress() const {
+void Cpu_8086::modrmMemOperand(OperandRef &ref) const {
     Register baseReg;
     // obtain byte/word offset value for the displacement addressing modes, if applicable
     Word offset;
     SWord displacement;
+    // the displacement or direct address follows the optional prefix, the opcode and the modrm byte
+    const Byte *operand = instr_.data + (instr_.prefix != PRF_NONE ? 3 : 2);
     switch (modrm_mod(modrm_)) {
-    // assuming cs:ip points at the opcode, so the displacement will be 2 bytes past that,
-    // after the opcode and the modrm byte
-    case MODRM_MOD_DISP8:  displacement = BYTE_SIGNED(ipByte(2)); break; 
-    case MODRM_MOD_DISP16: displacement = WORD_SIGNED(ipWord(2)); break;
+    case MODRM_MOD_DISP8:  displacement = BYTE_SIGNED(operand[0]); break; 
+    case MODRM_MOD_DISP16: displacement = WORD_SIGNED(*WORD_PTR(operand, 0)); break;
     }
     // calculate offset of the word or byte from the register values and optionally the displacement
     switch (modrm_mod(modrm_)) {
@@ -84,8 +170,8 @@ Offset Cpu_8086::modrmMemAddress() const {
         case MODRM_MEM_BP_SI: baseReg = REG_BP;   offset = regs_.get(REG_BP) + regs_.get(REG_SI); break;
         case MODRM_MEM_BP_DI: baseReg = REG_BP;   offset = regs_.get(REG_BP) + regs_.get(REG_DI); break;
         case MODRM_MEM_SI:    baseReg = REG_SI;   offset = regs_.get(REG_SI); break;
-        case MODRM_MEM_DI:    baseReg = REG_DI;   offset = regs_.get(REG_DI); break;
-        case MODRM_MEM_ADDR:  baseReg = REG_NONE; offset = ipWord(2); break; // address is the word past the opcode and modrm byte
+        case MODRM_MEM_DI:    baseReg = REG_NONE; offset = regs_.get(REG_DI); break; // DI only implies ES for string instructions
+        case MODRM_MEM_ADDR:  baseReg = REG_NONE; offset = *WORD_PTR(operand, 0); break;
         case MODRM_MEM_BX:    baseReg = REG_BX;   offset = regs_.get(REG_BX); break;
         }
         break;
@@ -98,7 +184,7 @@ Offset Cpu_8086::modrmMemAddress() const {
         case MODRM_MEM_BP_SI_OFF: baseReg = REG_BP; offset = regs_.get(REG_BP) + regs_.get(REG_SI); break;
         case MODRM_MEM_BP_DI_OFF: baseReg = REG_BP; offset = regs_.get(REG_BP) + regs_.get(REG_DI); break;
         case MODRM_MEM_SI_OFF:    baseReg = REG_SI; offset = regs_.get(REG_SI) ; break;
-        case MODRM_MEM_DI_OFF:    baseReg = REG_DI; offset = regs_.get(REG_DI) ; break;
+        case MODRM_MEM_DI_OFF:    baseReg = REG_NONE; offset = regs_.get(REG_DI) ; break;
         case MODRM_MEM_BP_OFF:    baseReg = REG_BP; offset = regs_.get(REG_BP) ; break;
         case MODRM_MEM_BX_OFF:    baseReg = REG_BX; offset = regs_.get(REG_BX) ; break;
         }
@@ -110,34 +196,267 @@ Offset Cpu_8086::modrmMemAddress() const {
         throw CpuError("Invalid ModR/M for address calculation: "s + hexVal(modrm_mod(modrm_)));
     }
     // the calculated address is relative to a segment that is implicitly associated with the base register
-    const Offset segOffset = SEG_TO_OFFSET(regs_.get(defaultSeg(baseReg)));
-    return segOffset + offset;
+    ref.reg = defaultSeg(baseReg);
+    ref.offset = offset;
+    ref.addr = SEG_TO_OFFSET(regs_.get(ref.reg)) + offset;
 }
 
-// TODO: merge this with getInstruction in the future?
-void Cpu_8086::preProcessOpcode() {
-    static const Register PREFIX_REGS[4] = { REG_ES, REG_CS, REG_SS, REG_DS };
-    Word ipOffset = 0;
-    // clear segment override in case it was active
-    segOverride_ = REG_NONE;
-    modrm_ = 0;
-    // in case the current opcode is actually a segment override prefix, set a flag and fetch the actual opcode from the next byte
-    if (opcodeIsSegmentPrefix(opcode_)) {
-        const size_t index = (opcode_ - OP_PREFIX_ES) / 8; // first prefix opcodes is for ES and subsequent ones are multiples of 8
-        segOverride_ = PREFIX_REGS[index]; 
-        opcode_ = ipByte(1);
-        ipOffset++;
-        // fall through, need to process updated opcode
-        // TODO: ip remains at override prefix, modrm read etc will be off?
+// decode the instruction at cs:ip, a segment override or chain prefix is folded into the decoded instruction
+void Cpu_8086::translate(const Address &csip, MicroOp &op) const {
+    static constexpr Size MAX_PREFIXES = 4;
+    const Byte *code = memBase_ + csip.toLinear();
+    op.segOverride = REG_NONE;
+    op.chainPrefix = PRF_NONE;
+    // the decoder takes a single prefix, an instruction can have both a segment and a chain prefix (e.g. rep cs: movsw),
+    // so consume all but the last one here
+    Size skip = 0;
+    while (skip < MAX_PREFIXES && opcodePrefix(code[skip]) != PRF_NONE && opcodePrefix(code[skip + 1]) != PRF_NONE) {
+        const InstructionPrefix p = opcodePrefix(code[skip++]);
+        if (prefixIsSegment(p)) op.segOverride = prefixRegId(p);
+        else op.chainPrefix = p;
     }
-    // read modrm byte if opcode contains it
-    if (opcodeIsModrm(opcode_)) {
-        modrm_ = ipByte(1 + ipOffset);
+    op.instr = Instruction{csip, code + skip};
+    const Instruction &i = op.instr;
+    op.length = skip + i.length;
+    if (prefixIsSegment(i.prefix)) op.segOverride = prefixRegId(i.prefix);
+    else if (prefixIsChain(i.prefix)) op.chainPrefix = i.prefix;
+    op.modrm = opcodeIsModrm(i.opcode) ? i.data[i.prefix != PRF_NONE ? 2 : 1] : 0;
+    op.handler = opcodeIsGroup(i.opcode) ? CLASS_HANDLER[i.iclass] : OPCODE_HANDLER[i.opcode];
+}
+
+void Cpu_8086::loadMicroOp(const MicroOp &op) {
+    instr_ = op.instr;
+    length_ = op.length;
+    opcode_ = instr_.opcode;
+    modrm_ = op.modrm;
+    segOverride_ = op.segOverride;
+    chainPrefix_ = op.chainPrefix;
+}
+
+// find the translated block starting at cs:ip, or translate one; a block ends after an instruction which can transfer control,
+// before one that does not decode (so that the error comes up when it is reached), or when it grows too large
+const Cpu_8086::CodeBlock& Cpu_8086::fetchBlock() {
+    static constexpr Size INSTRUCTION_SPAN_MAX = 16;
+    const Address csip = regs_.csip();
+    const Offset linear = csip.toLinear();
+    auto it = blocks_.find(linear);
+    // the same code reached through a different segment needs its addresses redone
+    if (it != blocks_.end() && it->second.segment == csip.segment) return it->second;
+    if (it != blocks_.end()) {
+        mem_->untrackCode(it->second.begin, it->second.end - it->second.begin);
+        blocks_.erase(it);
     }
+    CodeBlock block{csip.segment, linear, linear, {}, false};
+    Address a = csip;
+    while (block.ops.size() < BLOCK_OPS_MAX && block.end - block.begin + INSTRUCTION_SPAN_MAX <= BLOCK_SPAN_MAX) {
+        MicroOp op;
+        try {
+            translate(a, op);
+        }
+        catch (CpuError &e) {
+            if (block.ops.empty()) throw;
+            break;
+        }
+        block.ops.push_back(op);
+        block.end += op.length;
+        const Instruction &i = op.instr;
+        if (i.isBranch() || i.isReturn() || i.iclass == INS_INT || i.iclass == INS_INT3 || i.iclass == INS_INTO || i.iclass == INS_HLT
+            || i.op1.type == OPR_REG_CS) break;
+        // do not let the block wrap around the end of the segment
+        if (a.offset + op.length > OFFSET_MAX) break;
+        a.offset += op.length;
+    }
+    block.poll = pollLoop(block, csip.offset);
+    mem_->trackCode(block.begin, block.end - block.begin);
+    return blocks_.emplace(linear, std::move(block)).first->second;
+}
+
+// Whether the block is a loop which waits for a port or a memory location to change, like waiting for the retrace
+// or for the timer count in the BIOS data area to go up: it jumps back onto its start conditionally, and otherwise
+// only reads into registers and compares them, so it does not change anything that it could observe on the way round.
+bool Cpu_8086::pollLoop(const CodeBlock &block, const Word start) {
+    if (block.ops.size() < 2) return false;
+    const Instruction &last = block.ops.back().instr;
+    if (last.iclass != INS_JMP_IF || last.destinationAddress().offset != start) return false;
+    bool reads = false;
+    for (auto it = block.ops.begin(); it != block.ops.end() - 1; ++it) {
+        const Instruction &i = it->instr;
+        switch (i.iclass) {
+        case INS_IN:
+            reads = true;
+            continue;
+        case INS_MOV: case INS_AND: case INS_OR:
+            if (!operandIsReg(i.op1.type)) return false;
+            break;
+        case INS_CMP: case INS_TEST:
+            break;
+        default:
+            return false;
+        }
+        if (operandIsMem(i.op1.type) || operandIsMem(i.op2.type)) reads = true;
+    }
+    return reads;
+}
+
+// drop the translated blocks which overlap the code written since the last check, then restore the tracking
+// of the bytes they shared with surviving blocks
+void Cpu_8086::invalidateCode() {
+    const Offset low = mem_->codeWriteLow(), high = mem_->codeWriteHigh();
+    mem_->clearCodeWrites();
+    Offset dropLow = low, dropHigh = high;
+    auto it = blocks_.lower_bound(low >= BLOCK_SPAN_MAX ? low - BLOCK_SPAN_MAX : 0);
+    while (it != blocks_.end() && it->first <= high) {
+        const CodeBlock &b = it->second;
+        if (b.end > low) {
+            dropLow = min(dropLow, b.begin);
+            dropHigh = max(dropHigh, b.end - 1);
+            it = blocks_.erase(it);
+        }
+        else ++it;
+    }
+    mem_->untrackCode(dropLow, dropHigh - dropLow + 1);
+    it = blocks_.lower_bound(dropLow >= BLOCK_SPAN_MAX ? dropLow - BLOCK_SPAN_MAX : 0);
+    for (; it != blocks_.end() && it->first <= dropHigh; ++it) {
+        const CodeBlock &b = it->second;
+        if (b.end > dropLow) mem_->trackCode(b.begin, b.end - b.begin);
+    }
+}
+
+void Cpu_8086::flushBlocks() {
+    for (const auto &[begin, b] : blocks_) mem_->untrackCode(b.begin, b.end - b.begin);
+    blocks_.clear();
+    mem_->clearCodeWrites();
 }
 
 size_t Cpu_8086::instructionLength() const {
-    return 0; // TODO: fix
+    return length_;
+}
+
+// resolve the locations of the instruction operands; the switch dispatch evaluates a ModR/M memory operand
+// from the ModR/M byte, the table dispatch from the operand type found by the decoder
+void Cpu_8086::bindOperands() {
+    const bool modrm = dispatch_ == DISPATCH_SWITCH && opcodeIsModrm(opcode_);
+    bindOperand(ops_[0], instr_.op1, modrm);
+    bindOperand(ops_[1], instr_.op2, modrm);
+    wide_ = instr_.op1.size == OPRSZ_WORD || (instr_.op1.size != OPRSZ_BYTE && instr_.op2.size == OPRSZ_WORD);
+}
+
+void Cpu_8086::bindOperand(OperandRef &ref, const Instruction::Operand &op, const bool modrm) {
+    if (operandIsReg(op.type)) {
+        ref.loc = LOC_REG;
+        ref.reg = op.regId();
+    }
+    else if (operandIsMem(op.type)) {
+        ref.loc = LOC_MEM;
+        if (modrm) modrmMemOperand(ref);
+        else operandAddress(ref, op);
+    }
+    else if (operandIsImmediate(op.type)) {
+        ref.loc = LOC_IMM;
+        // a byte immediate is sign-extended for word operations, byte operations only look at the low byte anyway
+        ref.value = op.type == OPR_IMM8 ? static_cast<Word>(BYTE_SIGNED(op.immval.u8)) : op.immval.u16;
+    }
+    else ref.loc = LOC_NONE;
+}
+
+void Cpu_8086::operandAddress(OperandRef &ref, const Instruction::Operand &op) const {
+    Word offset = 0;
+    switch (op.type) {
+    case OPR_MEM_BX_SI: case OPR_MEM_BX_SI_OFF8: case OPR_MEM_BX_SI_OFF16: offset = regs_.get(REG_BX) + regs_.get(REG_SI); break;
+    case OPR_MEM_BX_DI: case OPR_MEM_BX_DI_OFF8: case OPR_MEM_BX_DI_OFF16: offset = regs_.get(REG_BX) + regs_.get(REG_DI); break;
+    case OPR_MEM_BP_SI: case OPR_MEM_BP_SI_OFF8: case OPR_MEM_BP_SI_OFF16: offset = regs_.get(REG_BP) + regs_.get(REG_SI); break;
+    case OPR_MEM_BP_DI: case OPR_MEM_BP_DI_OFF8: case OPR_MEM_BP_DI_OFF16: offset = regs_.get(REG_BP) + regs_.get(REG_DI); break;
+    case OPR_MEM_SI:    case OPR_MEM_SI_OFF8:    case OPR_MEM_SI_OFF16:    offset = regs_.get(REG_SI); break;
+    case OPR_MEM_DI:    case OPR_MEM_DI_OFF8:    case OPR_MEM_DI_OFF16:    offset = regs_.get(REG_DI); break;
+    case OPR_MEM_BX:    case OPR_MEM_BX_OFF8:    case OPR_MEM_BX_OFF16:    offset = regs_.get(REG_BX); break;
+    case OPR_MEM_BP_OFF8: case OPR_MEM_BP_OFF16: offset = regs_.get(REG_BP); break;
+    default: break; // direct address
+    }
+    if (op.type == OPR_MEM_OFF8) offset += op.immval.u8;
+    else if (operandIsMemWithByteOffset(op.type)) offset += BYTE_SIGNED(op.immval.u8);
+    else if (operandIsMemWithWordOffset(op.type)) offset += op.immval.u16;
+    ref.reg = segOverride_ != REG_NONE ? segOverride_ : defaultMemSegment(op.type);
+    ref.offset = offset;
+    ref.addr = SEG_TO_OFFSET(regs_.get(ref.reg)) + offset;
+}
+
+template<typename T> T Cpu_8086::load(const int idx) const {
+    const OperandRef &ref = ops_[idx];
+    switch (ref.loc) {
+    case LOC_REG: return static_cast<T>(regs_.get(ref.reg));
+    case LOC_MEM: return memRead<T>(ref.addr);
+    case LOC_IMM: return static_cast<T>(ref.value);
+    default: throw CpuError("Invalid read of operand " + to_string(idx + 1) + " @ " + instr_.addr.toString());
+    }
+}
+
+template<typename T> void Cpu_8086::store(const int idx, const T value) {
+    const OperandRef &ref = ops_[idx];
+    switch (ref.loc) {
+    case LOC_REG: 
+        if (ref.reg == REG_CS) setCodeSegment(value);
+        else regs_.set(ref.reg, value);
+        break;
+    case LOC_MEM: memWrite<T>(ref.addr, value); break;
+    default: throw CpuError("Invalid write of operand " + to_string(idx + 1) + " @ " + instr_.addr.toString());
+    }
+}
+
+// a far pointer in memory, offset first
+Address Cpu_8086::loadFarPointer(const int idx) const {
+    const OperandRef &ref = ops_[idx];
+    if (ref.loc != LOC_MEM) throw CpuError("Far pointer operand not in memory @ " + instr_.addr.toString());
+    return { memRead<Word>(ref.addr + sizeof(Word)), memRead<Word>(ref.addr) };
+}
+
+void Cpu_8086::push(const Word value) {
+    const Word sp = regs_.get(REG_SP) - sizeof(Word);
+    regs_.set(REG_SP, sp);
+    memWrite<Word>(SEG_TO_OFFSET(regs_.get(REG_SS)) + sp, value);
+}
+
+Word Cpu_8086::pop() {
+    const Word sp = regs_.get(REG_SP);
+    regs_.set(REG_SP, sp + sizeof(Word));
+    return memRead<Word>(SEG_TO_OFFSET(regs_.get(REG_SS)) + sp);
+}
+
+// interrupts are serviced by the handler directly instead of going through the vector table
+void Cpu_8086::interrupt(const Byte num) {
+    updateFlags();
+    syncTime();
+    const IntStatus status = int_->interrupt(num, regs_);
+    if (status == INT_EXIT || status == INT_TERMINATE) done_ = true;
+}
+
+// the port of an IN or OUT instruction is either an immediate byte or in DX
+Word Cpu_8086::portNumber(const int idx) const {
+    return ops_[idx].loc == LOC_IMM ? ops_[idx].value & 0xff : regs_.get(REG_DX);
+}
+
+void Cpu_8086::syncTime() {
+    int_->elapse(executed_ - synced_);
+    synced_ = executed_;
+}
+
+// A polling loop which went around without changing the registers would keep doing the same until something outside
+// the CPU changes, so let the time run forward up to that point instead of spinning through it.
+void Cpu_8086::checkIdle(const CodeBlock &block) {
+    updateFlags();
+    if (block.begin != pollBegin_ || !(regs_ == pollRegs_)) {
+        pollBegin_ = block.begin;
+        pollEnd_ = block.end;
+        pollRegs_ = regs_;
+        return;
+    }
+    std::optional<Word> port;
+    for (const MicroOp &op : block.ops) {
+        if (op.instr.iclass != INS_IN) continue;
+        port = op.instr.op2.type == OPR_REG_DX ? regs_.get(REG_DX) : op.instr.op2.immval.u8;
+        break;
+    }
+    syncTime();
+    skipped_ += int_->skipIdle(port);
 }
 
 void Cpu_8086::init(const Address &codeAddr, const Address &stackAddr, const Size codeSize) {
@@ -147,14 +466,74 @@ void Cpu_8086::init(const Address &codeAddr, const Address &stackAddr, const Siz
     regs_.set(REG_IP, codeAddr.offset);
     regs_.set(REG_SS, stackAddr.segment);
     regs_.set(REG_SP, stackAddr.offset);
-    const Offset pspLinearAddr = SEG_TO_OFFSET(codeAddr.segment) - PSP_SIZE;
-    Address pspAddr(pspLinearAddr);
-    assert(pspAddr.offset == 0);
-    regs_.set(REG_DS, pspAddr.segment);
-    regs_.set(REG_ES, pspAddr.segment);
+    // the PSP immediately precedes the code segment
+    assert(codeAddr.segment >= BYTES_TO_PARA(PSP_SIZE));
+    const Word pspSegment = codeAddr.segment - BYTES_TO_PARA(PSP_SIZE);
+    regs_.set(REG_DS, pspSegment);
+    regs_.set(REG_ES, pspSegment);
+    flushBlocks();
     codeExtents_ = Block({codeAddr.segment, 0}, Address(SEG_TO_OFFSET(codeAddr.segment) + codeSize));
 }
 
+void Cpu_8086::setWatch(const Watchpoints *watch, WatchInterface *handler) {
+    watch_ = handler ? watch : nullptr;
+    watchHandler_ = handler;
+    watchHits_.clear();
+    breakAt_ = MEM_TOTAL;
+}
+
+// an instruction at a breakpoint is reported before it executes
+bool Cpu_8086::breakpoint(const Address &csip, const Offset linear) {
+    if (linear == breakAt_) {
+        breakAt_ = MEM_TOTAL;
+        return false;
+    }
+    updateFlags();
+    if (!watchHandler_->hit({WATCH_EXEC, csip, linear, instructionLength()}, regs_, *mem_)) return false;
+    breakAt_ = linear;
+    return true;
+}
+
+bool Cpu_8086::watchReport(const Address &csip) {
+    updateFlags();
+    bool stop = false;
+    for (WatchHit &hit : watchHits_) {
+        hit.csip = csip;
+        if (watchHandler_->hit(hit, regs_, *mem_)) stop = true;
+    }
+    watchHits_.clear();
+    return stop;
+}
+
+void Cpu_8086::setTrace(TraceInterface *trace) {
+    trace_ = trace;
+    writes_.clear();
+    mem_->logWrites(trace ? &writes_ : nullptr);
+}
+
+CpuSnapshot Cpu_8086::snapshot() {
+    updateFlags();
+    return { regs_, mem_->snapshot(), codeExtents_, executed_, skipped_, synced_, done_, pollBegin_, pollEnd_, pollRegs_ };
+}
+
+// the memory might be a fresh instance created from the same snapshot, or the one it was taken from,
+// in which case only the pages changed since are copied back and the blocks translated from them are dropped
+void Cpu_8086::restore(const CpuSnapshot &snap) {
+    mem_->restore(snap.memory);
+    regs_ = snap.regs;
+    setCodeSegment(regs_.get(REG_CS));
+    flagsLazy_ = 0;
+    codeExtents_ = snap.codeExtents;
+    executed_ = snap.executed;
+    skipped_ = snap.skipped;
+    synced_ = snap.synced;
+    pollBegin_ = snap.pollBegin;
+    pollEnd_ = snap.pollEnd;
+    pollRegs_ = snap.pollRegs;
+    breakAt_ = MEM_TOTAL;
+    done_ = snap.done;
+}
+
 void Cpu_8086::step() {
     step_ = true;
     pipeline();
@@ -165,8 +544,27 @@ void Cpu_8086::run() {
     pipeline();
 }
 
+void Cpu_8086::run(const Size count) {
+    if (count == 0) return;
+    step_ = false;
+    stopAt_ = executed_ + count;
+    try {
+        pipeline();
+    }
+    catch (...) {
+        stopAt_ = SIZE_MAX;
+        throw;
+    }
+    stopAt_ = SIZE_MAX;
+}
+
 string Cpu_8086::opcodeStr() const {
     string ret = regs_.csip().toString() + "  " + hexVal(opcode_) + "  ";
+    switch (chainPrefix_) {
+    case PRF_CHAIN_REPNZ: ret += "REPNZ "; break;
+    case PRF_CHAIN_REPZ: ret += "REPZ "; break;
+    default: break;
+    }
     switch(segOverride_) {
     case REG_ES: ret += "ES:"; break;
     case REG_CS: ret += "CS:"; break;
@@ -179,14 +577,60 @@ string Cpu_8086::opcodeStr() const {
 // main loop for evaluating and executing instructions
 void Cpu_8086::pipeline() {
     done_ = false;
-    while (!done_) {
-        opcode_ = ipByte();
-        preProcessOpcode();
-        // evaluate instruction, apply side efects
-        dispatch();
-        ipAdvance(WORD_SIGNED(instructionLength()));
-        if (step_) break;
+    stopped_ = false;
+    watchHits_.clear();
+    try {
+        while (!done_) {
+            // code might have been written from outside between runs
+            if (mem_->codeWritten()) invalidateCode();
+            const CodeBlock &block = fetchBlock();
+            const Word cs = block.segment;
+            if (block.poll) checkIdle(block);
+            // stepping through the loop goes through blocks starting inside of it
+            else if (block.begin < pollBegin_ || block.begin >= pollEnd_) pollBegin_ = pollEnd_ = 0;
+            for (const MicroOp &op : block.ops) {
+                loadMicroOp(op);
+                bindOperands();
+                // like on the real thing, ip points past the current instruction during its execution,
+                // relative branches are taken from there and others overwrite it
+                const Word ip = regs_.get(REG_IP), next = ip + instructionLength();
+                const Offset linear = SEG_TO_OFFSET(cs) + ip;
+                if (watch_ && watch_->test(WATCH_EXEC, linear) && breakpoint(Address{cs, ip}, linear)) {
+                    stopped_ = true;
+                    break;
+                }
+                if (profile_) profile_->hit(linear, static_cast<Byte>(next - ip));
+                regs_.set(REG_IP, next);
+                // evaluate instruction, apply side efects
+                if (dispatch_ == DISPATCH_TABLE) (this->*op.handler)();
+                else dispatch();
+                executed_++;
+                if (executed_ - synced_ >= SYNC_INSTRUCTIONS) syncTime();
+                if (profile_ && conditionalBranch(instr_.iclass)) profile_->branch(linear, regs_.get(REG_IP) != next);
+                else if (profile_ && indirectBranch(opcode_, instr_.iclass))
+                    profile_->indirect(Address{cs, ip}, Address{regs_.get(REG_CS), regs_.get(REG_IP)}, instr_.isCall(), instr_.iclass == INS_CALL || instr_.iclass == INS_JMP);
+                if (trace_) {
+                    updateFlags();
+                    trace_->record(Address{cs, ip}, regs_, writes_, *mem_);
+                    writes_.clear();
+                }
+                if (!watchHits_.empty() && watchReport(Address{cs, ip})) stopped_ = true;
+                // the instruction wrote into translated code, which might include the rest of this block
+                if (mem_->codeWritten()) {
+                    invalidateCode();
+                    break;
+                }
+                if (done_ || step_ || stopped_ || executed_ == stopAt_ || regs_.get(REG_IP) != next || regs_.get(REG_CS) != cs) break;
+            }
+            if (step_ || stopped_ || executed_ == stopAt_) break;
+        }
     }
+    catch (...) {
+        updateFlags();
+        throw;
+    }
+    // leave the flags register up to date for whoever inspects the state after execution stops
+    updateFlags();
 }
 
 void Cpu_8086::dispatch() {
@@ -208,6 +652,8 @@ void Cpu_8086::dispatch() {
     case INS_INC: instr_inc(); break;
     case INS_DEC: instr_dec(); break;
     case INS_JMP: instr_jmp(); break; // all unconditional jumps:
+    case INS_JMP_IF: instr_jmp(); break;
+    case INS_JMP_FAR: instr_jmp(); break;
     case INS_TEST: instr_test(); break;
     case INS_XCHG: instr_xchg(); break;
     case INS_MOV: instr_mov(); break;
@@ -216,6 +662,7 @@ void Cpu_8086::dispatch() {
     case INS_CBW: instr_cbw(); break;
     case INS_CWD: instr_cwd(); break;
     case INS_CALL: instr_call(); break;
+    case INS_CALL_FAR: instr_call(); break;
     case INS_WAIT: instr_wait(); break;
     case INS_PUSHF: instr_pushf(); break;
     case INS_POPF: instr_popf(); break;
@@ -236,6 +683,7 @@ void Cpu_8086::dispatch() {
     case INS_LDS: instr_lds(); break;
     case INS_RETF: instr_retf(); break;
     case INS_INT: instr_int(); break;
+    case INS_INT3: instr_int(); break;
     case INS_INTO: instr_int(); break;
     case INS_IRET: instr_iret(); break;
     case INS_AAM: instr_aam(); break;
@@ -342,377 +790,746 @@ void Cpu_8086::groupDispatch() {
     }
 }
 
+void Cpu_8086::groupClassDispatch() {
+    (this->*CLASS_HANDLER[instr_.iclass])();
+}
+
 void Cpu_8086::unknown(const string &stage) const {
     string msg = "Unknown opcode during "s + stage + " stage @ "s + regs_.csip().toString() + ": " + hexVal(opcode_);
     if (opcodeIsModrm(opcode_)) msg += ", modrm = " + hexVal(modrm_);
     throw CpuError(msg);
 }
 
-void Cpu_8086::updateFlags() {
-    static const Byte NIBBLE_CARRY = 0x10;
-    static const Byte BYTE_SIGN = 0x80;
-    static const Word WORD_SIGN = 0x8000;
-    // parity flag values for all possible 8-bit results, used as a lookup table
-    // to avoid counting 1 bits after an arithmetic instruction 
-    // (8086 only checks the lower 8 bits, even for 16bit results)
-    static const Word parity_lookup[256] = {
-    1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1,
-    0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0,
-    0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0,
-    1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1,
-    0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0,
-    1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1,
-    1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1,
-    0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0,
-    0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0,
-    1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1,
-    1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1,
-    0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0,
-    1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1,
-    0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0,
-    0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0,
-    1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1
-    };    
-    // update carry and overflow
-    switch (opcode_) {
-    case OP_ADD_AL_Ib: 
-        // byte add
-        regs_.setFlag(FLAG_CARRY, byteResult_ < byteOperand1_);
-        regs_.setFlag(FLAG_OVER, ((byteOperand1_ ^ byteOperand2_ ^ BYTE_SIGN) & (byteResult_ ^ byteOperand2_)) & BYTE_SIGN);
-        break;
-    case OP_SUB_Eb_Gb:
-    case OP_SUB_Gb_Eb:
-    case OP_SUB_AL_Ib:
-    case OP_CMP_Eb_Gb:
-    case OP_CMP_Gb_Eb:
-    case OP_CMP_AL_Ib:
-        // byte sub
-        regs_.setFlag(FLAG_CARRY, byteOperand1_ < byteOperand2_);
-        regs_.setFlag(FLAG_OVER, ((byteOperand1_ ^ byteOperand2_) & (byteOperand1_ ^ byteResult_)) & BYTE_SIGN);
-        break;
-    case OP_SUB_Ev_Gv:
-    case OP_SUB_Gv_Ev:
-    case OP_SUB_AX_Iv:
-    case OP_CMP_Ev_Gv:
-    case OP_CMP_Gv_Ev:
-    case OP_CMP_AX_Iv:    
-        // word sub
-        regs_.setFlag(FLAG_CARRY, wordOperand1_ < wordOperand2_);
-        regs_.setFlag(FLAG_OVER, ((wordOperand1_ ^ wordOperand2_) & (wordOperand1_ ^ wordResult_)) & WORD_SIGN);
-        break;
-    default:
-        throw CpuError("Unexpected opcode in flag update stage 1: "s + hexVal(opcode_));
-    }
-    // update remaining arithmetic flags, these are simpler
-    switch (opcode_)
-    {
-    case OP_ADD_AL_Ib: 
-    case OP_SUB_Eb_Gb:
-    case OP_SUB_Gb_Eb:
-    case OP_SUB_AL_Ib:
-    case OP_CMP_Eb_Gb:
-    case OP_CMP_Gb_Eb:    
-    case OP_CMP_AL_Ib:
-        // byte result
-        regs_.setFlag(FLAG_ZERO, byteResult_ == 0);
-        regs_.setFlag(FLAG_SIGN, byteResult_ & BYTE_SIGN);
-        regs_.setFlag(FLAG_AUXC, ((byteOperand1_ ^ byteOperand2_) ^ byteResult_) & NIBBLE_CARRY);
-        regs_.setFlag(FLAG_PARITY, parity_lookup[byteResult_]);
-        break;
-    case OP_SUB_Ev_Gv:
-    case OP_SUB_Gv_Ev:
-    case OP_SUB_AX_Iv:        
-    case OP_CMP_Ev_Gv:
-    case OP_CMP_Gv_Ev:
-    case OP_CMP_AX_Iv:
-        // word result
-        regs_.setFlag(FLAG_ZERO, wordResult_ == 0);
-        regs_.setFlag(FLAG_SIGN, wordResult_ & WORD_SIGN);
-        regs_.setFlag(FLAG_AUXC, ((wordOperand1_ ^ wordOperand2_) ^ wordResult_) & NIBBLE_CARRY);
-        regs_.setFlag(FLAG_PARITY, parity_lookup[wordResult_ & 0xff]);
-        break;
+// arithmetic flags which each kind of operation defines
+static constexpr Word
+    FLAGS_ARITH = FLAG_CARRY | FLAG_PARITY | FLAG_AUXC | FLAG_ZERO | FLAG_SIGN | FLAG_OVER,
+    FLAGS_INCDEC = FLAGS_ARITH & ~FLAG_CARRY;
+
+// compute a single flag from the operands and result of the last arithmetic or logic operation
+bool Cpu_8086::lazyFlag(const Flag flag) const {
+    static const Word NIBBLE_CARRY = 0x10;
+    const Word sign = flagWide_ ? 0x8000 : 0x80;
+    const Word op1 = flagOperand1_, op2 = flagOperand2_, res = flagResult_;
+    switch (flag) {
+    case FLAG_ZERO:   return res == 0;
+    case FLAG_SIGN:   return res & sign;
+    case FLAG_PARITY: return PARITY[res & 0xff];
+    case FLAG_AUXC:   return flagOp_ != FLAGOP_LOGIC && ((op1 ^ op2) ^ res) & NIBBLE_CARRY;
+    case FLAG_CARRY:
+        switch (flagOp_) {
+        // with an incoming carry, a result equal to the 1st operand means the 2nd operand wrapped around
+        case FLAGOP_ADD: 
+        case FLAGOP_ADC: return res < op1 || (flagCarry_ && res == op1);
+        case FLAGOP_SUB: 
+        case FLAGOP_SBB: return op1 < op2 || (flagCarry_ && op1 == op2);
+        default:         return false; // logic, inc/dec do not define it
+        }
+    case FLAG_OVER:
+        switch (flagOp_) {
+        case FLAGOP_ADD: 
+        case FLAGOP_ADC: return ((op1 ^ op2 ^ sign) & (res ^ op2)) & sign;
+        case FLAGOP_SUB: 
+        case FLAGOP_SBB: return ((op1 ^ op2) & (op1 ^ res)) & sign;
+        case FLAGOP_INC: return res == sign;
+        case FLAGOP_DEC: return res == sign - 1;
+        default:         return false;
+        }
     default:
-        throw CpuError("Unexpected opcode in flag update stage 2: "s + hexVal(opcode_));
+        throw CpuError("Unexpected lazy flag: " + hexVal(static_cast<Word>(flag)));
+    }
+}
+
+// write the flags which are still pending from the recorded operation into the flags register
+void Cpu_8086::updateFlags() {
+    static constexpr Flag ARITH[] = { FLAG_CARRY, FLAG_PARITY, FLAG_AUXC, FLAG_ZERO, FLAG_SIGN, FLAG_OVER };
+    if (flagsLazy_ == 0) return;
+    for (const Flag f : ARITH) {
+        if (flagsLazy_ & f) regs_.setFlag(f, lazyFlag(f));
     }
+    flagsLazy_ = 0;
+}
+
+Word Cpu_8086::getFlags() {
+    updateFlags();
+    return regs_.get(REG_FLAGS);
+}
+
+void Cpu_8086::setFlags(const Word value) {
+    flagsLazy_ = 0;
+    regs_.set(REG_FLAGS, value);
+}
+
+// record the operation for computing the flags later, a flag it leaves alone which is still pending
+// from the previous operation has to be settled first
+template<typename T> void Cpu_8086::setFlagOperands(const FlagOp op, const T op1, const T op2, const T result, const bool carry) {
+    const Word defined = (op == FLAGOP_INC || op == FLAGOP_DEC) ? FLAGS_INCDEC : FLAGS_ARITH;
+    if (flagsLazy_ & ~defined) updateFlags();
+    flagOp_ = op;
+    flagWide_ = sizeof(T) == sizeof(Word);
+    flagCarry_ = carry;
+    flagOperand1_ = op1;
+    flagOperand2_ = op2;
+    flagResult_ = result;
+    flagsLazy_ = defined;
+}
+
+// only the flags which depend on the result alone, for the instructions which leave the others undefined or set them by other rules
+template<typename T> void Cpu_8086::setResultFlags(const T result) {
+    setFlag(FLAG_ZERO, result == 0);
+    setFlag(FLAG_SIGN, result >> (sizeof(T) * 8 - 1));
+    setFlag(FLAG_PARITY, PARITY[result & 0xff]);
+}
+
+// evaluate the condition of a conditional jump, the conditions of 70-7f come in pairs with the low bit negating the condition
+bool Cpu_8086::condition(const Byte opcode) const {
+    if (opcode == OP_JCXZ_Jb) return regs_.get(REG_CX) == 0;
+    bool ret;
+    switch ((opcode >> 1) & 0x7) {
+    case 0: ret = getFlag(FLAG_OVER); break;
+    case 1: ret = getFlag(FLAG_CARRY); break;
+    case 2: ret = getFlag(FLAG_ZERO); break;
+    case 3: ret = getFlag(FLAG_CARRY) || getFlag(FLAG_ZERO); break;
+    case 4: ret = getFlag(FLAG_SIGN); break;
+    case 5: ret = getFlag(FLAG_PARITY); break;
+    case 6: ret = getFlag(FLAG_SIGN) != getFlag(FLAG_OVER); break;
+    default: ret = (getFlag(FLAG_SIGN) != getFlag(FLAG_OVER)) || getFlag(FLAG_ZERO); break;
+    }
+    return (opcode & 1) ? !ret : ret;
+}
+
+template<typename T> T Cpu_8086::memRead(const Offset offset) const {
+    T ret;
+    if constexpr (sizeof(T) == sizeof(Byte)) ret = mem_->readByte(offset);
+    else ret = mem_->readWord(offset);
+    watchAccess(WATCH_READ, offset, sizeof(T));
+    return ret;
+}
+
+template<typename T> void Cpu_8086::memWrite(const Offset offset, const T value) {
+    if constexpr (sizeof(T) == sizeof(Byte)) mem_->writeByte(offset, value);
+    else mem_->writeWord(offset, value);
+    watchAccess(WATCH_WRITE, offset, sizeof(T));
+}
+
+// add/adc/sub/sbb/cmp, the result goes into the 1st operand unless only the flags are needed
+template<typename T> void Cpu_8086::arith(const FlagOp op, const bool writeback) {
+    const T op1 = load<T>(0), op2 = load<T>(1);
+    const bool carry = (op == FLAGOP_ADC || op == FLAGOP_SBB) && getFlag(FLAG_CARRY);
+    const T result = (op == FLAGOP_ADD || op == FLAGOP_ADC) ? op1 + op2 + carry : op1 - op2 - carry;
+    setFlagOperands<T>(op, op1, op2, result, carry);
+    if (writeback) store<T>(0, result);
+}
+
+template<typename T> void Cpu_8086::logic(const InstructionClass iclass) {
+    const T op1 = load<T>(0), op2 = load<T>(1);
+    T result;
+    switch (iclass) {
+    case INS_OR:  result = op1 | op2; break;
+    case INS_XOR: result = op1 ^ op2; break;
+    default:      result = op1 & op2; break; // and, test
+    }
+    setFlagOperands<T>(FLAGOP_LOGIC, op1, op2, result);
+    if (iclass != INS_TEST) store<T>(0, result);
+}
+
+template<typename T> void Cpu_8086::incdec(const bool inc) {
+    const T value = load<T>(0);
+    const T result = inc ? value + 1 : value - 1;
+    setFlagOperands<T>(inc ? FLAGOP_INC : FLAGOP_DEC, value, T(1), result);
+    store<T>(0, result);
+}
+
+// shifts and rotates go one bit at a time like on the 8086, which does not mask the count;
+// the overflow flag is only defined for a count of 1 but is set from the last step regardless
+template<typename T> void Cpu_8086::shift(const InstructionClass iclass) {
+    static constexpr T SIGN = T(1) << (sizeof(T) * 8 - 1);
+    const Byte count = load<Byte>(1);
+    if (count == 0) return;
+    T value = load<T>(0);
+    bool carry = getFlag(FLAG_CARRY);
+    for (Byte i = 0; i < count; ++i) {
+        const bool high = value & SIGN, low = value & 1;
+        switch (iclass) {
+        case INS_ROL: value = static_cast<T>(value << 1) | high; carry = high; break;
+        case INS_ROR: value = static_cast<T>(value >> 1) | (low ? SIGN : 0); carry = low; break;
+        case INS_RCL: value = static_cast<T>(value << 1) | carry; carry = high; break;
+        case INS_RCR: value = static_cast<T>(value >> 1) | (carry ? SIGN : 0); carry = low; break;
+        case INS_SHL: value = static_cast<T>(value << 1); carry = high; break;
+        case INS_SHR: value = static_cast<T>(value >> 1); carry = low; break;
+        default:      value = static_cast<T>(value >> 1) | (value & SIGN); carry = low; break; // sar
+        }
+    }
+    const bool left = iclass == INS_ROL || iclass == INS_RCL || iclass == INS_SHL;
+    setFlag(FLAG_CARRY, carry);
+    if (left) setFlag(FLAG_OVER, static_cast<bool>(value & SIGN) != carry);
+    else setFlag(FLAG_OVER, static_cast<bool>(value & SIGN) != static_cast<bool>(value & (SIGN >> 1)));
+    if (iclass == INS_SHL || iclass == INS_SHR || iclass == INS_SAR) setResultFlags<T>(value);
+    store<T>(0, value);
+}
+
+// al * r/m8 -> ax, ax * r/m16 -> dx:ax; carry and overflow signal that the upper half of the result is significant
+template<typename T> void Cpu_8086::multiply(const bool sign) {
+    const T src = load<T>(0);
+    bool upper;
+    if constexpr (sizeof(T) == sizeof(Byte)) {
+        const Byte acc = regs_.get(REG_AL);
+        Word result;
+        if (sign) {
+            const SWord sres = static_cast<SByte>(acc) * static_cast<SByte>(src);
+            result = sres;
+            upper = sres != static_cast<SByte>(sres);
+        }
+        else {
+            result = acc * src;
+            upper = result > 0xff;
+        }
+        regs_.set(REG_AX, result);
+    }
+    else {
+        const Word acc = regs_.get(REG_AX);
+        DWord result;
+        if (sign) {
+            const int32_t sres = static_cast<int32_t>(static_cast<SWord>(acc)) * static_cast<SWord>(src);
+            result = sres;
+            upper = sres != static_cast<SWord>(sres);
+        }
+        else {
+            result = static_cast<DWord>(acc) * src;
+            upper = result > 0xffff;
+        }
+        regs_.set(REG_AX, result & 0xffff);
+        regs_.set(REG_DX, result >> 16);
+    }
+    setFlag(FLAG_CARRY, upper);
+    setFlag(FLAG_OVER, upper);
+}
+
+// ax / r/m8 -> al rem ah, dx:ax / r/m16 -> ax rem dx; a zero divisor or a quotient too big for the destination raises int 0,
+// the 8086 also faults on the most negative quotient for signed division
+template<typename T> void Cpu_8086::divide(const bool sign) {
+    static constexpr int BITS = sizeof(T) * 8;
+    static constexpr int64_t UMAX = (int64_t(1) << BITS) - 1, SMAX = (int64_t(1) << (BITS - 1)) - 1;
+    const T divisor = load<T>(0);
+    if (divisor == 0) return interrupt(0);
+    int64_t dividend, quotient, remainder;
+    if constexpr (sizeof(T) == sizeof(Byte)) dividend = sign ? static_cast<SWord>(regs_.get(REG_AX)) : regs_.get(REG_AX);
+    else {
+        const DWord dxax = static_cast<DWord>(regs_.get(REG_DX)) << 16 | regs_.get(REG_AX);
+        dividend = sign ? static_cast<int32_t>(dxax) : dxax;
+    }
+    const int64_t div = sign ? static_cast<int64_t>(static_cast<make_signed_t<T>>(divisor)) : divisor;
+    quotient = dividend / div;
+    remainder = dividend % div;
+    if ((sign && (quotient > SMAX || quotient < -SMAX)) || (!sign && quotient > UMAX)) return interrupt(0);
+    if constexpr (sizeof(T) == sizeof(Byte)) {
+        regs_.set(REG_AL, static_cast<Byte>(quotient));
+        regs_.set(REG_AH, static_cast<Byte>(remainder));
+    }
+    else {
+        regs_.set(REG_AX, static_cast<Word>(quotient));
+        regs_.set(REG_DX, static_cast<Word>(remainder));
+    }
+}
+
+// Check whether a string of count elements starting at the offset within a segment occupies a contiguous area of memory,
+// i.e. the offset does not wrap around the segment boundary along the way. If so, return the linear address of the lowest element.
+static bool stringBlock(const Offset segBase, const Word offset, const Word count, const Size elemSize, const bool backward, Offset &lowest) {
+    const Size span = (count - 1) * elemSize;
+    if (backward) {
+        if (span > offset) return false;
+        lowest = segBase + offset - span;
+    }
+    else {
+        if (offset + span + elemSize > OFFSET_MAX + 1) return false;
+        lowest = segBase + offset;
+    }
+    return lowest + span + elemSize <= MEM_TOTAL;
 }
 
 void Cpu_8086::instr_mov() {
+    if (wide_) store<Word>(0, load<Word>(1));
+    else store<Byte>(0, load<Byte>(1));
 }
 
 void Cpu_8086::instr_int() {
-    Byte num;
-    switch (opcode_) {
-    case OP_INT_3:
-        int_->interrupt(3, regs_);
-        break;
-    case OP_INT_Ib:
-        num = ipByte(1);
-        int_->interrupt(num, regs_);
-        break;
-    case OP_INTO:
-        if (regs_.getFlag(FLAG_OVER)) int_->interrupt(4, regs_);
-        break;    
+    switch (instr_.iclass) {
+    case INS_INT3: interrupt(3); break;
+    case INS_INT:  interrupt(instr_.op1.immval.u8); break;
+    case INS_INTO: if (getFlag(FLAG_OVER)) interrupt(4); break;    
     default: 
         throw CpuError("Unexpected opcode for INT: " + hexVal(opcode_));        
     }
 }
 
-// TODO: do we need to do signed arithmetic?
 void Cpu_8086::instr_cmp() {
-    updateFlags();
+    SIZED(arith, FLAGOP_SUB, false);
 }
 
 void Cpu_8086::instr_sub() {
-    // reuse CMP implementation for data load, result calculation and flag update
+    SIZED(arith, FLAGOP_SUB, true);
 }
 
 void Cpu_8086::instr_add() {
-    throw CpuError("Opcode not implemented: ADD");
+    SIZED(arith, FLAGOP_ADD, true);
 }
 
 void Cpu_8086::instr_or() {
-    throw CpuError("Opcode not implemented: OR");
+    SIZED(logic, INS_OR);
 }
 
 void Cpu_8086::instr_adc() {
-    throw CpuError("Opcode not implemented: ADC");
+    SIZED(arith, FLAGOP_ADC, true);
 }
 
 void Cpu_8086::instr_sbb() {
-    throw CpuError("Opcode not implemented: SBB");
+    SIZED(arith, FLAGOP_SBB, true);
 }
 
 void Cpu_8086::instr_and() {
-    throw CpuError("Opcode not implemented: AND");
+    SIZED(logic, INS_AND);
 }
 
 void Cpu_8086::instr_xor() {
-    throw CpuError("Opcode not implemented: XOR");
+    SIZED(logic, INS_XOR);
 }
 
 void Cpu_8086::instr_rol() {
-    throw CpuError("Opcode not implemented: ROL");
+    SIZED(shift, INS_ROL);
 }
 void Cpu_8086::instr_ror() {
-    throw CpuError("Opcode not implemented: ROR");
+    SIZED(shift, INS_ROR);
 }
 void Cpu_8086::instr_rcl() {
-    throw CpuError("Opcode not implemented: RCL");
+    SIZED(shift, INS_RCL);
 }
 void Cpu_8086::instr_rcr() {
-    throw CpuError("Opcode not implemented: RCR");
+    SIZED(shift, INS_RCR);
 }
 void Cpu_8086::instr_shl() {
-    throw CpuError("Opcode not implemented: SHL");
+    SIZED(shift, INS_SHL);
 }
 void Cpu_8086::instr_shr() {
-    throw CpuError("Opcode not implemented: SHR");
+    SIZED(shift, INS_SHR);
 }
 void Cpu_8086::instr_sar() {
-    throw CpuError("Opcode not implemented: SAR");
+    SIZED(shift, INS_SAR);
 }
 
 void Cpu_8086::instr_test() {
-    throw CpuError("Opcode not implemented: TEST");
+    SIZED(logic, INS_TEST);
 }
 
 void Cpu_8086::instr_not() {
-    throw CpuError("Opcode not implemented: NOT");
+    if (wide_) store<Word>(0, ~load<Word>(0));
+    else store<Byte>(0, ~load<Byte>(0));
 }
 
 void Cpu_8086::instr_neg() {
-    throw CpuError("Opcode not implemented: NEG");
+    // flags as if subtracted from zero
+    if (wide_) {
+        const Word value = load<Word>(0), result = -value;
+        setFlagOperands<Word>(FLAGOP_SUB, 0, value, result);
+        store<Word>(0, result);
+    }
+    else {
+        const Byte value = load<Byte>(0), result = -value;
+        setFlagOperands<Byte>(FLAGOP_SUB, 0, value, result);
+        store<Byte>(0, result);
+    }
 }
 
 void Cpu_8086::instr_mul() {
-    throw CpuError("Opcode not implemented: MUL");
+    SIZED(multiply, false);
 }
 
 void Cpu_8086::instr_imul() {
-    throw CpuError("Opcode not implemented: IMUL");
+    SIZED(multiply, true);
 }
 
 void Cpu_8086::instr_div() {
-    throw CpuError("Opcode not implemented: DIV");
+    SIZED(divide, false);
 }
 
 void Cpu_8086::instr_idiv()  {
-    throw CpuError("Opcode not implemented: IDIV");
+    SIZED(divide, true);
 }
 
 void Cpu_8086::instr_inc() {
-    throw CpuError("Opcode not implemented: INC");
+    SIZED(incdec, true);
 }
 
 void Cpu_8086::instr_dec() {
-    throw CpuError("Opcode not implemented: DEC");
+    SIZED(incdec, false);
 }
 
 void Cpu_8086::instr_call() {
-    throw CpuError("Opcode not implemented: CALL");
+    if (instr_.iclass == INS_CALL_FAR) {
+        const Address target = ops_[0].loc == LOC_IMM ? instr_.op1.farAddr() : loadFarPointer(0);
+        push(regs_.get(REG_CS));
+        push(regs_.get(REG_IP));
+        ipJump(target);
+    }
+    else if (ops_[0].loc == LOC_IMM) {
+        push(regs_.get(REG_IP));
+        ipAdvance(instr_.relativeOffset());
+    }
+    else {
+        const Word target = load<Word>(0);
+        push(regs_.get(REG_IP));
+        regs_.set(REG_IP, target);
+    }
 }
 
 void Cpu_8086::instr_jmp() {
-    byteOperand1_ = BYTE_SIGNED(ipByte(1));
-    bool jump = false;
-    switch (opcode_) {
-    case OP_JO_Jb : jump = regs_.getFlag(FLAG_OVER); break;
-    case OP_JNO_Jb: jump = !regs_.getFlag(FLAG_OVER); break;
-    case OP_JB_Jb : jump = regs_.getFlag(FLAG_CARRY); break;
-    case OP_JNB_Jb: jump = !regs_.getFlag(FLAG_CARRY); break;
-    case OP_JZ_Jb : jump = regs_.getFlag(FLAG_ZERO); break;
-    case OP_JNZ_Jb: jump = !regs_.getFlag(FLAG_ZERO); break;
-    case OP_JBE_Jb: jump = regs_.getFlag(FLAG_CARRY) || regs_.getFlag(FLAG_ZERO); break;
-    case OP_JA_Jb : jump = !(regs_.getFlag(FLAG_CARRY) || regs_.getFlag(FLAG_ZERO)); break;
-    case OP_JS_Jb : jump = regs_.getFlag(FLAG_SIGN); break;
-    case OP_JNS_Jb: jump = !regs_.getFlag(FLAG_SIGN); break;
-    case OP_JPE_Jb: jump = regs_.getFlag(FLAG_PARITY); break;
-    case OP_JPO_Jb: jump = !regs_.getFlag(FLAG_PARITY); break;
-    case OP_JL_Jb : jump = (regs_.getFlag(FLAG_SIGN) != regs_.getFlag(FLAG_OVER)); break;
-    case OP_JGE_Jb: jump = (regs_.getFlag(FLAG_SIGN) == regs_.getFlag(FLAG_OVER)); break;
-    case OP_JLE_Jb: jump = (regs_.getFlag(FLAG_SIGN) != regs_.getFlag(FLAG_OVER)) || regs_.getFlag(FLAG_ZERO); break;
-    case OP_JG_Jb : jump = (regs_.getFlag(FLAG_SIGN) == regs_.getFlag(FLAG_OVER)) && !regs_.getFlag(FLAG_ZERO); break;
-    default: 
-        throw CpuError("Unexpected opcode for short JMP: " + hexVal(opcode_));    
+    switch (instr_.iclass) {
+    case INS_JMP_IF:
+        if (condition(opcode_)) ipAdvance(instr_.relativeOffset());
+        break;
+    case INS_JMP_FAR:
+        ipJump(ops_[0].loc == LOC_IMM ? instr_.op1.farAddr() : loadFarPointer(0));
+        break;
+    default:
+        if (ops_[0].loc == LOC_IMM) ipAdvance(instr_.relativeOffset());
+        else regs_.set(REG_IP, load<Word>(0));
+        break;
     }
-    if (jump) ipAdvance(BYTE_SIGNED(byteOperand1_));
 }
 
 void Cpu_8086::instr_push() {
-    throw CpuError("Opcode not implemented: PUSH");
+    // the 8086 pushes the value of sp after the decrement
+    if (ops_[0].loc == LOC_REG && ops_[0].reg == REG_SP) push(regs_.get(REG_SP) - sizeof(Word));
+    else push(load<Word>(0));
 }
 
 void Cpu_8086::instr_pop() {
-    throw CpuError("Opcode not implemented: POP");
+    store<Word>(0, pop());
 }
 
 void Cpu_8086::instr_daa() {
-    throw CpuError("Opcode not implemented: DAA");
+    Byte al = regs_.get(REG_AL);
+    const Byte orig = al;
+    const bool carry = getFlag(FLAG_CARRY), auxc = (al & 0xf) > 9 || getFlag(FLAG_AUXC);
+    if (auxc) al += 0x6;
+    const bool adjust = orig > 0x99 || carry;
+    if (adjust) al += 0x60;
+    regs_.set(REG_AL, al);
+    setFlag(FLAG_AUXC, auxc);
+    setFlag(FLAG_CARRY, adjust);
+    setResultFlags<Byte>(al);
 }
 
 void Cpu_8086::instr_das() {
-    throw CpuError("Opcode not implemented: DAS");
+    Byte al = regs_.get(REG_AL);
+    const Byte orig = al;
+    const bool carry = getFlag(FLAG_CARRY), auxc = (al & 0xf) > 9 || getFlag(FLAG_AUXC);
+    if (auxc) al -= 0x6;
+    const bool adjust = orig > 0x99 || carry;
+    if (adjust) al -= 0x60;
+    regs_.set(REG_AL, al);
+    setFlag(FLAG_AUXC, auxc);
+    setFlag(FLAG_CARRY, adjust);
+    setResultFlags<Byte>(al);
 }
 
+// on the 8086 the adjustment of al does not carry into ah, unlike on later processors
 void Cpu_8086::instr_aaa() {
-    throw CpuError("Opcode not implemented: AAA");
+    const bool adjust = (regs_.get(REG_AL) & 0xf) > 9 || getFlag(FLAG_AUXC);
+    if (adjust) {
+        regs_.set(REG_AL, regs_.get(REG_AL) + 0x6);
+        regs_.set(REG_AH, regs_.get(REG_AH) + 1);
+    }
+    regs_.set(REG_AL, regs_.get(REG_AL) & 0xf);
+    setFlag(FLAG_AUXC, adjust);
+    setFlag(FLAG_CARRY, adjust);
 }
 
 void Cpu_8086::instr_aas() {
-    throw CpuError("Opcode not implemented: AAS");
+    const bool adjust = (regs_.get(REG_AL) & 0xf) > 9 || getFlag(FLAG_AUXC);
+    if (adjust) {
+        regs_.set(REG_AL, regs_.get(REG_AL) - 0x6);
+        regs_.set(REG_AH, regs_.get(REG_AH) - 1);
+    }
+    regs_.set(REG_AL, regs_.get(REG_AL) & 0xf);
+    setFlag(FLAG_AUXC, adjust);
+    setFlag(FLAG_CARRY, adjust);
 }
 
 void Cpu_8086::instr_xchg() {
-    throw CpuError("Opcode not implemented: AAS");
+    if (wide_) {
+        const Word op1 = load<Word>(0), op2 = load<Word>(1);
+        store<Word>(0, op2);
+        store<Word>(1, op1);
+    }
+    else {
+        const Byte op1 = load<Byte>(0), op2 = load<Byte>(1);
+        store<Byte>(0, op2);
+        store<Byte>(1, op1);
+    }
 }
 
 void Cpu_8086::instr_lea() {
-    throw CpuError("Opcode not implemented: AAS");
+    if (ops_[1].loc != LOC_MEM) throw CpuError("Invalid LEA source operand @ " + instr_.addr.toString());
+    store<Word>(0, ops_[1].offset);
 }
 
 void Cpu_8086::instr_nop() {
-    throw CpuError("Opcode not implemented: NOP");
 }
 
 void Cpu_8086::instr_cbw() {
-    throw CpuError("Opcode not implemented: CBW");
+    regs_.set(REG_AX, static_cast<Word>(BYTE_SIGNED(regs_.get(REG_AL))));
 }
 
 void Cpu_8086::instr_cwd() {
-    throw CpuError("Opcode not implemented: CWD");
+    regs_.set(REG_DX, (regs_.get(REG_AX) & 0x8000) ? 0xffff : 0);
 }
 
 void Cpu_8086::instr_wait() {
-    throw CpuError("Opcode not implemented: WAIT");
 }
 
 void Cpu_8086::instr_pushf() {
-    throw CpuError("Opcode not implemented: PUSHF");
+    push(getFlags());
 }
 
 void Cpu_8086::instr_popf() {
-    throw CpuError("Opcode not implemented: POPF");
+    setFlags(pop() | FLAGS_RESERVED);
 }
 
 void Cpu_8086::instr_sahf() {
-    throw CpuError("Opcode not implemented: SAHF");
+    static constexpr Word SAHF_MASK = FLAG_SIGN | FLAG_ZERO | FLAG_AUXC | FLAG_PARITY | FLAG_CARRY;
+    setFlags((getFlags() & ~SAHF_MASK) | (regs_.get(REG_AH) & SAHF_MASK));
 }
 
 void Cpu_8086::instr_lahf() {
-    throw CpuError("Opcode not implemented: LAHF");
+    regs_.set(REG_AH, getFlags() & 0xff);
+}
+
+// number of elements a string instruction processes, a chain prefix takes it from CX
+Word Cpu_8086::stringCount() const {
+    return chainPrefix_ == PRF_NONE ? 1 : regs_.get(REG_CX);
+}
+
+// move the string index registers past the processed elements in the direction set by the flag, and consume the count
+void Cpu_8086::stringAdvance(const Word count, const Size elemSize, const bool src, const bool dst) {
+    const Word delta = count * elemSize;
+    const bool backward = getFlag(FLAG_DIR);
+    if (src) regs_.set(REG_SI, backward ? regs_.get(REG_SI) - delta : regs_.get(REG_SI) + delta);
+    if (dst) regs_.set(REG_DI, backward ? regs_.get(REG_DI) - delta : regs_.get(REG_DI) + delta);
+    if (chainPrefix_ != PRF_NONE) regs_.set(REG_CX, regs_.get(REG_CX) - count);
+}
+
+// ds:si -> es:di, a repeated move of a contiguous string goes through a single memory copy
+template<typename T> void Cpu_8086::stringMove() {
+    const Word count = stringCount();
+    if (count == 0) return;
+    const bool backward = getFlag(FLAG_DIR);
+    const Word si = regs_.get(REG_SI), di = regs_.get(REG_DI);
+    const Offset srcBase = SEG_TO_OFFSET(regs_.get(defaultSeg(REG_SI))), dstBase = SEG_TO_OFFSET(regs_.get(REG_ES));
+    const Size total = count * sizeof(T);
+    Offset src, dst;
+    if (count > 1 && stringBlock(srcBase, si, count, sizeof(T), backward, src) && stringBlock(dstBase, di, count, sizeof(T), backward, dst)) {
+        // a destination overlapping the source ahead of it in the direction of the move picks up the elements
+        // written by the earlier iterations, which is a common way of filling memory and needs to be done one by one
+        const bool overlap = backward ? (dst < src && src - dst < total) : (dst > src && dst - src < total);
+        if (!overlap) {
+            mem_->copyBuf(dst, src, total);
+            watchAccess(WATCH_READ, src, total);
+            watchAccess(WATCH_WRITE, dst, total);
+            stringAdvance(count, sizeof(T), true, true);
+            return;
+        }
+    }
+    const SWord step = backward ? -static_cast<SWord>(sizeof(T)) : sizeof(T);
+    for (Word i = 0, s = si, d = di; i < count; ++i, s += step, d += step) {
+        memWrite<T>(dstBase + d, memRead<T>(srcBase + s));
+    }
+    stringAdvance(count, sizeof(T), true, true);
+}
+
+// al/ax -> es:di, a repeated store of a contiguous string becomes a memory fill
+template<typename T> void Cpu_8086::stringStore() {
+    const Word count = stringCount();
+    if (count == 0) return;
+    const bool backward = getFlag(FLAG_DIR);
+    const Word di = regs_.get(REG_DI);
+    const Offset dstBase = SEG_TO_OFFSET(regs_.get(REG_ES));
+    Offset dst;
+    if (stringBlock(dstBase, di, count, sizeof(T), backward, dst)) {
+        if constexpr (sizeof(T) == sizeof(Byte)) mem_->fillBytes(dst, regs_.get(REG_AL), count);
+        else mem_->fillWords(dst, regs_.get(REG_AX), count);
+        watchAccess(WATCH_WRITE, dst, count * sizeof(T));
+    }
+    else {
+        const T value = static_cast<T>(regs_.get(sizeof(T) == sizeof(Byte) ? REG_AL : REG_AX));
+        const SWord step = backward ? -static_cast<SWord>(sizeof(T)) : sizeof(T);
+        for (Word i = 0, d = di; i < count; ++i, d += step) memWrite<T>(dstBase + d, value);
+    }
+    stringAdvance(count, sizeof(T), false, true);
+}
+
+// ds:si -> al/ax, only the last element of a repeated load survives so it is the only one read
+template<typename T> void Cpu_8086::stringLoad() {
+    const Word count = stringCount();
+    if (count == 0) return;
+    const Word last = (count - 1) * sizeof(T);
+    const Word si = regs_.get(REG_SI);
+    const Word offset = getFlag(FLAG_DIR) ? si - last : si + last;
+    const T value = memRead<T>(SEG_TO_OFFSET(regs_.get(defaultSeg(REG_SI))) + offset);
+    regs_.set(sizeof(T) == sizeof(Byte) ? REG_AL : REG_AX, value);
+    stringAdvance(count, sizeof(T), true, false);
+}
+
+// compare ds:si (or al/ax for a scan) with es:di, under a chain prefix until the count runs out or the equality
+// condition of the prefix no longer holds; the flags reflect the last comparison made
+template<typename T> void Cpu_8086::stringCompare(const bool scan) {
+    const Word count = stringCount();
+    if (count == 0) return;
+    const bool backward = getFlag(FLAG_DIR);
+    const Word si = regs_.get(REG_SI), di = regs_.get(REG_DI);
+    const Offset srcBase = SEG_TO_OFFSET(regs_.get(defaultSeg(REG_SI))), dstBase = SEG_TO_OFFSET(regs_.get(REG_ES));
+    const T acc = static_cast<T>(regs_.get(sizeof(T) == sizeof(Byte) ? REG_AL : REG_AX));
+    const SWord step = backward ? -static_cast<SWord>(sizeof(T)) : sizeof(T);
+    Word done = 0;
+    Offset src, dst;
+    // the usual forward byte searches are done with the library routines straight over memory
+    if (sizeof(T) == sizeof(Byte) && count > 1 && !backward && stringBlock(dstBase, di, count, 1, false, dst)) {
+        const Byte *dstPtr = memBase_ + dst;
+        if (scan && chainPrefix_ == PRF_CHAIN_REPNZ) {
+            const void *hit = memchr(dstPtr, acc, count);
+            done = hit ? static_cast<const Byte*>(hit) - dstPtr + 1 : count;
+        }
+        else if (!scan && chainPrefix_ == PRF_CHAIN_REPZ && stringBlock(srcBase, si, count, 1, false, src)) {
+            const Byte *srcPtr = memBase_ + src;
+            done = mismatch(srcPtr, srcPtr + count, dstPtr).first - srcPtr;
+            if (done < count) done++;
+            watchAccess(WATCH_READ, src, done - 1);
+        }
+        // the last element is read again below
+        if (done > 1) watchAccess(WATCH_READ, dst, done - 1);
+    }
+    T op1, op2;
+    if (done != 0) {
+        const Word last = (done - 1) * sizeof(T);
+        op1 = scan ? acc : memRead<T>(srcBase + static_cast<Word>(si + last));
+        op2 = memRead<T>(dstBase + static_cast<Word>(di + last));
+    }
+    else for (Word s = si, d = di; done < count; s += step, d += step) {
+        op1 = scan ? acc : memRead<T>(srcBase + s);
+        op2 = memRead<T>(dstBase + d);
+        done++;
+        if ((chainPrefix_ == PRF_CHAIN_REPZ && op1 != op2) || (chainPrefix_ == PRF_CHAIN_REPNZ && op1 == op2)) break;
+    }
+    setFlagOperands<T>(FLAGOP_SUB, op1, op2, static_cast<T>(op1 - op2));
+    stringAdvance(done, sizeof(T), !scan, true);
 }
 
 void Cpu_8086::instr_movsb() {
-throw CpuError("Opcode not implemented: MOVSB");    
+    stringMove<Byte>();
 }
 void Cpu_8086::instr_movsw() {
-throw CpuError("Opcode not implemented: MOVSW");
+    stringMove<Word>();
 }
 void Cpu_8086::instr_cmpsb() {
-throw CpuError("Opcode not implemented: CMPSB");
+    stringCompare<Byte>(false);
 }
 void Cpu_8086::instr_cmpsw() {
-throw CpuError("Opcode not implemented: CMPSW");
+    stringCompare<Word>(false);
 }
 void Cpu_8086::instr_stosb() {
-throw CpuError("Opcode not implemented: STOSB");
+    stringStore<Byte>();
 }
 void Cpu_8086::instr_stosw() {
-throw CpuError("Opcode not implemented: STOSW");
+    stringStore<Word>();
 }
 void Cpu_8086::instr_lodsb() {
-throw CpuError("Opcode not implemented: LODSB");
+    stringLoad<Byte>();
 }
 void Cpu_8086::instr_lodsw() {
-throw CpuError("Opcode not implemented: LODSW");
+    stringLoad<Word>();
 }
 void Cpu_8086::instr_scasb() {
-throw CpuError("Opcode not implemented: SCASB");
+    stringCompare<Byte>(true);
 }
 void Cpu_8086::instr_scasw() {
-throw CpuError("Opcode not implemented: SCASW");
+    stringCompare<Word>(true);
 }
 void Cpu_8086::instr_ret() {
-throw CpuError("Opcode not implemented: RET");
+    regs_.set(REG_IP, pop());
+    // optional count of bytes to release from the stack
+    if (ops_[0].loc == LOC_IMM) regs_.set(REG_SP, regs_.get(REG_SP) + ops_[0].value);
 }
 void Cpu_8086::instr_les() {
-throw CpuError("Opcode not implemented: LES");
+    const Address ptr = loadFarPointer(1);
+    store<Word>(0, ptr.offset);
+    regs_.set(REG_ES, ptr.segment);
 }
 void Cpu_8086::instr_lds() {
-throw CpuError("Opcode not implemented: LDS");
+    const Address ptr = loadFarPointer(1);
+    store<Word>(0, ptr.offset);
+    regs_.set(REG_DS, ptr.segment);
 }
 void Cpu_8086::instr_retf() {
-throw CpuError("Opcode not implemented: RETF");
+    const Word offset = pop(), segment = pop();
+    if (ops_[0].loc == LOC_IMM) regs_.set(REG_SP, regs_.get(REG_SP) + ops_[0].value);
+    ipJump({ segment, offset });
 }
 void Cpu_8086::instr_iret() {
-throw CpuError("Opcode not implemented: IRET");    
+    const Word offset = pop(), segment = pop();
+    setFlags(pop() | FLAGS_RESERVED);
+    ipJump({ segment, offset });
 }
+// the base is the immediate byte, normally 10
 void Cpu_8086::instr_aam() {
-throw CpuError("Opcode not implemented: AAM");
+    const Byte base = instr_.op1.immval.u8, al = regs_.get(REG_AL);
+    if (base == 0) return interrupt(0);
+    regs_.set(REG_AH, al / base);
+    regs_.set(REG_AL, al % base);
+    setResultFlags<Byte>(al % base);
 }
 void Cpu_8086::instr_aad() {
-throw CpuError("Opcode not implemented: AAD");
+    const Byte base = instr_.op1.immval.u8;
+    const Byte al = regs_.get(REG_AL) + regs_.get(REG_AH) * base;
+    regs_.set(REG_AX, al);
+    setResultFlags<Byte>(al);
 }
 void Cpu_8086::instr_xlat() {
-throw CpuError("Opcode not implemented: XLAT");
+    const Register seg = segOverride_ != REG_NONE ? segOverride_ : REG_DS;
+    const Word offset = regs_.get(REG_BX) + regs_.get(REG_AL);
+    regs_.set(REG_AL, memRead<Byte>(SEG_TO_OFFSET(regs_.get(seg)) + offset));
 }
 void Cpu_8086::instr_loopnz() {
-throw CpuError("Opcode not implemented: LOOPNZ");
+    regs_.set(REG_CX, regs_.get(REG_CX) - 1);
+    if (regs_.get(REG_CX) != 0 && !getFlag(FLAG_ZERO)) ipAdvance(instr_.relativeOffset());
 }
 void Cpu_8086::instr_loopz() {
-throw CpuError("Opcode not implemented: LOOPZ");
+    regs_.set(REG_CX, regs_.get(REG_CX) - 1);
+    if (regs_.get(REG_CX) != 0 && getFlag(FLAG_ZERO)) ipAdvance(instr_.relativeOffset());
 }
 void Cpu_8086::instr_loop() {
-throw CpuError("Opcode not implemented: LOOP");
+    regs_.set(REG_CX, regs_.get(REG_CX) - 1);
+    if (regs_.get(REG_CX) != 0) ipAdvance(instr_.relativeOffset());
 }
+// a word goes through two consecutive byte ports
 void Cpu_8086::instr_in() {
-throw CpuError("Opcode not implemented: IN");
+    syncTime();
+    const Word port = portNumber(1);
+    if (opcode_ & 1) {
+        const Byte low = int_->portIn(port);
+        store<Word>(0, static_cast<Word>(int_->portIn(port + 1)) << 8 | low);
+    }
+    else store<Byte>(0, int_->portIn(port));
 }
 void Cpu_8086::instr_out() {
-throw CpuError("Opcode not implemented: OUT");
+    syncTime();
+    const Word port = portNumber(0);
+    if (opcode_ & 1) {
+        const Word value = load<Word>(1);
+        int_->portOut(port, value & 0xff);
+        int_->portOut(port + 1, value >> 8);
+    }
+    else int_->portOut(port, load<Byte>(1));
 }
+// no other processors to lock the bus against
 void Cpu_8086::instr_lock() {
-throw CpuError("Opcode not implemented: LOCK");
 }
 void Cpu_8086::instr_repnz() {
 throw CpuError("Opcode not implemented: REPNZ");
@@ -721,26 +1538,29 @@ void Cpu_8086::instr_repz() {
 throw CpuError("Opcode not implemented: REPZ");
 }
 void Cpu_8086::instr_hlt() {
-throw CpuError("Opcode not implemented: HLT");
+    done_ = true;
 }
 void Cpu_8086::instr_cmc() {
-throw CpuError("Opcode not implemented: CMC");
+    setFlag(FLAG_CARRY, !getFlag(FLAG_CARRY));
 }
 void Cpu_8086::instr_clc() {
-throw CpuError("Opcode not implemented: CLC");
+    setFlag(FLAG_CARRY, false);
 }
 void Cpu_8086::instr_stc() {
-throw CpuError("Opcode not implemented: STC");
+    setFlag(FLAG_CARRY, true);
 }
 void Cpu_8086::instr_cli() {
-throw CpuError("Opcode not implemented: CLI");
+    setFlag(FLAG_INT, false);
 }
 void Cpu_8086::instr_sti() {
-throw CpuError("Opcode not implemented: STI");
+    setFlag(FLAG_INT, true);
 }
 void Cpu_8086::instr_cld() {
-throw CpuError("Opcode not implemented: CLD");
+    setFlag(FLAG_DIR, false);
 }
 void Cpu_8086::instr_std() {
-throw CpuError("Opcode not implemented: STD");
+    setFlag(FLAG_DIR, true);
+}
+void Cpu_8086::instr_invalid() {
+    UNKNOWN_DISPATCH;
 }
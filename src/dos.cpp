@@ -2,6 +2,7 @@
 #include <iostream>
 #include <algorithm>
 #include <fstream>
+#include <filesystem>
 #include <cassert>
 
 #include "dos/dos.h"
@@ -13,29 +14,75 @@
 #include "dos/output.h"
 
 using namespace std;
+namespace fs = std::filesystem;
+
+static constexpr Byte
+    ATTR_DIRECTORY = 0x10,
+    ATTR_ARCHIVE = 0x20;
 
 void dosMessage(const string &msg) {
     output(msg, LOG_OS);
 }
 
-Dos::Dos(Memory *memory) : memory_(memory) {
+static string upperCase(string str) {
+    transform(str.begin(), str.end(), str.begin(), [](const unsigned char c) { return toupper(c); });
+    return str;
+}
+
+// components of a DOS path made absolute against the current directory, with the drive letter and any . or .. resolved
+static vector<string> dosComponents(const string &path, const string &cwd) {
+    string p = path;
+    if (p.size() >= 2 && p[1] == ':') p = p.substr(2);
+    vector<string> ret;
+    if (p.empty() || (p[0] != '\\' && p[0] != '/')) {
+        for (const string &c : splitString(cwd, '\\')) if (!c.empty()) ret.push_back(c);
+    }
+    replace(p.begin(), p.end(), '/', '\\');
+    for (const string &c : splitString(p, '\\')) {
+        if (c.empty() || c == ".") continue;
+        else if (c == "..") { if (!ret.empty()) ret.pop_back(); }
+        else ret.push_back(upperCase(c));
+    }
+    return ret;
 }
 
-LoadModule Dos::loadExe(MzImage &mz) {
+// match a name against a DOS wildcard pattern, the '*' matches the rest of the name or the extension
+static bool wildcardMatch(const string &name, const string &pattern) {
+    const auto split = [](const string &s) {
+        const auto dot = s.find('.');
+        return dot == string::npos ? pair{s, ""s} : pair{s.substr(0, dot), s.substr(dot + 1)};
+    };
+    const auto fieldMatch = [](const string &field, const string &pat) {
+        Size i = 0;
+        for (; i < pat.size(); ++i) {
+            if (pat[i] == '*') return true;
+            if (i >= field.size()) return pat[i] == '?';
+            if (pat[i] != '?' && pat[i] != field[i]) return false;
+        }
+        return i == field.size();
+    };
+    const auto [nameBase, nameExt] = split(upperCase(name));
+    const auto [patBase, patExt] = split(upperCase(pattern));
+    return fieldMatch(nameBase, patBase) && fieldMatch(nameExt, patExt);
+}
+
+Dos::Dos(Memory *memory, const std::string &hostDir) : memory_(memory), conIn_(&cin), conOut_(&cout), conErr_(&cerr), hostDir_(hostDir), pspSegment_(0), exitCode_(0), foundIdx_(0), foundAttr_(0) {
+    arenaStart_ = static_cast<Word>(BYTES_TO_PARA(memory_->freeStart()));
+    arenaEnd_ = static_cast<Word>(memory_->freeEnd() / PARAGRAPH_SIZE);
+}
+
+LoadModule Dos::loadExe(MzImage &mz, const std::string &cmdline) {
     const Address freeStart{memory_->freeStart()};
     const Size memSize = memory_->availableBytes(),
                memBlock = memory_->availableBlock();
-    Address pspAddr = freeStart;
-    // align PSP to paragraph boundary
-    if (pspAddr.offset != 0) {
-        pspAddr.segment += 1;
-        pspAddr.offset = 0;
-    }
+    // PSP goes at the first paragraph boundary of free memory, directly followed by the load module;
+    // the linear address converts to a zero segment, so the alignment is done on the paragraph number
+    const Address
+        pspAddr{static_cast<Word>(BYTES_TO_PARA(freeStart.toLinear())), 0},
+        loadAddr{static_cast<Word>(pspAddr.segment + BYTES_TO_PARA(PSP_SIZE)), 0};
     dosMessage("Free DOS memory: "s + to_string(memSize) + ", starts at address "s + freeStart.toString());
-    Address loadAddr(pspAddr.toLinear() + PSP_SIZE);
-    assert(loadAddr.offset == 0);
     dosMessage("Determined address of PSP: "s + pspAddr.toString() + ", load module: " + loadAddr.toString());
-    const Size 
+    const Size
         loadModuleOffset = mz.loadModuleOffset(),
         loadModuleSize = mz.loadModuleSize(),
         minSize = PSP_SIZE + loadModuleSize + mz.minAlloc(),
@@ -45,14 +92,25 @@ LoadModule Dos::loadExe(MzImage &mz) {
     dosMessage("Load module at file offset " + hexVal(loadModuleOffset) + " is "s + to_string(loadModuleSize) + " / " + hexVal(loadModuleSize) + " bytes");
     dosMessage("min alloc = " + to_string(minSize) + ", max = " + to_string(maxSize));
     if (minBlock > memBlock) throw DosError("Minimum alloc size of " + to_string(minSize) + " bytes exceeds available memory: " + to_string(memSize));
+    if (cmdline.size() > sizeof(ProgramSegmentPrefix::cmdline) - 2) throw DosError("Command line too long: " + cmdline);
     const Size allocBlock = min(memBlock, maxBlock);
     assert(allocBlock % PARAGRAPH_SIZE == 0);
     // allocate memory
     memory_->allocBlock(allocBlock);
     dosMessage("Allocated memory: "s + to_string(allocBlock) + " paragraphs, free mem at " + Address{memory_->freeStart()}.toString());
-    // blit psp data over to memory
-    // TODO: implement cmdline
+    pspSegment_ = pspAddr.segment;
+    blocks_[pspSegment_] = static_cast<Word>(allocBlock);
+    dta_ = Address{pspSegment_, 0x80};
+    // blit psp data over to memory, the command line tail starts with a space and ends with a carriage return
     ProgramSegmentPrefix psp;
+    psp.byte_past_segment = static_cast<Word>(pspSegment_ + allocBlock);
+    if (!cmdline.empty()) {
+        const string tail = " " + cmdline;
+        psp.cmdline_size = static_cast<Byte>(tail.size());
+        copy(tail.begin(), tail.end(), begin(psp.cmdline));
+        psp.cmdline[tail.size()] = '\r';
+    }
+    else psp.cmdline[0] = '\r';
     const Byte *pspData = reinterpret_cast<const Byte*>(&psp);
     memory_->writeBuf(pspAddr.toLinear(), pspData, PSP_SIZE);
     // read load module data from exe file into memory
@@ -69,7 +127,365 @@ LoadModule Dos::loadExe(MzImage &mz) {
     ret.code.segment += loadAddr.segment;
     ret.stack.segment += loadAddr.segment;
     ret.size = loadModuleSize;
+    ret.segment = loadAddr.segment;
     dosMessage("Code entrypoint at "s + codeAddress + " (relocated " + ret.code + ")\nStack at " + stackAddress + " (relocated " + ret.stack + ")");
     return ret;
 }
 
+Address Dos::getVector(const Byte num) const {
+    const Offset entry = num * 4;
+    return { memory_->readWord(entry + 2), memory_->readWord(entry) };
+}
+
+void Dos::setVector(const Byte num, const Address &addr) {
+    const Offset entry = num * 4;
+    memory_->writeWord(entry, addr.offset);
+    memory_->writeWord(entry + 2, addr.segment);
+}
+
+std::string Dos::readString(const Address &addr, const char term, const Size maxLen) const {
+    string ret;
+    Offset linear = addr.toLinear();
+    while (ret.size() < maxLen) {
+        const char c = static_cast<char>(memory_->readByte(linear++));
+        if (c == term) break;
+        ret += c;
+    }
+    return ret;
+}
+
+void Dos::writeString(const Address &addr, const std::string &str) {
+    memory_->writeBuf(addr.toLinear(), reinterpret_cast<const Byte*>(str.c_str()), str.size() + 1);
+}
+
+// find the host file corresponding to a DOS path, with the last component allowed to not exist yet unless mustExist,
+// empty if the path cannot be resolved
+std::string Dos::hostPath(const std::string &dosPath, const bool mustExist) const {
+    const vector<string> comps = dosComponents(dosPath, cwd_);
+    fs::path ret{hostDir_};
+    error_code ec;
+    for (Size i = 0; i < comps.size(); ++i) {
+        const bool last = i + 1 == comps.size();
+        string match;
+        for (const auto &entry : fs::directory_iterator(ret, ec)) {
+            if (upperCase(entry.path().filename().string()) == comps[i]) {
+                match = entry.path().filename().string();
+                break;
+            }
+        }
+        if (match.empty()) {
+            if (!last || mustExist) return {};
+            match = comps[i];
+        }
+        ret /= match;
+        if (!last && !fs::is_directory(ret, ec)) return {};
+    }
+    return ret.string();
+}
+
+Word Dos::newHandle() const {
+    for (Word h = HANDLE_STDPRN + 1; h < HANDLE_MAX; ++h) {
+        if (!files_.count(h)) return h;
+    }
+    return 0;
+}
+
+Word Dos::createFile(const std::string &path, Word &handle) {
+    const string host = hostPath(path, false);
+    if (host.empty()) return DOSERR_PATH_NOT_FOUND;
+    if (fs::is_directory(host)) return DOSERR_ACCESS_DENIED;
+    const Word h = newHandle();
+    if (h == 0) return DOSERR_TOO_MANY_FILES;
+    OpenFile &f = files_[h];
+    f.path = host;
+    f.mode = ios::in | ios::out | ios::binary;
+    f.stream.open(host, f.mode | ios::trunc);
+    if (!f.stream.is_open()) {
+        files_.erase(h);
+        return DOSERR_ACCESS_DENIED;
+    }
+    dosMessage("Created file " + path + " as " + host + ", handle " + to_string(h));
+    handle = h;
+    return DOSERR_NONE;
+}
+
+Word Dos::openFile(const std::string &path, const Byte mode, Word &handle) {
+    const string host = hostPath(path, true);
+    if (host.empty()) return DOSERR_FILE_NOT_FOUND;
+    if (fs::is_directory(host)) return DOSERR_ACCESS_DENIED;
+    ios::openmode omode = ios::binary;
+    switch (mode & 0x7) {
+    case 0: omode |= ios::in; break;
+    case 1: omode |= ios::out | ios::in; break;
+    case 2: omode |= ios::out | ios::in; break;
+    default: return DOSERR_INVALID_ACCESS;
+    }
+    const Word h = newHandle();
+    if (h == 0) return DOSERR_TOO_MANY_FILES;
+    OpenFile &f = files_[h];
+    f.path = host;
+    f.mode = omode;
+    f.stream.open(host, omode);
+    if (!f.stream.is_open()) {
+        files_.erase(h);
+        return DOSERR_ACCESS_DENIED;
+    }
+    dosMessage("Opened file " + path + " as " + host + ", handle " + to_string(h));
+    handle = h;
+    return DOSERR_NONE;
+}
+
+Word Dos::closeFile(const Word handle) {
+    if (handle <= HANDLE_STDPRN) return DOSERR_NONE;
+    if (files_.erase(handle) == 0) return DOSERR_INVALID_HANDLE;
+    return DOSERR_NONE;
+}
+
+DosSnapshot Dos::snapshot() {
+    DosSnapshot ret{ pspSegment_, dta_, exitCode_, cwd_, {}, blocks_, found_, foundIdx_, foundAttr_, -1 };
+    for (auto &[handle, f] : files_) ret.files[handle] = { f.path, f.mode, static_cast<streamoff>(f.stream.tellg()) };
+    ret.consolePos = conIn_->tellg();
+    conIn_->clear();
+    return ret;
+}
+
+// files which are no longer open the same way are closed, then the missing ones opened again and put back at their positions
+void Dos::restore(const DosSnapshot &snap) {
+    for (auto it = files_.begin(); it != files_.end();) {
+        auto sit = snap.files.find(it->first);
+        if (sit == snap.files.end() || sit->second.path != it->second.path) it = files_.erase(it);
+        else ++it;
+    }
+    for (const auto &[handle, sf] : snap.files) {
+        OpenFile &f = files_[handle];
+        if (!f.stream.is_open()) {
+            f.path = sf.path;
+            f.mode = sf.mode;
+            f.stream.open(sf.path, sf.mode);
+            if (!f.stream.is_open()) throw IoError("Unable to reopen " + sf.path + " for handle " + to_string(handle));
+        }
+        f.stream.clear();
+        if (sf.pos >= 0) f.stream.seekg(sf.pos);
+    }
+    pspSegment_ = snap.pspSegment;
+    dta_ = snap.dta;
+    exitCode_ = snap.exitCode;
+    cwd_ = snap.cwd;
+    blocks_ = snap.blocks;
+    found_ = snap.found;
+    foundIdx_ = snap.foundIdx;
+    foundAttr_ = snap.foundAttr;
+    if (snap.consolePos >= 0) {
+        conIn_->clear();
+        conIn_->seekg(snap.consolePos);
+    }
+}
+
+// console input is a line from the console input stream
+Word Dos::readFile(const Word handle, const Address &buf, const Word size, Word &count) {
+    string data;
+    if (handle == HANDLE_STDIN) {
+        string line;
+        if (getline(*conIn_, line)) data = line + "\r\n";
+        data = data.substr(0, size);
+    }
+    else if (handle <= HANDLE_STDPRN) data.clear();
+    else {
+        auto it = files_.find(handle);
+        if (it == files_.end()) return DOSERR_INVALID_HANDLE;
+        fstream &str = it->second.stream;
+        data.resize(size);
+        str.read(data.data(), size);
+        data.resize(str.gcount());
+        str.clear();
+    }
+    memory_->writeBuf(buf.toLinear(), reinterpret_cast<const Byte*>(data.data()), data.size());
+    count = static_cast<Word>(data.size());
+    return DOSERR_NONE;
+}
+
+// writing zero bytes truncates the file at the current position
+Word Dos::writeFile(const Word handle, const Address &buf, const Word size, Word &count) {
+    if (buf.toLinear() + size > memory_->size()) return DOSERR_ACCESS_DENIED;
+    const char *data = reinterpret_cast<const char*>(memory_->pointer(buf));
+    count = size;
+    switch (handle) {
+    case HANDLE_STDOUT: conOut_->write(data, size); return DOSERR_NONE;
+    case HANDLE_STDERR: conErr_->write(data, size); return DOSERR_NONE;
+    case HANDLE_STDIN:
+    case HANDLE_STDAUX:
+    case HANDLE_STDPRN: return DOSERR_NONE;
+    }
+    auto it = files_.find(handle);
+    if (it == files_.end()) return DOSERR_INVALID_HANDLE;
+    fstream &str = it->second.stream;
+    if (size == 0) {
+        str.flush();
+        error_code ec;
+        fs::resize_file(it->second.path, str.tellp(), ec);
+        return ec ? DOSERR_ACCESS_DENIED : DOSERR_NONE;
+    }
+    str.write(data, size);
+    if (!str) {
+        str.clear();
+        count = 0;
+        return DOSERR_ACCESS_DENIED;
+    }
+    return DOSERR_NONE;
+}
+
+Word Dos::seekFile(const Word handle, const Byte origin, const DWord offset, DWord &pos) {
+    if (handle <= HANDLE_STDPRN) {
+        pos = 0;
+        return DOSERR_NONE;
+    }
+    auto it = files_.find(handle);
+    if (it == files_.end()) return DOSERR_INVALID_HANDLE;
+    ios::seekdir dir;
+    switch (origin) {
+    case 0: dir = ios::beg; break;
+    case 1: dir = ios::cur; break;
+    case 2: dir = ios::end; break;
+    default: return DOSERR_FUNCTION;
+    }
+    fstream &str = it->second.stream;
+    str.clear();
+    str.seekg(static_cast<int32_t>(offset), dir);
+    const auto newPos = str.tellg();
+    str.seekp(newPos);
+    if (!str) {
+        str.clear();
+        return DOSERR_FUNCTION;
+    }
+    pos = static_cast<DWord>(newPos);
+    return DOSERR_NONE;
+}
+
+Word Dos::removeFile(const std::string &path) {
+    const string host = hostPath(path, true);
+    if (host.empty()) return DOSERR_FILE_NOT_FOUND;
+    error_code ec;
+    if (fs::is_directory(host) || !fs::remove(host, ec)) return DOSERR_ACCESS_DENIED;
+    dosMessage("Deleted file " + path + " as " + host);
+    return DOSERR_NONE;
+}
+
+Word Dos::fileAttributes(const std::string &path, Word &attr) {
+    const string host = hostPath(path, true);
+    if (host.empty()) return DOSERR_FILE_NOT_FOUND;
+    attr = fs::is_directory(host) ? ATTR_DIRECTORY : ATTR_ARCHIVE;
+    return DOSERR_NONE;
+}
+
+// device information word: character device with console input and output for the standard handles, a file on drive C otherwise
+Word Dos::deviceInfo(const Word handle, Word &info) const {
+    if (handle <= HANDLE_STDPRN) info = 0x80d3;
+    else if (files_.count(handle)) info = 0x0002;
+    else return DOSERR_INVALID_HANDLE;
+    return DOSERR_NONE;
+}
+
+// the search state is kept here instead of the reserved area of the DTA, so only one search can be in progress
+Word Dos::findFirst(const std::string &pattern, const Byte attr) {
+    found_.clear();
+    foundIdx_ = 0;
+    foundAttr_ = attr;
+    string dir = pattern, mask = pattern;
+    const auto sep = pattern.find_last_of("\\/:");
+    if (sep != string::npos) {
+        dir = pattern.substr(0, sep + 1);
+        mask = pattern.substr(sep + 1);
+    }
+    else dir.clear();
+    const string host = dir.empty() ? hostPath(".", true) : hostPath(dir, true);
+    if (host.empty()) return DOSERR_PATH_NOT_FOUND;
+    error_code ec;
+    for (const auto &entry : fs::directory_iterator(host, ec)) {
+        if (entry.is_directory() && !(attr & ATTR_DIRECTORY)) continue;
+        if (wildcardMatch(entry.path().filename().string(), mask)) found_.push_back(entry.path().string());
+    }
+    sort(found_.begin(), found_.end());
+    return findNext() == DOSERR_NONE ? DOSERR_NONE : DOSERR_FILE_NOT_FOUND;
+}
+
+Word Dos::findNext() {
+    if (foundIdx_ >= found_.size()) return DOSERR_NO_MORE_FILES;
+    foundEntry(found_[foundIdx_++]);
+    return DOSERR_NONE;
+}
+
+// fill in the result of a file search in the DTA
+void Dos::foundEntry(const std::string &path) {
+    const Offset dta = dta_.toLinear();
+    error_code ec;
+    const bool isDir = fs::is_directory(path, ec);
+    const DWord size = isDir ? 0 : static_cast<DWord>(fs::file_size(path, ec));
+    memory_->writeByte(dta + 0x15, isDir ? ATTR_DIRECTORY : ATTR_ARCHIVE);
+    memory_->writeWord(dta + 0x16, 0); // time
+    memory_->writeWord(dta + 0x18, 0); // date
+    memory_->writeWord(dta + 0x1a, size & 0xffff);
+    memory_->writeWord(dta + 0x1c, size >> 16);
+    writeString(Address{dta + 0x1e}, upperCase(fs::path(path).filename().string()).substr(0, 12));
+}
+
+Word Dos::changeDir(const std::string &path) {
+    const string host = hostPath(path, true);
+    if (host.empty() || !fs::is_directory(host)) return DOSERR_PATH_NOT_FOUND;
+    string dir;
+    for (const string &c : dosComponents(path, cwd_)) dir += (dir.empty() ? "" : "\\") + c;
+    cwd_ = dir;
+    return DOSERR_NONE;
+}
+
+// the first paragraph past the space available to the block, before the MCB of the next one or the end of memory
+Word Dos::blockLimit(const Word segment) const {
+    auto it = blocks_.upper_bound(segment);
+    return it == blocks_.end() ? arenaEnd_ : it->first - 1;
+}
+
+Word Dos::largestFree() const {
+    int largest = 0, cur = arenaStart_;
+    for (const auto &[seg, size] : blocks_) {
+        largest = max(largest, seg - 1 - cur - 1);
+        cur = seg + size;
+    }
+    largest = max(largest, arenaEnd_ - cur - 1);
+    return static_cast<Word>(max(largest, 0));
+}
+
+// first fit, the block goes right past its MCB paragraph in the first gap big enough
+Word Dos::allocMemory(const Word size, Word &segment, Word &largest) {
+    int cur = arenaStart_;
+    for (auto it = blocks_.begin();; ++it) {
+        const int limit = it == blocks_.end() ? arenaEnd_ : it->first - 1;
+        if (limit - cur - 1 >= size) {
+            segment = static_cast<Word>(cur + 1);
+            blocks_[segment] = size;
+            dosMessage("Allocated " + to_string(size) + " paragraphs at " + hexVal(segment));
+            return DOSERR_NONE;
+        }
+        if (it == blocks_.end()) break;
+        cur = it->first + it->second;
+    }
+    largest = largestFree();
+    return DOSERR_NO_MEMORY;
+}
+
+Word Dos::freeMemory(const Word segment) {
+    if (blocks_.erase(segment) == 0) return DOSERR_INVALID_BLOCK;
+    dosMessage("Freed memory block at " + hexVal(segment));
+    return DOSERR_NONE;
+}
+
+Word Dos::resizeMemory(const Word segment, const Word size, Word &largest) {
+    auto it = blocks_.find(segment);
+    if (it == blocks_.end()) return DOSERR_INVALID_BLOCK;
+    const Word limit = blockLimit(segment);
+    if (segment + size > limit) {
+        largest = limit - segment;
+        return DOSERR_NO_MEMORY;
+    }
+    it->second = size;
+    dosMessage("Resized memory block at " + hexVal(segment) + " to " + to_string(size) + " paragraphs");
+    return DOSERR_NONE;
+}
@@ -8,6 +8,8 @@
 #include "dos/output.h"
 #include "dos/util.h"
 #include "dos/error.h"
+#include "dos/sweep.h"
+#include "dos/superset.h"
 
 using namespace std;
 
@@ -132,7 +134,7 @@ bool Executable::storeSegment(const Segment &seg) {
     return true;
 }
 
-Address Executable::find(const ByteString &pattern, Block where) const {
+Address Executable::find(const BytePattern &pattern, Block where) const {
     if (!where.isValid()) where = { 
         Address{loadSegment, 0}, 
         Address{SEG_TO_OFFSET(loadSegment) + codeSize}
@@ -140,14 +142,33 @@ Address Executable::find(const ByteString &pattern, Block where) const {
     return code.find(pattern, where);
 }
 
+// decode the instruction at the specified address, each location within the load module is only decoded once and served from a cache afterwards
+PackedInstruction Executable::decoded(const Address &addr) const {
+    const Offset 
+        linear = addr.toLinear(),
+        base = SEG_TO_OFFSET(loadSegment);
+    if (linear < base || linear - base >= codeSize) return PackedInstruction{Instruction{addr, code.pointer(addr)}};
+    if (decodeCache.empty()) decodeCache.resize(codeSize);
+    PackedInstruction &cached = decodeCache[linear - base];
+    // invalid instructions throw and are not cached
+    if (!cached.isValid()) cached = PackedInstruction{Instruction{addr, code.pointer(addr)}};
+    return cached;
+}
+
+const SupersetIndex& Executable::superset() const {
+    if (!supersetIndex) supersetIndex = make_shared<const SupersetIndex>(*this);
+    return *supersetIndex;
+}
+
 vector<Signature> Executable::getSignatures(const Block &range) const {
     if (!range.isValid()) throw ArgError("Invalid block provided for signature extraction");
     if (!range.singleSegment()) throw LogicError("Block boundaries reside in different segments for signature extraction");
-    vector<Signature> ret;
-    Instruction i;
-    for (Address a = range.begin; a <= range.end; a += i.length) {
-        i = Instruction{a, code.pointer(a)};
-        ret.push_back(i.signature());
-    }
+    return InstructionSweep{*this, range}.signatures();
+}
+
+vector<Signature16> Executable::getSignatures16(const Block &range) const {
+    const vector<Signature> sigs = getSignatures(range);
+    vector<Signature16> ret(sigs.size());
+    transform(sigs.begin(), sigs.end(), ret.begin(), compactSignature);
     return ret;
 }
@@ -0,0 +1,188 @@
+#include "dos/harness.h"
+#include "dos/codemap.h"
+#include "dos/mz.h"
+#include "dos/error.h"
+#include "dos/util.h"
+#include "dos/output.h"
+
+#include <set>
+#include <sstream>
+#include <iostream>
+
+using namespace std;
+
+OUTPUT_CONF(LOG_CPU)
+
+// registers which the caller can observe after a call by the C calling convention
+static constexpr Register RESULT_REGS[] = { REG_AX, REG_DX, REG_SI, REG_DI, REG_BP, REG_DS };
+
+std::string HarnessInput::toString() const {
+    ostringstream str;
+    str << "args:";
+    if (args.empty()) str << " none";
+    for (const Word a : args) str << " " << hexVal(a);
+    str << ", ax = " << hexVal(ax) << ", bx = " << hexVal(bx) << ", cx = " << hexVal(cx) << ", dx = " << hexVal(dx) 
+        << ", si = " << hexVal(si) << ", di = " << hexVal(di);
+    return str.str();
+}
+
+static void compareWrites(const string &area, const map<Offset, Byte> &ref, const map<Offset, Byte> &tgt, vector<string> &diffs) {
+    if (ref == tgt) return;
+    set<Offset> addrs;
+    for (const auto &[addr, val] : ref) addrs.insert(addr);
+    for (const auto &[addr, val] : tgt) addrs.insert(addr);
+    const auto valStr = [](const map<Offset, Byte> &writes, const Offset addr) {
+        const auto it = writes.find(addr);
+        return it == writes.end() ? "(none)"s : hexVal(it->second);
+    };
+    Size count = 0;
+    string first;
+    for (const Offset addr : addrs) {
+        const string refVal = valStr(ref, addr), tgtVal = valStr(tgt, addr);
+        if (refVal == tgtVal) continue;
+        if (count++ == 0) first = area + "+" + hexVal(addr) + " = " + refVal + " vs " + tgtVal;
+    }
+    diffs.push_back(to_string(count) + " " + area + " bytes written differently, first at " + first);
+}
+
+std::string HarnessResult::compare(const HarnessResult &other) const {
+    const auto outcome = [](const HarnessResult &r) { return r.returned ? "returned"s : r.error; };
+    vector<string> diffs;
+    if (returned != other.returned || error != other.error) {
+        diffs.push_back(outcome(*this) + " vs " + outcome(other));
+    }
+    else if (returned) {
+        for (const Register r : RESULT_REGS) {
+            if (regs.get(r) != other.regs.get(r))
+                diffs.push_back(regName(r) + " = " + hexVal(regs.get(r)) + " vs " + hexVal(other.regs.get(r)));
+        }
+        if (stackDelta != other.stackDelta)
+            diffs.push_back("stack pointer moved by " + to_string(stackDelta) + " vs " + to_string(other.stackDelta));
+    }
+    compareWrites("data", dataWrites, other.dataWrites, diffs);
+    compareWrites("stack", stackWrites, other.stackWrites, diffs);
+    compareWrites("memory", otherWrites, other.otherWrites, diffs);
+    string ret;
+    for (const string &d : diffs) ret += (ret.empty() ? "" : ", ") + d;
+    return ret;
+}
+
+RoutineHarness::RoutineHarness(const std::string &exePath, const std::string &mapPath, const std::string &name, const Size warmup, const std::string &hostDir) : 
+    dos_(&mem_, hostDir), ints_(&dos_), cpu_(&mem_, &ints_, DISPATCH_TABLE), callerSp_(0), reached_(false)
+{
+    MzImage mz{exePath};
+    lm_ = dos_.loadExe(mz, "");
+    cpu_.init(lm_.code, lm_.stack, lm_.size);
+    const CodeMap map{mapPath, lm_.segment};
+    routine_ = map.getRoutine(name);
+    if (!routine_.isValid()) throw ArgError("Routine " + name + " not found in map " + mapPath);
+    const Address entry = routine_.entrypoint();
+    const CpuSnapshot loaded = cpu_.snapshot();
+    const DosSnapshot dosLoaded = dos_.snapshot();
+    const InterruptSnapshot intsLoaded = ints_.snapshot();
+    // run the program until it calls the routine for the first time, without a console to talk to on the way
+    NullBuffer discard;
+    ostream nullOut{&discard};
+    istream nullIn{&discard};
+    dos_.setConsole(nullIn, nullOut);
+    try {
+        for (Size i = 0; i < warmup && !cpu_.done(); ++i) {
+            if (cpu_.registers().csip() == entry) {
+                reached_ = true;
+                break;
+            }
+            cpu_.step();
+        }
+    }
+    catch (Error &e) {
+        debug("Program failed before reaching routine " + name + ": " + e.why());
+    }
+    dos_.setConsole(cin, cout, &cerr);
+    if (reached_) {
+        start_ = cpu_.snapshot();
+        dosStart_ = dos_.snapshot();
+        intsStart_ = ints_.snapshot();
+        // drop the return address, the arguments are pushed over the ones of the actual call
+        callerSp_ = start_.regs.get(REG_SP) + (routine_.near ? 2 : 4);
+        debug("Routine " + name + " reached after " + to_string(cpu_.executed()) + " instructions, caller stack at " + Address{start_.regs.get(REG_SS), callerSp_}.toString());
+    }
+    else {
+        debug("Routine " + name + " not reached by the program, starting calls right after loading");
+        cpu_.restore(loaded);
+        dos_.restore(dosLoaded);
+        ints_.restore(intsLoaded);
+        start_ = cpu_.snapshot();
+        dosStart_ = dos_.snapshot();
+        intsStart_ = ints_.snapshot();
+        const Segment dataSeg = map.defaultSegment();
+        if (dataSeg.type != Segment::SEG_NONE) start_.regs.set(REG_DS, dataSeg.address);
+        callerSp_ = start_.regs.get(REG_SP);
+    }
+}
+
+HarnessResult RoutineHarness::call(const HarnessInput &input, const Size limit) {
+    HarnessResult ret;
+    const Address entry = routine_.entrypoint(), sentinel{entry.segment, 0xffff};
+    const Word 
+        argsStart = callerSp_ - 2 * input.args.size(),
+        retSp = argsStart - (routine_.near ? 2 : 4);
+    CpuSnapshot trial = start_;
+    Registers &regs = trial.regs;
+    regs.set(REG_AX, input.ax);
+    regs.set(REG_BX, input.bx);
+    regs.set(REG_CX, input.cx);
+    regs.set(REG_DX, input.dx);
+    regs.set(REG_SI, input.si);
+    regs.set(REG_DI, input.di);
+    regs.set(REG_SP, retSp);
+    regs.set(REG_CS, entry.segment);
+    regs.set(REG_IP, entry.offset);
+    cpu_.restore(trial);
+    dos_.restore(dosStart_);
+    ints_.restore(intsStart_);
+    const Offset ssBase = SEG_TO_OFFSET(regs.get(REG_SS)), dsBase = SEG_TO_OFFSET(regs.get(REG_DS));
+    for (Size i = 0; i < input.args.size(); ++i) mem_.writeWord(ssBase + static_cast<Word>(argsStart + 2 * i), input.args[i]);
+    mem_.writeWord(ssBase + retSp, sentinel.offset);
+    if (!routine_.near) mem_.writeWord(ssBase + static_cast<Word>(retSp + 2), sentinel.segment);
+
+    writes_.clear();
+    mem_.logWrites(&writes_);
+    Word minSp = retSp;
+    try {
+        while (true) {
+            if (cpu_.registers().csip() == sentinel) {
+                ret.returned = true;
+                break;
+            }
+            if (ret.instructions == limit) {
+                ret.error = "no return after " + to_string(limit) + " instructions";
+                break;
+            }
+            cpu_.step();
+            ret.instructions++;
+            minSp = min(minSp, cpu_.registers().get(REG_SP));
+            if (cpu_.done()) {
+                ret.error = "program terminated";
+                break;
+            }
+        }
+    }
+    catch (Error &e) {
+        ret.error = e.why();
+    }
+    mem_.logWrites(nullptr);
+    ret.regs = cpu_.registers();
+    ret.stackDelta = static_cast<SWord>(ret.regs.get(REG_SP) - argsStart);
+    for (const MemoryWrite &w : writes_) {
+        for (Offset addr = w.addr; addr < w.addr + w.size; ++addr) {
+            const Byte val = mem_.readByte(addr);
+            if (addr >= ssBase + minSp && addr < ssBase + argsStart) continue; // locals and the return address
+            // the timer ticks along with the instructions executed, which differ between builds
+            else if (addr >= InterruptHandler::BDA_TICKS && addr < InterruptHandler::BDA_TICKS + sizeof(DWord)) continue;
+            else if (addr >= ssBase + argsStart && addr <= ssBase + OFFSET_MAX) ret.stackWrites[addr - ssBase - argsStart] = val;
+            else if (addr >= dsBase && addr <= dsBase + OFFSET_MAX) ret.dataWrites[addr - dsBase] = val;
+            else ret.otherWrites[addr] = val;
+        }
+    }
+    return ret;
+}
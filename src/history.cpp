@@ -0,0 +1,127 @@
+#include "dos/history.h"
+#include "dos/error.h"
+#include "dos/util.h"
+#include "dos/output.h"
+
+#include <algorithm>
+#include <ostream>
+
+using namespace std;
+
+OUTPUT_CONF(LOG_CPU)
+
+string LastWrite::toString() const {
+    return "Written at " + csip.toString() + " by instruction " + to_string(instruction) + ", " + to_string(size) + " bytes at " + Address{addr}.toString();
+}
+
+// takes the last of the writes it is told about, with the number of the instruction which did it
+class WriteRecorder : public WatchInterface {
+    const Cpu_8086 &cpu_;
+public:
+    optional<LastWrite> last;
+    WriteRecorder(const Cpu_8086 &cpu) : cpu_(cpu) {}
+    bool hit(const WatchHit &hit, const Registers &, const Memory &) override {
+        last = LastWrite{ cpu_.executed() - 1, hit.csip, hit.addr, hit.size };
+        return false;
+    }
+};
+
+ExecHistory::ExecHistory(Cpu_8086 &cpu, Dos &dos, InterruptHandler &ints, const Size interval, const Size capacity) :
+    cpu_(cpu), dos_(dos), ints_(ints), interval_(interval), capacity_(capacity), watch_(nullptr), watchHandler_(nullptr)
+{
+    if (interval_ == 0) throw ArgError("Checkpoint interval must not be zero");
+    if (capacity_ < 2) throw ArgError("History needs room for at least 2 checkpoints");
+    checkpoints_.push_back(checkpoint());
+}
+
+void ExecHistory::setWatch(const Watchpoints *watch, WatchInterface *handler) {
+    watch_ = watch;
+    watchHandler_ = handler;
+    cpu_.setWatch(watch, handler);
+}
+
+void ExecHistory::run(const Size limit) {
+    const Size now = cpu_.executed();
+    while (checkpoints_.size() > 1 && checkpoints_.back().cpu.executed > now) checkpoints_.pop_back();
+    const Size end = limit > SIZE_MAX - now ? SIZE_MAX : now + limit;
+    while (cpu_.executed() < end) {
+        const Size next = checkpoints_.back().cpu.executed + interval_;
+        cpu_.run(min(next, end) - cpu_.executed());
+        if (cpu_.done() || cpu_.stopped() || cpu_.executed() != next) break;
+        checkpoints_.push_back(checkpoint());
+        if (checkpoints_.size() <= capacity_) continue;
+        // thin out the history, keeping the start
+        Size kept = 1;
+        for (Size i = 2; i < checkpoints_.size(); i += 2) checkpoints_[kept++] = std::move(checkpoints_[i]);
+        checkpoints_.resize(kept);
+        interval_ *= 2;
+        debug("Checkpoint interval increased to " + to_string(interval_) + " instructions, " + to_string(kept) + " checkpoints kept");
+    }
+}
+
+void ExecHistory::stepBack(const Size count) {
+    const Size start = checkpoints_.front().cpu.executed, now = cpu_.executed();
+    const Size target = now - start > count ? now - count : start;
+    // last checkpoint at or before the target
+    const auto it = prev(upper_bound(checkpoints_.begin(), checkpoints_.end(), target, [](const Size val, const ExecCheckpoint &cp) {
+        return val < cp.cpu.executed;
+    }));
+    restore(*it);
+    replay(target - it->cpu.executed, nullptr, nullptr);
+    if (cpu_.executed() != target) throw CpuError("Replay from instruction " + to_string(it->cpu.executed) + " ended at " + to_string(cpu_.executed()) + " instead of " + to_string(target));
+}
+
+// Go through the intervals between the checkpoints from the most recent one, replaying each with a watchpoint on the byte
+// until one of them writes into it, then go back to where it started.
+optional<LastWrite> ExecHistory::lastWrite(const Offset addr) {
+    if (addr >= MEM_TOTAL) throw ArgError("Invalid address for the last write: " + hexVal(addr));
+    const ExecCheckpoint current = checkpoint();
+    const Size now = current.cpu.executed;
+    Watchpoints watch;
+    watch.add(WATCH_WRITE, Block{addr});
+    WriteRecorder recorder{cpu_};
+    try {
+        for (Size i = checkpoints_.size(); i-- > 0 && !recorder.last;) {
+            const ExecCheckpoint &cp = checkpoints_[i];
+            if (cp.cpu.executed >= now) continue;
+            const Size end = i + 1 < checkpoints_.size() ? min(checkpoints_[i + 1].cpu.executed, now) : now;
+            restore(cp);
+            replay(end - cp.cpu.executed, &watch, &recorder);
+        }
+    }
+    catch (...) {
+        restore(current);
+        throw;
+    }
+    restore(current);
+    return recorder.last;
+}
+
+ExecCheckpoint ExecHistory::checkpoint() {
+    return { cpu_.snapshot(), dos_.snapshot(), ints_.snapshot() };
+}
+
+void ExecHistory::restore(const ExecCheckpoint &cp) {
+    cpu_.restore(cp.cpu);
+    dos_.restore(cp.dos);
+    ints_.restore(cp.ints);
+}
+
+// run for a number of instructions with the console output discarded, it was already shown the first time around
+void ExecHistory::replay(const Size count, const Watchpoints *watch, WatchInterface *handler) {
+    NullBuffer discard;
+    ostream nullOut{&discard};
+    ostream &out = dos_.consoleOut(), &err = dos_.consoleErr();
+    dos_.setConsole(dos_.consoleIn(), nullOut);
+    cpu_.setWatch(watch, handler);
+    try {
+        cpu_.run(count);
+    }
+    catch (...) {
+        dos_.setConsole(dos_.consoleIn(), out, &err);
+        cpu_.setWatch(watch_, watchHandler_);
+        throw;
+    }
+    dos_.setConsole(dos_.consoleIn(), out, &err);
+    cpu_.setWatch(watch_, watchHandler_);
+}
@@ -6,6 +6,8 @@
 
 #include <sstream>
 #include <cstring>
+#include <array>
+#include <algorithm>
 
 using namespace std;
 
@@ -15,28 +17,19 @@ OUTPUT_CONF(LOG_CPU)
 static const char* INS_CLASS_ID[] = {
 INSTRUCTION_CLASS
 };
-static const char* INS_PRF_ID[] = {
-INSTRUCTION_PREFIX
-};
 static const char* OPR_TYPE_ID[] = {
 OPERAND_TYPE
 };
 static const char* OPR_SIZE_ID[] = {
 OPERAND_SIZE
 };
-static const char* GRP_IDX_ID[] = {
-INS_GROUP_IDX
-};
 static const char* INS_MATCH_ID[] = {
 INSTRUCTION_MATCH
 };
-static const char* MODRM_OPR_ID[] = {
-MODRM_OPERAND
-};
 #undef X
 
 // maps non-group opcodes to an instruction class
-static const InstructionClass OPCODE_CLASS[] = {
+static constexpr InstructionClass OPCODE_CLASS[] = {
 // 0           1           2           3           4           5           6           7           8           9           A             B           C           D           E           F
 INS_ADD,    INS_ADD,    INS_ADD,    INS_ADD,    INS_ADD,    INS_ADD,    INS_PUSH,   INS_POP,    INS_OR,     INS_OR,     INS_OR,       INS_OR,     INS_OR,     INS_OR,     INS_PUSH,   INS_ERR,    // 0
 INS_ADC,    INS_ADC,    INS_ADC,    INS_ADC,    INS_ADC,    INS_ADC,    INS_PUSH,   INS_POP,    INS_SBB,    INS_SBB,    INS_SBB,      INS_SBB,    INS_SBB,    INS_SBB,    INS_PUSH,   INS_POP,    // 1
@@ -57,7 +50,7 @@ INS_LOCK,   INS_ERR,    INS_REPNZ,  INS_REPZ,   INS_HLT,    INS_CMC,    INS_ERR,
 };
 
 // maps group opcodes to group indexes in the next table
-static const InstructionGroupIndex GRP_IDX[0x100] = {
+static constexpr InstructionGroupIndex GRP_IDX[0x100] = {
 //  0         1         2         3         4         5         6         7         8         9         A         B         C         D         E         F
 IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, // 0
 IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, // 1
@@ -78,7 +71,7 @@ IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_BAD, IGRP_3a,  IGRP_3b,
 };
 
 // maps a group index and the GRP value from a modrm byte to an instruction class for a group opcode
-static const InstructionClass GRP_INS_CLASS[6][8] = {
+static constexpr InstructionClass GRP_INS_CLASS[6][8] = {
     INS_ADD,  INS_OR,  INS_ADC,  INS_SBB,      INS_AND, INS_SUB,      INS_XOR,  INS_CMP,  // GRP1
     INS_ROL,  INS_ROR, INS_RCL,  INS_RCR,      INS_SHL, INS_SHR,      INS_ERR,  INS_SAR,  // GRP2
     INS_TEST, INS_ERR, INS_NOT,  INS_NEG,      INS_MUL, INS_IMUL,     INS_DIV,  INS_IDIV, // GRP3a
@@ -88,7 +81,7 @@ static const InstructionClass GRP_INS_CLASS[6][8] = {
 };
 
 // maps non-modrm opcodes into their first operand's type
-static const OperandType OP1_TYPE[] = {
+static constexpr OperandType OP1_TYPE[] = {
 //   0         1           2              3              4           5           6           7           8           9           A           B           C           D           E           F
 OPR_ERR,    OPR_ERR,    OPR_ERR,       OPR_ERR,       OPR_REG_AL, OPR_REG_AX, OPR_REG_ES, OPR_REG_ES, OPR_ERR,    OPR_ERR,    OPR_ERR,    OPR_ERR,    OPR_REG_AL, OPR_REG_AX, OPR_REG_CS, OPR_ERR,    // 0
 OPR_ERR,    OPR_ERR,    OPR_ERR,       OPR_ERR,       OPR_REG_AL, OPR_REG_AX, OPR_REG_SS, OPR_REG_SS, OPR_ERR,    OPR_ERR,    OPR_ERR,    OPR_ERR,    OPR_REG_AL, OPR_REG_AX, OPR_REG_DS, OPR_REG_DS, // 1
@@ -103,13 +96,13 @@ OPR_NONE,   OPR_REG_CX, OPR_REG_DX,    OPR_REG_BX,    OPR_REG_SP, OPR_REG_BP, OP
 OPR_REG_AL, OPR_REG_AX, OPR_MEM_OFF16, OPR_MEM_OFF16, OPR_NONE,   OPR_NONE,   OPR_NONE,   OPR_NONE,   OPR_REG_AL, OPR_REG_AX, OPR_NONE,   OPR_NONE,   OPR_NONE,   OPR_NONE,   OPR_NONE,   OPR_NONE,   // A
 OPR_REG_AL, OPR_REG_CL, OPR_REG_DL,    OPR_REG_BL,    OPR_REG_AH, OPR_REG_CH, OPR_REG_DH, OPR_REG_BH, OPR_REG_AX, OPR_REG_CX, OPR_REG_DX, OPR_REG_BX, OPR_REG_SP, OPR_REG_BP, OPR_REG_SI, OPR_REG_DI, // B
 OPR_ERR,    OPR_ERR,    OPR_IMM16,     OPR_NONE,      OPR_ERR,    OPR_ERR,    OPR_ERR,    OPR_ERR,    OPR_ERR,    OPR_ERR,    OPR_IMM16,  OPR_NONE,   OPR_NONE,   OPR_IMM8,   OPR_NONE,   OPR_NONE,   // C
-OPR_ERR,    OPR_ERR,    OPR_ERR,       OPR_ERR,       OPR_IMM0,   OPR_IMM0,   OPR_ERR,    OPR_NONE,   OPR_ERR,    OPR_ERR,    OPR_ERR,    OPR_ERR,    OPR_ERR,    OPR_ERR,    OPR_ERR,    OPR_ERR,    // D
+OPR_ERR,    OPR_ERR,    OPR_ERR,       OPR_ERR,       OPR_IMM8,   OPR_IMM8,   OPR_ERR,    OPR_NONE,   OPR_ERR,    OPR_ERR,    OPR_ERR,    OPR_ERR,    OPR_ERR,    OPR_ERR,    OPR_ERR,    OPR_ERR,    // D
 OPR_IMM8,   OPR_IMM8,   OPR_IMM8,      OPR_IMM8,      OPR_REG_AL, OPR_REG_AX, OPR_IMM8,   OPR_IMM8,   OPR_IMM16,  OPR_IMM16,  OPR_IMM32,  OPR_IMM8,   OPR_REG_AL, OPR_REG_AX, OPR_REG_DX, OPR_REG_DX, // E
 OPR_NONE,   OPR_NONE,   OPR_NONE,      OPR_NONE,      OPR_NONE,   OPR_NONE,   OPR_ERR,    OPR_ERR,    OPR_NONE,   OPR_NONE,   OPR_NONE,   OPR_NONE,   OPR_NONE,   OPR_NONE,   OPR_ERR,    OPR_ERR,    // F
 };
 
 // maps non-modrm opcodes into their second operand's type
-static const OperandType OP2_TYPE[] = {
+static constexpr OperandType OP2_TYPE[] = {
 //   0            1              2           3           4           5           6           7           8          9          A          B          C           D           E           F
 OPR_ERR,       OPR_ERR,       OPR_ERR,    OPR_ERR,    OPR_IMM8,   OPR_IMM16,  OPR_NONE,   OPR_NONE,   OPR_ERR,   OPR_ERR,   OPR_ERR,   OPR_ERR,   OPR_IMM8,   OPR_IMM16,  OPR_NONE,   OPR_ERR,    // 0
 OPR_ERR,       OPR_ERR,       OPR_ERR,    OPR_ERR,    OPR_IMM8,   OPR_IMM16,  OPR_NONE,   OPR_NONE,   OPR_ERR,   OPR_ERR,   OPR_ERR,   OPR_ERR,   OPR_IMM8,   OPR_IMM16,  OPR_NONE,   OPR_NONE,   // 1
@@ -130,7 +123,7 @@ OPR_NONE,      OPR_NONE,      OPR_NONE,   OPR_NONE,   OPR_NONE,   OPR_NONE,   OP
 };
 
 // map operand type to operand size
-static const OperandSize OPR_SIZE[] = {
+static constexpr OperandSize OPR_SIZE[] = {
     OPRSZ_UNK,  OPRSZ_NONE, // error, none
     OPRSZ_WORD, OPRSZ_BYTE, OPRSZ_BYTE, // ax, al, ah
     OPRSZ_WORD, OPRSZ_BYTE, OPRSZ_BYTE, // bx, bl, bh
@@ -150,7 +143,7 @@ static const OperandSize OPR_SIZE[] = {
 };
 
 // map modrm operand type to operand size
-static const OperandSize MODRM_OPR_SIZE[] = {
+static constexpr OperandSize MODRM_OPR_SIZE[] = {
     OPRSZ_NONE,  // MODRM_NONE
     OPRSZ_BYTE,  // MODRM_Eb
     OPRSZ_BYTE,  // MODRM_Gb
@@ -187,6 +180,11 @@ static const char* OPR_NAME[] = {
     "0", "1", "i8", "i16", "i32",
 };
 
+static const char* SOP_NAME[] = {
+    "X", "a", "b", "c", "d", "si", "di", "bp", "sp", "sreg", "r8h", "[bx]", "[bp]", "[si/di]", "[off]", "imm"
+};
+static_assert(ARRAY_SIZE(SOP_NAME) == SOP_IMM + 1);
+
 static const char* PRF_NAME[] = {
     "???", "es:", "cs:", "ss:", "ds:", "repnz", "repz"
 };
@@ -203,6 +201,10 @@ const char* operandName(const OperandType t) {
     return OPR_NAME[t];
 }
 
+const char* signatureOperandName(const SignatureOperand so) {
+    return SOP_NAME[so];
+}
+
 // convert an operand type with a memory offset or an immediate value to a word-sized equivalent, 
 // useful in fuzzy comparisons
 OperandType operandTypeToWord(const OperandType ot) {
@@ -262,6 +264,176 @@ Register defaultMemSegment(const OperandType ot) {
     return ret;
 }
 
+// lookup table for converting modrm mod and mem values into OperandType
+static constexpr OperandType MODRM_BYTE_MEM_OP[4][8] = {
+    OPR_MEM_BX_SI,       OPR_MEM_BX_DI,       OPR_MEM_BP_SI,       OPR_MEM_BP_DI,       OPR_MEM_SI,       OPR_MEM_DI,       OPR_MEM_OFF16,    OPR_MEM_BX,       // mod 00 (no displacement)
+    OPR_MEM_BX_SI_OFF8,  OPR_MEM_BX_DI_OFF8,  OPR_MEM_BP_SI_OFF8,  OPR_MEM_BP_DI_OFF8,  OPR_MEM_SI_OFF8,  OPR_MEM_DI_OFF8,  OPR_MEM_BP_OFF8,  OPR_MEM_BX_OFF8,  // mod 01 (8bit displacement)
+    OPR_MEM_BX_SI_OFF16, OPR_MEM_BX_DI_OFF16, OPR_MEM_BP_SI_OFF16, OPR_MEM_BP_DI_OFF16, OPR_MEM_SI_OFF16, OPR_MEM_DI_OFF16, OPR_MEM_BP_OFF16, OPR_MEM_BX_OFF16, // mod 10 (16bit displacement)
+    OPR_REG_AL,          OPR_REG_CL,          OPR_REG_DL,          OPR_REG_BL,          OPR_REG_AH,       OPR_REG_CH,       OPR_REG_DH,       OPR_REG_BH,       // mod 11 (register)
+};
+
+static constexpr OperandType MODRM_WORD_MEM_OP[4][8] = {
+    OPR_MEM_BX_SI,       OPR_MEM_BX_DI,       OPR_MEM_BP_SI,       OPR_MEM_BP_DI,       OPR_MEM_SI,       OPR_MEM_DI,       OPR_MEM_OFF16,    OPR_MEM_BX,       // mod 00 (no displacement)
+    OPR_MEM_BX_SI_OFF8,  OPR_MEM_BX_DI_OFF8,  OPR_MEM_BP_SI_OFF8,  OPR_MEM_BP_DI_OFF8,  OPR_MEM_SI_OFF8,  OPR_MEM_DI_OFF8,  OPR_MEM_BP_OFF8,  OPR_MEM_BX_OFF8,  // mod 01 (8bit displacement)
+    OPR_MEM_BX_SI_OFF16, OPR_MEM_BX_DI_OFF16, OPR_MEM_BP_SI_OFF16, OPR_MEM_BP_DI_OFF16, OPR_MEM_SI_OFF16, OPR_MEM_DI_OFF16, OPR_MEM_BP_OFF16, OPR_MEM_BX_OFF16, // mod 10 (16bit displacement)
+    OPR_REG_AX,          OPR_REG_CX,          OPR_REG_DX,          OPR_REG_BX,          OPR_REG_SP,       OPR_REG_BP,       OPR_REG_SI,       OPR_REG_DI,       // mod 11 (register)
+};
+
+static constexpr OperandType MODRM_MEM_OP[4][8] = {
+    OPR_MEM_BX_SI,       OPR_MEM_BX_DI,       OPR_MEM_BP_SI,       OPR_MEM_BP_DI,       OPR_MEM_SI,       OPR_MEM_DI,       OPR_MEM_OFF16,    OPR_MEM_BX,       // mod 00 (no displacement)
+    OPR_MEM_BX_SI_OFF8,  OPR_MEM_BX_DI_OFF8,  OPR_MEM_BP_SI_OFF8,  OPR_MEM_BP_DI_OFF8,  OPR_MEM_SI_OFF8,  OPR_MEM_DI_OFF8,  OPR_MEM_BP_OFF8,  OPR_MEM_BX_OFF8,  // mod 01 (8bit displacement)
+    OPR_MEM_BX_SI_OFF16, OPR_MEM_BX_DI_OFF16, OPR_MEM_BP_SI_OFF16, OPR_MEM_BP_DI_OFF16, OPR_MEM_SI_OFF16, OPR_MEM_DI_OFF16, OPR_MEM_BP_OFF16, OPR_MEM_BX_OFF16, // mod 10 (16bit displacement)
+    OPR_ERR,             OPR_ERR,             OPR_ERR,             OPR_ERR,             OPR_ERR,          OPR_ERR,          OPR_ERR,          OPR_ERR,          // mod 11 (register)
+};
+
+static constexpr OperandType MODRM_BYTE_REG_OP[8] = {
+    OPR_REG_AL, OPR_REG_CL, OPR_REG_DL, OPR_REG_BL, OPR_REG_AH, OPR_REG_CH, OPR_REG_DH, OPR_REG_BH,
+};
+
+static constexpr OperandType MODRM_WORD_REG_OP[8] = {
+    OPR_REG_AX, OPR_REG_CX, OPR_REG_DX, OPR_REG_BX, OPR_REG_SP, OPR_REG_BP, OPR_REG_SI, OPR_REG_DI,
+};
+
+static constexpr OperandType MODRM_SEGREG_OP[8] = {
+    OPR_REG_ES, OPR_REG_CS, OPR_REG_SS, OPR_REG_DS, OPR_ERR, OPR_ERR, OPR_ERR, OPR_ERR,
+};
+
+// The decoding of an instruction is driven by the descriptor tables below, which are generated at compile time from the tables above.
+// That way Instruction::load() only needs to walk the tables for the bytes it reads instead of consulting every table separately.
+
+// how the bytes following an opcode are interpreted
+enum DecodeKind : Byte {
+    DEC_PLAIN, // operands are implied by the opcode, optionally followed by immediates
+    DEC_MODRM, // followed by a modrm byte which determines the operands
+    DEC_GROUP, // followed by a modrm byte which determines the operands and the instruction class
+};
+
+struct OpcodeDesc {
+    DecodeKind kind;
+    InstructionPrefix prefix; // non-PRF_NONE for prefix opcodes
+    InstructionClass iclass;
+    InstructionGroupIndex group;
+    OperandType op1, op2; // plain opcodes only
+    OperandSize size1, size2; // plain opcodes only
+    ModrmOperand modop1, modop2;
+};
+
+// instruction class and operand overrides for a group opcode and the GRP value from its modrm byte
+struct GroupDesc {
+    InstructionClass iclass;
+    ModrmOperand modop1, modop2; // replaces the operand designation of the opcode if not MODRM_NONE
+};
+
+// size and implicit value of the immediate or displacement that follows the opcode/modrm for an operand type
+struct ImmediateDesc {
+    Byte length;
+    OperandSize size;
+    DWord value;
+};
+
+static constexpr array<OpcodeDesc, 0x100> opcodeDescTable() {
+    array<OpcodeDesc, 0x100> ret{};
+    for (int opcode = 0; opcode < 0x100; ++opcode) {
+        OpcodeDesc &d = ret[opcode];
+        d.prefix = opcodePrefix(opcode);
+        d.iclass = OPCODE_CLASS[opcode];
+        d.group = GRP_IDX[opcode];
+        d.modop1 = MODRM_OP1[opcode];
+        d.modop2 = MODRM_OP2[opcode];
+        if (d.group != IGRP_BAD) d.kind = DEC_GROUP;
+        else if (d.modop1 != MODRM_NONE) d.kind = DEC_MODRM;
+        else d.kind = DEC_PLAIN;
+        if (d.kind != DEC_PLAIN) {
+            d.op1 = d.op2 = OPR_NONE;
+            d.size1 = d.size2 = OPRSZ_NONE;
+            continue;
+        }
+        d.op1 = OP1_TYPE[opcode];
+        d.op2 = OP2_TYPE[opcode];
+        // TODO: do not derive size from operand type, but from opcode, same for modrm and group
+        d.size1 = OPR_SIZE[d.op1];
+        d.size2 = OPR_SIZE[d.op2];
+        // temporary stopgap, derive unknown 1st op's size from 2nd op if possible
+        if (d.size1 == OPRSZ_UNK && operandIsMem(d.op1) && operandIsImmediate(d.op2))
+            d.size1 = d.size2;
+    }
+    return ret;
+}
+
+static constexpr array<array<GroupDesc, 8>, IGRP_BAD> groupDescTable() {
+    array<array<GroupDesc, 8>, IGRP_BAD> ret{};
+    for (int grp = IGRP_1; grp < IGRP_BAD; ++grp) {
+        for (int idx = 0; idx < 8; ++idx) {
+            GroupDesc &d = ret[grp][idx];
+            d.iclass = GRP_INS_CLASS[grp][idx];
+            d.modop1 = d.modop2 = MODRM_NONE;
+            // special case for implicit 2nd operand for group 3a/3b TEST instruction
+            if (d.iclass == INS_TEST) d.modop2 = (grp == IGRP_3a ? MODRM_Ib : MODRM_Iv);
+            // another special case for operand override in group 5 far call and jmp instructions
+            else if (d.iclass == INS_CALL_FAR || d.iclass == INS_JMP_FAR) d.modop1 = MODRM_Mp;
+        }
+    }
+    return ret;
+}
+
+// convert from messy modrm operand designation to our nice type
+static constexpr OperandType modrmOperandType(const Byte modrm, const ModrmOperand op) {
+    const Byte 
+        modVal = modrm_mod(modrm) >> MODRM_MOD_SHIFT,
+        regVal = modrm_reg(modrm) >> MODRM_REG_SHIFT,
+        mem = modrm_mem(modrm);
+
+    switch (op) {
+    case MODRM_NONE: return OPR_NONE;
+    case MODRM_Eb:   return MODRM_BYTE_MEM_OP[modVal][mem];
+    case MODRM_Gb:   return MODRM_BYTE_REG_OP[regVal];
+    case MODRM_Ib:   return OPR_IMM8;
+    case MODRM_Ev:   return MODRM_WORD_MEM_OP[modVal][mem];
+    case MODRM_Gv:   return MODRM_WORD_REG_OP[regVal];
+    case MODRM_Iv:   return OPR_IMM16;
+    case MODRM_Sw:   return MODRM_SEGREG_OP[regVal];
+    case MODRM_M:  
+    case MODRM_Mp:   return MODRM_MEM_OP[modVal][mem];
+    case MODRM_1:    return OPR_IMM1;
+    case MODRM_CL:   return OPR_REG_CL;
+    default:         return OPR_ERR;
+    }
+}
+
+static constexpr array<array<OperandType, 0x100>, MODRM_CL + 1> modrmOperandTable() {
+    array<array<OperandType, 0x100>, MODRM_CL + 1> ret{};
+    for (int op = MODRM_NONE; op <= MODRM_CL; ++op)
+        for (int modrm = 0; modrm < 0x100; ++modrm)
+            ret[op][modrm] = modrmOperandType(modrm, static_cast<ModrmOperand>(op));
+    return ret;
+}
+
+static constexpr array<ImmediateDesc, OPR_IMM32 + 1> immediateDescTable() {
+    array<ImmediateDesc, OPR_IMM32 + 1> ret{};
+    for (int t = OPR_ERR; t <= OPR_IMM32; ++t) {
+        const OperandType type = static_cast<OperandType>(t);
+        ImmediateDesc &d = ret[type];
+        // register and memory operands with no displacement
+        d = { 0, OPRSZ_NONE, 0 };
+        if (operandIsMemWithByteOffset(type) || type == OPR_IMM8) d = { sizeof(Byte), OPRSZ_BYTE, 0 };
+        else if (operandIsMemWithWordOffset(type) || type == OPR_IMM16) d = { sizeof(Word), OPRSZ_WORD, 0 };
+        else if (type == OPR_IMM32) d = { sizeof(DWord), OPRSZ_DWORD, 0 };
+        else if (type == OPR_IMM1) d = { 0, OPRSZ_NONE, 1 };
+    }
+    return ret;
+}
+
+static constexpr auto OPCODE_DESC = opcodeDescTable();
+static constexpr auto GROUP_DESC = groupDescTable();
+static constexpr auto MODRM_OPERAND_TYPE = modrmOperandTable();
+static constexpr auto IMMEDIATE_DESC = immediateDescTable();
+
+static_assert(OPCODE_DESC[OP_PREFIX_SS].prefix == PRF_SEG_SS && OPCODE_DESC[OP_REPZ].prefix == PRF_CHAIN_REPZ);
+static_assert(OPCODE_DESC[OP_GRP1_Ev_Ib].kind == DEC_GROUP && OPCODE_DESC[OP_GRP5_Ev].kind == DEC_GROUP);
+static_assert(OPCODE_DESC[OP_LEA_Gv_M].kind == DEC_MODRM && OPCODE_DESC[OP_CALL_Ap].kind == DEC_PLAIN);
+static_assert(GROUP_DESC[IGRP_3b][0].modop2 == MODRM_Iv && GROUP_DESC[IGRP_5][3].modop1 == MODRM_Mp);
+static_assert(MODRM_OPERAND_TYPE[MODRM_Ev][0x46] == OPR_MEM_BP_OFF8 && MODRM_OPERAND_TYPE[MODRM_M][0xc0] == OPR_ERR);
+
 Instruction::Instruction() : addr{}, prefix(PRF_NONE), opcode(OP_INVALID), iclass(INS_ERR), length(0), data(nullptr) {
 }
 
@@ -269,118 +441,86 @@ Instruction::Instruction(const Address &addr, const Byte *data) : addr{addr}, pr
     load(data);
 }
 
+Instruction::Instruction(const Address &addr, const PackedInstruction &packed, const Byte *data) : 
+    addr{addr}, 
+    prefix(static_cast<InstructionPrefix>(packed.prefix)), 
+    opcode(packed.opcode), 
+    iclass(static_cast<InstructionClass>(packed.iclass)), 
+    length(packed.length),
+    data(data)
+{
+    op1.type = packed.type1;
+    op1.size = static_cast<OperandSize>(packed.sizes & 0xf);
+    op1.immsize = static_cast<OperandSize>(packed.immsizes & 0xf);
+    op1.immval.u32 = packed.imm1;
+    op2.type = packed.type2;
+    op2.size = static_cast<OperandSize>(packed.sizes >> 4);
+    op2.immsize = static_cast<OperandSize>(packed.immsizes >> 4);
+    op2.immval.u32 = packed.imm2;
+}
+
 void Instruction::load(const Byte *data)  {
     this->data = data;
     opcode = *data++;
     length++;
-    // in case of a chain opcode, use it to set an appropriate prefix value and replace the opcode with the subsequent instruction
+    const OpcodeDesc *desc = &OPCODE_DESC[opcode];
+    // in case of a chain or segment override prefix opcode, set an appropriate prefix value and replace the opcode with the subsequent instruction
     // TODO: support LOCK, other prefix-like opcodes?
-    if (opcode == OP_REPZ || opcode == OP_REPNZ) { 
-        prefix = static_cast<InstructionPrefix>(opcode - OP_REPNZ + PRF_CHAIN_REPNZ); // convert opcode to instruction prefix enum
+    if (desc->prefix != PRF_NONE) {
+        prefix = desc->prefix;
         // TODO: guard against memory overflow
         opcode = *data++;
         length++;
-        debug("Found chain prefix "s + INS_PRF_ID[prefix] + ", length = " + to_string(length));
-    }
-    // likewise in case of a segment ovverride prefix, set instruction prefix value and get next opcode
-    else if (opcodeIsSegmentPrefix(opcode)) {
-        prefix = static_cast<InstructionPrefix>(((opcode - OP_PREFIX_ES) / 8) + PRF_SEG_ES); // convert opcode to instruction prefix enum, the segment prefix opcode values differ by 8
-        opcode = *data++;
-        length++;
-        debug("Found segment prefix "s + INS_PRF_ID[prefix] + ", length = " + to_string(length));
+        desc = &OPCODE_DESC[opcode];
     }
 
-    // regular instruction opcode
-    if (!opcodeIsModrm(opcode)) {
-        iclass = instr_class(opcode);
-        // get type of operands
-        op1.type = OP1_TYPE[opcode];
-        op2.type = OP2_TYPE[opcode];
-        debug("regular opcode "s + opcodeName(opcode) + ", operand types: op1 = "s + OPR_TYPE_ID[op1.type] + ", op2 = " + OPR_TYPE_ID[op2.type] 
-            + ", class " + INS_CLASS_ID[iclass]);
-        // TODO: do not derive size from operand type, but from opcode, same for modrm and group
-        op1.size = OPR_SIZE[op1.type];
-        op2.size = OPR_SIZE[op2.type];
-        // temporary stopgap, derive unknown 1st op's size from 2nd op if possible
-        if (op1.size == OPRSZ_UNK && operandIsMem(op1.type) && operandIsImmediate(op2.type))
-            op1.size = op2.size;
-
-    }
-    // modr/m insruction opcode
-    else if (!opcodeIsGroup(opcode)) {
-        const Byte modrm = *data++; // load modrm byte
-        length++;
-        const ModrmOperand 
-            modop1 = modrm_op1(opcode),
-            modop2 = modrm_op2(opcode);
-        iclass = instr_class(opcode);
-        if (iclass == INS_ERR)
-            throw CpuError("Invalid instruction (opcode: " + hexVal(opcode) + " at " + addr.toString());        
-        debug("modrm opcode "s + opcodeName(opcode) + ", modrm = " + hexVal(modrm) + ", operand types: op1 = "s + MODRM_OPR_ID[modop1] + ", op2 = " + MODRM_OPR_ID[modop2] 
-            + ", class " + INS_CLASS_ID[iclass]);
-        // convert from messy modrm operand designation to our nice type
-        op1.type = getModrmOperand(modrm, modop1);
-        op2.type = getModrmOperand(modrm, modop2);
-        op1.size = MODRM_OPR_SIZE[modop1];
-        op2.size = MODRM_OPR_SIZE[modop2];
+    // regular instruction opcode, everything comes straight from the descriptor
+    if (desc->kind == DEC_PLAIN) {
+        iclass = desc->iclass;
+        op1.type = desc->op1;
+        op2.type = desc->op2;
+        op1.size = desc->size1;
+        op2.size = desc->size2;
     }
-    // group instruction opcode
+    // modr/m or group instruction opcode, operands (and class for groups) depend on the modrm byte
     else {
-        if (!opcodeIsGroup(opcode))
-            throw CpuError("Opcode is not group: " + hexVal(opcode) + " at " + addr.toString());
         const Byte modrm = *data++; // load modrm byte
         length++;
-        // obtain index of group for instruction class lookup
-        const InstructionGroupIndex grpIdx = GRP_IDX[opcode];
-        const Byte grpInstrIdx = modrm_grp(modrm) >> MODRM_GRP_SHIFT;
-        debug("group opcode "s + opcodeName(opcode) + ", modrm = " + hexVal(modrm) + ", group index " + GRP_IDX_ID[grpIdx] + ", instruction " + hexVal(grpInstrIdx));
-        if (grpIdx < IGRP_1 || grpIdx > IGRP_5)
-            throw CpuError("Group index out of range: " + to_string(grpIdx) + " at " + addr.toString());
-        // groups have up to 8 instructions (index 0-based)
-        if (grpInstrIdx >= 8)
-            throw CpuError("Group Instruction index out of range: " + to_string(grpInstrIdx) + " at " + addr.toString());
-        // determine instruction class
-        iclass = GRP_INS_CLASS[grpIdx][grpInstrIdx];
-        if (iclass == INS_ERR)
-            throw CpuError("Invalid group instruction (group: " + to_string(grpIdx) + ", index: " + to_string(grpInstrIdx) + ") at " + addr.toString());
-        // the rest is just like a "normal" modrm opcode
         ModrmOperand 
-            modop1 = modrm_op1(opcode),
-            modop2 = modrm_op2(opcode);
-        // special case for implicit 2nd operand for group 3a/3b TEST instruction
-        if (iclass == INS_TEST) {
-            switch(grpIdx) {
-            case IGRP_3a: modop2 = MODRM_Ib; break;
-            case IGRP_3b: modop2 = MODRM_Iv; break;
-            default:
-                throw CpuError("Invalid group index for TEST opcode at " + addr.toString());
-            }
+            modop1 = desc->modop1,
+            modop2 = desc->modop2;
+        if (desc->kind == DEC_GROUP) {
+            const GroupDesc &grp = GROUP_DESC[desc->group][modrm_grp(modrm) >> MODRM_GRP_SHIFT];
+            iclass = grp.iclass;
+            if (iclass == INS_ERR)
+                throw CpuError("Invalid group instruction (group: " + to_string(desc->group) + ", index: " + to_string(modrm_grp(modrm) >> MODRM_GRP_SHIFT) + ") at " + addr.toString());
+            if (grp.modop1 != MODRM_NONE) modop1 = grp.modop1;
+            if (grp.modop2 != MODRM_NONE) modop2 = grp.modop2;
         }
-        // another special case for operand override in group 5 far call and jmp instructions
-        else if (iclass == INS_CALL_FAR || iclass == INS_JMP_FAR) {
-            if (grpIdx != IGRP_5)
-                throw CpuError("Unexpected group index for far call/jump instruction: " + to_string(grpIdx) + " at " + addr.toString());
-            modop1 = MODRM_Mp;
+        else {
+            iclass = desc->iclass;
+            if (iclass == INS_ERR)
+                throw CpuError("Invalid instruction (opcode: " + hexVal(opcode) + " at " + addr.toString());
         }
-        debug("modrm operand types: op1 = "s + MODRM_OPR_ID[modop1] + ", op2 = " + MODRM_OPR_ID[modop2] + ", class " + INS_CLASS_ID[iclass]);
-        // convert from messy modrm operand designation to our nice type
-        op1.type = getModrmOperand(modrm, modop1);
-        op2.type = getModrmOperand(modrm, modop2);
+        op1.type = MODRM_OPERAND_TYPE[modop1][modrm];
+        op2.type = MODRM_OPERAND_TYPE[modop2][modrm];
         op1.size = MODRM_OPR_SIZE[modop1];
         op2.size = MODRM_OPR_SIZE[modop2];
     }
 
     if (op1.type == OPR_ERR || op2.type == OPR_ERR)
         throw CpuError("Error parsing instruction operand(s) at " + addr.toString());
-    debug("generalized operands, op1: type = "s + OPR_TYPE_ID[op1.type] + ", size = " + OPR_SIZE_ID[op1.size] + ", op2: type = " + OPR_TYPE_ID[op2.type] + ", size = " + OPR_SIZE_ID[op2.size]);
     // load immediate values if present
     Size immSize = loadImmediate(op1, data);
     data += immSize;
     length += immSize;
     immSize = loadImmediate(op2, data);
-    data += immSize;
     length += immSize;
-    debug("Instruction @" + addr.toString() + ": " + toString() + ", length = " + to_string(length));
+    // avoid building the message unless it is going to be shown, this is the hot path of all the analysis code
+    if (getOutputLevel() <= LOG_DEBUG)
+        debug("Instruction @" + addr.toString() + ": " + toString() + ", opcode " + opcodeName(opcode) + ", class " + INS_CLASS_ID[iclass] + ", op1: type = " 
+            + OPR_TYPE_ID[op1.type] + ", size = " + OPR_SIZE_ID[op1.size] + ", op2: type = " + OPR_TYPE_ID[op2.type] + ", size = " + OPR_SIZE_ID[op2.size] 
+            + ", length = " + to_string(length));
 }
 
 // calculate an absolute offset from an offset that is relative to this instruction's end, based on the immediate operand 
@@ -404,92 +544,225 @@ SWord Instruction::relativeOffset() const {
 }
 
 
-// lookup table for which instructions modify their first operand
-// 0: doesn't modify any regs, 1: modifies 1st operand, 2: modifies both operands, 3: special case, implicit registers
-// TODO: ret accepts operand?
-// TODO: doesn't include flags register
-// TODO: put values in enum
-static const int OPERAND_MODIFIED[] = {
-    //INS_ERR   INS_ADD      INS_PUSH    INS_POP    INS_OR     INS_ADC    INS_SBB     INS_AND    INS_DAA    INS_SUB   INS_DAS       INS_XOR   INS_AAA    INS_CMP   INS_AAS    INS_INC   INS_DEC
-    0,          1,           3,          3,         1,         1,         1,          1,         3,         1,        3,            1,        3,         0,        3,         1,        1,
-    //INS_JMP   INS_JMP_IF  INS_JMP_FAR  INS_TEST    INS_XCHG   INS_MOV    INS_LEA    INS_NOP     INS_CBW    INS_CWD    INS_CALL  INS_CALL_FAR  INS_WAIT  INS_PUSHF  INS_POPF  INS_SAHF   INS_LAHF  INS_MOVSB
-    0,          0,           0,           3,          2,         1,         1,         0,          3,         3,         0,        0,            0,        3,         3,        3,         3,        2, 
-    //INS_MOVSW INS_CMPSB    INS_CMPSW   INS_STOSB  INS_STOSW  INS_LODSB  INS_LODSW   INS_SCASB  INS_SCASW  INS_RET   INS_LES       INS_LDS   INS_RETF   INS_INT   INS_INT3   INS_INTO   INS_IRET  INS_AAM
-    3,          3,           3,          3,         3,         3,         0,          3,         3,         0,        3,            3,        0,         3,        3,          3,         0,        3, 
-    //INS_AAD   INS_XLAT     INS_LOOPNZ  INS_LOOPZ  INS_LOOP   INS_IN     INS_OUT     INS_LOCK   INS_REPNZ  INS_REPZ  INS_HLT       INS_CMC   INS_CLC    INS_STC   INS_CLI    INS_STI   INS_CLD
-    3,          3,           3,          3,         3,         1,         0,          0,         0,         0,        0,            3,        3,         3,        3,         3,        3, 
-    //INS_STD   INS_ROL      INS_ROR     INS_RCL    INS_RCR    INS_SHL    INS_SHR     INS_SAR    INS_NOT    INS_NEG   INS_MUL       INS_IMUL  INS_DIV    INS_IDIV
-    3,          1,           1,          3,         3,         1,         1,          0,         1,         1,        0,            3,        3,         3,
+// how an instruction class accesses its explicit operands
+enum OperandAccess : Byte {
+    ACC_NONE = 0,
+    ACC_READ1 = 1 << 0,
+    ACC_WRITE1 = 1 << 1,
+    ACC_READ2 = 1 << 2,
+    ACC_WRITE2 = 1 << 3,
+    ACC_MODIFY1 = ACC_READ1 | ACC_WRITE1,
+    ACC_MODIFY2 = ACC_READ2 | ACC_WRITE2,
+};
+
+// register effects of an instruction class, in addition to the ones of its explicit operands
+struct RegisterEffect {
+    RegisterMask read, write;
+    Byte access;
 };
-static_assert(ARRAY_SIZE(OPERAND_MODIFIED) == ARRAY_SIZE(INS_CLASS_ID));
-
-// TODO: basically all special cases, refactor this
-vector<Register> Instruction::touchedRegs() const {
-    const int touch = OPERAND_MODIFIED[iclass];
-    vector<Register> ret;
-    if (touch == 0) return { REG_NONE };
-    else if (touch == 1) ret = { op1.regId() }; 
-    else if (touch == 2) ret = { op1.regId(), op2.regId() };
-    else switch(iclass) {
+
+static constexpr RegisterMask 
+    RM_AL = regMask(REG_AL), RM_AH = regMask(REG_AH), RM_AX = regMask(REG_AX), RM_BX = regMask(REG_BX), 
+    RM_CX = regMask(REG_CX), RM_DX = regMask(REG_DX), RM_SI = regMask(REG_SI), RM_DI = regMask(REG_DI), 
+    RM_SP = regMask(REG_SP), RM_DS = regMask(REG_DS), RM_ES = regMask(REG_ES), RM_SS = regMask(REG_SS), 
+    RM_FLAGS = regMask(REG_FLAGS),
+    RM_STACK = RM_SP | RM_SS;
+
+static constexpr RegisterEffect registerEffect(const InstructionClass iclass) {
+    switch (iclass) {
+    case INS_ADD:
+    case INS_OR:
+    case INS_AND:
+    case INS_SUB:
+    case INS_XOR:      return { 0, RM_FLAGS, ACC_MODIFY1 | ACC_READ2 };
+    case INS_ADC:
+    case INS_SBB:      return { RM_FLAGS, RM_FLAGS, ACC_MODIFY1 | ACC_READ2 };
+    case INS_CMP:
+    case INS_TEST:     return { 0, RM_FLAGS, ACC_READ1 | ACC_READ2 };
+    case INS_INC:
+    case INS_DEC:
+    case INS_NEG:      return { 0, RM_FLAGS, ACC_MODIFY1 };
+    case INS_NOT:      return { 0, 0, ACC_MODIFY1 };
+    case INS_PUSH:     return { RM_STACK, RM_SP, ACC_READ1 };
+    case INS_POP:      return { RM_STACK, RM_SP, ACC_WRITE1 };
+    case INS_PUSHF:    return { RM_STACK | RM_FLAGS, RM_SP, ACC_NONE };
+    case INS_POPF:     return { RM_STACK, RM_SP | RM_FLAGS, ACC_NONE };
+    case INS_DAA:
+    case INS_DAS:      return { RM_AL | RM_FLAGS, RM_AL | RM_FLAGS, ACC_NONE };
     case INS_AAA:
-    case INS_AAD:
-    case INS_AAM:
-    case INS_AAS: ret = { REG_AL, REG_AH }; break;
+    case INS_AAS:      return { RM_AL | RM_AH | RM_FLAGS, RM_AL | RM_AH | RM_FLAGS, ACC_NONE };
+    case INS_AAM:      return { RM_AL, RM_AL | RM_AH | RM_FLAGS, ACC_NONE };
+    case INS_AAD:      return { RM_AL | RM_AH, RM_AL | RM_AH | RM_FLAGS, ACC_NONE };
+    case INS_CBW:      return { RM_AL, RM_AH, ACC_NONE };
+    case INS_CWD:      return { RM_AX, RM_DX, ACC_NONE };
+    case INS_SAHF:     return { RM_AH, RM_FLAGS, ACC_NONE };
+    case INS_LAHF:     return { RM_FLAGS, RM_AH, ACC_NONE };
+    case INS_JMP:
+    case INS_JMP_FAR:  return { 0, 0, ACC_READ1 };
+    case INS_JMP_IF:   return { RM_FLAGS, 0, ACC_READ1 };
     case INS_CALL:
-    case INS_CALL_FAR:
-    case INS_INT: ret = { REG_AX, REG_BX, REG_CX, REG_DX, REG_SI, REG_DI, REG_FLAGS }; break;
-    case INS_CBW:
-    case INS_LAHF: ret = { REG_AH }; break;
-    case INS_CMPSB:
-    case INS_CMPSW:
+    case INS_CALL_FAR: return { RM_STACK, RM_SP, ACC_READ1 };
+    case INS_RET:
+    case INS_RETF:     return { RM_STACK, RM_SP, ACC_NONE };
+    case INS_IRET:     return { RM_STACK, RM_SP | RM_FLAGS, ACC_NONE };
+    // software interrupts return values in any of the registers, assume them all clobbered
+    case INS_INT:
+    case INS_INT3:
+    case INS_INTO:     return { RM_STACK | RM_FLAGS, RM_AX | RM_BX | RM_CX | RM_DX | RM_SI | RM_DI | RM_ES | RM_FLAGS, ACC_READ1 };
+    case INS_XCHG:     return { 0, 0, ACC_MODIFY1 | ACC_MODIFY2 };
+    case INS_MOV:      return { 0, 0, ACC_WRITE1 | ACC_READ2 };
+    case INS_LEA:      return { 0, 0, ACC_WRITE1 | ACC_READ2 };
+    case INS_LES:      return { 0, RM_ES, ACC_WRITE1 | ACC_READ2 };
+    case INS_LDS:      return { 0, RM_DS, ACC_WRITE1 | ACC_READ2 };
     case INS_MOVSB:
-    case INS_MOVSW: ret = { REG_SI, REG_DI }; break;
-    case INS_CWD: ret = { REG_DX }; break;
-    case INS_DAA:
-    case INS_DAS: ret = { REG_AL }; break;
-    case INS_DIV:
-    case INS_IDIV:
-        if (op1.size == OPRSZ_BYTE) return { REG_AL, REG_AH };
-        else return { REG_AX, REG_DX };
-        break;
-    case INS_MUL:
-    case INS_IMUL:
-        if (op1.size == OPRSZ_BYTE) return { REG_AX };
-        else return { REG_AX, REG_DX };
-        break;
-    case INS_LDS: ret = { op1.regId(), REG_DS }; break;
-    case INS_LES: ret = { op1.regId(), REG_ES }; break;
-    case INS_LODSB: ret = { REG_AL, REG_SI }; break;
-    case INS_LODSW: ret = { REG_AX, REG_SI }; break;
-    case INS_LOOP:
+    case INS_MOVSW:    return { RM_SI | RM_DI | RM_DS | RM_ES | RM_FLAGS, RM_SI | RM_DI, ACC_NONE };
+    case INS_CMPSB:
+    case INS_CMPSW:    return { RM_SI | RM_DI | RM_DS | RM_ES | RM_FLAGS, RM_SI | RM_DI | RM_FLAGS, ACC_NONE };
+    case INS_STOSB:    return { RM_AL | RM_DI | RM_ES | RM_FLAGS, RM_DI, ACC_NONE };
+    case INS_STOSW:    return { RM_AX | RM_DI | RM_ES | RM_FLAGS, RM_DI, ACC_NONE };
+    case INS_LODSB:    return { RM_SI | RM_DS | RM_FLAGS, RM_AL | RM_SI, ACC_NONE };
+    case INS_LODSW:    return { RM_SI | RM_DS | RM_FLAGS, RM_AX | RM_SI, ACC_NONE };
+    case INS_SCASB:    return { RM_AL | RM_DI | RM_ES | RM_FLAGS, RM_DI | RM_FLAGS, ACC_NONE };
+    case INS_SCASW:    return { RM_AX | RM_DI | RM_ES | RM_FLAGS, RM_DI | RM_FLAGS, ACC_NONE };
+    case INS_XLAT:     return { RM_AL | RM_BX | RM_DS, RM_AL, ACC_NONE };
+    case INS_LOOP:     return { RM_CX, RM_CX, ACC_READ1 };
     case INS_LOOPZ:
-    case INS_LOOPNZ: ret = { REG_CX }; break;
-    case INS_POP: ret = { op1.regId(), REG_SP }; break;
-    case INS_POPF: ret = { REG_FLAGS, REG_SP }; break;
-    case INS_PUSH:
-    case INS_PUSHF: ret = { REG_SP }; break;
-    case INS_RCL:
-    case INS_RCR: ret = { op1.regId(), REG_FLAGS }; break;
-    case INS_CMC:
+    case INS_LOOPNZ:   return { RM_CX | RM_FLAGS, RM_CX, ACC_READ1 };
+    case INS_IN:       return { 0, 0, ACC_WRITE1 | ACC_READ2 };
+    case INS_OUT:      return { 0, 0, ACC_READ1 | ACC_READ2 };
+    case INS_CMC:      return { RM_FLAGS, RM_FLAGS, ACC_NONE };
     case INS_CLC:
+    case INS_STC:
     case INS_CLI:
     case INS_STI:
-    case INS_STC:
     case INS_CLD:
-    case INS_STD:
-    case INS_TEST:
-    case INS_SAHF: ret = { REG_FLAGS }; break;
-    case INS_SCASB: 
-    case INS_SCASW: ret = { REG_DI, REG_FLAGS }; break;
-    case INS_STOSW:
-    case INS_STOSB: ret = { REG_DI };
-    case INS_XLAT: ret = { REG_AL };
-        break;
-    default:
-        throw CpuError("Unknown instruction class for touched reg: "s + INS_CLASS_ID[iclass]);
+    case INS_STD:      return { 0, RM_FLAGS, ACC_NONE };
+    case INS_ROL:
+    case INS_ROR:
+    case INS_SHL:
+    case INS_SHR:
+    case INS_SAR:      return { 0, RM_FLAGS, ACC_MODIFY1 | ACC_READ2 };
+    case INS_RCL:
+    case INS_RCR:      return { RM_FLAGS, RM_FLAGS, ACC_MODIFY1 | ACC_READ2 };
+    // the implicit accumulator operands depend on the operand size, see Instruction::regsRead/regsWritten
+    case INS_MUL:
+    case INS_IMUL:
+    case INS_DIV:
+    case INS_IDIV:     return { 0, RM_FLAGS, ACC_READ1 };
+    default:           return { 0, 0, ACC_NONE };
+    }
+}
+
+static constexpr array<RegisterEffect, INS_IDIV + 1> registerEffectTable() {
+    array<RegisterEffect, INS_IDIV + 1> ret{};
+    for (int c = INS_ERR; c <= INS_IDIV; ++c) ret[c] = registerEffect(static_cast<InstructionClass>(c));
+    return ret;
+}
+
+// registers referenced by an operand: the register itself, or the base/index and default segment registers of a memory location
+static constexpr RegisterMask operandRegisters(const OperandType type) {
+    switch (type) {
+    case OPR_REG_AX: return RM_AX;
+    case OPR_REG_AL: return RM_AL;
+    case OPR_REG_AH: return RM_AH;
+    case OPR_REG_BX: return RM_BX;
+    case OPR_REG_BL: return regMask(REG_BL);
+    case OPR_REG_BH: return regMask(REG_BH);
+    case OPR_REG_CX: return RM_CX;
+    case OPR_REG_CL: return regMask(REG_CL);
+    case OPR_REG_CH: return regMask(REG_CH);
+    case OPR_REG_DX: return RM_DX;
+    case OPR_REG_DL: return regMask(REG_DL);
+    case OPR_REG_DH: return regMask(REG_DH);
+    case OPR_REG_SI: return RM_SI;
+    case OPR_REG_DI: return RM_DI;
+    case OPR_REG_BP: return regMask(REG_BP);
+    case OPR_REG_SP: return RM_SP;
+    case OPR_REG_CS: return regMask(REG_CS);
+    case OPR_REG_DS: return RM_DS;
+    case OPR_REG_ES: return RM_ES;
+    case OPR_REG_SS: return RM_SS;
+    case OPR_MEM_BX_SI:
+    case OPR_MEM_BX_SI_OFF8:
+    case OPR_MEM_BX_SI_OFF16: return RM_BX | RM_SI | RM_DS;
+    case OPR_MEM_BX_DI:
+    case OPR_MEM_BX_DI_OFF8:
+    case OPR_MEM_BX_DI_OFF16: return RM_BX | RM_DI | RM_DS;
+    case OPR_MEM_BP_SI:
+    case OPR_MEM_BP_SI_OFF8:
+    case OPR_MEM_BP_SI_OFF16: return regMask(REG_BP) | RM_SI | RM_SS;
+    case OPR_MEM_BP_DI:
+    case OPR_MEM_BP_DI_OFF8:
+    case OPR_MEM_BP_DI_OFF16: return regMask(REG_BP) | RM_DI | RM_SS;
+    case OPR_MEM_SI:
+    case OPR_MEM_SI_OFF8:
+    case OPR_MEM_SI_OFF16:    return RM_SI | RM_DS;
+    case OPR_MEM_DI:
+    case OPR_MEM_DI_OFF8:
+    case OPR_MEM_DI_OFF16:    return RM_DI | RM_DS;
+    case OPR_MEM_BX:
+    case OPR_MEM_BX_OFF8:
+    case OPR_MEM_BX_OFF16:    return RM_BX | RM_DS;
+    case OPR_MEM_BP_OFF8:
+    case OPR_MEM_BP_OFF16:    return regMask(REG_BP) | RM_SS;
+    case OPR_MEM_OFF8:
+    case OPR_MEM_OFF16:       return RM_DS;
+    default:                  return 0;
+    }
+}
+
+static constexpr array<RegisterMask, OPR_IMM32 + 1> operandRegisterTable() {
+    array<RegisterMask, OPR_IMM32 + 1> ret{};
+    for (int t = OPR_ERR; t <= OPR_IMM32; ++t) ret[t] = operandRegisters(static_cast<OperandType>(t));
+    return ret;
+}
+
+static constexpr auto REGISTER_EFFECT = registerEffectTable();
+static constexpr auto OPERAND_REGISTERS = operandRegisterTable();
+
+static_assert(REGISTER_EFFECT[INS_STOSB].write == RM_DI && REGISTER_EFFECT[INS_XLAT].write == RM_AL);
+static_assert(OPERAND_REGISTERS[OPR_MEM_BP_DI_OFF8] == (regMask(REG_BP) | RM_DI | RM_SS));
+
+// registers involved in accessing an operand, accounting for a segment override of a memory operand
+static RegisterMask operandMask(const OperandType type, const InstructionPrefix prefix) {
+    RegisterMask ret = OPERAND_REGISTERS[type];
+    if (operandIsMem(type) && prefixIsSegment(prefix)) ret = (ret & ~(RM_DS | RM_SS)) | regMask(prefixRegId(prefix));
+    return ret;
+}
+
+// registers whose values are used by the instruction, including the ones needed to address memory operands
+RegisterMask Instruction::regsRead() const {
+    const RegisterEffect &e = REGISTER_EFFECT[iclass];
+    RegisterMask ret = e.read;
+    // a memory operand needs its address registers whether it is read or written
+    if ((e.access & ACC_READ1) || operandIsMem(op1.type)) ret |= operandMask(op1.type, prefix);
+    if ((e.access & ACC_READ2) || operandIsMem(op2.type)) ret |= operandMask(op2.type, prefix);
+    switch (iclass) {
+    case INS_MUL:
+    case INS_IMUL: ret |= op1.size == OPRSZ_BYTE ? RM_AL : RM_AX; break;
+    case INS_DIV:
+    case INS_IDIV: ret |= op1.size == OPRSZ_BYTE ? RM_AX : RM_AX | RM_DX; break;
+    case INS_JMP_IF: if (opcode == OP_JCXZ_Jb) ret |= RM_CX; break;
+    default: break;
+    }
+    if (prefixIsChain(prefix)) ret |= RM_CX;
+    return ret;
+}
+
+// registers whose values are changed by the instruction
+RegisterMask Instruction::regsWritten() const {
+    const RegisterEffect &e = REGISTER_EFFECT[iclass];
+    RegisterMask ret = e.write;
+    if ((e.access & ACC_WRITE1) && operandIsReg(op1.type)) ret |= OPERAND_REGISTERS[op1.type];
+    if ((e.access & ACC_WRITE2) && operandIsReg(op2.type)) ret |= OPERAND_REGISTERS[op2.type];
+    switch (iclass) {
+    case INS_MUL:
+    case INS_IMUL:
+    case INS_DIV:
+    case INS_IDIV: ret |= op1.size == OPRSZ_BYTE ? RM_AX : RM_AX | RM_DX; break;
+    default: break;
     }
-    if (prefix == PRF_CHAIN_REPNZ || prefix == PRF_CHAIN_REPZ) 
-        ret.push_back(REG_CX);
+    if (prefixIsChain(prefix)) ret |= RM_CX;
     return ret;
 }
 
@@ -525,29 +798,37 @@ Register Instruction::memSegmentId() const {
 }
 
 std::string Instruction::Operand::toString() const {
-    ostringstream str;
+    char buf[INSTRUCTION_TEXT_MAX];
+    TextBuffer out{buf, sizeof(buf)};
+    format(out);
+    return buf;
+}
+
+void Instruction::Operand::format(TextBuffer &out) const {
     if (operandIsReg(type))
-        str << OPR_NAME[type];
+        out << OPR_NAME[type];
     else if (operandIsMemNoOffset(type))
-        str << "[" << OPR_NAME[type] << "]";
+        out << "[" << OPR_NAME[type] << "]";
     else if (operandIsMemWithByteOffset(type)) {
-        if (type == OPR_MEM_OFF8) str << "[" << hexVal(immval.u8, true, false)  << "]";
-        else str << "[" << OPR_NAME[type] << signedHexVal(static_cast<SByte>(immval.u8)) << "]";
+        out << "[";
+        if (type == OPR_MEM_OFF8) out.hex(immval.u8);
+        else (out << OPR_NAME[type]).signedHex(static_cast<SByte>(immval.u8), 2);
+        out << "]";
     }
     else if (operandIsMemWithWordOffset(type)) {
-        if (type == OPR_MEM_OFF16) str << "[" << hexVal(immval.u16, true, false) << "]";
-        else str << "[" << OPR_NAME[type] << signedHexVal(static_cast<SWord>(immval.u16)) << "]";
+        out << "[";
+        if (type == OPR_MEM_OFF16) out.hex(immval.u16);
+        else (out << OPR_NAME[type]).signedHex(static_cast<SWord>(immval.u16), 4);
+        out << "]";
     }
     else if (type == OPR_IMM0 || type == OPR_IMM1)
-        str << OPR_NAME[type];
+        out << OPR_NAME[type];
     else if (type == OPR_IMM8)
-        str << hexVal(immval.u8, true, false);
+        out.hex(immval.u8);
     else if (type == OPR_IMM16)
-        str << hexVal(immval.u16, true, false);
+        out.hex(immval.u16);
     else if (type == OPR_IMM32)
-        str << hexVal(immval.u32, true, false);
-
-    return str.str();
+        out.hex(immval.u32);
 }
 
 InstructionMatch Instruction::Operand::match(const Operand &other) const {
@@ -581,10 +862,17 @@ InstructionMatch Instruction::Operand::match(const Operand &other) const {
 }
 
 std::string Instruction::toString(const bool extended) const {
-    ostringstream str;
+    char buf[INSTRUCTION_TEXT_MAX];
+    TextBuffer out{buf, sizeof(buf)};
+    format(out, extended);
+    return buf;
+}
+
+// write the instruction text into a buffer, without allocating
+void Instruction::format(TextBuffer &out, const bool extended) const {
     // output chain prefix if present
     if (prefix > PRF_SEG_DS)
-        str << PRF_NAME[prefix] << " ";
+        out << PRF_NAME[prefix] << " ";
     
     // output instruction name
     // conditional jumps, lookup specific jump name
@@ -592,121 +880,187 @@ std::string Instruction::toString(const bool extended) const {
         Byte idx = opcode - OP_JO_Jb;
         // jcxz special case
         if (idx >= JMP_NAME_COUNT) idx = JMP_NAME_COUNT - 1;
-        str << JMP_NAME[idx];
+        out << JMP_NAME[idx];
     }
     // otherwise just output name corresponding to instruction class
     else {
-        str << INS_NAME[iclass];
+        out << INS_NAME[iclass];
     }
     // special extra label for short jump opcode
-    if (opcode == OP_JMP_Jb) str << " short";
+    if (opcode == OP_JMP_Jb) out << " short";
 
     // output operands
     if (op1.type != OPR_NONE) {
-        str << " ";
+        out << " ";
         // show size prefix if not implicit from operands
         if ((operandIsMem(op1.type) && operandIsImmediate(op2.type)) || opcode == OP_POP_Ev) {
             OperandSize immSize = op1.size;
             if (immSize == OPRSZ_UNK) immSize = op2.size;
             switch(immSize) {
-            case OPRSZ_BYTE:  str << "byte ";  break;
-            case OPRSZ_WORD:  str << "word ";  break;
-            case OPRSZ_DWORD: str << "dword "; break;
+            case OPRSZ_BYTE:  out << "byte ";  break;
+            case OPRSZ_WORD:  out << "word ";  break;
+            case OPRSZ_DWORD: out << "dword "; break;
             default:
                 throw CpuError("unexpected immediate operand size: "s + OPR_SIZE_ID[immSize]);
             }
         }
         // segment override prefix if present
         if (prefix > PRF_NONE && prefix < PRF_CHAIN_REPNZ && operandIsMem(op1.type))
-            str << PRF_NAME[prefix];
+            out << PRF_NAME[prefix];
         // for near branch instructions (call, jump, loop), the immediate relative offset operand is added to the
         // address of the byte past the current instruction to form an absolute offset.
         // In extended text output, show distance relative to the displayed instruction offset for readability.
         if (isNearBranch() && operandIsImmediate(op1.type)) {
             const Word aoff = absoluteOffset();
             const Word startAddr = addr.offset;
-            str << hexVal(aoff, true, false);
+            out.hex(aoff);
             if (extended) {
                 if (aoff < startAddr) {
-                    str << " (" << hexVal(static_cast<Word>(startAddr - aoff), true, false) << " up)";
+                    out << " (";
+                    out.hex(static_cast<Word>(startAddr - aoff)) << " up)";
                 } else {
-                    str << " (" << hexVal(static_cast<Word>(aoff - startAddr), true, false) << " down)";
+                    out << " (";
+                    out.hex(static_cast<Word>(aoff - startAddr)) << " down)";
                 }
             }
         }
         else {
-            str << op1.toString();
+            op1.format(out);
         }
     }
     if (op2.type != OPR_NONE) {
-        str << ", ";
+        out << ", ";
         // segment override prefix if present
         if (prefix > PRF_NONE && prefix < PRF_CHAIN_REPNZ && operandIsMem(op2.type))
-            str << PRF_NAME[prefix];
+            out << PRF_NAME[prefix];
         // immediate size prefix if not implicit
         if (operandIsReg(op1.type) && op1.size == OPRSZ_WORD && operandIsImmediate(op2.type) && op2.size == OPRSZ_BYTE)
-            str << "byte ";
-        str << op2.toString();
+            out << "byte ";
+        op2.format(out);
     }
-
-    return str.str();
 }
 
 // create a search pattern from the instruction's encoding bytes; i.e. the binary data of the instruction with any offsets and immediates replaced with placeholder values
-ByteString Instruction::pattern() const {
-    ByteString ret;
-    // put instruction bytes into vector
-    for (int i = 0; i < length; ++i) {
-        ret.push_back(static_cast<SWord>(*(data + i)));
-    }
-    debug("Instruction bytes for pattern: " + hexJoin(ret));
-    // if present, extract bytes of an immediate value from both instruction operands and erase them from the pattern
-    if (operandIsMemWithOffset(op1.type) || operandIsExplicitImmediate(op1.type)) {
-        auto value = op1.immediateValue();
-        erasePattern(ret, value);
-    }
-    if (operandIsMemWithOffset(op2.type) || operandIsExplicitImmediate(op2.type)) {
-        auto value = op2.immediateValue();
-        erasePattern(ret, value);
-    }
+BytePattern Instruction::pattern() const {
+    BytePattern ret{data, length};
+    // if present, immediates and offsets of both operands are always encoded at the end of the instruction, replace them with wildcards
+    const Size immLength = operandSizeBytes(op1.immsize) + operandSizeBytes(op2.immsize);
+    assert(immLength <= ret.size());
+    ret.wildcard(length - immLength, immLength);
     return ret;
 }
 
 // similar to the search pattern above, a signature is an ambiguation of an instruction, 
 // but this time used to lookup equivalent instruction sequences using edit distance
-Signature Instruction::signature() const {
-    Signature ret = 0;
-    // fuse the instruction subtypes into a singular 32bit value that will serve as the instruction's signature:
-    // |reserved|prefix|class|op1type|op2type|
-    //  10b      3b     7b    6b      6b    
-    const int reserved = 10;
-    int shift = (sizeof(ret) * 8) - reserved;
-    if (prefix > 0b111) throw RangeError("Instruction prefix out of range: " + hexVal((Word)prefix));
-    DWord val = static_cast<DWord>(prefix) << (shift -= 3);
-    ret |= val;
-    if (iclass > 0b1111111) throw RangeError("Instruction class out of range: " + hexVal((Word)iclass));
-    val = static_cast<DWord>(iclass) << (shift -= 7);
-    ret |= val;
-    // ambiguate away embedded immediate size differences by converting a byte type to an equivalent word type
-    // TODO: create specialized enum for signatures, this could fit in 16bits?
-    // TODO: also, no need to store off8/off16 for the operand type
-    auto optype = operandTypeToWord(op1.type);
-    if (optype > 0b111111) throw RangeError("Instruction operand 1 type out of range: " + hexVal((Word)optype));
-    val = static_cast<DWord>(optype) << (shift -= 6);
-    ret |= val;
-    // if (op1.size > 0b111) throw RangeError("Instruction operand 1 size out of range: " + hexVal((Word)op1.size));
-    // val = static_cast<DWord>(op1.size) << (shift -= 3);
-    // ret |= val;
-    optype = operandTypeToWord(op2.type);
-    if (optype > 0b111111) throw RangeError("Instruction operand 2 type out of range: " + hexVal((Word)optype));
-    val = static_cast<DWord>(optype) << (shift -= 6);
-    ret |= val;
-    // if (op2.size > 0b111) throw RangeError("Instruction operand 2 size out of range: " + hexVal((Word)op2.size));    
-    // val = static_cast<DWord>(op2.size) << (shift -= 3);
-    // ret |= val;
+// Instruction signatures are built from precomputed per-field tables, the full 32bit format is:
+// |reserved|prefix|class|op1type|op2type|
+//  10b      3b     7b    6b      6b
+static constexpr int SIG_PREFIX_SHIFT = 19, SIG_CLASS_SHIFT = 12, SIG_OP1_SHIFT = 6;
+static constexpr DWord SIG_PREFIX_MASK = 0b111, SIG_CLASS_MASK = 0b1111111, SIG_OPERAND_MASK = 0b111111;
+static_assert(PRF_CHAIN_REPZ <= SIG_PREFIX_MASK && INS_IDIV <= SIG_CLASS_MASK && OPR_IMM32 <= SIG_OPERAND_MASK);
+// the compact 16bit format drops the segment prefixes and the operand sizes, except for a flag
+// which marks either an 8bit register operand or a chained (rep) prefix, the latter only ever appearing on string instructions without operands:
+// |class|flag|op1kind|op2kind|
+//  7b    1b   4b      4b
+static constexpr int SIG16_CLASS_SHIFT = 9, SIG16_FLAG_SHIFT = 8, SIG16_OP1_SHIFT = 4;
+static_assert(SOP_IMM <= 0b1111);
+
+static_assert(OPR_MEM_OFF16 - OPR_MEM_OFF8 == OPR_MEM_BX_OFF16 - OPR_MEM_BX_OFF8);
+// ambiguate away embedded immediate size differences by converting a byte type to an equivalent word type, same as operandTypeToWord()
+static constexpr OperandType signatureOperandType(const OperandType ot) {
+    if (operandIsMemWithByteOffset(ot)) return static_cast<OperandType>(ot + (OPR_MEM_OFF16 - OPR_MEM_OFF8));
+    if (ot == OPR_IMM8) return OPR_IMM16;
+    return ot;
+}
+
+static constexpr SignatureOperand signatureOperandKind(const OperandType ot) {
+    switch (ot) {
+    case OPR_REG_AX: case OPR_REG_AL: return SOP_REG_A;
+    case OPR_REG_BX: case OPR_REG_BL: return SOP_REG_B;
+    case OPR_REG_CX: case OPR_REG_CL: return SOP_REG_C;
+    case OPR_REG_DX: case OPR_REG_DL: return SOP_REG_D;
+    case OPR_REG_AH: case OPR_REG_BH: case OPR_REG_CH: case OPR_REG_DH: return SOP_REG_HIGH;
+    case OPR_REG_SI: return SOP_REG_SI;
+    case OPR_REG_DI: return SOP_REG_DI;
+    case OPR_REG_BP: return SOP_REG_BP;
+    case OPR_REG_SP: return SOP_REG_SP;
+    case OPR_REG_CS: case OPR_REG_DS: case OPR_REG_ES: case OPR_REG_SS: return SOP_REG_SEG;
+    case OPR_MEM_BX_SI: case OPR_MEM_BX_DI: case OPR_MEM_BX:
+    case OPR_MEM_BX_SI_OFF8: case OPR_MEM_BX_DI_OFF8: case OPR_MEM_BX_OFF8:
+    case OPR_MEM_BX_SI_OFF16: case OPR_MEM_BX_DI_OFF16: case OPR_MEM_BX_OFF16: return SOP_MEM_BX;
+    case OPR_MEM_BP_SI: case OPR_MEM_BP_DI:
+    case OPR_MEM_BP_SI_OFF8: case OPR_MEM_BP_DI_OFF8: case OPR_MEM_BP_OFF8:
+    case OPR_MEM_BP_SI_OFF16: case OPR_MEM_BP_DI_OFF16: case OPR_MEM_BP_OFF16: return SOP_MEM_BP;
+    case OPR_MEM_SI: case OPR_MEM_DI:
+    case OPR_MEM_SI_OFF8: case OPR_MEM_DI_OFF8:
+    case OPR_MEM_SI_OFF16: case OPR_MEM_DI_OFF16: return SOP_MEM_INDEX;
+    case OPR_MEM_OFF8: case OPR_MEM_OFF16: return SOP_MEM_DIRECT;
+    case OPR_IMM0: case OPR_IMM1: case OPR_IMM8: case OPR_IMM16: case OPR_IMM32: return SOP_IMM;
+    default: return SOP_NONE;
+    }
+}
+
+static constexpr bool operandIsByteReg(const OperandType ot) {
+    switch (ot) {
+    case OPR_REG_AL: case OPR_REG_AH: case OPR_REG_BL: case OPR_REG_BH:
+    case OPR_REG_CL: case OPR_REG_CH: case OPR_REG_DL: case OPR_REG_DH: return true;
+    default: return false;
+    }
+}
+
+// per operand type: the signature operand field for the first and second operand, and the compact 16bit fields in the same positions
+struct SignatureOperandDesc {
+    DWord op1, op2;
+    Signature16 op1compact, op2compact;
+};
+
+static constexpr array<SignatureOperandDesc, OPR_IMM32 + 1> signatureOperandTable() {
+    array<SignatureOperandDesc, OPR_IMM32 + 1> ret{};
+    for (Size i = 0; i < ret.size(); ++i) {
+        const auto ot = static_cast<OperandType>(i);
+        const DWord field = signatureOperandType(ot);
+        const Signature16 flag = operandIsByteReg(ot) ? 1 << SIG16_FLAG_SHIFT : 0;
+        const Signature16 kind = signatureOperandKind(ot);
+        ret[i] = { field << SIG_OP1_SHIFT, field, static_cast<Signature16>(flag | kind << SIG16_OP1_SHIFT), static_cast<Signature16>(flag | kind) };
+    }
     return ret;
 }
 
+static constexpr auto SIGNATURE_OPERAND_DESC = signatureOperandTable();
+static_assert(SIGNATURE_OPERAND_DESC[OPR_MEM_BP_OFF8].op2 == OPR_MEM_BP_OFF16 && SIGNATURE_OPERAND_DESC[OPR_IMM8].op1 == OPR_IMM16 << SIG_OP1_SHIFT);
+static_assert(SIGNATURE_OPERAND_DESC[OPR_REG_CL].op2compact == (1 << SIG16_FLAG_SHIFT | SOP_REG_C));
+
+static Signature makeSignature(const InstructionPrefix prefix, const InstructionClass iclass, const OperandType op1type, const OperandType op2type) {
+    return static_cast<DWord>(prefix) << SIG_PREFIX_SHIFT | static_cast<DWord>(iclass) << SIG_CLASS_SHIFT 
+        | SIGNATURE_OPERAND_DESC[op1type].op1 | SIGNATURE_OPERAND_DESC[op2type].op2;
+}
+
+static Signature16 makeSignature16(const InstructionPrefix prefix, const InstructionClass iclass, const OperandType op1type, const OperandType op2type) {
+    Signature16 ret = static_cast<Signature16>(iclass << SIG16_CLASS_SHIFT) | SIGNATURE_OPERAND_DESC[op1type].op1compact | SIGNATURE_OPERAND_DESC[op2type].op2compact;
+    if (prefixIsChain(prefix)) ret |= 1 << SIG16_FLAG_SHIFT;
+    return ret;
+}
+
+// fold a full instruction signature into the compact 16bit format, 
+// the same value as computing the compact signature of the instruction directly
+Signature16 compactSignature(const Signature sig) {
+    const auto prefix = static_cast<InstructionPrefix>((sig >> SIG_PREFIX_SHIFT) & SIG_PREFIX_MASK);
+    const auto iclass = static_cast<InstructionClass>((sig >> SIG_CLASS_SHIFT) & SIG_CLASS_MASK);
+    const auto
+        op1 = static_cast<OperandType>((sig >> SIG_OP1_SHIFT) & SIG_OPERAND_MASK),
+        op2 = static_cast<OperandType>(sig & SIG_OPERAND_MASK);
+    if (prefix > PRF_CHAIN_REPZ || iclass > INS_IDIV || op1 > OPR_IMM32 || op2 > OPR_IMM32) throw RangeError("Invalid instruction signature: " + hexVal(sig));
+    return makeSignature16(prefix, iclass, op1, op2);
+}
+
+Signature Instruction::signature() const {
+    return makeSignature(prefix, iclass, op1.type, op2.type);
+}
+
+Signature16 Instruction::signature16() const {
+    return makeSignature16(prefix, iclass, op1.type, op2.type);
+}
+
 InstructionMatch Instruction::match(const Instruction &other) const {
     // normally we check whether instructions match in their "class", e.g. MOV, not whether they
     // have the same opcode. An exception are conditional jumps, which all belong to class JMP_IF,
@@ -732,130 +1086,13 @@ InstructionMatch Instruction::match(const Instruction &other) const {
     return INS_MATCH_FULL;
 }
 
-// lookup table for converting modrm mod and mem values into OperandType
-static const OperandType MODRM_BYTE_MEM_OP[4][8] = {
-    OPR_MEM_BX_SI,       OPR_MEM_BX_DI,       OPR_MEM_BP_SI,       OPR_MEM_BP_DI,       OPR_MEM_SI,       OPR_MEM_DI,       OPR_MEM_OFF16,    OPR_MEM_BX,       // mod 00 (no displacement)
-    OPR_MEM_BX_SI_OFF8,  OPR_MEM_BX_DI_OFF8,  OPR_MEM_BP_SI_OFF8,  OPR_MEM_BP_DI_OFF8,  OPR_MEM_SI_OFF8,  OPR_MEM_DI_OFF8,  OPR_MEM_BP_OFF8,  OPR_MEM_BX_OFF8,  // mod 01 (8bit displacement)
-    OPR_MEM_BX_SI_OFF16, OPR_MEM_BX_DI_OFF16, OPR_MEM_BP_SI_OFF16, OPR_MEM_BP_DI_OFF16, OPR_MEM_SI_OFF16, OPR_MEM_DI_OFF16, OPR_MEM_BP_OFF16, OPR_MEM_BX_OFF16, // mod 10 (16bit displacement)
-    OPR_REG_AL,          OPR_REG_CL,          OPR_REG_DL,          OPR_REG_BL,          OPR_REG_AH,       OPR_REG_CH,       OPR_REG_DH,       OPR_REG_BH,       // mod 11 (register)
-};
-
-static const OperandType MODRM_WORD_MEM_OP[4][8] = {
-    OPR_MEM_BX_SI,       OPR_MEM_BX_DI,       OPR_MEM_BP_SI,       OPR_MEM_BP_DI,       OPR_MEM_SI,       OPR_MEM_DI,       OPR_MEM_OFF16,    OPR_MEM_BX,       // mod 00 (no displacement)
-    OPR_MEM_BX_SI_OFF8,  OPR_MEM_BX_DI_OFF8,  OPR_MEM_BP_SI_OFF8,  OPR_MEM_BP_DI_OFF8,  OPR_MEM_SI_OFF8,  OPR_MEM_DI_OFF8,  OPR_MEM_BP_OFF8,  OPR_MEM_BX_OFF8,  // mod 01 (8bit displacement)
-    OPR_MEM_BX_SI_OFF16, OPR_MEM_BX_DI_OFF16, OPR_MEM_BP_SI_OFF16, OPR_MEM_BP_DI_OFF16, OPR_MEM_SI_OFF16, OPR_MEM_DI_OFF16, OPR_MEM_BP_OFF16, OPR_MEM_BX_OFF16, // mod 10 (16bit displacement)
-    OPR_REG_AX,          OPR_REG_CX,          OPR_REG_DX,          OPR_REG_BX,          OPR_REG_SP,       OPR_REG_BP,       OPR_REG_SI,       OPR_REG_DI,       // mod 11 (register)
-};
-
-static const OperandType MODRM_MEM_OP[4][8] = {
-    OPR_MEM_BX_SI,       OPR_MEM_BX_DI,       OPR_MEM_BP_SI,       OPR_MEM_BP_DI,       OPR_MEM_SI,       OPR_MEM_DI,       OPR_MEM_OFF16,    OPR_MEM_BX,       // mod 00 (no displacement)
-    OPR_MEM_BX_SI_OFF8,  OPR_MEM_BX_DI_OFF8,  OPR_MEM_BP_SI_OFF8,  OPR_MEM_BP_DI_OFF8,  OPR_MEM_SI_OFF8,  OPR_MEM_DI_OFF8,  OPR_MEM_BP_OFF8,  OPR_MEM_BX_OFF8,  // mod 01 (8bit displacement)
-    OPR_MEM_BX_SI_OFF16, OPR_MEM_BX_DI_OFF16, OPR_MEM_BP_SI_OFF16, OPR_MEM_BP_DI_OFF16, OPR_MEM_SI_OFF16, OPR_MEM_DI_OFF16, OPR_MEM_BP_OFF16, OPR_MEM_BX_OFF16, // mod 10 (16bit displacement)
-    OPR_ERR,             OPR_ERR,             OPR_ERR,             OPR_ERR,             OPR_ERR,          OPR_ERR,          OPR_ERR,          OPR_ERR,          // mod 11 (register)
-};
-
-static const OperandType MODRM_BYTE_REG_OP[8] = {
-    OPR_REG_AL, OPR_REG_CL, OPR_REG_DL, OPR_REG_BL, OPR_REG_AH, OPR_REG_CH, OPR_REG_DH, OPR_REG_BH,
-};
-
-static const OperandType MODRM_WORD_REG_OP[8] = {
-    OPR_REG_AX, OPR_REG_CX, OPR_REG_DX, OPR_REG_BX, OPR_REG_SP, OPR_REG_BP, OPR_REG_SI, OPR_REG_DI,
-};
-
-static const OperandType MODRM_SEGREG_OP[8] = {
-    OPR_REG_ES, OPR_REG_CS, OPR_REG_SS, OPR_REG_DS, OPR_ERR, OPR_ERR, OPR_ERR, OPR_ERR,
-};
-
-OperandType Instruction::getModrmOperand(const Byte modrm, const ModrmOperand op) {
-    OperandType ret = OPR_NONE;
-    const Byte 
-        modVal = modrm_mod(modrm) >> MODRM_MOD_SHIFT,
-        regVal = modrm_reg(modrm) >> MODRM_REG_SHIFT,
-        mem = modrm_mem(modrm);
-
-    switch (op) {
-    case MODRM_NONE: break;
-    case MODRM_Eb: ret = MODRM_BYTE_MEM_OP[modVal][mem]; break;
-    case MODRM_Gb: ret = MODRM_BYTE_REG_OP[regVal]; break;
-    case MODRM_Ib: ret = OPR_IMM8; break;
-    case MODRM_Ev: ret = MODRM_WORD_MEM_OP[modVal][mem]; break;    
-    case MODRM_Gv: ret = MODRM_WORD_REG_OP[regVal]; break;
-    case MODRM_Iv: ret = OPR_IMM16; break;
-    case MODRM_Sw: ret = MODRM_SEGREG_OP[regVal]; break;
-    case MODRM_M:  
-    case MODRM_Mp: ret = MODRM_MEM_OP[modVal][mem]; break;
-    case MODRM_1:  ret = OPR_IMM1; break;
-    case MODRM_CL: ret = OPR_REG_CL; break;
-    default: 
-        return OPR_ERR;
-    }
-    return ret;
-}
-
 Size Instruction::loadImmediate(Operand &op, const Byte *data) {
-    DWord dwordVal;
-    Word wordVal;
-    Byte byteVal;
-    Size size = 0;
-
-    switch (op.type) {
-    case OPR_MEM_OFF8:
-    case OPR_MEM_BX_SI_OFF8:
-    case OPR_MEM_BX_DI_OFF8:
-    case OPR_MEM_BP_SI_OFF8:
-    case OPR_MEM_BP_DI_OFF8:
-    case OPR_MEM_SI_OFF8:
-    case OPR_MEM_DI_OFF8:
-    case OPR_MEM_BP_OFF8:
-    case OPR_MEM_BX_OFF8:
-    case OPR_IMM8:
-        size = sizeof(Byte);
-        memcpy(&byteVal, data, size);
-        op.immval.u8 = byteVal;
-        op.immsize = OPRSZ_BYTE;
-        debug("8bit operand, value = "s + hexVal(op.immval.u8) + ", instruction length = " + to_string(length + size));
-        break;
-    case OPR_MEM_OFF16:
-    case OPR_MEM_BX_SI_OFF16:
-    case OPR_MEM_BX_DI_OFF16:
-    case OPR_MEM_BP_SI_OFF16:
-    case OPR_MEM_BP_DI_OFF16:
-    case OPR_MEM_SI_OFF16:
-    case OPR_MEM_DI_OFF16:
-    case OPR_MEM_BP_OFF16:
-    case OPR_MEM_BX_OFF16:
-    case OPR_IMM16:
-        size = sizeof(Word);
-        memcpy(&wordVal, data, size);
-        op.immval.u16 = wordVal;
-        op.immsize = OPRSZ_WORD;
-        debug("16bit operand, value = "s + hexVal(op.immval.u16) + ", instruction length = " + to_string(length + size));
-        break;    
-    case OPR_IMM0:
-        op.immval.u32 = 0;
-        op.immsize = OPRSZ_NONE;
-        debug("imm0 operand");
-        break;
-    case OPR_IMM1:
-        op.immval.u32 = 1;
-        op.immsize = OPRSZ_NONE;
-        debug("imm1 operand");
-        break;    
-    case OPR_IMM32:
-        size = sizeof(DWord);
-        memcpy(&dwordVal, data, size);
-        op.immval.u32 = dwordVal;
-        op.immsize = OPRSZ_DWORD;
-        debug("32bit immediate = "s + hexVal(op.immval.u32) + ", instruction length = " + to_string(length + size));
-        break;
-    default:
-        // register and memory operands with no displacement
-        debug("direct or no operand, immval = 0");
-        op.immval.u32 = 0; 
-        op.immsize = OPRSZ_NONE;
-        break;
-    }
-    return size;
+    const ImmediateDesc &imm = IMMEDIATE_DESC[op.type];
+    // TODO: assumes little-endian
+    op.immval.u32 = imm.value;
+    memcpy(&op.immval, data, imm.length);
+    op.immsize = imm.size;
+    return imm.length;
 }
 
 const Instruction::Operand* Instruction::memOperand() const {
@@ -898,8 +1135,8 @@ Address Instruction::Operand::farAddr() const {
    return {segment, offset};
 }
 
-ByteString Instruction::Operand::immediateValue() const {
-    ByteString value;
+std::vector<Byte> Instruction::Operand::immediateValue() const {
+    std::vector<Byte> value;
     // TODO: assumes little-endian
     // also, could probably put this in the immval union and skip the memcpy, but unions are quirky in c++
     Byte data[sizeof(DWord)];
@@ -922,8 +1159,8 @@ ByteString Instruction::Operand::immediateValue() const {
     }
     auto dataBegin = std::begin(data);
     auto dataEnd = dataBegin + dataSize;
-    value = ByteString(dataBegin, dataEnd);
-    debug("Found immediate value, bytes: " + hexJoin(value));
+    value = std::vector<Byte>(dataBegin, dataEnd);
+    debug("Found immediate value, bytes: " + bytesToHex(value));
     return value;
 }
 
@@ -944,6 +1181,36 @@ InstructionClass instr_class(const Byte opcode) {
     return OPCODE_CLASS[opcode];
 }
 
+PackedInstruction::PackedInstruction(const Instruction &i) :
+    opcode(i.opcode),
+    length(i.length),
+    iclass(static_cast<Byte>(i.iclass)),
+    prefix(static_cast<Byte>(i.prefix)),
+    type1(i.op1.type),
+    type2(i.op2.type),
+    sizes(static_cast<Byte>(i.op1.size | (i.op2.size << 4))),
+    immsizes(static_cast<Byte>(i.op1.immsize | (i.op2.immsize << 4))),
+    imm1(i.op1.immval.u32),
+    imm2(i.op2.immval.u16)
+{
+}
+
+Signature PackedInstruction::signature() const {
+    return makeSignature(static_cast<InstructionPrefix>(prefix), static_cast<InstructionClass>(iclass), type1, type2);
+}
+
+Signature16 PackedInstruction::signature16() const {
+    return makeSignature16(static_cast<InstructionPrefix>(prefix), static_cast<InstructionClass>(iclass), type1, type2);
+}
+
+// render the text of the instruction into a caller-supplied buffer without allocating, truncating if necessary, returns the length of the text
+Size PackedInstruction::render(const Address &addr, char *buf, const Size bufSize, const bool extended) const {
+    if (bufSize == 0) return 0;
+    TextBuffer out{buf, bufSize};
+    Instruction{addr, *this, nullptr}.format(out, extended);
+    return out.size();
+}
+
 const char* instr_class_name(const InstructionClass iclass) {
     return INS_CLASS_ID[iclass];
 }
@@ -12,6 +12,9 @@
 using namespace std;
 
 enum Interrupt : Byte {
+    INT_VIDEO = 0x10,
+    INT_KEYBOARD = 0x16,
+    INT_TIMER = 0x1a,
     INT_DOS_TERMINATE = 0x20,
     INT_DOS = 0x21,
 };
@@ -20,33 +23,439 @@ void intMessage(const string &msg) {
     output(msg, LOG_INTERRUPT, LOG_INFO);
 }
 
+static void intDebug(const string &msg) {
+    output(msg, LOG_INTERRUPT, LOG_DEBUG);
+}
+
+// key code returned when the program insists on reading a key: enter, which gets most prompts out of the way
+static constexpr Word KEY_DEFAULT = 0x1c0d;
+// the BIOS timer runs at 1193180 / 65536 ticks per second, and wraps around at midnight
+static constexpr DWord TICKS_PER_DAY = 0x1800b0;
+
+enum Port : Word {
+    PORT_PIT_COUNTER0 = 0x40,
+    PORT_KBD_DATA = 0x60,
+    PORT_VGA_STATUS = 0x3da,
+};
+// bits of the input status register of the video card
+static constexpr Byte VGA_DISPLAY_OFF = 0x01, VGA_VRETRACE = 0x08;
+
+Byte InterruptInterface::portIn(const Word port) {
+    throw InterruptError("Port input not supported: "s + hexVal(port));
+}
+
+void InterruptInterface::portOut(const Word port, const Byte) {
+    throw InterruptError("Port output not supported: "s + hexVal(port));
+}
+
 IntStatus InterruptHandler::interrupt(const Byte num, Registers &regs) {
-    const Byte 
-        funcHi = regs.get(REG_AH), 
+    const Byte
+        funcHi = regs.get(REG_AH),
         funcLo = regs.get(REG_AL);
     switch (num) {
+    case INT_VIDEO:
+        videoFunction(funcHi, funcLo, regs);
+        return INT_OK;
+    case INT_KEYBOARD:
+        keyboardFunction(funcHi, regs);
+        return INT_OK;
+    case INT_TIMER:
+        timerFunction(funcHi, regs);
+        return INT_OK;
     case INT_DOS_TERMINATE:
         return INT_TERMINATE;
     case INT_DOS:
-        dosFunction(funcHi, funcLo, regs);
-        return INT_OK;
+        return dosFunction(funcHi, funcLo, regs);
     default:
         throw InterruptError("Interrupt not implemented: "s + hexVal(num) + " at " + regs.csip().toString());
     }
 }
 
 enum DosFunction : Byte {
+    DOS_TERMINATE = 0x00,
+    DOS_READ_CHAR_ECHO = 0x01,
+    DOS_WRITE_CHAR = 0x02,
+    DOS_CONSOLE_IO = 0x06,
+    DOS_READ_CHAR_RAW = 0x07,
+    DOS_READ_CHAR = 0x08,
+    DOS_WRITE_STRING = 0x09,
+    DOS_READ_LINE = 0x0a,
+    DOS_INPUT_STATUS = 0x0b,
+    DOS_SELECT_DRIVE = 0x0e,
+    DOS_CURRENT_DRIVE = 0x19,
+    DOS_SET_DTA = 0x1a,
+    DOS_SET_VECTOR = 0x25,
+    DOS_GET_DATE = 0x2a,
+    DOS_GET_TIME = 0x2c,
+    DOS_GET_DTA = 0x2f,
     DOS_VERSION = 0x30,
+    DOS_CTRL_BREAK = 0x33,
+    DOS_GET_VECTOR = 0x35,
+    DOS_CHDIR = 0x3b,
+    DOS_CREATE = 0x3c,
+    DOS_OPEN = 0x3d,
+    DOS_CLOSE = 0x3e,
+    DOS_READ = 0x3f,
+    DOS_WRITE = 0x40,
+    DOS_DELETE = 0x41,
+    DOS_SEEK = 0x42,
+    DOS_ATTRIBUTES = 0x43,
+    DOS_IOCTL = 0x44,
+    DOS_GET_CWD = 0x47,
+    DOS_ALLOC = 0x48,
+    DOS_FREE = 0x49,
+    DOS_RESIZE = 0x4a,
+    DOS_EXIT = 0x4c,
+    DOS_RETURN_CODE = 0x4d,
+    DOS_FIND_FIRST = 0x4e,
+    DOS_FIND_NEXT = 0x4f,
+    DOS_GET_PSP = 0x51,
+    DOS_GET_PSP2 = 0x62,
 };
 
-void InterruptHandler::dosFunction(const Byte funcHi, const Byte funcLo, Registers &regs) {
+// DOS functions report failure with the carry flag set and the error code in ax
+void InterruptHandler::dosResult(const Word error, Registers &regs) const {
+    regs.setFlag(FLAG_CARRY, error != DOSERR_NONE);
+    if (error != DOSERR_NONE) {
+        intDebug("DOS function " + hexVal(regs.get(REG_AH)) + " failed with error " + hexVal(error));
+        regs.set(REG_AX, error);
+    }
+}
+
+static Byte readConsole(istream &in) {
+    const int c = in.get();
+    return c == EOF ? '\r' : (c == '\n' ? '\r' : static_cast<Byte>(c));
+}
+
+IntStatus InterruptHandler::dosFunction(const Byte funcHi, const Byte funcLo, Registers &regs) {
+    const Address dsdx{regs.get(REG_DS), regs.get(REG_DX)};
+    Word error = DOSERR_NONE, value = 0;
     switch (funcHi)
     {
+    case DOS_TERMINATE:
+        dos_->setExitCode(0);
+        return INT_EXIT;
+    case DOS_READ_CHAR_ECHO:
+        regs.set(REG_AL, readConsole(dos_->consoleIn()));
+        dos_->consoleOut().put(regs.get(REG_AL));
+        break;
+    case DOS_WRITE_CHAR:
+        dos_->consoleOut().put(regs.get(REG_DL));
+        regs.set(REG_AL, regs.get(REG_DL));
+        break;
+    case DOS_CONSOLE_IO:
+        // input never has a key available
+        if (regs.get(REG_DL) == 0xff) {
+            regs.setFlag(FLAG_ZERO, true);
+            regs.set(REG_AL, 0);
+        }
+        else dos_->consoleOut().put(regs.get(REG_DL));
+        break;
+    case DOS_READ_CHAR_RAW:
+    case DOS_READ_CHAR:
+        regs.set(REG_AL, readConsole(dos_->consoleIn()));
+        break;
+    case DOS_WRITE_STRING:
+        dos_->consoleOut() << dos_->readString(dsdx, '$', 0x10000);
+        regs.set(REG_AL, '$');
+        break;
+    case DOS_READ_LINE: {
+        // buffer holds the capacity, followed by the count of characters read and the characters up to a carriage return
+        const string cap = dos_->readString(dsdx, '\0', 1);
+        const Byte capacity = cap.empty() ? 0 : static_cast<Byte>(cap[0]);
+        string line;
+        if (capacity) getline(dos_->consoleIn(), line);
+        line = line.substr(0, capacity ? capacity - 1 : 0);
+        dos_->consoleOut() << line << endl;
+        dos_->writeString(Address{dsdx.segment, static_cast<Word>(dsdx.offset + 1)}, string(1, static_cast<char>(line.size())) + line + '\r');
+        break;
+    }
+    case DOS_INPUT_STATUS:
+        regs.set(REG_AL, 0);
+        break;
+    case DOS_SELECT_DRIVE:
+        regs.set(REG_AL, 3);
+        break;
+    case DOS_CURRENT_DRIVE:
+        regs.set(REG_AL, 2);
+        break;
+    case DOS_SET_DTA:
+        dos_->setDta(dsdx);
+        break;
+    case DOS_SET_VECTOR:
+        dos_->setVector(funcLo, dsdx);
+        break;
+    case DOS_GET_DATE:
+        // fixed date for reproducible runs, monday 1st of january 1990
+        regs.set(REG_CX, 1990);
+        regs.set(REG_DX, 0x0101);
+        regs.set(REG_AL, 1);
+        break;
+    case DOS_GET_TIME: {
+        const DWord t = ticks_;
+        setTicks(t + 1);
+        const DWord centis = static_cast<DWord>(static_cast<uint64_t>(t % TICKS_PER_DAY) * 6553600 / 1193180);
+        regs.set(REG_CH, centis / 360000);
+        regs.set(REG_CL, centis / 6000 % 60);
+        regs.set(REG_DH, centis / 100 % 60);
+        regs.set(REG_DL, centis % 100);
+        break;
+    }
+    case DOS_GET_DTA:
+        regs.set(REG_ES, dos_->dta().segment);
+        regs.set(REG_BX, dos_->dta().offset);
+        break;
     case DOS_VERSION:
         regs.set(REG_AL, static_cast<Byte>(dos_->version()));
         regs.set(REG_AH, 0);
         break;
+    case DOS_CTRL_BREAK:
+        if (funcLo == 0) regs.set(REG_DL, 0);
+        break;
+    case DOS_GET_VECTOR: {
+        const Address vec = dos_->getVector(funcLo);
+        regs.set(REG_ES, vec.segment);
+        regs.set(REG_BX, vec.offset);
+        break;
+    }
+    case DOS_CHDIR:
+        error = dos_->changeDir(dos_->readString(dsdx));
+        dosResult(error, regs);
+        break;
+    case DOS_CREATE:
+        error = dos_->createFile(dos_->readString(dsdx), value);
+        if (!error) regs.set(REG_AX, value);
+        dosResult(error, regs);
+        break;
+    case DOS_OPEN:
+        error = dos_->openFile(dos_->readString(dsdx), funcLo, value);
+        if (!error) regs.set(REG_AX, value);
+        dosResult(error, regs);
+        break;
+    case DOS_CLOSE:
+        dosResult(dos_->closeFile(regs.get(REG_BX)), regs);
+        break;
+    case DOS_READ:
+        error = dos_->readFile(regs.get(REG_BX), dsdx, regs.get(REG_CX), value);
+        if (!error) regs.set(REG_AX, value);
+        dosResult(error, regs);
+        break;
+    case DOS_WRITE:
+        error = dos_->writeFile(regs.get(REG_BX), dsdx, regs.get(REG_CX), value);
+        if (!error) regs.set(REG_AX, value);
+        dosResult(error, regs);
+        break;
+    case DOS_DELETE:
+        dosResult(dos_->removeFile(dos_->readString(dsdx)), regs);
+        break;
+    case DOS_SEEK: {
+        DWord pos = 0;
+        error = dos_->seekFile(regs.get(REG_BX), funcLo, static_cast<DWord>(regs.get(REG_CX)) << 16 | regs.get(REG_DX), pos);
+        if (!error) {
+            regs.set(REG_AX, pos & 0xffff);
+            regs.set(REG_DX, pos >> 16);
+        }
+        dosResult(error, regs);
+        break;
+    }
+    case DOS_ATTRIBUTES:
+        // setting the attributes is accepted and ignored
+        error = dos_->fileAttributes(dos_->readString(dsdx), value);
+        if (!error && funcLo == 0) regs.set(REG_CX, value);
+        dosResult(error, regs);
+        break;
+    case DOS_IOCTL:
+        if (funcLo == 0) {
+            error = dos_->deviceInfo(regs.get(REG_BX), value);
+            if (!error) regs.set(REG_DX, value);
+        }
+        else if (funcLo != 1) error = DOSERR_FUNCTION;
+        dosResult(error, regs);
+        break;
+    case DOS_GET_CWD:
+        dos_->writeString({regs.get(REG_DS), regs.get(REG_SI)}, dos_->currentDir());
+        dosResult(DOSERR_NONE, regs);
+        break;
+    case DOS_ALLOC: {
+        Word largest = 0;
+        error = dos_->allocMemory(regs.get(REG_BX), value, largest);
+        if (error) regs.set(REG_BX, largest);
+        else regs.set(REG_AX, value);
+        dosResult(error, regs);
+        break;
+    }
+    case DOS_FREE:
+        dosResult(dos_->freeMemory(regs.get(REG_ES)), regs);
+        break;
+    case DOS_RESIZE:
+        error = dos_->resizeMemory(regs.get(REG_ES), regs.get(REG_BX), value);
+        if (error == DOSERR_NO_MEMORY) regs.set(REG_BX, value);
+        dosResult(error, regs);
+        break;
+    case DOS_EXIT:
+        dos_->setExitCode(funcLo);
+        intMessage("Program exited with code " + to_string(funcLo));
+        return INT_EXIT;
+    case DOS_RETURN_CODE:
+        regs.set(REG_AX, 0);
+        break;
+    case DOS_FIND_FIRST:
+        dosResult(dos_->findFirst(dos_->readString(dsdx), regs.get(REG_CL)), regs);
+        break;
+    case DOS_FIND_NEXT:
+        dosResult(dos_->findNext(), regs);
+        break;
+    case DOS_GET_PSP:
+    case DOS_GET_PSP2:
+        regs.set(REG_BX, dos_->pspSegment());
+        break;
     default:
         throw InterruptError("DOS interrupt function not implemented: "s + hexVal(funcHi) + "/" + hexVal(funcLo));
     }
-}
\ No newline at end of file
+    return INT_OK;
+}
+
+enum VideoFunction : Byte {
+    VIDEO_CURSOR_POS = 0x03,
+    VIDEO_TELETYPE = 0x0e,
+    VIDEO_GET_MODE = 0x0f,
+    VIDEO_EGA_INFO = 0x12,
+    VIDEO_DISPLAY_COMBINATION = 0x1a,
+};
+
+// report a color text mode on a VGA, anything else which only sets up the display is ignored
+void InterruptHandler::videoFunction(const Byte funcHi, const Byte funcLo, Registers &regs) {
+    switch (funcHi) {
+    case VIDEO_CURSOR_POS:
+        regs.set(REG_CX, 0x0607);
+        regs.set(REG_DX, 0);
+        break;
+    case VIDEO_TELETYPE:
+        dos_->consoleOut().put(funcLo);
+        break;
+    case VIDEO_GET_MODE:
+        regs.set(REG_AL, 0x3);
+        regs.set(REG_AH, 80);
+        regs.set(REG_BH, 0);
+        break;
+    case VIDEO_EGA_INFO:
+        if (regs.get(REG_BL) == 0x10) regs.set(REG_BX, 0x0003);
+        break;
+    case VIDEO_DISPLAY_COMBINATION:
+        if (funcLo == 0) {
+            regs.set(REG_AL, 0x1a);
+            regs.set(REG_BX, 0x0008);
+        }
+        break;
+    default:
+        intDebug("Ignoring video function " + hexVal(funcHi));
+        break;
+    }
+}
+
+enum KeyboardFunction : Byte {
+    KEYB_READ = 0x00,
+    KEYB_STATUS = 0x01,
+    KEYB_SHIFT = 0x02,
+    KEYB_READ_EXT = 0x10,
+    KEYB_STATUS_EXT = 0x11,
+    KEYB_SHIFT_EXT = 0x12,
+};
+
+void InterruptHandler::keyboardFunction(const Byte funcHi, Registers &regs) {
+    switch (funcHi) {
+    case KEYB_READ:
+    case KEYB_READ_EXT:
+        regs.set(REG_AX, KEY_DEFAULT);
+        break;
+    case KEYB_STATUS:
+    case KEYB_STATUS_EXT:
+        regs.setFlag(FLAG_ZERO, true);
+        break;
+    case KEYB_SHIFT:
+    case KEYB_SHIFT_EXT:
+        regs.set(REG_AX, 0);
+        break;
+    default:
+        intDebug("Ignoring keyboard function " + hexVal(funcHi));
+        break;
+    }
+}
+
+enum TimerFunction : Byte {
+    TIMER_GET_TICKS = 0x00,
+    TIMER_SET_TICKS = 0x01,
+};
+
+void InterruptHandler::timerFunction(const Byte funcHi, Registers &regs) {
+    switch (funcHi) {
+    case TIMER_GET_TICKS: {
+        const DWord t = ticks_;
+        setTicks(t + 1);
+        regs.set(REG_CX, (t % TICKS_PER_DAY) >> 16);
+        regs.set(REG_DX, (t % TICKS_PER_DAY) & 0xffff);
+        regs.set(REG_AL, (t / TICKS_PER_DAY) != (ticks_ / TICKS_PER_DAY) ? 1 : 0);
+        break;
+    }
+    case TIMER_SET_TICKS:
+        setTicks(static_cast<DWord>(regs.get(REG_CX)) << 16 | regs.get(REG_DX));
+        break;
+    default:
+        // no real time clock
+        regs.setFlag(FLAG_CARRY, true);
+        break;
+    }
+}
+
+void InterruptHandler::setTicks(const DWord ticks) {
+    ticks_ = ticks;
+    Memory *mem = dos_->memory();
+    const DWord t = ticks_ % TICKS_PER_DAY;
+    mem->writeWord(BDA_TICKS, t & 0xffff);
+    mem->writeWord(BDA_TICKS + 2, t >> 16);
+}
+
+Byte InterruptHandler::portIn(const Word port) {
+    switch (port) {
+    case PORT_PIT_COUNTER0: {
+        // counts down from 0xffff over a tick, read low byte first
+        const Word count = 0xffff - (clock_ % TICK_INSTRUCTIONS) * 0x10000 / TICK_INSTRUCTIONS;
+        const bool high = pitHigh_;
+        pitHigh_ = !pitHigh_;
+        return high ? count >> 8 : count & 0xff;
+    }
+    case PORT_KBD_DATA:
+        // no keys are ever pressed
+        return 0;
+    case PORT_VGA_STATUS:
+        return clock_ % FRAME_INSTRUCTIONS >= FRAME_INSTRUCTIONS - RETRACE_INSTRUCTIONS ? VGA_VRETRACE | VGA_DISPLAY_OFF : 0;
+    }
+    auto it = ports_.find(port);
+    if (it != ports_.end()) return it->second;
+    intDebug("Read from unknown port " + hexVal(port));
+    return 0xff;
+}
+
+void InterruptHandler::portOut(const Word port, const Byte value) {
+    intDebug("Write " + hexVal(value) + " to port " + hexVal(port));
+    ports_[port] = value;
+}
+
+void InterruptHandler::elapse(const Size instructions) {
+    const Size ticks = (clock_ + instructions) / TICK_INSTRUCTIONS - clock_ / TICK_INSTRUCTIONS;
+    clock_ += instructions;
+    if (ticks) setTicks(ticks_ + static_cast<DWord>(ticks));
+}
+
+// Polling the status of the video card waits for the next edge of the vertical retrace. Nothing else changes by itself,
+// except for the time, so any other loop gets to see the next tick of the timer.
+Size InterruptHandler::skipIdle(const std::optional<Word> port) {
+    Size skip;
+    if (port && *port == PORT_VGA_STATUS) {
+        const Size phase = clock_ % FRAME_INSTRUCTIONS, retrace = FRAME_INSTRUCTIONS - RETRACE_INSTRUCTIONS;
+        skip = phase < retrace ? retrace - phase : FRAME_INSTRUCTIONS - phase;
+    }
+    else skip = TICK_INSTRUCTIONS - clock_ % TICK_INSTRUCTIONS;
+    elapse(skip);
+    return skip;
+}
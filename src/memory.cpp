@@ -2,6 +2,11 @@
 #include <fstream>
 #include <sstream>
 #include <cstring>
+#include <cstdio>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include "dos/memory.h"
 #include "dos/error.h"
@@ -13,20 +18,133 @@ using namespace std;
 
 OUTPUT_CONF(LOG_MEMORY)
 
-Memory::Memory() : break_(INIT_BREAK) {
-    const Byte pattern[] = { 0xde, 0xad, 0xbe, 0xef };
-    
-    for (Offset i = 0, j = 0; i < MEM_TOTAL; ++i) {
-        // initialize memory data with initial pattern
-        data_[i] = pattern[j];
-        if (++j >= sizeof pattern) j = 0;
+static const Byte FILL_PATTERN[] = { 0xde, 0xad, 0xbe, 0xef };
+
+static void fillPattern(Byte *data, const Size size) {
+    for (Size i = 0; i < size; ++i) data[i] = FILL_PATTERN[i % sizeof FILL_PATTERN];
+}
+
+#ifndef _WIN32
+// the mapping extends a host page past the end of memory, so that reading a word at the last byte does not fault
+static Size mappingSize() {
+    static const Size size = MEM_TOTAL + sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+// unlinked temporary file with the fill pattern, created on first use and closed at exit; the mappings outlive it
+class PatternFile {
+    FILE *file_;
+public:
+    PatternFile() : file_(tmpfile()) {
+        if (!file_) return;
+        vector<Byte> data(mappingSize());
+        fillPattern(data.data(), data.size());
+        if (fwrite(data.data(), 1, data.size(), file_) != data.size() || fflush(file_) != 0) {
+            fclose(file_);
+            file_ = nullptr;
+        }
     }
+    ~PatternFile() { if (file_) fclose(file_); }
+    PatternFile(const PatternFile&) = delete;
+    PatternFile& operator=(const PatternFile&) = delete;
+    int descriptor() const { return file_ ? fileno(file_) : -1; }
+};
+
+// a private mapping of the pattern file, whose pages are only copied when written;
+// if the file could not be created, fall back to anonymous memory filled with the pattern up front
+static Byte* allocMemory() {
+    static const PatternFile pattern;
+    const int fd = pattern.descriptor();
+    void *ptr = fd >= 0 ? mmap(nullptr, mappingSize(), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if (ptr != MAP_FAILED) return static_cast<Byte*>(ptr);
+    ptr = mmap(nullptr, mappingSize(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) throw MemoryError("Unable to map "s + to_string(mappingSize()) + " bytes for the emulated memory");
+    Byte *data = static_cast<Byte*>(ptr);
+    fillPattern(data, mappingSize());
+    return data;
+}
+
+static void freeMemory(Byte *data) {
+    if (data) munmap(data, mappingSize());
+}
+#else
+// without mmap, a plain buffer filled with the pattern up front, with room past the end for reading a word at the last byte
+static constexpr Size BUFFER_SIZE = MEM_TOTAL + sizeof(Word);
+
+static Byte* allocMemory() {
+    Byte *data = new Byte[BUFFER_SIZE];
+    fillPattern(data, BUFFER_SIZE);
+    return data;
+}
+
+static void freeMemory(Byte *data) {
+    delete[] data;
+}
+#endif
+
+// snapshot page for the pages never written, shared by all of them
+static const shared_ptr<const MemoryPage>& patternPage() {
+    static const shared_ptr<const MemoryPage> page = [] {
+        auto ret = make_shared<MemoryPage>();
+        fillPattern(ret->data(), ret->size());
+        return ret;
+    }();
+    return page;
+}
+
+Memory::Memory() : data_(allocMemory()), break_(INIT_BREAK), codeWriteLow_(MEM_TOTAL), codeWriteHigh_(0), writeLog_(nullptr) {
 }
 
 Memory::Memory(const Word segment, const Byte *data, const Size size) : Memory() {
     writeBuf(SEG_TO_OFFSET(segment), data, size);
 }
 
+// a new instance with the contents of the snapshot, which keeps sharing its pages until they are written
+Memory::Memory(const MemorySnapshot &snap) : data_(nullptr), break_(snap.break_), codeWriteLow_(MEM_TOTAL), codeWriteHigh_(0), writeLog_(nullptr) {
+    if (!snap.isValid()) throw MemoryError("Unable to create memory from an invalid snapshot");
+    data_ = allocMemory();
+    for (Size page = 0; page < MEM_PAGE_COUNT; ++page) {
+        origin_[page] = snap.pages_[page];
+        if (snap.pages_[page] == patternPage()) continue;
+        copy(snap.pages_[page]->begin(), snap.pages_[page]->end(), data_ + page * MEM_PAGE_SIZE);
+        touched_.set(page);
+    }
+}
+
+Memory::Memory(const Memory &other) : data_(allocMemory()), break_(other.break_), touched_(other.touched_), codeBits_(other.codeBits_),
+    codeWriteLow_(other.codeWriteLow_), codeWriteHigh_(other.codeWriteHigh_), origin_(other.origin_), dirty_(other.dirty_), writeLog_(nullptr)
+{
+    copyPages(other);
+}
+
+Memory& Memory::operator=(const Memory &other) {
+    if (this == &other) return *this;
+    // start over from a fresh mapping, the pages written here but not in the other one need to go back to the pattern
+    Byte *data = allocMemory();
+    freeMemory(data_);
+    data_ = data;
+    break_ = other.break_;
+    touched_ = other.touched_;
+    codeBits_ = other.codeBits_;
+    codeWriteLow_ = other.codeWriteLow_;
+    codeWriteHigh_ = other.codeWriteHigh_;
+    origin_ = other.origin_;
+    dirty_ = other.dirty_;
+    writeLog_ = nullptr;
+    copyPages(other);
+    return *this;
+}
+
+Memory::~Memory() {
+    freeMemory(data_);
+}
+
+void Memory::copyPages(const Memory &other) {
+    for (Size page = 0; page < MEM_PAGE_COUNT; ++page) {
+        if (other.touched_[page]) memcpy(data_ + page * MEM_PAGE_SIZE, other.data_ + page * MEM_PAGE_SIZE, MEM_PAGE_SIZE);
+    }
+}
+
 void Memory::allocBlock(const Size para) {
     const Size size = para * PARAGRAPH_SIZE;
     if (break_ + size <= MEM_END)
@@ -49,7 +167,7 @@ Byte Memory::readByte(const Offset addr) const {
 }
 
 Word Memory::readWord(const Offset addr) const {
-    if (addr >= MEM_TOTAL) throw MemoryError(std::string("Read word outside memory bounds"));
+    if (addr + sizeof(Word) > MEM_TOTAL) throw MemoryError(std::string("Read word outside memory bounds"));
     Word ret;
     memcpy(&ret, &data_[addr], sizeof(ret));
     return ret;
@@ -57,47 +175,120 @@ Word Memory::readWord(const Offset addr) const {
 
 void Memory::writeByte(const Offset addr, const Byte value) {
     if (addr >= MEM_TOTAL) throw MemoryError(std::string("Byte write outside memory bounds"));
+    written(addr, sizeof(value));
     data_[addr] = value;
 }
 
 void Memory::writeWord(const Offset addr, const Word value) {
-    if (addr >= MEM_TOTAL) throw MemoryError(std::string("Word write outside memory bounds"));
+    if (addr + sizeof(Word) > MEM_TOTAL) throw MemoryError(std::string("Word write outside memory bounds"));
+    written(addr, sizeof(value));
     memcpy(&data_[addr], &value, sizeof(value));
 }
 
 void Memory::writeBuf(const Offset addr, const Byte *data, const Size size) {
     if (addr + size > MEM_TOTAL) throw MemoryError(std::string("Buffer write outside memory bounds"));
-    copy(data, data + size, begin(data_) + addr);
+    written(addr, size);
+    copy(data, data + size, data_ + addr);
+}
+
+// overlapping areas are handled as if the source was copied out to a temporary buffer first
+void Memory::copyBuf(const Offset dest, const Offset src, const Size size) {
+    if (dest + size > MEM_TOTAL || src + size > MEM_TOTAL) throw MemoryError(std::string("Buffer copy outside memory bounds"));
+    written(dest, size);
+    memmove(&data_[dest], &data_[src], size);
+}
+
+void Memory::fillBytes(const Offset addr, const Byte value, const Size count) {
+    if (addr + count > MEM_TOTAL) throw MemoryError(std::string("Byte fill outside memory bounds"));
+    written(addr, count);
+    memset(&data_[addr], value, count);
+}
+
+void Memory::fillWords(const Offset addr, const Word value, const Size count) {
+    if (addr + count * sizeof(Word) > MEM_TOTAL) throw MemoryError(std::string("Word fill outside memory bounds"));
+    written(addr, count * sizeof(Word));
+    const Byte lo = value & 0xff, hi = value >> 8;
+    if (lo == hi) {
+        memset(&data_[addr], lo, count * sizeof(Word));
+        return;
+    }
+    for (Size i = 0; i < count; ++i) memcpy(&data_[addr + i * sizeof(Word)], &value, sizeof(value));
 }
 
-// TODO: use std::search with custom predicate to cover -1 case
-Address Memory::find(const ByteString &pattern, Block where) const {
+Address Memory::find(const BytePattern &pattern, Block where) const {
     if (!where.isValid()) where = { {0}, {MEM_TOTAL - 1} };
     if (where.size() < pattern.size()) {
         debug("Block " + where.toString() + " too small to fit pattern of size " + to_string(pattern.size()));
         return {};
     }
     const Offset start = where.begin.toLinear();
-    const Offset end = std::min(where.end.toLinear(), MEM_TOTAL);
+    const Offset end = std::min(where.end.toLinear(), MEM_TOTAL - 1);
     if (start > end) throw AddressError("Invalid search range: " + where.toString());
-    const Size patSize = pattern.size();
-    debug("Searching for pattern of size " + sizeStr(patSize) + " within " + where.toString());
-    Address found;
-    vector<Byte> buffer(patSize);
-    for (Offset dataIdx = start; dataIdx + patSize - 1 <= end; ++dataIdx) {
-        std::copy(data_.begin() + dataIdx, data_.begin() + dataIdx + patSize, buffer.begin());
-        //debug("dataIdx = " + hexVal(dataIdx) + ", buffer: " + bytesToHex(buffer));
-        bool match = true;
-        // ouch, O(n^2)
-        for (Offset patIdx = 0; patIdx < pattern.size(); ++patIdx) {
-            const SWord pat = pattern[patIdx];
-            //debug(hexVal(pat, false) + " ");
-            if (pat == -1) continue;
-            if (pat != buffer[patIdx]) { match = false; break; }
+    debug("Searching for pattern of size " + sizeStr(pattern.size()) + " within " + where.toString());
+    const Size found = pattern.find(data_ + start, end - start + 1);
+    if (found == BytePattern::npos) return {};
+    return Address{start + found};
+}
+
+void Memory::trackCode(const Offset addr, const Size size) {
+    if (addr + size > MEM_TOTAL) throw MemoryError("Code tracking range outside memory bounds: " + hexVal(addr));
+    if (codeBits_.empty()) codeBits_.resize(MEM_TOTAL / 64, 0);
+    bitRange(addr, size, [this](const Size word, const uint64_t mask) { codeBits_[word] |= mask; });
+}
+
+void Memory::untrackCode(const Offset addr, const Size size) {
+    if (codeBits_.empty()) return;
+    if (addr + size > MEM_TOTAL) throw MemoryError("Code tracking range outside memory bounds: " + hexVal(addr));
+    bitRange(addr, size, [this](const Size word, const uint64_t mask) { codeBits_[word] &= ~mask; });
+}
+
+// extend the range of written code by the tracked bytes within the write, the untracked bytes around them do not count
+void Memory::codeWrite(const Offset addr, const Size size) {
+    bitRange(addr, size, [this](const Size word, const uint64_t mask) {
+        const uint64_t hit = codeBits_[word] & mask;
+        if (hit == 0) return;
+        codeWriteLow_ = std::min(codeWriteLow_, word * 64 + __builtin_ctzll(hit));
+        codeWriteHigh_ = std::max(codeWriteHigh_, word * 64 + 63 - __builtin_clzll(hit));
+    });
+}
+
+// capture the contents, only the pages written since the last snapshot or restore need to be copied, 
+// the rest are shared with the previous snapshot, or with the pattern page if they were never written
+MemorySnapshot Memory::snapshot() {
+    MemorySnapshot ret;
+    ret.pages_.resize(MEM_PAGE_COUNT);
+    ret.break_ = break_;
+    for (Size page = 0; page < MEM_PAGE_COUNT; ++page) {
+        if (!touched_[page]) origin_[page] = patternPage();
+        else if (dirty_[page] || !origin_[page]) {
+            auto copy = make_shared<MemoryPage>();
+            memcpy(copy->data(), &data_[page * MEM_PAGE_SIZE], MEM_PAGE_SIZE);
+            origin_[page] = std::move(copy);
         }
-        if (match) { found = Address{dataIdx}; break; }
+        ret.pages_[page] = origin_[page];
+    }
+    dirty_.reset();
+    debug("Created memory snapshot");
+    return ret;
+}
+
+// bring the contents back to the state of the snapshot, only the pages which differ from it are copied;
+// those still count as written for the purpose of code tracking
+void Memory::restore(const MemorySnapshot &snap) {
+    if (!snap.isValid()) throw MemoryError("Unable to restore memory from an invalid snapshot");
+    Size restored = 0;
+    for (Size page = 0; page < MEM_PAGE_COUNT; ++page) {
+        if (!dirty_[page] && origin_[page] == snap.pages_[page]) continue;
+        const Offset addr = page * MEM_PAGE_SIZE;
+        if (!codeBits_.empty()) codeWrite(addr, MEM_PAGE_SIZE);
+        memcpy(&data_[addr], snap.pages_[page]->data(), MEM_PAGE_SIZE);
+        origin_[page] = snap.pages_[page];
+        touched_.set(page);
+        restored++;
     }
-    return found;
+    dirty_.reset();
+    break_ = snap.break_;
+    debug("Restored memory snapshot, pages copied: " + to_string(restored));
 }
 
 string Memory::info() const {
@@ -145,7 +145,7 @@ Executable loadExe(const string &spec, const string &mapSpec, const Word segment
         // use location of provided hexa string as entrypoint, if found in the executable
         const string hexa = match[1].str();
         debug("Entrypoint search for location of '" + hexa + "'");
-        auto pattern = hexaToNumeric(hexa);
+        const BytePattern pattern{hexa};
         Address ep = exe.find(pattern);
         if (!ep.isValid()) fatal("Could not find pattern '" + hexa + "' in " + path);
         debug("Pattern found at " + ep.toString());
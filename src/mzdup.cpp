@@ -20,7 +20,8 @@ void usage() {
         << "--verbose:       show more detailed information about processed routines" << endl
         << "--debug:         show additional debug information" << endl
         << "--minsize count: don't search for duplicates of routines smaller than 'count' instructions (default: " << options.routineSizeThresh << ")" << endl
-        << "--maxdist ratio: how many instructions relative to its size can a routine differ by to still be reported as a duplicate (default: " << options.routineDistanceThresh << "%)";
+        << "--maxdist ratio: how many instructions relative to its size can a routine differ by to still be reported as a duplicate (default: " << options.routineDistanceThresh << "%)" << endl
+        << "--sig16:         match using compact 16bit signatures, faster but less precise (implied by a signature file saved with mzsig --sig16)";
     output(str.str(), LOG_OTHER, LOG_ERROR);
     exit(1);
 }
@@ -39,10 +40,12 @@ int main(int argc, char *argv[]) {
     Word loadSegment = 0x1000;
     string sigFilePath, tgtExePath, tgtMapPath;
     Size minSize = options.routineSizeThresh, maxDist = options.routineDistanceThresh;
+    bool compact = false;
     for (int aidx = 1; aidx < argc; ++aidx) {
         string arg(argv[aidx]);
         if (arg == "--debug") setOutputLevel(LOG_DEBUG);
         else if (arg == "--verbose") { setOutputLevel(LOG_VERBOSE); }
+        else if (arg == "--sig16") compact = true;
         else if (arg == "--minsize" && (aidx++ + 1 < argc)) {
             string minSizeStr(argv[aidx]);
             minSize = stoi(minSizeStr, nullptr, 10);
@@ -66,6 +69,7 @@ int main(int argc, char *argv[]) {
         options.routineSizeThresh = minSize;
         options.routineDistanceThresh = maxDist;
         SignatureLibrary sigs{sigFilePath};
+        if (compact) sigs.compact();
         MzImage tgtMz{tgtExePath, loadSegment};
         Executable tgt{tgtMz};
         CodeMap &tgtMap = tgt.map();
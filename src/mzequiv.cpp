@@ -0,0 +1,201 @@
+#include "dos/output.h"
+#include "dos/error.h"
+#include "dos/harness.h"
+#include "dos/pool.h"
+#include "dos/util.h"
+
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <random>
+#include <atomic>
+
+using namespace std;
+
+OUTPUT_CONF(LOG_SYSTEM)
+
+const Size TRIALS_DEFAULT = 1000;
+const Size SHOW_DEFAULT = 5;
+
+void usage() {
+    ostringstream str;
+    str << "mzequiv v" << VERSION << endl
+        << "Usage: " << endl
+        << "mzequiv [options] reference.exe reference.map target.exe target.map routine [target_routine]" << endl
+        << "    Calls a routine in isolation in both executables with the same randomized arguments and registers, and compares" << endl
+        << "    the registers preserved or returned by the C calling convention and the memory written by the calls." << endl
+        << "    Both start from the state of the program at the first call of the routine, or right after loading if it is not reached." << endl
+        << "    Exits with 0 if the routines behaved the same in all trials." << endl
+        << "Options:" << endl
+        << "--args spec     comma-separated list of the stack arguments, each either 'w' for a random word, 'b' for a random byte" << endl
+        << "                or a fixed hex value, e.g. 'w,b,0x100' (default: no arguments)" << endl
+        << "--trials count  number of calls with different inputs (default: " << to_string(TRIALS_DEFAULT) << ")" << endl
+        << "--seed value    seed of the random inputs, for reproducing a run (default: random)" << endl
+        << "--limit count   maximum number of instructions executed by a call (default: " << to_string(RoutineHarness::CALL_LIMIT) << ")" << endl
+        << "--warmup count  maximum number of instructions executed by the program before the routine is reached (default: " << to_string(RoutineHarness::WARMUP_LIMIT) << ")" << endl
+        << "--show count    number of differing trials to show (default: " << to_string(SHOW_DEFAULT) << ")" << endl
+        << "--console       let the routines write to the console, discarded by default" << endl
+        << "--jobs count    number of threads running the trials, each with its own pair of machines (default: 1, 0 for all cores)" << endl
+        << "--dir path      host directory which the programs see as the root of their current drive (default: current directory)" << endl
+        << "--verbose       show more information about the trials" << endl
+        << "--debug         show additional debug information";
+    output(str.str(), LOG_OTHER, LOG_ERROR);
+    exit(1);
+}
+
+void fatal(const string &msg) {
+    error(msg);
+    exit(1);
+}
+
+enum ArgKind { ARG_WORD, ARG_BYTE, ARG_FIXED };
+
+struct ArgSpec {
+    ArgKind kind;
+    Word value;
+};
+
+vector<ArgSpec> parseArgs(const string &spec) {
+    vector<ArgSpec> ret;
+    istringstream str{spec};
+    string token;
+    while (getline(str, token, ',')) {
+        if (token == "w") ret.push_back({ARG_WORD, 0});
+        else if (token == "b") ret.push_back({ARG_BYTE, 0});
+        else try {
+            ret.push_back({ARG_FIXED, static_cast<Word>(stoi(token, nullptr, 16))});
+        }
+        catch (std::exception &e) {
+            fatal("Invalid argument spec: " + token);
+        }
+    }
+    return ret;
+}
+
+// random values biased towards the edge cases where the arithmetic is most likely to go different ways
+class InputGenerator {
+    mt19937 rng_;
+    static constexpr Word EDGES[] = { 0, 1, 2, 0x7f, 0x80, 0xff, 0x7fff, 0x8000, 0xfffe, 0xffff };
+
+public:
+    explicit InputGenerator(const unsigned seed) : rng_(seed) {}
+    Word word() {
+        if (rng_() % 4 == 0) return EDGES[rng_() % size(EDGES)];
+        return static_cast<Word>(rng_());
+    }
+    Word byte() { return word() & 0xff; }
+    HarnessInput input(const vector<ArgSpec> &specs) {
+        HarnessInput ret;
+        for (const ArgSpec &s : specs) {
+            switch (s.kind) {
+            case ARG_WORD: ret.args.push_back(word()); break;
+            case ARG_BYTE: ret.args.push_back(byte()); break;
+            case ARG_FIXED: ret.args.push_back(s.value); break;
+            }
+        }
+        ret.ax = word(); ret.bx = word(); ret.cx = word();
+        ret.dx = word(); ret.si = word(); ret.di = word();
+        return ret;
+    }
+};
+
+int main(int argc, char *argv[]) {
+    setOutputLevel(LOG_INFO);
+    setModuleVisibility(LOG_CPU, false);
+    if (argc < 6) usage();
+    vector<string> files;
+    string hostDir = ".", argSpec;
+    Size trials = TRIALS_DEFAULT, limit = RoutineHarness::CALL_LIMIT, warmup = RoutineHarness::WARMUP_LIMIT, show = SHOW_DEFAULT, jobs = 1;
+    unsigned seed = random_device{}();
+    bool console = false;
+    for (int aidx = 1; aidx < argc; ++aidx) {
+        string arg(argv[aidx]);
+        if (arg == "--debug") setOutputLevel(LOG_DEBUG);
+        else if (arg == "--verbose") setOutputLevel(LOG_VERBOSE);
+        else if (arg == "--args" && ++aidx < argc) argSpec = argv[aidx];
+        else if (arg == "--trials" && ++aidx < argc) trials = stoi(string{argv[aidx]}, nullptr, 10);
+        else if (arg == "--seed" && ++aidx < argc) seed = stoul(string{argv[aidx]}, nullptr, 10);
+        else if (arg == "--limit" && ++aidx < argc) limit = stoi(string{argv[aidx]}, nullptr, 10);
+        else if (arg == "--warmup" && ++aidx < argc) warmup = stoi(string{argv[aidx]}, nullptr, 10);
+        else if (arg == "--show" && ++aidx < argc) show = stoi(string{argv[aidx]}, nullptr, 10);
+        else if (arg == "--dir" && ++aidx < argc) hostDir = argv[aidx];
+        else if (arg == "--jobs" && ++aidx < argc) jobs = stoi(string{argv[aidx]}, nullptr, 10);
+        else if (arg == "--console") console = true;
+        else if (arg == "--help") usage();
+        else if (arg.starts_with("--")) fatal("Unrecognized option: "s + arg);
+        else files.push_back(arg);
+    }
+    if (files.size() < 5 || files.size() > 6) usage();
+    for (Size i = 0; i < 4; ++i) {
+        if (!checkFile(files[i]).exists) fatal("File " + files[i] + " does not exist");
+    }
+    const string &refName = files[4], &tgtName = files.size() > 5 ? files[5] : files[4];
+    const vector<ArgSpec> specs = parseArgs(argSpec);
+    if (getOutputLevel() > LOG_VERBOSE) {
+        setModuleVisibility(LOG_OS, false);
+        setModuleVisibility(LOG_INTERRUPT, false);
+    }
+    Size mismatches = 0;
+    try {
+        RoutineHarness ref{files[0], files[1], refName, warmup, hostDir};
+        RoutineHarness tgt{files[2], files[3], tgtName, warmup, hostDir};
+        verbose("Reference routine: " + ref.routine().toString() + (ref.reached() ? "" : ", not reached by the program"));
+        verbose("Target routine: " + tgt.routine().toString() + (tgt.reached() ? "" : ", not reached by the program"));
+        if (ref.routine().near != tgt.routine().near) fatal("Routines differ in their call type");
+        // the inputs do not depend on how the trials are split between the threads, and every call starts from the same state
+        // of the machine whatever ran on it before, so a seed reproduces a run with any number of them
+        InputGenerator gen{seed};
+        vector<HarnessInput> inputs;
+        for (Size i = 0; i < trials; ++i) inputs.push_back(gen.input(specs));
+        vector<string> diffs(trials);
+        atomic<Size> next{0};
+        // every thread runs its share of the trials on its own pair of machines, the first one uses the pair above
+        const auto runTrials = [&](RoutineHarness &r, RoutineHarness &t) {
+            NullBuffer discard;
+            ostream nullOut{&discard};
+            istream nullIn{&discard};
+            if (!console) {
+                r.setConsole(nullIn, nullOut);
+                t.setConsole(nullIn, nullOut);
+            }
+            for (Size i = next++; i < trials; i = next++) {
+                diffs[i] = r.call(inputs[i], limit).compare(t.call(inputs[i], limit));
+            }
+        };
+        ThreadPool pool{jobs};
+        info("Running " + to_string(trials) + " trials with seed " + to_string(seed) + (pool.size() > 1 ? " on " + to_string(pool.size()) + " threads" : ""));
+        const auto start = chrono::steady_clock::now();
+        vector<ostringstream> logs(pool.size());
+        for (Size w = 1; w < pool.size(); ++w) pool.submit([&, w] {
+            LogContext ctx{logs[w]};
+            LogScope scope{ctx};
+            RoutineHarness r{files[0], files[1], refName, warmup, hostDir};
+            RoutineHarness t{files[2], files[3], tgtName, warmup, hostDir};
+            runTrials(r, t);
+        });
+        pool.submit([&] { runTrials(ref, tgt); });
+        pool.wait();
+        for (const ostringstream &log : logs) cout << log.str();
+        cout.flush();
+        const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        for (Size i = 0; i < trials; ++i) {
+            if (diffs[i].empty()) continue;
+            if (mismatches++ < show) error("Trial " + to_string(i) + " with " + inputs[i].toString() + ": " + diffs[i]);
+        }
+        ostringstream str;
+        str << fixed << setprecision(3) << "Ran " << trials << " trials in " << seconds << " s";
+        verbose(str.str());
+    }
+    catch (Error &e) {
+        fatal(e.why());
+    }
+    catch (std::exception &e) {
+        fatal(string(e.what()));
+    }
+    if (mismatches) {
+        error("Routines differ in " + to_string(mismatches) + " out of " + to_string(trials) + " trials");
+        return 1;
+    }
+    info("Routines behaved the same in all " + to_string(trials) + " trials");
+    return 0;
+}
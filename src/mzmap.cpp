@@ -4,6 +4,7 @@
 #include "dos/output.h"
 #include "dos/executable.h"
 #include "dos/analysis.h"
+#include "dos/superset.h"
 
 #include <iostream>
 #include <string>
@@ -32,6 +33,8 @@ void usage() {
            "--nocpu:        omit CPU-related information like instruction decoding from debug output\n"
            "--noanal:       omit analysis-related information from debug output\n"
            "--linkmap file  use a linker map from Microsoft C to seed initial location of routines\n"
+           "--coverage file follow the indirect branch destinations and executed code recorded by mzrun --coverage\n"
+           "--seeds:        propose likely code locations inside unclaimed blocks after the scan\n"
            "--load segment: override default load segment (0x0)", LOG_OTHER, LOG_ERROR);
     exit(1);
 }
@@ -73,6 +76,26 @@ Executable loadExe(const string &spec, const Word loadSegment) {
     return exe;
 }
 
+// use a superset disassembly of the load module to tell apart unclaimed blocks which look like code from ones which are probably data
+void proposeSeeds(const Executable &exe) {
+    const SupersetIndex &superset = exe.superset();
+    const auto unclaimed = exe.map().getUnclaimed();
+    Size codeCount = 0;
+    for (const Block &b : unclaimed) {
+        const auto seeds = superset.seeds(b);
+        if (seeds.empty()) {
+            verbose("Unclaimed block " + b.toString() + " contains no plausible code, probably data");
+            continue;
+        }
+        codeCount++;
+        ostringstream str;
+        str << "Unclaimed block " << b.toString() << " may contain code at:";
+        for (const auto &s : seeds) str << " " << s.toString();
+        info(str.str());
+    }
+    info("Found plausible code in " + to_string(codeCount) + " out of " + to_string(unclaimed.size()) + " unclaimed blocks");
+}
+
 void loadAndPrintMap(const string &mapfile, const bool verbose, const bool brief, const bool format) {
     info("Single parameter specified, printing existing mapfile");
     auto fs = checkFile(mapfile);
@@ -95,9 +118,9 @@ int main(int argc, char *argv[]) {
         usage();
     }
     Word loadSegment = 0x1000;
-    string file1, file2, linkmapPath;
+    string file1, file2, linkmapPath, coveragePath;
     bool verbose = false;
-    bool brief = false, format = false, overwrite = false;
+    bool brief = false, format = false, overwrite = false, seeds = false;
     for (int aidx = 1; aidx < argc; ++aidx) {
         string arg(argv[aidx]);
         if (arg == "--debug") setOutputLevel(LOG_DEBUG);
@@ -110,6 +133,7 @@ int main(int argc, char *argv[]) {
             brief = true;
         }
         else if (arg == "--format") format = true;
+        else if (arg == "--seeds") seeds = true;
         else if (arg == "--load") {
             if (++aidx >= argc) fatal("Option requires an argument: --load");
             string loadSegStr(argv[aidx]);
@@ -121,6 +145,11 @@ int main(int argc, char *argv[]) {
             linkmapPath = string{argv[aidx]};
             if (!checkFile(linkmapPath).exists) fatal("Linker map file does not exist: " + linkmapPath);
         }
+        else if (arg == "--coverage") {
+            if (++aidx >= argc) fatal("Option requires an argument: --coverage");
+            coveragePath = string{argv[aidx]};
+            if (!checkFile(coveragePath).exists) fatal("Coverage file does not exist: " + coveragePath);
+        }
         else if (file1.empty()) file1 = arg;
         else if (file2.empty()) file2 = arg;
         else fatal("Unrecognized argument: "s + arg);
@@ -144,6 +173,13 @@ int main(int argc, char *argv[]) {
                 info("Using linker map file " + linkmapPath + " to seed scan: " + to_string(linkmap.segmentCount()) + " segments, " + to_string(linkmap.routineCount()) + " routines, " + to_string(linkmap.variableCount()) + " variables");
                 a.seedQueue(exe);
             }
+            // optionally follow the code executed by an emulated run
+            Coverage coverage;
+            if (!coveragePath.empty()) {
+                coverage = Coverage{coveragePath, loadSegment};
+                info("Using coverage file " + coveragePath + " to guide scan: " + to_string(coverage.executed().size()) + " executed blocks, " + to_string(coverage.branches().size()) + " indirect branches");
+                a.seedCoverage(coverage);
+            }
             a.exploreCode(exe);
             const CodeMap &map = exe.map();
             if (map.empty()) {
@@ -151,6 +187,7 @@ int main(int argc, char *argv[]) {
                 return 1;
             }
             if (verbose) cout << map.getSummary(verbose, brief).text;
+            if (seeds) proposeSeeds(exe);
             map.save(file2, loadSegment, overwrite);
             info("Please review the output file (" + file2 + "), assign names to routines/segments\nYou may need to resolve inaccuracies with routine block ranges manually; this tool is not perfect");
         }
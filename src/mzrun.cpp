@@ -0,0 +1,252 @@
+#include "dos/output.h"
+#include "dos/error.h"
+#include "dos/cpu.h"
+#include "dos/memory.h"
+#include "dos/dos.h"
+#include "dos/interrupt.h"
+#include "dos/mz.h"
+#include "dos/codemap.h"
+#include "dos/profile.h"
+#include "dos/trace.h"
+#include "dos/coverage.h"
+#include "dos/watch.h"
+#include "dos/history.h"
+#include "dos/util.h"
+
+#include <iostream>
+#include <chrono>
+#include <memory>
+#include <fstream>
+
+using namespace std;
+
+OUTPUT_CONF(LOG_SYSTEM)
+
+const Size TOP_DEFAULT = 20;
+
+void usage() {
+    ostringstream str;
+    str << "mzrun v" << VERSION << endl
+        << "Usage: " << endl
+        << "mzrun [options] exe [args...]" << endl
+        << "    Runs a DOS executable on the emulated CPU without a display, with the file services of DOS backed by a host directory." << endl
+        << "    Console output goes to the standard output, console input is read from the standard input." << endl
+        << "    Exits with the exit code of the program, or 1 if the emulation failed." << endl
+        << "Options:" << endl
+        << "--dir path      host directory which the program sees as the root of its current drive (default: current directory)" << endl
+        << "--switch        use the switch dispatch engine of the CPU instead of the table" << endl
+        << "--profile map   count the executed instructions and report the hottest routines of the map at exit" << endl
+        << "--top count     number of routines in the profile report (default: " << to_string(TOP_DEFAULT) << ")" << endl
+        << "--coverage path save the executed code and the destinations of indirect branches for mzmap --coverage" << endl
+        << "--trace path    record a binary trace of the execution into a file" << endl
+        << "--replay path   compare the execution against a previously recorded trace, stop at the first difference" << endl
+        << "--lockstep exe  run another build of the program alongside, stop at the first instruction where they behave differently" << endl
+        << "--map path      map of the program for naming the routines where a difference was found" << endl
+        << "--othermap path map of the program given with --lockstep" << endl
+        << "--break addr    stop before executing the instruction at a segment:offset address relative to the load module, can be repeated" << endl
+        << "--watch range   report the writes into a range of memory, as in 1234:0010-1234:001f relative to the load module, can be repeated" << endl
+        << "--watchread r   report the reads of a range, like --watch" << endl
+        << "--lastwrite a   when the program ends or stops, find the last instruction which wrote into a byte at an address relative to the load module, can be repeated" << endl
+        << "                writes made by the DOS handlers (e.g. into the buffer of a file read) are not recorded" << endl
+        << "--checkpoint n  instructions between the checkpoints kept for --lastwrite (default: " << to_string(ExecHistory::INTERVAL_DEFAULT) << ")" << endl
+        << "--verbose       show more information about the loading and execution" << endl
+        << "--debug         show additional debug information";
+    output(str.str(), LOG_OTHER, LOG_ERROR);
+    exit(1);
+}
+
+void fatal(const string &msg) {
+    error(msg);
+    exit(1);
+}
+
+// reports the hits of the watchpoints, stops at the breakpoints
+class WatchLog : public WatchInterface {
+public:
+    bool hit(const WatchHit &hit, const Registers &regs, const Memory &) override {
+        info(hit.toString());
+        if (hit.kind != WATCH_EXEC) return false;
+        output(regs.dump(), LOG_OTHER, LOG_INFO);
+        return true;
+    }
+};
+
+// a complete emulated system with an executable loaded
+struct Machine {
+    Memory mem;
+    Dos dos;
+    InterruptHandler ints;
+    Cpu_8086 cpu;
+    LoadModule lm;
+
+    Machine(const string &exePath, const string &hostDir, const string &cmdline, const CpuDispatch dispatch) : dos(&mem, hostDir), ints(&dos), cpu(&mem, &ints, dispatch) {
+        MzImage mz{exePath};
+        lm = dos.loadExe(mz, cmdline);
+        cpu.init(lm.code, lm.stack, lm.size);
+    }
+};
+
+// Run against a recorded trace or another build of the program, the result is 0 if no difference was found.
+// The other map describes the program which recorded the trace, or the one running in lockstep.
+int compare(Machine &machine, const string &replayPath, const string &otherPath, const string &hostDir, const string &cmdline, const string &mapPath, const string &otherMapPath) {
+    unique_ptr<CodeMap> map, otherMap;
+    if (!mapPath.empty()) map = make_unique<CodeMap>(mapPath, machine.lm.segment);
+    if (!otherMapPath.empty()) otherMap = make_unique<CodeMap>(otherMapPath, machine.lm.segment);
+    TraceDivergence div;
+    string result;
+    if (!replayPath.empty()) {
+        ifstream traceFile{replayPath, ios::binary};
+        if (!traceFile) fatal("Unable to open trace " + replayPath);
+        TraceReader reader{traceFile};
+        div = traceReplay(reader, machine.cpu);
+        result = div.toString(otherMap.get(), map.get());
+    }
+    else {
+        Machine other{otherPath, hostDir, cmdline, machine.cpu.dispatchMode()};
+        if (other.lm.segment != machine.lm.segment) fatal("Executables loaded at different segments");
+        div = traceLockstep(machine.cpu, other.cpu);
+        result = div.toString(map.get(), otherMap.get());
+    }
+    cout.flush();
+    if (!div.found) {
+        info(result);
+        return 0;
+    }
+    error(result);
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    setOutputLevel(LOG_INFO);
+    setModuleVisibility(LOG_CPU, false);
+    if (argc < 2) usage();
+    string exePath, hostDir = ".", mapPath, cmdline, coveragePath, tracePath, replayPath, otherPath, refMapPath, otherMapPath;
+    vector<pair<WatchKind, string>> watchSpecs;
+    vector<string> lastWriteSpecs;
+    Size checkpointInterval = ExecHistory::INTERVAL_DEFAULT;
+    CpuDispatch dispatch = DISPATCH_TABLE;
+    Size top = TOP_DEFAULT;
+    for (int aidx = 1; aidx < argc; ++aidx) {
+        string arg(argv[aidx]);
+        // everything after the executable goes to its command line
+        if (!exePath.empty()) cmdline += (cmdline.empty() ? "" : " ") + arg;
+        else if (arg == "--debug") setOutputLevel(LOG_DEBUG);
+        else if (arg == "--verbose") setOutputLevel(LOG_VERBOSE);
+        else if (arg == "--switch") dispatch = DISPATCH_SWITCH;
+        else if (arg == "--dir" && ++aidx < argc) hostDir = argv[aidx];
+        else if (arg == "--profile" && ++aidx < argc) mapPath = argv[aidx];
+        else if (arg == "--top" && ++aidx < argc) top = stoi(string{argv[aidx]}, nullptr, 10);
+        else if (arg == "--coverage" && ++aidx < argc) coveragePath = argv[aidx];
+        else if (arg == "--trace" && ++aidx < argc) tracePath = argv[aidx];
+        else if (arg == "--replay" && ++aidx < argc) replayPath = argv[aidx];
+        else if (arg == "--lockstep" && ++aidx < argc) otherPath = argv[aidx];
+        else if (arg == "--map" && ++aidx < argc) refMapPath = argv[aidx];
+        else if (arg == "--othermap" && ++aidx < argc) otherMapPath = argv[aidx];
+        else if (arg == "--break" && ++aidx < argc) watchSpecs.push_back({WATCH_EXEC, argv[aidx]});
+        else if (arg == "--watch" && ++aidx < argc) watchSpecs.push_back({WATCH_WRITE, argv[aidx]});
+        else if (arg == "--watchread" && ++aidx < argc) watchSpecs.push_back({WATCH_READ, argv[aidx]});
+        else if (arg == "--lastwrite" && ++aidx < argc) lastWriteSpecs.push_back(argv[aidx]);
+        else if (arg == "--checkpoint" && ++aidx < argc) checkpointInterval = stoi(string{argv[aidx]}, nullptr, 10);
+        else if (arg == "--help") usage();
+        else if (arg.starts_with("--")) fatal("Unrecognized option: "s + arg);
+        else exePath = arg;
+    }
+    if (exePath.empty()) fatal("Executable path was not provided");
+    if (!checkFile(exePath).exists) fatal("Executable " + exePath + " does not exist");
+    for (const string &path : { mapPath, refMapPath, otherMapPath }) {
+        if (!path.empty() && !checkFile(path).exists) fatal("Map file " + path + " does not exist");
+    }
+    if (!otherPath.empty() && !checkFile(otherPath).exists) fatal("Executable " + otherPath + " does not exist");
+    if (!replayPath.empty() && !checkFile(replayPath).exists) fatal("Trace " + replayPath + " does not exist");
+    if (!replayPath.empty() + !otherPath.empty() + !tracePath.empty() > 1) fatal("Options --trace, --replay and --lockstep are mutually exclusive");
+    if (!lastWriteSpecs.empty() && (!replayPath.empty() || !otherPath.empty())) fatal("Option --lastwrite does not work with --replay or --lockstep");
+    if (checkpointInterval == 0) fatal("Checkpoint interval must not be zero");
+    if (getOutputLevel() > LOG_VERBOSE) {
+        setModuleVisibility(LOG_OS, false);
+        setModuleVisibility(LOG_INTERRUPT, false);
+    }
+    int ret = 0;
+    try {
+        Machine machine{exePath, hostDir, cmdline, dispatch};
+        Cpu_8086 &cpu = machine.cpu;
+        const LoadModule &lm = machine.lm;
+        if (!replayPath.empty() || !otherPath.empty()) return compare(machine, replayPath, otherPath, hostDir, cmdline, refMapPath, otherMapPath);
+        unique_ptr<ofstream> traceFile;
+        unique_ptr<TraceWriter> trace;
+        if (!tracePath.empty()) {
+            traceFile = make_unique<ofstream>(tracePath, ios::binary);
+            if (!*traceFile) fatal("Unable to open trace " + tracePath);
+            trace = make_unique<TraceWriter>(*traceFile);
+            cpu.setTrace(trace.get());
+        }
+        unique_ptr<ExecProfile> profile;
+        if (!mapPath.empty() || !coveragePath.empty()) {
+            profile = make_unique<ExecProfile>(Block{Address{lm.segment, 0}, Address{SEG_TO_OFFSET(lm.segment) + lm.size - 1}});
+            cpu.setProfile(profile.get());
+        }
+        Watchpoints watch;
+        WatchLog watchLog;
+        for (const auto &[kind, spec] : watchSpecs) {
+            Block range = kind == WATCH_EXEC ? Block{Address{spec}} : Block{spec};
+            range.relocate(lm.segment);
+            watch.add(kind, range);
+        }
+        // the history of the execution is only kept if it is going to be asked about
+        unique_ptr<ExecHistory> history;
+        if (!lastWriteSpecs.empty()) history = make_unique<ExecHistory>(cpu, machine.dos, machine.ints, checkpointInterval);
+        if (!watchSpecs.empty()) {
+            if (history) history->setWatch(&watch, &watchLog);
+            else cpu.setWatch(&watch, &watchLog);
+        }
+        const auto start = chrono::steady_clock::now();
+        try {
+            if (history) history->run();
+            else cpu.run();
+            if (cpu.stopped()) info("Stopped at breakpoint after " + to_string(cpu.executed()) + " instructions");
+        }
+        catch (Error &e) {
+            error(e.why());
+            output(cpu.info(), LOG_OTHER, LOG_ERROR);
+            ret = 1;
+        }
+        cout.flush();
+        const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        ostringstream str;
+        str << fixed << setprecision(3) << "Executed " << cpu.executed() << " instructions in " << seconds << " s";
+        if (cpu.skipped()) str << ", skipped " << cpu.skipped() << " in idle loops";
+        verbose(str.str());
+        if (trace) {
+            trace->flush();
+            verbose("Recorded " + to_string(trace->records()) + " instructions into " + tracePath + ", " + to_string(trace->bytes()) + " bytes");
+        }
+        if (!coveragePath.empty()) {
+            const Coverage coverage{*profile};
+            coverage.save(coveragePath, lm.segment, true);
+            verbose("Saved coverage to " + coveragePath + ": " + to_string(coverage.executed().size()) + " executed blocks, " + to_string(coverage.branches().size()) + " indirect branches");
+        }
+        if (!mapPath.empty()) {
+            const CodeMap map{mapPath, lm.segment};
+            info(profile->report(map, top));
+        }
+        if (history) {
+            // the replays would be counted again
+            cpu.setProfile(nullptr);
+            cpu.setTrace(nullptr);
+            for (const string &spec : lastWriteSpecs) {
+                Address addr{spec};
+                addr.relocate(lm.segment);
+                const auto write = history->lastWrite(addr.toLinear());
+                if (write) info("Last write of " + addr.toString() + ": " + write->toString());
+                else info("No write of " + addr.toString() + " since the start");
+            }
+        }
+        if (ret == 0) ret = machine.dos.exitCode();
+    }
+    catch (Error &e) {
+        fatal(e.why());
+    }
+    catch (std::exception &e) {
+        fatal(string(e.what()));
+    }
+    return ret;
+}
@@ -32,6 +32,7 @@ void usage() {
         << "--overwrite     overwrite output file if exists" << endl
         << "--min count     ignore routines smaller than 'count' instructions (default: " << to_string(MIN_DEFAULT) << ")" << endl
         << "--max count     ignore routines larger than 'count' instructions (0: no limit, default: " << to_string(MAX_DEFAULT) << ")" << endl
+        << "--sig16         save compact 16bit signatures, half the size but less precise when matching" << endl
         << "You can prevent specific routines from having their signatures extracted by annotating them with 'ignore' in the map file," << endl
         << "see the map file format documentation for more information."; 
     output(str.str(), LOG_OTHER, LOG_ERROR);
@@ -51,6 +52,7 @@ int main(int argc, char *argv[]) {
     }
     string path1, path2, path3;
     bool overwrite = false;
+    SignatureFormat format = SIG_FULL;
     Word loadSegment = 0x1000;
     Size minInstructions = MIN_DEFAULT, maxInstructions = MAX_DEFAULT;
     for (int aidx = 1; aidx < argc; ++aidx) {
@@ -58,6 +60,7 @@ int main(int argc, char *argv[]) {
         if (arg == "--verbose") setOutputLevel(LOG_VERBOSE);
         else if (arg == "--debug") setOutputLevel(LOG_DEBUG);
         else if (arg == "--overwrite") overwrite = true;
+        else if (arg == "--sig16") format = SIG_COMPACT;
         else if (arg == "--min" && ++aidx < argc) {
             string countStr{argv[aidx]};
             minInstructions = stoi(countStr, nullptr, 10);
@@ -89,7 +92,7 @@ int main(int argc, char *argv[]) {
         info("Loaded map file " + mapPath + ": " + to_string(map.segmentCount()) + " segments, " + to_string(map.routineCount()) + " routines, " + to_string(map.variableCount()) + " variables");
         MzImage mz{exePath, loadSegment};
         Executable exe{mz};
-        SignatureLibrary sig{map, exe, minInstructions, maxInstructions};
+        SignatureLibrary sig{map, exe, minInstructions, maxInstructions, format};
         info("Extracted signatures from " + to_string(sig.signatureCount()) + " routines, saving to " + outPath);
         sig.save(outPath);
     }
@@ -1,7 +1,6 @@
 #include "dos/output.h"
 
 #include <iostream>
-#include <map>
 #include <vector>
 #include <cassert>
 #include <cstdlib>
@@ -11,9 +10,6 @@
 
 using namespace std;
 
-static LogPriority globalPriority = LOG_INFO;
-static vector<string> msgBuffer;
-
 struct ColorConfig {
     bool shouldColor;
     ColorConfig() : shouldColor(true) {
@@ -22,43 +18,79 @@ struct ColorConfig {
     }
 } cc;
 
-static map<LogModule, bool> moduleVisibility = {
-    { LOG_SYSTEM,    true },
-    { LOG_CPU,       true },
-    { LOG_MEMORY,    true },
-    { LOG_OS,        true },
-    { LOG_INTERRUPT, true },
-    { LOG_ANALYSIS,  true },
-    { LOG_OTHER,     true },
-};
+static LogContext& globalContext() {
+    static LogContext ctx{cout, LOG_INFO};
+    return ctx;
+}
 
-void output(const std::string &msg, const LogModule mod, const LogPriority pri, const Color color, const bool suppressNewline) {
-    if (pri == LOG_DEBUG && globalPriority > LOG_DEBUG) return;
-    ostringstream ostr;
-    const bool hide = (pri < globalPriority || !moduleVisibility[mod]);
-    ostream& str = hide ? ostr : cout;
+static thread_local LogContext *currentContext = nullptr;
+
+LogContext& logContext() {
+    return currentContext ? *currentContext : globalContext();
+}
+
+LogContext::LogContext(std::ostream &out, const LogPriority priority) : priority_(priority), out_(&out) {
+    visible_.fill(true);
+}
+
+LogContext::LogContext(std::ostream &out) : out_(&out) {
+    const LogContext &cur = logContext();
+    priority_ = cur.priority_;
+    visible_ = cur.visible_;
+}
+
+void LogContext::write(const std::string &msg, const LogModule mod, const LogPriority pri, const Color color, const bool suppressNewline) {
+    ostringstream str;
     if (color != OUT_DEFAULT) str << output_color(color);
     str << msg;
     if (color != OUT_DEFAULT) str << output_color(OUT_DEFAULT);
     if (!suppressNewline) str << "\n";
-    if (hide) msgBuffer.push_back(ostr.str());
+    const bool hide = (pri < priority_ || !visible_[mod]);
+    lock_guard<mutex> lock(mutex_);
+    if (hide) buffer_.push_back(str.str());
+    else *out_ << str.str();
+}
+
+void LogContext::clearBuffer() {
+    lock_guard<mutex> lock(mutex_);
+    buffer_.clear();
+}
+
+void LogContext::flushBuffer() {
+    lock_guard<mutex> lock(mutex_);
+    for (const auto &m : buffer_) *out_ << m;
+    buffer_.clear();
+}
+
+LogScope::LogScope(LogContext &ctx) : prev_(currentContext) {
+    currentContext = &ctx;
+}
+
+LogScope::~LogScope() {
+    currentContext = prev_;
+}
+
+void output(const std::string &msg, const LogModule mod, const LogPriority pri, const Color color, const bool suppressNewline) {
+    LogContext &ctx = logContext();
+    if (pri == LOG_DEBUG && ctx.priority() > LOG_DEBUG) return;
+    ctx.write(msg, mod, pri, color, suppressNewline);
 }
 
 LogPriority getOutputLevel() {
-    return globalPriority;
+    return logContext().priority();
 }
 
 void setOutputLevel(const LogPriority minPriority) {
-    globalPriority = minPriority;
+    logContext().setPriority(minPriority);
 }
 
 void setModuleVisibility(const LogModule mod, const bool visible) {
-    moduleVisibility[mod] = visible;
+    logContext().setVisible(mod, visible);
 }
 
 bool moduleVisible(const LogModule mod) {
-    assert(mod < moduleVisibility.size());
-    return moduleVisibility[mod];
+    assert(mod <= LOG_OTHER);
+    return logContext().visible(mod);
 }
 
 string output_color(const Color c) {
@@ -97,10 +129,9 @@ string output_color(const Color c) {
 }
 
 void clearOutputBuffer() {
-    msgBuffer.clear();
+    logContext().clearBuffer();
 }
 
 void flushOutputBuffer() {
-    for (const auto &m : msgBuffer) cout << m;
-    clearOutputBuffer();
+    logContext().flushBuffer();
 }
@@ -0,0 +1,140 @@
+#include "dos/pattern.h"
+#include "dos/error.h"
+
+#include <array>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+// expands 8 bits of the mask into the byte lanes of a 64bit word, assumes little-endian
+static constexpr array<uint64_t, 0x100> laneMaskTable() {
+    array<uint64_t, 0x100> ret{};
+    for (Size bits = 0; bits < ret.size(); ++bits) {
+        for (Size lane = 0; lane < 8; ++lane) {
+            if (bits & (1 << lane)) ret[bits] |= 0xffULL << (lane * 8);
+        }
+    }
+    return ret;
+}
+
+static constexpr auto LANE_MASK = laneMaskTable();
+static_assert(LANE_MASK[0b101] == 0x0000'0000'00ff'00ffULL && LANE_MASK[0x80] == 0xff00'0000'0000'0000ULL);
+
+static int hexDigitValue(const char d) {
+    if (d >= '0' && d <= '9') return d - '0';
+    if (d >= 'a' && d <= 'f') return d - 'a' + 10;
+    if (d >= 'A' && d <= 'F') return d - 'A' + 10;
+    return -1;
+}
+
+BytePattern::BytePattern(const Byte *data, const Size size) {
+    grow(size);
+    copy(data, data + size, bytes_.begin());
+    for (Size i = 0; i < size; ++i) mask_[i / 64] |= 1ULL << (i % 64);
+}
+
+BytePattern::BytePattern(const std::string &hexa) {
+    if (hexa.size() & 1) throw ArgError("Hexa string must be of even size");
+    for (Size s = 0; s < hexa.size(); s += 2) {
+        if (hexa[s] == '?' && hexa[s + 1] == '?') {
+            appendWildcard();
+            continue;
+        }
+        const int hi = hexDigitValue(hexa[s]), lo = hexDigitValue(hexa[s + 1]);
+        if (hi < 0 || lo < 0) throw ArgError("Invalid byte in hexa string: " + hexa.substr(s, 2));
+        append(static_cast<Byte>(hi << 4 | lo));
+    }
+}
+
+Size BytePattern::fixedCount() const {
+    Size ret = 0;
+    for (const uint64_t m : mask_) ret += __builtin_popcountll(m);
+    return ret;
+}
+
+void BytePattern::grow(const Size count) {
+    bytes_.resize(bytes_.size() + count, 0);
+    mask_.resize((bytes_.size() + 63) / 64, 0);
+}
+
+void BytePattern::append(const Byte b) {
+    const Size idx = size();
+    grow(1);
+    bytes_[idx] = b;
+    mask_[idx / 64] |= 1ULL << (idx % 64);
+}
+
+void BytePattern::appendWildcard(const Size count) {
+    grow(count);
+}
+
+void BytePattern::append(const BytePattern &other) {
+    const Size base = size();
+    grow(other.size());
+    copy(other.bytes_.begin(), other.bytes_.end(), bytes_.begin() + base);
+    for (Size i = 0; i < other.size(); ++i) {
+        if (!other.isWildcard(i)) mask_[(base + i) / 64] |= 1ULL << ((base + i) % 64);
+    }
+}
+
+// turn a range of positions into wildcards
+void BytePattern::wildcard(const Size idx, const Size count) {
+    if (idx + count > size()) throw ArgError("Wildcard range out of pattern bounds: " + to_string(idx + count));
+    for (Size i = idx; i < idx + count; ++i) {
+        bytes_[i] = 0;
+        mask_[i / 64] &= ~(1ULL << (i % 64));
+    }
+}
+
+// check whether the data, which must be at least as long as the pattern, matches it
+bool BytePattern::matches(const Byte *data) const {
+    const Size patSize = size();
+    Size i = 0;
+    for (; i + 8 <= patSize; i += 8) {
+        const Byte bits = static_cast<Byte>(mask_[i / 64] >> (i % 64));
+        if (bits == 0) continue;
+        uint64_t d, p;
+        memcpy(&d, data + i, sizeof(d));
+        memcpy(&p, bytes_.data() + i, sizeof(p));
+        if ((d ^ p) & LANE_MASK[bits]) return false;
+    }
+    for (; i < patSize; ++i) {
+        if (!isWildcard(i) && data[i] != bytes_[i]) return false;
+    }
+    return true;
+}
+
+// offset of the first match within the data, npos if not found;
+// candidate locations are found by scanning for the first fixed byte of the pattern
+Size BytePattern::find(const Byte *data, const Size size) const {
+    const Size patSize = this->size();
+    if (patSize == 0 || size < patSize) return npos;
+    Size anchor = 0;
+    while (anchor < patSize && isWildcard(anchor)) anchor++;
+    if (anchor == patSize) return 0;
+    const Size last = size - patSize;
+    Size pos = 0;
+    while (pos <= last) {
+        const void *hit = memchr(data + pos + anchor, bytes_[anchor], last - pos + 1);
+        if (hit == nullptr) break;
+        const Size start = static_cast<const Byte*>(hit) - data - anchor;
+        if (matches(data + start)) return start;
+        pos = start + 1;
+    }
+    return npos;
+}
+
+std::string BytePattern::toString() const {
+    static const char DIGITS[] = "0123456789abcdef";
+    string ret;
+    ret.reserve(size() * 2);
+    for (Size i = 0; i < size(); ++i) {
+        if (isWildcard(i)) ret += "??";
+        else {
+            ret += DIGITS[bytes_[i] >> 4];
+            ret += DIGITS[bytes_[i] & 0xf];
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,62 @@
+#include "dos/pool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(const Size threads) : busy_(0), stop_(false) {
+    Size count = threads ? threads : thread::hardware_concurrency();
+    if (count == 0) count = 1;
+    for (Size i = 0; i < count; ++i) threads_.emplace_back(&ThreadPool::work, this);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (thread &t : threads_) t.join();
+}
+
+void ThreadPool::submit(function<void()> task) {
+    {
+        lock_guard<mutex> lock(mutex_);
+        tasks_.push(std::move(task));
+    }
+    wake_.notify_one();
+}
+
+void ThreadPool::wait() {
+    unique_lock<mutex> lock(mutex_);
+    idle_.wait(lock, [this] { return tasks_.empty() && busy_ == 0; });
+    if (error_) {
+        exception_ptr e = error_;
+        error_ = nullptr;
+        rethrow_exception(e);
+    }
+}
+
+void ThreadPool::work() {
+    while (true) {
+        function<void()> task;
+        {
+            unique_lock<mutex> lock(mutex_);
+            wake_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+            if (tasks_.empty()) return;
+            task = std::move(tasks_.front());
+            tasks_.pop();
+            busy_++;
+        }
+        try {
+            task();
+        }
+        catch (...) {
+            lock_guard<mutex> lock(mutex_);
+            if (!error_) error_ = current_exception();
+        }
+        {
+            lock_guard<mutex> lock(mutex_);
+            busy_--;
+        }
+        idle_.notify_all();
+    }
+}
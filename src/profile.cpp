@@ -0,0 +1,173 @@
+#include "dos/profile.h"
+#include "dos/codemap.h"
+#include "dos/error.h"
+#include "dos/util.h"
+
+#include <algorithm>
+#include <numeric>
+#include <map>
+#include <sstream>
+#include <tuple>
+
+using namespace std;
+
+ExecProfile::ExecProfile(const Block &area) : base_(0), outside_(0) {
+    if (!area.isValid()) throw ArgError("Invalid profiling area: " + area.toString());
+    base_ = area.begin.toLinear();
+    hits_.resize(area.size(), 0);
+    taken_.resize(area.size(), 0);
+    notTaken_.resize(area.size(), 0);
+    lengths_.resize(area.size(), 0);
+}
+
+Block ExecProfile::area() const {
+    return Block{base_, static_cast<Offset>(base_ + hits_.size() - 1)};
+}
+
+void ExecProfile::clear() {
+    fill(hits_.begin(), hits_.end(), 0);
+    fill(taken_.begin(), taken_.end(), 0);
+    fill(notTaken_.begin(), notTaken_.end(), 0);
+    fill(lengths_.begin(), lengths_.end(), 0);
+    outside_ = 0;
+    indirect_.clear();
+}
+
+bool ExecProfile::IndirectBranch::operator<(const IndirectBranch &other) const {
+    const auto key = [](const IndirectBranch &b) {
+        return tuple{b.source.segment, b.source.offset, b.destination.segment, b.destination.offset, b.isCall, b.isNear};
+    };
+    return key(*this) < key(other);
+}
+
+Size ExecProfile::counter(const std::vector<uint32_t> &counters, const Address &addr) const {
+    const Offset idx = addr.toLinear() - base_;
+    return idx < counters.size() ? counters[idx] : 0;
+}
+
+Size ExecProfile::total() const {
+    return accumulate(hits_.begin(), hits_.end(), Size{0});
+}
+
+// sum the counters over the part of the block which overlaps the profiled area
+ExecProfile::BlockStats ExecProfile::blockStats(const Block &block) const {
+    BlockStats ret{block, 0, 0, 0};
+    if (!block.isValid()) return ret;
+    const Offset end = base_ + hits_.size();
+    const Offset from = max(block.begin.toLinear(), base_), to = min(block.end.toLinear() + 1, end);
+    for (Offset i = from; i < to; ++i) {
+        ret.instructions += hits_[i - base_];
+        ret.taken += taken_[i - base_];
+        ret.notTaken += notTaken_[i - base_];
+    }
+    return ret;
+}
+
+Offset ExecProfile::runEnd(const Offset start, const std::vector<bool> *claimed) const {
+    Offset i = start;
+    while (true) {
+        const Offset next = i + max<Size>(lengths_[i], 1);
+        if (next >= hits_.size() || hits_[next] == 0 || (claimed && (*claimed)[next])) return min<Offset>(next, hits_.size()) - 1;
+        i = next;
+    }
+}
+
+std::vector<Block> ExecProfile::executed() const {
+    vector<Block> ret;
+    for (Offset i = 0; i < hits_.size(); ++i) {
+        if (hits_[i] == 0) continue;
+        const Offset j = runEnd(i);
+        ret.emplace_back(base_ + i, base_ + j);
+        i = j;
+    }
+    return ret;
+}
+
+vector<ExecProfile::RoutineStats> ExecProfile::routineStats(const CodeMap &map) const {
+    vector<RoutineStats> ret;
+    vector<bool> claimed(hits_.size(), false);
+    for (Size i = 0; i < map.routineCount(); ++i) {
+        const Routine r = map.getRoutine(i);
+        RoutineStats rs{r.name, r.entrypoint(), 0, 0, 0, {}};
+        for (const Block &b : r.sortedBlocks()) {
+            const BlockStats bs = blockStats(b);
+            for (Offset l = b.begin.toLinear(); l <= b.end.toLinear(); ++l) {
+                if (l - base_ < claimed.size()) claimed[l - base_] = true;
+            }
+            if (bs.instructions == 0) continue;
+            rs.instructions += bs.instructions;
+            rs.taken += bs.taken;
+            rs.notTaken += bs.notTaken;
+            rs.blocks.push_back(bs);
+        }
+        if (rs.instructions) ret.push_back(rs);
+    }
+    // gather the executed code outside of the routines into runs of consecutive instructions
+    RoutineStats other{"", {}, 0, 0, 0, {}};
+    for (Offset i = 0; i < hits_.size(); ++i) {
+        if (claimed[i] || hits_[i] == 0) continue;
+        const Offset j = runEnd(i, &claimed);
+        const BlockStats bs = blockStats(Block{base_ + i, base_ + j});
+        other.instructions += bs.instructions;
+        other.taken += bs.taken;
+        other.notTaken += bs.notTaken;
+        other.blocks.push_back(bs);
+        i = j;
+    }
+    if (other.instructions) ret.push_back(other);
+    stable_sort(ret.begin(), ret.end(), [](const RoutineStats &a, const RoutineStats &b) { return a.instructions > b.instructions; });
+    for (auto &rs : ret) {
+        stable_sort(rs.blocks.begin(), rs.blocks.end(), [](const BlockStats &a, const BlockStats &b) { return a.instructions > b.instructions; });
+    }
+    return ret;
+}
+
+static string branchStr(const Size taken, const Size notTaken) {
+    if (taken + notTaken == 0) return {};
+    return ", branches taken " + to_string(taken) + "/" + to_string(taken + notTaken);
+}
+
+// hottest routines with their share of all the instructions executed in the area, and the blocks they were executed in
+std::string ExecProfile::report(const CodeMap &map, const Size top) const {
+    ostringstream str;
+    const Size all = total();
+    str << "Executed " << all << " instructions in " << area().toString(true, false) << ", " << outside_ << " outside";
+    const auto stats = routineStats(map);
+    Size count = 0;
+    for (const auto &rs : stats) {
+        if (top && count++ == top) break;
+        str << endl << (rs.name.empty() ? "<unclaimed>" : rs.name);
+        if (rs.entrypoint.isValid()) str << " [" << rs.entrypoint.toString() << "]";
+        str << ": " << rs.instructions << " (" << ratioStr(rs.instructions, all) << ")" << branchStr(rs.taken, rs.notTaken);
+        for (const auto &bs : rs.blocks) {
+            str << endl << "\t" << bs.block.toString(false, true) << ": " << bs.instructions << branchStr(bs.taken, bs.notTaken);
+        }
+    }
+    return str.str();
+}
+
+// instruction counts of the routines present in both profiles, with the ones executing more instructions in the other profile first
+std::string ExecProfile::compare(const CodeMap &map, const ExecProfile &other, const CodeMap &otherMap) const {
+    std::map<string, Size> otherCounts;
+    for (const auto &rs : other.routineStats(otherMap)) {
+        if (!rs.name.empty()) otherCounts[rs.name] = rs.instructions;
+    }
+    struct Delta { string name; Size ref, tgt; };
+    vector<Delta> deltas;
+    Size missing = 0;
+    for (const auto &rs : routineStats(map)) {
+        if (rs.name.empty()) continue;
+        auto it = otherCounts.find(rs.name);
+        if (it == otherCounts.end()) { missing++; continue; }
+        deltas.push_back({rs.name, rs.instructions, it->second});
+    }
+    const auto diff = [](const Delta &d) { return static_cast<int64_t>(d.tgt) - static_cast<int64_t>(d.ref); };
+    stable_sort(deltas.begin(), deltas.end(), [&](const Delta &a, const Delta &b) { return diff(a) > diff(b); });
+    ostringstream str;
+    str << "Compared " << deltas.size() << " routines executed in both profiles, " << missing << " not executed in the other one";
+    for (const auto &d : deltas) {
+        const int64_t dif = diff(d);
+        str << endl << d.name << ": " << d.ref << " -> " << d.tgt << " (" << (dif > 0 ? "+" : "") << dif << ")";
+    }
+    return str.str();
+}
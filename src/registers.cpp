@@ -51,6 +51,18 @@ Register regLow(const Register r) {
     else return REG_NONE;
 }
 
+// list the register names in a mask, e.g. "AX DX FLAGS"
+std::string regMaskString(const RegisterMask mask) {
+    string ret;
+    for (int i = REG_AL; i <= REG_FLAGS; ++i) {
+        const Register r = static_cast<Register>(i);
+        if (!(mask & regMask(r))) continue;
+        if (!ret.empty()) ret += " ";
+        ret += regName(r);
+    }
+    return ret;
+}
+
 Registers::Registers() {
     reset();
 }
@@ -118,11 +130,10 @@ string Registers::dump() const {
     return str.str();    
 }
 
-CpuState::CpuState() {
+CpuState::CpuState() : known_(REGMASK_NONE) {
     for (int i = REG_AL; i <= REG_FLAGS; ++i) {
         Register r = (Register)i;
         regs_.set(r, 0);
-        known_.set(r, 0);
     }
 }
 
@@ -137,9 +148,15 @@ CpuState::CpuState(const Address &code, const Address &stack) : CpuState() {
     }
 }
 
+// bits of the known mask which track the state of a register
+static RegisterMask knownBits(const Register r) {
+    if (regIsGeneral(r)) return regHalves(regMask(r)) & ~regMask(r);
+    return regMask(r);
+}
+
 bool CpuState::isKnown(const Register r) const {
-    if (regIsWord(r)) return known_.get(r) == WORD_KNOWN;
-    else return known_.get(r) == BYTE_KNOWN;
+    const RegisterMask bits = knownBits(r);
+    return bits != 0 && (known_ & bits) == bits;
 }
 
 Word CpuState::getValue(const Register r) const {
@@ -195,12 +212,7 @@ string CpuState::toString() const {
 }  
 
 void CpuState::setState(const Register r, const Word value, const bool known) {
-    if (regIsWord(r)) {
-        regs_.set(r, value);
-        known_.set(r, known ? WORD_KNOWN : 0);
-    }
-    else {
-        regs_.set(r, value);
-        known_.set(r, known ? BYTE_KNOWN : 0);
-    }
+    regs_.set(r, value);
+    if (known) known_ |= knownBits(r);
+    else known_ &= ~knownBits(r);
 }
@@ -190,9 +190,9 @@ bool ScanQueue::saveCall(const Address &dest, const CpuState &regs, const bool n
 }
 
 // conditional jump, save as destination to be investigated, belonging to current routine
-bool ScanQueue::saveJump(const Address &dest, const CpuState &regs) {
+bool ScanQueue::saveJump(const Address &dest, const CpuState &regs, const RoutineIdx routineIdx) {
     const RoutineIdx 
-        curIdx = curSearch.routineIdx,
+        curIdx = routineIdx == NULL_ROUTINE ? curSearch.routineIdx : routineIdx,
         destIdx = getRoutineIdx(dest.toLinear());
     if (destIdx != NULL_ROUTINE) 
         debug("Jump destination already visited from routine "s + to_string(destIdx));
@@ -209,8 +209,8 @@ bool ScanQueue::saveJump(const Address &dest, const CpuState &regs) {
             debug("Unable to move jump destination " + destCopy.toString() + " to segment of routine " + ep.toString() + ", ignoring");
             return false;
         }
-        queue.emplace_front(Destination(destCopy, curSearch.routineIdx, false, regs));
-        debug("Jump destination not yet visited, scheduled visit from routine " + to_string(curSearch.routineIdx) + ", queue size = " + to_string(size()));
+        queue.emplace_front(Destination(destCopy, curIdx, false, regs));
+        debug("Jump destination not yet visited, scheduled visit from routine " + to_string(curIdx) + ", queue size = " + to_string(size()));
         return true;
     }
     return false;
@@ -19,7 +19,10 @@ using namespace std;
 
 OUTPUT_CONF(LOG_ANALYSIS)
 
-SignatureLibrary::SignatureLibrary(const CodeMap &map, const Executable &exe, const Size minInstructions, const Size maxInstructions) {
+// first line of a signature file holding compact signatures, absent for the full format
+static const string COMPACT_DIRECTIVE = "format sig16";
+
+SignatureLibrary::SignatureLibrary(const CodeMap &map, const Executable &exe, const Size minInstructions, const Size maxInstructions, const SignatureFormat format) : format_(SIG_FULL) {
     const Word loadSeg = exe.loadAddr().segment;
     for (Size idx = 0; idx < map.routineCount(); ++idx) {
         Routine routine = map.getRoutine(idx);
@@ -48,10 +51,11 @@ SignatureLibrary::SignatureLibrary(const CodeMap &map, const Executable &exe, co
             sigs.emplace_back(SignatureItem{routine.name, extents, std::move(sig)});
         }
     }
+    if (format == SIG_COMPACT) compact();
     verbose("Loaded signatures for " + to_string(sigs.size()) + " routines from executable");
 }
 
-SignatureLibrary::SignatureLibrary(const std::string &path) {
+SignatureLibrary::SignatureLibrary(const std::string &path) : format_(SIG_FULL) {
     if (path.empty()) throw ArgError("Empty path for loading signature library");
     ifstream file{path};
     string line;
@@ -60,8 +64,20 @@ SignatureLibrary::SignatureLibrary(const std::string &path) {
         lineno++;
         // ignore comments and empty lines
         if (line.empty() || line[0] == '#') continue;
+        if (line == COMPACT_DIRECTIVE) {
+            if (!sigs.empty()) throw ParseError("Signature format directive after signatures on line " + to_string(lineno));
+            format_ = SIG_COMPACT;
+            continue;
+        }
         string routineStr, routineName, extentsStr, sigStr;
         SignatureString tmpSigs;
+        SignatureString16 tmpSigs16;
+        const auto addToken = [&](const string &str) {
+            const DWord token = stoul(str, nullptr, 16);
+            if (format_ == SIG_FULL) tmpSigs.emplace_back(token);
+            else if (token > WORD_MAX) throw ParseError("Compact signature token out of range on line " + to_string(lineno) + ": " + str);
+            else tmpSigs16.emplace_back(static_cast<Signature16>(token));
+        };
         Block extents;
         vector<string> routineTokens;
         auto prevPos = line.begin(), curPos = line.begin();
@@ -84,7 +100,7 @@ SignatureLibrary::SignatureLibrary(const std::string &path) {
                 sigStr = {prevPos, curPos};
                 PARSE_DEBUG("Line " + to_string(lineno) + ", found signature token: '" + sigStr + "'");
                 prevPos = curPos + 1;
-                tmpSigs.emplace_back(stoi(sigStr, nullptr, 16));
+                addToken(sigStr);
                 break;
             }
         }
@@ -93,20 +109,34 @@ SignatureLibrary::SignatureLibrary(const std::string &path) {
         // read final token which is not comma-terminated
         sigStr = {prevPos, curPos};
         PARSE_DEBUG("Line " + to_string(lineno) + ", final signature token: '" + sigStr + "'");
-        tmpSigs.emplace_back(stoi(sigStr, nullptr, 16));
-        verbose("Loaded signature for routine " + routineName + ", " + to_string(tmpSigs.size()) + " instructions");
-        sigs.emplace_back(SignatureItem{routineName, extents, std::move(tmpSigs)});
+        addToken(sigStr);
+        if (format_ == SIG_FULL) sigs.emplace_back(SignatureItem{routineName, extents, std::move(tmpSigs)});
+        else sigs.emplace_back(SignatureItem{routineName, extents, std::move(tmpSigs16)});
+        verbose("Loaded signature for routine " + routineName + ", " + to_string(sigs.back().size()) + " instructions");
     }
     verbose("Loaded signatures for " + to_string(sigs.size()) + " routines from " + path);
 }
 
+// convert the library to the compact format in place, cannot be reversed
+void SignatureLibrary::compact() {
+    if (format_ == SIG_COMPACT) return;
+    for (auto &si : sigs) {
+        SignatureString16 compacted(si.signature.size());
+        transform(si.signature.begin(), si.signature.end(), compacted.begin(), compactSignature);
+        si.signature16 = std::move(compacted);
+        si.signature = {};
+    }
+    format_ = SIG_COMPACT;
+}
+
 void SignatureLibrary::save(const std::string &path) const {
     if (sigs.empty()) return;
     if (path.empty()) throw ArgError("Empty path for saving signature library");
     ofstream file{path};
+    if (format_ == SIG_COMPACT) file << COMPACT_DIRECTIVE << endl;
     for (Size i = 0; i < signatureCount(); ++i) {
         const SignatureItem &si = getSignature(i);
-        const Size size = si.signature.size();
+        const Size size = si.size();
         if (size == 0) continue;
         file << si.routineName;
         if (si.routineExtents.isValid())
@@ -114,7 +144,8 @@ void SignatureLibrary::save(const std::string &path) const {
         file << "/";
         for (Size j = 0; j < size; ++j) {
             if (j != 0) file << ",";
-            file << hexVal(si.signature[j], false, false);
+            if (format_ == SIG_FULL) file << hexVal(si.signature[j], false, false);
+            else file << hexVal(si.signature16[j], false, false);
         }
         file << endl;
     }
@@ -137,6 +168,21 @@ void SignatureLibrary::dump() const {
     for (Size i = 0; i < signatureCount(); ++i) {
         const SignatureItem &si = getSignature(i);  
         cout << si.routineName << ": " << si.size() << " instructions" << endl;
+        for (const Signature16 s : si.signature16) {
+            const InstructionClass c = static_cast<InstructionClass>(s >> 9);
+            const bool flag = (s >> 8) & 1;
+            const SignatureOperand
+                op1 = static_cast<SignatureOperand>((s >> 4) & 0b1111),
+                op2 = static_cast<SignatureOperand>(s & 0b1111);
+            cout << "\t";
+            // the flag marks a chain prefix on operandless string instructions, a byte register operand otherwise
+            if (flag && op1 == SOP_NONE) cout << "rep ";
+            cout << instructionName(c);
+            if (op1 != SOP_NONE) cout << " " << signatureOperandName(op1);
+            if (op2 != SOP_NONE) cout << ", " << signatureOperandName(op2);
+            if (flag && op1 != SOP_NONE) cout << " (byte)";
+            cout << endl;
+        }
         for (const Signature s : si.signature) {
             const InstructionPrefix p = static_cast<InstructionPrefix>((s >> 19) & 0b111);
             const InstructionClass c = static_cast<InstructionClass>((s >> 12) & 0b1111111);
@@ -0,0 +1,92 @@
+#include "dos/superset.h"
+#include "dos/executable.h"
+#include "dos/instruction.h"
+#include "dos/error.h"
+#include "dos/output.h"
+#include "dos/util.h"
+
+using namespace std;
+
+OUTPUT_CONF(LOG_ANALYSIS)
+
+SupersetIndex::SupersetIndex(const Executable &exe) : base_(exe.loadAddr().toLinear()), validCount_(0) {
+    const Size size = exe.size();
+    lengths_.resize(size, 0);
+    chainEnd_.resize(size, 0);
+    vector<bool> terminal(size, false);
+    for (Offset i = 0; i < size; ++i) {
+        try {
+            const PackedInstruction pi = exe.decoded(Address{base_ + i});
+            const auto iclass = static_cast<InstructionClass>(pi.iclass);
+            lengths_[i] = pi.length;
+            terminal[i] = iclass == INS_JMP || iclass == INS_JMP_FAR || iclass == INS_RET || iclass == INS_RETF || iclass == INS_IRET;
+            validCount_++;
+        }
+        catch (CpuError &e) {}
+    }
+    // resolve the chains backwards, every location either terminates the chain itself or shares the fate of its successor
+    for (Offset i = size; i-- > 0;) {
+        const Offset next = i + lengths_[i];
+        if (lengths_[i] == 0 || next > size) continue;
+        if (terminal[i]) chainEnd_[i] = next;
+        else if (next < size) chainEnd_[i] = chainEnd_[next];
+    }
+    // count the predecessors of each location, then lay them out contiguously
+    predBegin_.assign(size + 1, 0);
+    for (Offset i = 0; i < size; ++i) {
+        const Offset next = i + lengths_[i];
+        if (lengths_[i] != 0 && next < size) predBegin_[next + 1]++;
+    }
+    for (Offset i = 0; i < size; ++i) predBegin_[i + 1] += predBegin_[i];
+    preds_.resize(predBegin_[size]);
+    vector<Offset> cursor(predBegin_.begin(), predBegin_.end() - 1);
+    for (Offset i = 0; i < size; ++i) {
+        const Offset next = i + lengths_[i];
+        if (lengths_[i] != 0 && next < size) preds_[cursor[next]++] = base_ + i;
+    }
+    debug("Built superset index of " + sizeStr(size) + " load module, valid instruction starts: " + to_string(validCount_));
+}
+
+bool SupersetIndex::contains(const Address &addr) const {
+    const Offset linear = addr.toLinear();
+    return linear >= base_ && linear - base_ < size();
+}
+
+Size SupersetIndex::length(const Address &addr) const {
+    if (!contains(addr)) return 0;
+    return lengths_[index(addr)];
+}
+
+// the address right past the instruction which ends the flow of consecutive decodes starting at the specified location, invalid if none
+Address SupersetIndex::chainEnd(const Address &addr) const {
+    if (!contains(addr) || chainEnd_[index(addr)] == 0) return {};
+    return Address{base_ + chainEnd_[index(addr)]};
+}
+
+// linear addresses of locations which decode into an instruction ending right before the specified one
+std::span<const Offset> SupersetIndex::predecessors(const Address &addr) const {
+    if (!contains(addr)) return {};
+    const Offset i = index(addr);
+    return { preds_.data() + predBegin_[i], preds_.data() + predBegin_[i + 1] };
+}
+
+// propose potential routine entrypoints inside a block: the earliest locations from which the decode chain
+// reaches an unconditional jump or a return within the block, while skipping over the code covered by a previous proposal
+vector<Address> SupersetIndex::seeds(const Block &block) const {
+    vector<Address> ret;
+    if (!block.isValid()) return ret;
+    const Offset end = block.end.toLinear();
+    Offset linear = block.begin.toLinear();
+    while (linear <= end) {
+        const Address a{linear};
+        const Address stop = chainEnd(a);
+        if (stop.isValid() && stop.toLinear() <= end + 1) {
+            Address seed = a;
+            if (seed.inSegment(block.begin.segment)) seed.move(block.begin.segment);
+            ret.push_back(seed);
+            linear = stop.toLinear();
+        }
+        else linear++;
+    }
+    return ret;
+}
@@ -0,0 +1,82 @@
+#include "dos/sweep.h"
+#include "dos/executable.h"
+#include "dos/error.h"
+#include "dos/output.h"
+#include "dos/util.h"
+
+using namespace std;
+
+OUTPUT_CONF(LOG_ANALYSIS)
+
+InstructionSweep::InstructionSweep(const Executable &exe, const Block &range, const bool skipInvalid) : exe_(&exe), block_(range), invalid_(0) {
+    if (!range.isValid()) throw ArgError("Invalid block provided for instruction sweep");
+    const Offset
+        begin = range.begin.toLinear(),
+        end = range.end.toLinear();
+    // a rough guess of 3 bytes per instruction on average, avoids most of the reallocations
+    const Size estimate = (end - begin + 1) / 3 + 1;
+    offsets_.reserve(estimate);
+    lengths_.reserve(estimate);
+    immLengths_.reserve(estimate);
+    classes_.reserve(estimate);
+    prefixes_.reserve(estimate);
+    types1_.reserve(estimate);
+    types2_.reserve(estimate);
+    imm1_.reserve(estimate);
+    imm2_.reserve(estimate);
+    signatures_.reserve(estimate);
+
+    Offset linear = begin;
+    while (linear <= end) {
+        PackedInstruction pi;
+        try {
+            pi = exe.decoded(Address{linear});
+        }
+        catch (CpuError &e) {
+            if (!skipInvalid) throw;
+            pi = PackedInstruction{};
+            pi.length = 1;
+            pi.opcode = *exe.codePointer(Address{linear});
+            pi.iclass = INS_ERR;
+            pi.prefix = PRF_NONE;
+            pi.type1 = pi.type2 = OPR_ERR;
+            invalid_++;
+        }
+        offsets_.push_back(linear);
+        lengths_.push_back(pi.length);
+        immLengths_.push_back(operandSizeBytes(static_cast<OperandSize>(pi.immsizes & 0xf)) + operandSizeBytes(static_cast<OperandSize>(pi.immsizes >> 4)));
+        classes_.push_back(static_cast<InstructionClass>(pi.iclass));
+        prefixes_.push_back(static_cast<InstructionPrefix>(pi.prefix));
+        types1_.push_back(pi.type1);
+        types2_.push_back(pi.type2);
+        imm1_.push_back(pi.imm1);
+        imm2_.push_back(pi.imm2);
+        signatures_.push_back(pi.iclass == INS_ERR ? 0 : pi.signature());
+        linear += pi.length;
+    }
+    debug("Swept " + to_string(size()) + " instructions over " + range.toString() + ", invalid: " + to_string(invalid_));
+}
+
+// address of an instruction, expressed relative to the segment of the swept block if possible
+Address InstructionSweep::address(const Size idx) const {
+    Address ret{offsets_.at(idx)};
+    if (ret.inSegment(block_.begin.segment)) ret.move(block_.begin.segment);
+    return ret;
+}
+
+Instruction InstructionSweep::instruction(const Size idx) const {
+    return exe_->instruction(address(idx));
+}
+
+// search pattern for a run of instructions, with the immediates and displacements replaced by wildcards
+BytePattern InstructionSweep::pattern(const Size idx, const Size count) const {
+    if (idx + count > size()) throw ArgError("Instruction index out of range for sweep pattern: " + to_string(idx + count));
+    BytePattern ret;
+    for (Size i = idx; i < idx + count; ++i) {
+        const Byte *data = exe_->codePointer(Address{offsets_[i]});
+        const Size fixed = lengths_[i] - immLengths_[i];
+        ret.append(BytePattern{data, fixed});
+        ret.appendWildcard(immLengths_[i]);
+    }
+    return ret;
+}
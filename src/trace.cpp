@@ -0,0 +1,334 @@
+#include "dos/trace.h"
+#include "dos/cpu.h"
+#include "dos/codemap.h"
+#include "dos/error.h"
+#include "dos/util.h"
+
+#include <cstring>
+#include <algorithm>
+#include <sstream>
+
+using namespace std;
+
+static constexpr char TRACE_MAGIC[] = { 'M', 'Z', 'T', 'R' };
+static constexpr Byte TRACE_VERSION = 1;
+
+enum TraceTag : Byte {
+    TAG_CS = 0x1,   // code segment word follows
+    TAG_IP = 0x2,   // instruction offset word follows, otherwise a signed byte delta from the previous instruction
+    TAG_REGS = 0x4, // mask of changed registers follows, then their values
+    TAG_MEM = 0x8,  // count of memory writes follows, then the address, size and contents of each
+};
+
+// registers which a record can change, the code segment and instruction pointer are recorded separately
+static constexpr Register TRACE_REGS[] = {
+    REG_AX, REG_BX, REG_CX, REG_DX, REG_SI, REG_DI, REG_BP, REG_SP, REG_DS, REG_ES, REG_SS, REG_FLAGS
+};
+static constexpr Size TRACE_REG_COUNT = sizeof(TRACE_REGS) / sizeof(TRACE_REGS[0]);
+
+TraceWriter::TraceWriter(std::ostream &out, const Size bufSize) : out_(out), buf_(max(bufSize, Size{16})), len_(0), records_(0), bytes_(0) {
+    put(reinterpret_cast<const Byte*>(TRACE_MAGIC), sizeof(TRACE_MAGIC));
+    putByte(TRACE_VERSION);
+}
+
+TraceWriter::~TraceWriter() {
+    try {
+        flush();
+    }
+    catch (...) {}
+}
+
+void TraceWriter::flush() {
+    if (len_) {
+        out_.write(reinterpret_cast<const char*>(buf_.data()), len_);
+        bytes_ += len_;
+        len_ = 0;
+    }
+    out_.flush();
+    if (!out_) throw IoError("Unable to write execution trace");
+}
+
+// anything too big for the buffer goes straight to the stream
+void TraceWriter::put(const Byte *data, const Size size) {
+    if (len_ + size > buf_.size()) flush();
+    if (size > buf_.size()) {
+        out_.write(reinterpret_cast<const char*>(data), size);
+        bytes_ += size;
+        return;
+    }
+    memcpy(buf_.data() + len_, data, size);
+    len_ += size;
+}
+
+void TraceWriter::putWord(const Word w) {
+    const Byte b[] = { static_cast<Byte>(w & 0xff), static_cast<Byte>(w >> 8) };
+    put(b, sizeof(b));
+}
+
+// 7 bits per byte, lowest first, high bit set if more follow
+void TraceWriter::putVarint(DWord v) {
+    Byte b[5];
+    Size n = 0;
+    do {
+        b[n] = v & 0x7f;
+        v >>= 7;
+        if (v) b[n] |= 0x80;
+        n++;
+    } while (v);
+    put(b, n);
+}
+
+void TraceWriter::record(const Address &csip, const Registers &regs, const std::vector<MemoryWrite> &writes, const Memory &mem) {
+    Byte tag = 0;
+    if (records_ == 0 || csip.segment != prev_.segment) tag |= TAG_CS;
+    const int delta = static_cast<SWord>(csip.offset - prev_.offset);
+    const bool nearIp = !(tag & TAG_CS) && delta >= INT8_MIN && delta <= INT8_MAX;
+    if (!nearIp) tag |= TAG_IP;
+    Word mask = 0;
+    for (Size i = 0; i < TRACE_REG_COUNT; ++i) {
+        if (records_ == 0 || regs.get(TRACE_REGS[i]) != regs_.get(TRACE_REGS[i])) mask |= 1 << i;
+    }
+    if (mask) tag |= TAG_REGS;
+    if (!writes.empty()) tag |= TAG_MEM;
+    putByte(tag);
+    if (tag & TAG_CS) putWord(csip.segment);
+    if (tag & TAG_IP) putWord(csip.offset);
+    else putByte(static_cast<Byte>(delta));
+    if (mask) {
+        putWord(mask);
+        for (Size i = 0; i < TRACE_REG_COUNT; ++i) {
+            if (mask & (1 << i)) putWord(regs.get(TRACE_REGS[i]));
+        }
+    }
+    if (!writes.empty()) {
+        putVarint(writes.size());
+        for (const MemoryWrite &w : writes) {
+            putVarint(w.addr);
+            putVarint(w.size);
+            put(mem.pointer(w.addr), w.size);
+        }
+    }
+    prev_ = csip;
+    regs_ = regs;
+    records_++;
+}
+
+TraceReader::TraceReader(std::istream &in, const Size bufSize) : in_(in), buf_(max(bufSize, Size{16})), pos_(0), len_(0), records_(0) {
+    char magic[sizeof(TRACE_MAGIC)];
+    if (!get(reinterpret_cast<Byte*>(magic), sizeof(magic)) || !equal(begin(magic), end(magic), begin(TRACE_MAGIC)))
+        throw IoError("Not an execution trace");
+    const Byte version = getByte();
+    if (version != TRACE_VERSION) throw IoError("Unsupported execution trace version: " + to_string(version));
+}
+
+bool TraceReader::get(Byte *data, Size size) {
+    while (size) {
+        if (pos_ == len_) {
+            in_.read(reinterpret_cast<char*>(buf_.data()), buf_.size());
+            len_ = in_.gcount();
+            pos_ = 0;
+            if (len_ == 0) return false;
+        }
+        const Size n = min(size, len_ - pos_);
+        memcpy(data, buf_.data() + pos_, n);
+        pos_ += n;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+Byte TraceReader::getByte() {
+    Byte b;
+    if (!get(&b, 1)) throw IoError("Execution trace truncated after " + to_string(records_) + " records");
+    return b;
+}
+
+Word TraceReader::getWord() {
+    const Byte lo = getByte(), hi = getByte();
+    return static_cast<Word>(hi << 8 | lo);
+}
+
+DWord TraceReader::getVarint() {
+    DWord ret = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        const Byte b = getByte();
+        ret |= static_cast<DWord>(b & 0x7f) << shift;
+        if (!(b & 0x80)) return ret;
+    }
+    throw IoError("Invalid value in execution trace record " + to_string(records_));
+}
+
+bool TraceReader::next(TraceRecord &rec) {
+    Byte tag;
+    if (!get(&tag, 1)) return false;
+    Address csip = prev_;
+    if (tag & TAG_CS) csip.segment = getWord();
+    if (tag & TAG_IP) csip.offset = getWord();
+    else csip.offset += static_cast<SByte>(getByte());
+    if (tag & TAG_REGS) {
+        const Word mask = getWord();
+        for (Size i = 0; i < TRACE_REG_COUNT; ++i) {
+            if (mask & (1 << i)) regs_.set(TRACE_REGS[i], getWord());
+        }
+    }
+    rec.csip = csip;
+    rec.regs = regs_;
+    rec.regs.set(REG_CS, csip.segment);
+    rec.regs.set(REG_IP, csip.offset);
+    rec.writes.clear();
+    rec.data.clear();
+    if (tag & TAG_MEM) {
+        const DWord count = getVarint();
+        for (DWord i = 0; i < count; ++i) {
+            MemoryWrite w;
+            w.addr = getVarint();
+            w.size = getVarint();
+            if (w.addr + w.size > MEM_TOTAL) throw IoError("Invalid memory write in execution trace record " + to_string(records_));
+            rec.writes.push_back(w);
+            const Size start = rec.data.size();
+            rec.data.resize(start + w.size);
+            if (!get(rec.data.data() + start, w.size)) throw IoError("Execution trace truncated after " + to_string(records_) + " records");
+        }
+    }
+    prev_ = csip;
+    records_++;
+    return true;
+}
+
+std::string traceCompare(const TraceRecord &ref, const TraceRecord &tgt) {
+    vector<string> diffs;
+    if (ref.csip.segment != tgt.csip.segment || ref.csip.offset != tgt.csip.offset)
+        diffs.push_back("instruction at " + ref.csip.toString() + " vs " + tgt.csip.toString());
+    for (const Register r : TRACE_REGS) {
+        if (ref.regs.get(r) != tgt.regs.get(r))
+            diffs.push_back(regName(r) + " = " + hexVal(ref.regs.get(r)) + " vs " + hexVal(tgt.regs.get(r)));
+    }
+    if (ref.writes.size() != tgt.writes.size()) {
+        diffs.push_back("memory writes: " + to_string(ref.writes.size()) + " vs " + to_string(tgt.writes.size()));
+    }
+    else {
+        Size dataPos = 0;
+        for (Size i = 0; i < ref.writes.size(); ++i) {
+            const MemoryWrite &rw = ref.writes[i], &tw = tgt.writes[i];
+            if (rw.addr != tw.addr || rw.size != tw.size) {
+                diffs.push_back("memory write to " + hexVal(rw.addr) + "[" + to_string(rw.size) + "] vs " + hexVal(tw.addr) + "[" + to_string(tw.size) + "]");
+                break;
+            }
+            const auto mismatch = std::mismatch(ref.data.begin() + dataPos, ref.data.begin() + dataPos + rw.size, tgt.data.begin() + dataPos);
+            if (mismatch.first != ref.data.begin() + dataPos + rw.size) {
+                const Size off = mismatch.first - (ref.data.begin() + dataPos);
+                diffs.push_back("memory at " + hexVal(static_cast<Offset>(rw.addr + off)) + " written with " + hexVal(*mismatch.first) + " vs " + hexVal(*mismatch.second));
+                break;
+            }
+            dataPos += rw.size;
+        }
+    }
+    string ret;
+    for (const string &d : diffs) ret += (ret.empty() ? "" : ", ") + d;
+    return ret;
+}
+
+static string routineName(const CodeMap *map, const Address &addr) {
+    if (map == nullptr) return {};
+    const Routine r = map->getRoutine(addr);
+    return r.isValid() ? " (" + r.name + ")" : " (no routine)";
+}
+
+std::string TraceDivergence::toString(const CodeMap *refMap, const CodeMap *tgtMap) const {
+    if (!found) return "No divergence after " + to_string(index) + " instructions";
+    ostringstream str;
+    str << "Divergence at instruction " << index << ": " << reason << endl
+        << "reference: " << ref.csip.toString() << routineName(refMap, ref.csip) << endl
+        << "target:    " << tgt.csip.toString() << routineName(tgtMap, tgt.csip);
+    return str.str();
+}
+
+namespace {
+// keeps the effects of the last instruction executed
+class TraceCapture : public TraceInterface {
+public:
+    TraceRecord rec;
+    void record(const Address &csip, const Registers &regs, const std::vector<MemoryWrite> &writes, const Memory &mem) override {
+        rec.csip = csip;
+        rec.regs = regs;
+        rec.writes = writes;
+        rec.data.clear();
+        for (const MemoryWrite &w : writes) rec.data.insert(rec.data.end(), mem.pointer(w.addr), mem.pointer(w.addr) + w.size);
+    }
+};
+
+// execute a single instruction, a failure is returned as its message
+string traceStep(Cpu_8086 &cpu, TraceCapture &cap) {
+    cap.rec = {};
+    try {
+        cpu.step();
+    }
+    catch (Error &e) {
+        return e.why();
+    }
+    return {};
+}
+
+string failureReason(const string &refError, const string &tgtError) {
+    if (refError == tgtError) return {};
+    if (refError.empty()) return "target failed: " + tgtError;
+    if (tgtError.empty()) return "reference failed: " + refError;
+    return "reference failed: " + refError + ", target failed: " + tgtError;
+}
+}
+
+TraceDivergence traceLockstep(Cpu_8086 &ref, Cpu_8086 &tgt, const Size limit) {
+    TraceCapture refCap, tgtCap;
+    ref.setTrace(&refCap);
+    tgt.setTrace(&tgtCap);
+    TraceDivergence ret;
+    for (; limit == 0 || ret.index < limit; ++ret.index) {
+        const string refError = traceStep(ref, refCap), tgtError = traceStep(tgt, tgtCap);
+        ret.reason = failureReason(refError, tgtError);
+        // both failed the same way
+        if (ret.reason.empty() && !refError.empty()) break;
+        if (ret.reason.empty()) ret.reason = traceCompare(refCap.rec, tgtCap.rec);
+        if (ret.reason.empty() && ref.done() != tgt.done()) ret.reason = ref.done() ? "reference finished first" : "target finished first";
+        if (!ret.reason.empty()) {
+            ret.found = true;
+            ret.ref = refCap.rec;
+            ret.tgt = tgtCap.rec;
+            break;
+        }
+        if (ref.done()) {
+            ret.index++;
+            break;
+        }
+    }
+    ref.setTrace(nullptr);
+    tgt.setTrace(nullptr);
+    return ret;
+}
+
+TraceDivergence traceReplay(TraceReader &ref, Cpu_8086 &tgt, const Size limit) {
+    TraceCapture tgtCap;
+    tgt.setTrace(&tgtCap);
+    TraceDivergence ret;
+    TraceRecord refRec;
+    for (; limit == 0 || ret.index < limit; ++ret.index) {
+        const bool haveRef = ref.next(refRec);
+        const string tgtError = traceStep(tgt, tgtCap);
+        if (!haveRef) ret.reason = "reference trace ended";
+        else if (!tgtError.empty()) ret.reason = "target failed: " + tgtError;
+        else ret.reason = traceCompare(refRec, tgtCap.rec);
+        if (ret.reason.empty() && tgt.done()) {
+            ret.index++;
+            if (ref.next(refRec)) ret.reason = "target finished before the end of the reference trace";
+            else break;
+        }
+        if (!ret.reason.empty()) {
+            ret.found = true;
+            ret.ref = refRec;
+            ret.tgt = tgtCap.rec;
+            break;
+        }
+    }
+    tgt.setTrace(nullptr);
+    return ret;
+}
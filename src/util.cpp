@@ -7,6 +7,7 @@
 #include <bitset>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <cstring>
 
 #include "dos/util.h"
 #include "dos/output.h"
@@ -331,17 +332,6 @@ inline bool isHexDigit(const char d) {
     return (d >= '0' && d <= '9') || (d >= 'a' && d <= 'f') || (d >= 'A' && d <= 'F');
 }
 
-ByteString hexaToNumeric(const std::string &hexa) {
-    if (hexa.size() & 1) throw ArgError("Hexa string must be of even size");
-    ByteString ret;
-    for (Size s = 0; s < hexa.size(); s+=2) {
-        const string byteStr = hexa.substr(s, 2);
-        if (byteStr == "??") { ret.push_back(-1); continue; }
-        ret.push_back(stoi(byteStr, nullptr, 16));
-    }
-    return ret; 
-}
-
 std::string bytesToHex(const std::vector<Byte> &bytes) {
     ostringstream str;
     for (Byte b : bytes) { 
@@ -350,17 +340,6 @@ std::string bytesToHex(const std::vector<Byte> &bytes) {
     return str.str();
 }
 
-std::string numericToHexa(const ByteString &pattern) {
-    ostringstream str;
-    str << setbase(16) << setfill('0');
-    for (const SWord byte : pattern) {
-        if (byte < 0) str << "??";
-        else if (byte > 0xff) throw ArgError("Invalid byte value in string: " + to_string(byte));
-        else str << setw(2) << byte;
-    }
-    return str.str();
-}
-
 std::vector<string> splitString(const std::string &str, char delim) {
     vector<string> ret;
     size_t start = 0, end = 0;
@@ -372,19 +351,64 @@ std::vector<string> splitString(const std::string &str, char delim) {
     return ret;
 }
 
-void erasePattern(ByteString &str, const ByteString &pat) {
-    if (pat.empty()) throw ArgError("Empty pattern for erasure");
-    auto patFound = std::search(str.begin(), str.end(), pat.begin(), pat.end());
-    if (patFound == str.end()) throw LogicError("Unable to find pattern in string for erasure");
-    for (auto it = patFound; std::distance(patFound, it) < pat.size(); ++it) {
-        *it = -1;
-    }
-}
-
 std::vector<std::string> extractRegex(const std::regex &re, const std::string &str) {
     smatch match;
     if (!regex_match(str, match, re)) return {};
     vector<string> ret;
     for (int i = 1; i < match.size(); ++i) ret.push_back(match.str(i));
     return ret;
-}
\ No newline at end of file
+}
+
+TextBuffer::TextBuffer(char *buf, const Size cap) : buf_(buf), cap_(cap), len_(0), truncated_(false) {
+    if (cap_ == 0) throw ArgError("Text buffer capacity must be positive");
+    buf_[0] = '\0';
+}
+
+void TextBuffer::clear() {
+    len_ = 0;
+    truncated_ = false;
+    buf_[0] = '\0';
+}
+
+TextBuffer& TextBuffer::operator<<(const char c) {
+    return append(&c, 1);
+}
+
+TextBuffer& TextBuffer::operator<<(const char *str) {
+    return append(str, strlen(str));
+}
+
+TextBuffer& TextBuffer::append(const char *str, Size len) {
+    // keep space for the terminator
+    const Size avail = cap_ - 1 - len_;
+    if (len > avail) { len = avail; truncated_ = true; }
+    memcpy(buf_ + len_, str, len);
+    len_ += len;
+    buf_[len_] = '\0';
+    return *this;
+}
+
+TextBuffer& TextBuffer::pad(const Size width, const char c) {
+    while (len_ < width && !truncated_) *this << c;
+    return *this;
+}
+
+TextBuffer& TextBuffer::hex(DWord val, const Size digits, const bool prefix) {
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    char tmp[2 * sizeof(DWord)];
+    Size count = 0;
+    do {
+        tmp[count++] = HEX_DIGITS[val & 0xf];
+        val >>= 4;
+    } while (val != 0);
+    if (prefix) *this << "0x";
+    for (Size i = count; i < digits; ++i) *this << '0';
+    while (count > 0) *this << tmp[--count];
+    return *this;
+}
+
+TextBuffer& TextBuffer::signedHex(const SOffset val, const Size digits, const bool plus) {
+    if (val < 0) *this << '-';
+    else if (plus) *this << '+';
+    return hex(static_cast<DWord>(val < 0 ? -val : val), digits);
+}
@@ -0,0 +1,41 @@
+#include "dos/watch.h"
+#include "dos/error.h"
+#include "dos/util.h"
+
+using namespace std;
+
+static const char* WATCH_NAME[] = { "Breakpoint", "Read", "Write" };
+
+string WatchHit::toString() const {
+    string ret = string(WATCH_NAME[kind]) + " at " + csip.toString();
+    if (kind != WATCH_EXEC) ret += " of " + Block{addr, static_cast<Offset>(addr + size - 1)}.toString(true);
+    return ret;
+}
+
+void Watchpoints::add(const WatchKind kind, const Block &range) {
+    if (!range.isValid() || range.end.toLinear() >= MEM_TOTAL) throw ArgError("Invalid watchpoint range: " + range.toString());
+    vector<uint64_t> &bits = bits_[kind];
+    if (bits.empty()) bits.resize(MEM_TOTAL / 64, 0);
+    bitRange(range.begin.toLinear(), range.size(), [&bits](const Size word, const uint64_t mask) { bits[word] |= mask; });
+}
+
+void Watchpoints::remove(const WatchKind kind, const Block &range) {
+    vector<uint64_t> &bits = bits_[kind];
+    if (bits.empty()) return;
+    if (!range.isValid() || range.end.toLinear() >= MEM_TOTAL) throw ArgError("Invalid watchpoint range: " + range.toString());
+    bitRange(range.begin.toLinear(), range.size(), [&bits](const Size word, const uint64_t mask) { bits[word] &= ~mask; });
+    // drop the bitmap once it is empty, so that the checks against it are skipped again
+    for (const uint64_t w : bits) if (w) return;
+    bits.clear();
+}
+
+void Watchpoints::clear() {
+    for (auto &bits : bits_) bits.clear();
+}
+
+bool Watchpoints::testRange(const WatchKind kind, const Offset addr, const Size size) const {
+    const vector<uint64_t> &bits = bits_[kind];
+    bool hit = false;
+    bitRange(addr, size, [&](const Size word, const uint64_t mask) { if (bits[word] & mask) hit = true; });
+    return hit;
+}
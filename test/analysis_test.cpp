@@ -9,6 +9,13 @@
 #include "dos/opcodes.h"
 #include "dos/executable.h"
 #include "dos/editdistance.h"
+#include "dos/sweep.h"
+#include "dos/superset.h"
+#include "dos/coverage.h"
+#include "dos/memory.h"
+#include "dos/dos.h"
+#include "dos/interrupt.h"
+#include "dos/cpu.h"
 
 using namespace std;
 
@@ -48,7 +55,11 @@ protected:
         }
         return true;
     }
-    void writeExeData(Executable &exe, const Address &addr, const Byte value) { return exe.code.writeByte(addr.toLinear(), value); }
+    void writeExeData(Executable &exe, const Address &addr, const Byte value) { 
+        exe.code.writeByte(addr.toLinear(), value); 
+        exe.decodeCache.clear();
+        exe.supersetIndex.reset();
+    }
 };
 
 // TODO: divest tests of analysis.cpp as distinct test suite
@@ -113,6 +124,20 @@ TEST_F(AnalysisTest, CpuState) {
     ASSERT_EQ(rs.regString(REG_BH), "BH = ab"s);
     ASSERT_EQ(rs.regString(REG_BL), "BL = cd"s);
     TRACELN(rs.toString());    
+
+    TRACELN("Marking AL, BX and DS as unknown in one go");
+    rs.setValue(REG_AX, 0x1234);
+    rs.setValue(REG_DS, 0x2000);
+    rs.setValue(REG_SI, 0x10);
+    rs.setUnknown(regMask(REG_AL) | regMask(REG_BX) | regMask(REG_DS));
+    ASSERT_FALSE(rs.isKnown(REG_AL));
+    ASSERT_TRUE(rs.isKnown(REG_AH));
+    ASSERT_FALSE(rs.isKnown(REG_BX));
+    ASSERT_FALSE(rs.isKnown(REG_BH));
+    ASSERT_FALSE(rs.isKnown(REG_BL));
+    ASSERT_FALSE(rs.isKnown(REG_DS));
+    ASSERT_TRUE(rs.isKnown(REG_SI));
+    ASSERT_EQ(rs.regString(REG_AX), "AX = 12??"s);
 }
 
 TEST_F(AnalysisTest, CodeMap) {
@@ -354,6 +379,64 @@ TEST_F(AnalysisTest, FindWithRollback) {
     ASSERT_EQ(s.type, Segment::SEG_CODE);
 }
 
+TEST_F(AnalysisTest, FindWithCoverage) {
+    // run the executable on the emulated CPU to collect the coverage
+    Memory mem;
+    Dos dos{&mem};
+    InterruptHandler ints{&dos};
+    Cpu_8086 cpu{&mem, &ints, DISPATCH_TABLE};
+    MzImage runMz{"../bin/hello.exe"};
+    const LoadModule lm = dos.loadExe(runMz, "");
+    cpu.init(lm.code, lm.stack, lm.size);
+    ExecProfile profile{Block{Address{lm.segment, 0}, Address{SEG_TO_OFFSET(lm.segment) + lm.size - 1}}};
+    cpu.setProfile(&profile);
+    testing::internal::CaptureStdout();
+    cpu.run();
+    testing::internal::GetCapturedStdout();
+    Coverage(profile).save("hello.cov", lm.segment, true);
+
+    // the routine at 0x586 is only ever called through a pointer, the scan does not find it on its own
+    const Word loadSegment = 0x1234;
+    const Address indirectDest{loadSegment, 0x586};
+    const Coverage coverage{"hello.cov", loadSegment};
+    ASSERT_FALSE(coverage.executed().empty());
+    const auto branches = coverage.branches();
+    ASSERT_TRUE(any_of(branches.begin(), branches.end(), [&](const Coverage::IndirectBranch &b) { return b.isCall && b.destination == indirectDest; }));
+    MzImage mz{"../bin/hello.exe"};
+    mz.load(loadSegment);
+    Executable plainExe{mz};
+    Analyzer plain{Analyzer::Options()};
+    plain.exploreCode(plainExe);
+    ASSERT_FALSE(plainExe.map().getRoutine(indirectDest).isValid());
+
+    Executable exe{mz};
+    Analyzer a{Analyzer::Options()};
+    a.seedCoverage(coverage);
+    a.exploreCode(exe);
+    const CodeMap &discoveredMap = exe.map();
+    TRACE(discoveredMap.getSummary().text);
+    const Routine r = discoveredMap.getRoutine(indirectDest);
+    ASSERT_TRUE(r.isValid());
+    ASSERT_EQ(r.entrypoint(), indirectDest);
+    ASSERT_GT(discoveredMap.routineCount(), plainExe.map().routineCount());
+    // all the executed code is claimed
+    for (const Block &b : coverage.executed()) {
+        ASSERT_TRUE(discoveredMap.getRoutine(b.begin).isValid()) << b.toString();
+    }
+    // on top of the routines found without the coverage, which are left as they were
+    const CodeMap &plainMap = plainExe.map();
+    for (Size i = 0; i < plainMap.routineCount(); ++i) {
+        const Routine pr = plainMap.getRoutine(i);
+        const Routine cr = discoveredMap.getRoutine(pr.entrypoint());
+        ASSERT_TRUE(cr.isValid()) << pr.toString();
+        ASSERT_EQ(cr.entrypoint(), pr.entrypoint());
+        ASSERT_EQ(cr.extents, pr.extents) << pr.toString();
+        ASSERT_EQ(cr.near, pr.near) << pr.toString();
+        ASSERT_EQ(cr.reachable, pr.reachable) << pr.toString();
+        ASSERT_EQ(cr.unreachable, pr.unreachable) << pr.toString();
+    }
+}
+
 TEST_F(AnalysisTest, CodeMapCollision) {
     const string path = "bad.map";
     CodeMap rm = emptyCodeMap();
@@ -676,6 +759,28 @@ TEST_F(AnalysisTest, FindDuplicates) {
     }
     TRACELN("Found duplicates: " + to_string(foundDuplicates));
     ASSERT_EQ(foundDuplicates, expectedDuplicates);
+
+    // same with compact signatures, converted and serialized
+    SignatureLibrary compactSigs{"hello.sig"};
+    compactSigs.compact();
+    compactSigs.save("hello16.sig");
+    SignatureLibrary loadedCompact{"hello16.sig"};
+    ASSERT_EQ(loadedCompact.format(), SIG_COMPACT);
+    ASSERT_EQ(loadedCompact.signatureCount(), sigs.signatureCount());
+    for (Size i = 0; i < loadedCompact.signatureCount(); ++i) {
+        ASSERT_TRUE(loadedCompact.getSignature(i).signature.empty());
+        ASSERT_EQ(loadedCompact.getSignature(i).signature16, compactSigs.getSignature(i).signature16);
+        ASSERT_EQ(loadedCompact.getSignature(i).size(), sigs.getSignature(i).size());
+    }
+    Executable exe16{mz};
+    a.exploreCode(exe16);
+    ASSERT_TRUE(a.findDuplicates(loadedCompact, exe16));
+    foundDuplicates = 0;
+    for (Size i = 0; i < exe16.map().routineCount(); ++i) {
+        if (exe16.map().getRoutine(i).duplicate) foundDuplicates++;
+    }
+    TRACELN("Found duplicates with compact signatures: " + to_string(foundDuplicates));
+    ASSERT_EQ(foundDuplicates, expectedDuplicates);
 }
 
 TEST_F(AnalysisTest, EditDistance) {
@@ -708,3 +813,107 @@ TEST_F(AnalysisTest, DataCompare) {
     writeExeData(tgt, mismatchAddr, (*data)+1);
     ASSERT_FALSE(a.compareData(ref, tgt, dsegName, {}));
 }
+
+TEST_F(AnalysisTest, InstructionCache) {
+    // a paragraph of nops so that the same locations can be reached from two segments
+    vector<Byte> code(PARAGRAPH_SIZE, OP_NOP);
+    code.insert(code.end(), {
+        0xb9, 0x34, 0x12,       // mov cx,0x1234
+        0x36, 0x21, 0x16, 0xac, 0x19, // and [ss:0x19ac],dx
+        0x74, 0xfd,             // jz -0x3
+    });
+    Executable exe{0, code};
+    const Address a{1, 3}, alias{0, 0x13};
+    ASSERT_EQ(a.toLinear(), alias.toLinear());
+    const Instruction direct{a, exe.codePointer(a)};
+    const Instruction cached = exe.instruction(a), aliased = exe.instruction(alias), again = exe.instruction(a);
+    ASSERT_EQ(cached.toString(), direct.toString());
+    ASSERT_EQ(cached.length, direct.length);
+    ASSERT_EQ(cached.match(direct), INS_MATCH_FULL);
+    // the cached decode is returned with the address it was requested through
+    ASSERT_EQ(again.addr, a);
+    ASSERT_EQ(aliased.addr, alias);
+    ASSERT_EQ(aliased.toString(), direct.toString());
+    // branch destinations depend on the address the instruction was obtained through
+    const Address jz{1, 8}, jzAlias{0, 0x18};
+    ASSERT_EQ(exe.instruction(jz).destinationAddress(), Address(1, 7));
+    ASSERT_EQ(exe.instruction(jzAlias).destinationAddress(), Address(0, 0x17));
+    // signatures are extracted through the cache
+    const auto sigs = exe.getSignatures(Block{Address{1, 0}, Address{1, 9}});
+    ASSERT_EQ(sigs.size(), 3);
+    ASSERT_EQ(sigs[1], direct.signature());
+}
+
+TEST_F(AnalysisTest, InstructionSweep) {
+    vector<Byte> code{
+        0xb9, 0x34, 0x12,             // mov cx,0x1234
+        0x36, 0x21, 0x16, 0xac, 0x19, // and [ss:0x19ac],dx
+        0xc6, 0x06, 0xc6, 0x06, 0xc6, // mov byte [0x6c6],0xc6
+        0x0f,                         // invalid
+        0x74, 0xfd,                   // jz -0x3
+    };
+    Executable exe{0, code};
+    const Block all{Address{0, 0}, Address{0, static_cast<Word>(code.size() - 1)}};
+    ASSERT_THROW(InstructionSweep(exe, all), CpuError);
+    const InstructionSweep sweep{exe, all, true};
+    ASSERT_EQ(sweep.size(), 5);
+    ASSERT_EQ(sweep.invalidCount(), 1);
+    ASSERT_EQ(sweep.classes()[3], INS_ERR);
+    ASSERT_EQ(sweep.signatures()[3], 0);
+    // the columns agree with decoding the instructions one at a time
+    for (Size i = 0; i < sweep.size(); ++i) {
+        if (i == 3) continue;
+        const Address a = sweep.address(i);
+        const Instruction ins{a, exe.codePointer(a)};
+        TRACELN(a.toString() << ": " << ins.toString());
+        ASSERT_EQ(sweep.offsets()[i], a.toLinear());
+        ASSERT_EQ(sweep.lengths()[i], ins.length);
+        ASSERT_EQ(sweep.classes()[i], ins.iclass);
+        ASSERT_EQ(sweep.prefixes()[i], ins.prefix);
+        ASSERT_EQ(sweep.types1()[i], ins.op1.type);
+        ASSERT_EQ(sweep.types2()[i], ins.op2.type);
+        ASSERT_EQ(sweep.signatures()[i], ins.signature());
+        ASSERT_EQ(sweep.pattern(i), ins.pattern());
+        ASSERT_EQ(sweep.instruction(i).toString(), ins.toString());
+    }
+    ASSERT_EQ(sweep.immediates1()[1], 0x19ac);
+    ASSERT_EQ(sweep.immediates2()[2], 0xc6);
+    ASSERT_EQ(sweep.pattern(0, 3).toString(), "b9????362116????c606??????");
+    ASSERT_THROW(sweep.pattern(4, 2), ArgError);
+}
+
+TEST_F(AnalysisTest, SupersetIndex) {
+    vector<Byte> code{
+        0xb9, 0x34, 0x12, // mov cx,0x1234
+        0xc3,             // ret
+        0x0f,             // invalid
+        0x90,             // nop
+        0xeb, 0xfd,       // jmp short -0x3
+    };
+    Executable exe{0, code};
+    const SupersetIndex &superset = exe.superset();
+    ASSERT_EQ(&superset, &exe.superset());
+    ASSERT_EQ(superset.size(), code.size());
+    ASSERT_EQ(superset.validCount(), code.size() - 1);
+    ASSERT_TRUE(superset.isValid(Address{0, 0}));
+    ASSERT_EQ(superset.length(Address{0, 0}), 3);
+    ASSERT_EQ(superset.length(Address{0, 1}), 2); // xor al,0x12
+    ASSERT_FALSE(superset.isValid(Address{0, 4}));
+    ASSERT_FALSE(superset.contains(Address{0, 8}));
+    ASSERT_FALSE(superset.isValid(Address{0, 8}));
+    // both the real and the misaligned decode reach the ret
+    ASSERT_EQ(superset.chainEnd(Address{0, 0}), Address{4});
+    ASSERT_EQ(superset.chainEnd(Address{0, 1}), Address{4});
+    // adc al,bl runs into the invalid opcode
+    ASSERT_FALSE(superset.isPlausible(Address{0, 2}));
+    ASSERT_EQ(superset.chainEnd(Address{0, 5}), Address{8});
+    // std runs out of the load module
+    ASSERT_FALSE(superset.isPlausible(Address{0, 7}));
+    const auto preds = superset.predecessors(Address{0, 3});
+    ASSERT_EQ(vector<Offset>(preds.begin(), preds.end()), vector<Offset>({0, 1}));
+    ASSERT_TRUE(superset.predecessors(Address{0, 0}).empty());
+    const auto seeds = superset.seeds(Block{Address{0, 0}, Address{0, 7}});
+    ASSERT_EQ(seeds, vector<Address>({Address{0, 0}, Address{0, 5}}));
+    // a chain which does not terminate inside the block is not proposed
+    ASSERT_TRUE(superset.seeds(Block{Address{0, 4}, Address{0, 6}}).empty());
+}
@@ -1,5 +1,6 @@
 #include <vector>
 #include <limits>
+#include <sstream>
 #include "gtest/gtest.h"
 #include "gmock/gmock.h"
 #include "debug.h"
@@ -10,6 +11,12 @@
 #include "dos/util.h"
 #include "dos/interrupt.h"
 #include "dos/instruction.h"
+#include "dos/error.h"
+#include "dos/psp.h"
+#include "dos/codemap.h"
+#include "dos/trace.h"
+#include "dos/dos.h"
+#include "dos/watch.h"
 
 using namespace std;
 using ::testing::_;
@@ -46,13 +53,14 @@ protected:
 
     string info() { return cpu_->info(); }
     void setupCode(const Byte *code, const Size size) {
+        // the code is loaded at the start of a segment, preceded by room for the PSP
         const Offset
-            memStartLinear = mem_->freeStart(),
+            memStartLinear = mem_->freeStart() + PSP_SIZE,
             memEndLinear = mem_->freeEnd();
         const Address 
-            memStart(memStartLinear),
+            memStart(static_cast<Word>(BYTES_TO_PARA(memStartLinear)), 0),
             memEnd(memEndLinear);
-        mem_->writeBuf(memStartLinear, code, size);
+        mem_->writeBuf(memStart.toLinear(), code, size);
         cpu_->init(memStart, memEnd, 0);
     }
 
@@ -60,6 +68,7 @@ protected:
     inline void setReg(const Register reg, const Word value) { regs_->set(reg, value); }
     inline bool flag(const Flag flag) { return regs_->getFlag(flag); }
     inline Word instructionLength() const { return cpu_->instructionLength(); }
+    inline Registers& cpuRegs(Cpu_8086 &cpu) { return cpu.regs_; }
 };
 
 TEST_F(CpuTest, OrderHL) {
@@ -306,6 +315,100 @@ TEST_F(CpuTest, DISABLED_Mov) {
     ASSERT_EQ(mem_->readByte(off), getReg(REG_CH));
 }
 
+TEST_F(CpuTest, StringInstructions) {
+    const Byte code[] = {
+        OP_REPZ, OP_MOVSB,
+        OP_REPZ, OP_MOVSB,
+        OP_STD,
+        OP_REPZ, OP_STOSW,
+        OP_CLD,
+        OP_REPNZ, OP_SCASB,
+        OP_REPZ, OP_CMPSB,
+        OP_REPZ, OP_LODSW,
+        OP_PREFIX_ES, OP_MOVSB,
+        OP_REPZ, OP_STOSB,
+    };
+    setupCode(code, sizeof(code));
+    const Word srcSeg = 0x2000, dstSeg = 0x3000;
+    const Offset srcBase = SEG_TO_OFFSET(srcSeg), dstBase = SEG_TO_OFFSET(dstSeg);
+    const Byte text[] = "hello";
+    mem_->writeBuf(srcBase + 0x10, text, 5);
+    setReg(REG_DS, srcSeg); setReg(REG_SI, 0x10);
+    setReg(REG_ES, dstSeg); setReg(REG_DI, 0x20);
+    setReg(REG_CX, 5);
+    cpu_->step(); // rep movsb
+    ASSERT_EQ(getReg(REG_IP), 2);
+    ASSERT_EQ(getReg(REG_SI), 0x15);
+    ASSERT_EQ(getReg(REG_DI), 0x25);
+    ASSERT_EQ(getReg(REG_CX), 0);
+    for (Size i = 0; i < 5; ++i) ASSERT_EQ(mem_->readByte(dstBase + 0x20 + i), text[i]);
+
+    // destination one byte ahead of the source replicates the first byte
+    mem_->writeByte(dstBase + 0x40, 0xaa);
+    setReg(REG_DS, dstSeg); setReg(REG_SI, 0x40); setReg(REG_DI, 0x41);
+    setReg(REG_CX, 7);
+    cpu_->step(); // rep movsb
+    for (Size i = 0; i < 8; ++i) ASSERT_EQ(mem_->readByte(dstBase + 0x40 + i), 0xaa);
+    ASSERT_EQ(getReg(REG_DI), 0x48);
+
+    setReg(REG_AX, 0x1234); setReg(REG_DI, 0x10); setReg(REG_CX, 3);
+    cpu_->step(); // std
+    ASSERT_TRUE(flag(FLAG_DIR));
+    cpu_->step(); // rep stosw
+    ASSERT_EQ(mem_->readWord(dstBase + 0x10), 0x1234);
+    ASSERT_EQ(mem_->readWord(dstBase + 0xe), 0x1234);
+    ASSERT_EQ(mem_->readWord(dstBase + 0xc), 0x1234);
+    ASSERT_NE(mem_->readWord(dstBase + 0xa), 0x1234);
+    ASSERT_EQ(getReg(REG_DI), 0xa);
+    ASSERT_EQ(getReg(REG_CX), 0);
+    cpu_->step(); // cld
+    ASSERT_FALSE(flag(FLAG_DIR));
+
+    // search for the terminator of a string
+    const Byte str[] = "abc";
+    mem_->writeBuf(dstBase + 0x100, str, sizeof(str));
+    setReg(REG_AL, 0); setReg(REG_DI, 0x100); setReg(REG_CX, 0x10);
+    cpu_->step(); // repnz scasb
+    ASSERT_EQ(getReg(REG_DI), 0x104);
+    ASSERT_EQ(getReg(REG_CX), 0xc);
+    ASSERT_TRUE(flag(FLAG_ZERO));
+
+    // compare strings up to the first difference
+    const Byte str1[] = "abcd", str2[] = "abXd";
+    mem_->writeBuf(srcBase + 0x200, str1, 4);
+    mem_->writeBuf(dstBase + 0x200, str2, 4);
+    setReg(REG_DS, srcSeg); setReg(REG_SI, 0x200); setReg(REG_DI, 0x200); setReg(REG_CX, 4);
+    cpu_->step(); // repz cmpsb
+    ASSERT_EQ(getReg(REG_SI), 0x203);
+    ASSERT_EQ(getReg(REG_DI), 0x203);
+    ASSERT_EQ(getReg(REG_CX), 1);
+    ASSERT_FALSE(flag(FLAG_ZERO));
+    ASSERT_FALSE(flag(FLAG_CARRY));
+
+    // only the last loaded word remains
+    setReg(REG_SI, 0x200); setReg(REG_CX, 2);
+    cpu_->step(); // rep lodsw
+    ASSERT_EQ(getReg(REG_AX), 0x6463);
+    ASSERT_EQ(getReg(REG_SI), 0x204);
+    ASSERT_EQ(getReg(REG_CX), 0);
+
+    // segment override applies to the source
+    mem_->writeByte(dstBase + 0x300, 0x5a);
+    setReg(REG_SI, 0x300); setReg(REG_DI, 0x301);
+    cpu_->step(); // movsb es:
+    ASSERT_EQ(mem_->readByte(dstBase + 0x301), 0x5a);
+    ASSERT_EQ(getReg(REG_SI), 0x301);
+
+    // the offset wraps around within the segment
+    setReg(REG_AL, 0x77); setReg(REG_DI, 0xfffe); setReg(REG_CX, 4);
+    cpu_->step(); // rep stosb
+    ASSERT_EQ(mem_->readByte(dstBase + 0xfffe), 0x77);
+    ASSERT_EQ(mem_->readByte(dstBase + 0xffff), 0x77);
+    ASSERT_EQ(mem_->readByte(dstBase), 0x77);
+    ASSERT_EQ(mem_->readByte(dstBase + 1), 0x77);
+    ASSERT_EQ(getReg(REG_DI), 2);
+}
+
 TEST_F(CpuTest, DISABLED_Int) {
     const Byte code[] = {
         OP_INT_3,
@@ -410,6 +513,7 @@ TEST_F(CpuTest, Instruction) {
         0xa2, 0xce, 0x00, // mov [0xce],al
         0x8f, 0x06, 0xfe, 0x00, // pop word [0xfe]
         0x83, 0xec, 0x02,       // sub sp, byte 0x2
+        0xc6, 0x06, 0xc6, 0x06, 0xc6, // mov byte [0x6c6], 0xc6
     };
     const std::string instructions[] = {
         "push es",
@@ -429,7 +533,8 @@ TEST_F(CpuTest, Instruction) {
         "mov es, es:[0x2c]",
         "mov [0xce], al",
         "pop word [0xfe]",
-        "sub sp, byte 0x2"
+        "sub sp, byte 0x2",
+        "mov byte [0x6c6], 0xc6"
     };
     const std::string patterns[] = {
         "06", // push es
@@ -450,6 +555,7 @@ TEST_F(CpuTest, Instruction) {
         "a2????", // mov [0xce],al
         "8f06????", // pop word [0xfe]
         "83ec??", // sub sp, byte 0x2
+        "c606??????", // mov byte [0x6c6],0xc6 (immediate bytes also occur in the opcode)
     };
     const DWord signatures[] = {
         //PRF|CLASS  |OP1TYP|OP2TYP|
@@ -471,9 +577,32 @@ TEST_F(CpuTest, Instruction) {
         0b000'0010110'100110'000011, // none|mov|mem_off16|reg_al
         0b000'0000011'100110'000001, // none|pop|mem_off16|none
         0b000'0001001'010001'110010, // none|sub|reg_sp|imm_8
+        0b000'0010110'100110'110010, // none|mov|mem_off16|imm_8
+    };
+    const Signature16 signatures16[] = {
+        //CLASS  |F|OP1|OP2|
+        0b0000010'0'1001'0000, // push|sreg
+        0b0010000'0'0011'0000, // dec|c
+        0b0010110'0'0011'1111, // mov|c|imm
+        0b0100110'1'0000'0000, // rep stosb
+        0b0001101'0'1011'1111, // cmp|[bx]|imm
+        0b0000111'0'1110'0100, // and|[off]|d
+        0b0010010'0'1111'0000, // jmp_if|imm
+        0b1000111'1'0001'1111, // rol|byte|a|imm
+        0b0010110'0'1110'0001, // mov|[off]|a
+        0b0010100'1'0100'1111, // test|byte|d|imm
+        0b0011100'0'1011'0000, // call_far|[bx]
+        0b1001000'0'1100'1111, // ror|[bp]|imm
+        0b0000100'0'1000'1101, // or|sp|[si/di]
+        0b0010001'0'0011'0000, // jmp|c
+        0b0010110'0'1001'1110, // mov|sreg|[off]
+        0b0010110'1'1110'0001, // mov|byte|[off]|a
+        0b0000011'0'1110'0000, // pop|[off]
+        0b0001001'0'1000'1111, // sub|sp|imm
+        0b0010110'0'1110'1111, // mov|[off]|imm
     };
     const Size lengths[] = {
-        1, 1, 3, 2, 5, 5, 2, 2, 4, 3, 2, 2, 4, 2, 5, 3, 4, 3
+        1, 1, 3, 2, 5, 5, 2, 2, 4, 3, 2, 2, 4, 2, 5, 3, 4, 3, 5
     };
     const int icount = sizeof(lengths) / sizeof(Size);
 
@@ -484,13 +613,15 @@ TEST_F(CpuTest, Instruction) {
             << "' (length = " << static_cast<int>(ins.length) << ")" << ", memOfs = " << ins.memOffset() << "/" << hexVal(ins.memOffset()));
         ASSERT_EQ(ins.toString(), instructions[i]);
         ASSERT_EQ(ins.length, lengths[i]);
-        const string patStr = numericToHexa(ins.pattern());
+        const string patStr = ins.pattern().toString();
         TRACELN("pattern: " << patStr << ", expected: " << patterns[i]);
         const DWord sig = ins.signature();
         ASSERT_EQ(patStr, patterns[i]);
         TRACELN("signature: " << hexVal(sig) << "/" << binString(sig) << endl
              << "expected:  " << hexVal(signatures[i]) << "/" << binString(signatures[i]));
         ASSERT_EQ(sig, signatures[i]);
+        ASSERT_EQ(ins.signature16(), signatures16[i]);
+        ASSERT_EQ(compactSignature(sig), signatures16[i]);
         codeofs += ins.length;
     }
 }
@@ -551,3 +682,599 @@ TEST_F(CpuTest, BranchOffset) {
     ASSERT_EQ(exCall.absoluteOffset(), 0xdb45);
     ASSERT_EQ(exCall.toString(true), "call 0xdb45 (0x99a1 down)");
 }
+
+// the decoded lengths must agree with the opcode length table for every opcode that decodes with a register-mode modrm byte
+TEST_F(CpuTest, DecodeLength) {
+    Size checked = 0;
+    for (int opcode = 0; opcode < 0x100; ++opcode) {
+        const Size expected = opcodeInstructionLength(opcode);
+        if (expected == 0 || opcodeIsSegmentPrefix(opcode) || opcode == OP_REPZ || opcode == OP_REPNZ) continue;
+        // try a couple of group instruction selectors, some are invalid for some groups
+        for (const Byte modrm : { 0xc8, 0xd0 }) {
+            const Byte code[] = { static_cast<Byte>(opcode), modrm, 0x11, 0x22, 0x33, 0x44 };
+            try {
+                Instruction ins{Address{0, 0}, code};
+                TRACELN(hexVal(static_cast<Byte>(opcode)) << ": " << ins.toString() << ", length = " << static_cast<int>(ins.length));
+                ASSERT_EQ(ins.length, expected) << "opcode " << hexVal(static_cast<Byte>(opcode));
+                checked++;
+                break;
+            }
+            catch (CpuError &e) {}
+        }
+    }
+    ASSERT_GT(checked, 200);
+}
+
+TEST_F(CpuTest, PackedInstruction) {
+    const Byte code[] = {
+        0xb9, 0x34, 0x12, // mov cx,0x1234
+        0xf3, 0xaa, // rep stosb
+        0x81, 0x78, 0x10, 0xcd, 0xab, // cmp word [bx+si+0x10],0xabcd
+        0x36, 0x21, 0x16, 0xac, 0x19, // and [ss:0x19ac],dx
+        0x74, 0xfd, // jz -0x3
+        0x9a, 0x2f, 0xc, 0xb5, 0x6, // call 0x6b5:0xc2f
+        0x83, 0xec, 0x02, // sub sp, byte 0x2
+    };
+    Size codeofs = 0;
+    while (codeofs < sizeof(code)) {
+        const Address addr{0x1000, static_cast<Word>(0x100 + codeofs)};
+        const Instruction ins{addr, code + codeofs};
+        const PackedInstruction packed{ins};
+        const Instruction unpacked{addr, packed, code + codeofs};
+        TRACELN(ins.toString() << " -> " << unpacked.toString());
+        ASSERT_EQ(unpacked.toString(true), ins.toString(true));
+        ASSERT_EQ(unpacked.length, ins.length);
+        ASSERT_EQ(unpacked.match(ins), INS_MATCH_FULL);
+        ASSERT_EQ(unpacked.op1.size, ins.op1.size);
+        ASSERT_EQ(unpacked.op2.size, ins.op2.size);
+        ASSERT_EQ(unpacked.op1.dwordValue(), ins.op1.dwordValue());
+        ASSERT_EQ(unpacked.op2.dwordValue(), ins.op2.dwordValue());
+        ASSERT_EQ(unpacked.pattern(), ins.pattern());
+        ASSERT_EQ(packed.signature(), ins.signature());
+        ASSERT_EQ(packed.signature16(), ins.signature16());
+        char buf[64];
+        const Size len = packed.render(addr, buf, sizeof(buf));
+        ASSERT_EQ(string(buf), ins.toString());
+        ASSERT_EQ(len, ins.toString().size());
+        // truncated into a short buffer
+        ASSERT_EQ(packed.render(addr, buf, 4), 3);
+        ASSERT_EQ(string(buf), ins.toString().substr(0, 3));
+        codeofs += ins.length;
+    }
+}
+
+TEST_F(CpuTest, TextBuffer) {
+    char buf[16];
+    TextBuffer out{buf, sizeof(buf)};
+    ASSERT_EQ(string(out.c_str()), "");
+    out << "ax" << ',' << ' ';
+    out.hex(0xab);
+    ASSERT_EQ(string(buf), "ax, 0xab");
+    out.clear();
+    out.hex(0x1f, 4, false) << ":";
+    out.signedHex(-0x10, 2);
+    out.signedHex(0x7, 4);
+    // does not fit, gets cut off
+    ASSERT_EQ(string(buf), "001f:-0x10+0x00");
+    ASSERT_TRUE(out.truncated());
+    ASSERT_EQ(out.size(), sizeof(buf) - 1);
+    out.clear();
+    out << "mov";
+    out.pad(6) << "|";
+    ASSERT_EQ(string(buf), "mov   |");
+    // formatting agrees with the string conversions
+    const Byte code[] = { 0x8b, 0x46, 0xfe }; // mov ax,[bp-0x2]
+    const Instruction ins{Address{0x1000, 0x10}, code};
+    char ibuf[INSTRUCTION_TEXT_MAX];
+    TextBuffer iout{ibuf, sizeof(ibuf)};
+    ins.format(iout);
+    ASSERT_EQ(string(ibuf), ins.toString());
+    ASSERT_EQ(string(ibuf), "mov ax, [bp-0x02]");
+    iout.clear();
+    ins.addr.format(iout);
+    ASSERT_EQ(string(ibuf), ins.addr.toString());
+    ASSERT_EQ(string(ibuf), "1000:0010/010010");
+}
+
+TEST_F(CpuTest, RegisterEffects) {
+    const Byte code[] = {
+        0x01, 0xd8,             // add ax,bx
+        0x26, 0x89, 0x47, 0x02, // mov es:[bx+0x2],ax
+        0xf3, 0xaa,             // rep stosb
+        0xd7,                   // xlat
+        0xf7, 0xe1,             // mul cx
+        0xf6, 0xf3,             // div bl
+        0x8b, 0x46, 0xfe,       // mov ax,[bp-0x2]
+        0xe3, 0x00,             // jcxz +0
+        0xac,                   // lodsb
+    };
+    const RegisterMask 
+        AX = regMask(REG_AX), BX = regMask(REG_BX), CX = regMask(REG_CX), DX = regMask(REG_DX), AL = regMask(REG_AL), BL = regMask(REG_BL),
+        SI = regMask(REG_SI), DI = regMask(REG_DI), BP = regMask(REG_BP), ES = regMask(REG_ES), DS = regMask(REG_DS), SS = regMask(REG_SS), 
+        FLAGS = regMask(REG_FLAGS);
+    const RegisterMask reads[] = {
+        AX | BX,
+        AX | BX | ES,
+        AL | DI | ES | FLAGS | CX,
+        AL | BX | DS,
+        CX | AX,
+        BL | AX,
+        BP | SS,
+        FLAGS | CX,
+        SI | DS | FLAGS,
+    };
+    const RegisterMask writes[] = {
+        AX | FLAGS,
+        0,
+        DI | CX,
+        AL,
+        AX | DX | FLAGS,
+        AX | FLAGS,
+        AX,
+        0,
+        AL | SI,
+    };
+    Size codeofs = 0;
+    for (Size i = 0; i < ARRAY_SIZE(reads); ++i) {
+        const Instruction ins{Address{0, static_cast<Word>(codeofs)}, code + codeofs};
+        TRACELN(ins.toString() << ": read " << regMaskString(ins.regsRead()) << ", written " << regMaskString(ins.regsWritten()));
+        ASSERT_EQ(regMaskString(ins.regsRead()), regMaskString(reads[i]));
+        ASSERT_EQ(regMaskString(ins.regsWritten()), regMaskString(writes[i]));
+        codeofs += ins.length;
+    }
+    ASSERT_EQ(codeofs, sizeof(code));
+}
+
+TEST_F(CpuTest, DispatchEngines) {
+    const Byte code[] = {
+        0xb8, 0x34, 0x12,   // mov ax, 0x1234
+        0xbb, 0x00, 0x01,   // mov bx, 0x100
+        0xb9, 0x0a, 0x00,   // mov cx, 10
+        0x31, 0xd2,         // xor dx, dx
+        0x01, 0xca,         // add dx, cx
+        0x88, 0x17,         // mov [bx], dl
+        0x43,               // inc bx
+        0xe2, 0xf9,         // loop -7
+        0x52,               // push dx
+        0xe8, 0x2d, 0x00,   // call 0x43
+        0x5e,               // pop si
+        0xbf, 0x00, 0x02,   // mov di, 0x200
+        0xb9, 0x04, 0x00,   // mov cx, 4
+        0xf3, 0xab,         // rep stosw
+        0xb8, 0xe8, 0x03,   // mov ax, 1000
+        0xb9, 0x07, 0x00,   // mov cx, 7
+        0x31, 0xd2,         // xor dx, dx
+        0xf7, 0xf1,         // div cx
+        0xb1, 0x03,         // mov cl, 3
+        0xd3, 0xe0,         // shl ax, cl
+        0xd1, 0xf8,         // sar ax, 1
+        0xf7, 0xd8,         // neg ax
+        0x3d, 0x00, 0x00,   // cmp ax, 0
+        0x7c, 0x03,         // jl +3
+        0xbd, 0xad, 0xde,   // mov bp, 0xdead
+        0xa3, 0x00, 0x03,   // mov [0x300], ax
+        0xb0, 0x19,         // mov al, 0x19
+        0x04, 0x28,         // add al, 0x28
+        0x27,               // daa
+        0xcd, 0x20,         // int 0x20
+        0x55,               // push bp
+        0x89, 0xe5,         // mov bp, sp
+        0x8b, 0x46, 0x04,   // mov ax, [bp+4]
+        0xb9, 0x03, 0x00,   // mov cx, 3
+        0xf7, 0xe1,         // mul cx
+        0x5d,               // pop bp
+        0xc3,               // ret
+    };
+    const Address codeAddr{0x1000, 0}, stackAddr{0x3000, 0x1000};
+    const Word dataSeg = 0x2000;
+    const Offset dataBase = SEG_TO_OFFSET(dataSeg);
+    EXPECT_CALL(*int_, interrupt(0x20, _)).Times(2).WillRepeatedly(Return(INT_TERMINATE));
+    Memory mem[2];
+    Cpu_8086 table(&mem[1], int_, DISPATCH_TABLE);
+    ASSERT_EQ(table.dispatchMode(), DISPATCH_TABLE);
+    Cpu_8086 *cpus[2] = { cpu_, &table };
+    // run the same program on both engines and compare the outcomes
+    for (int i = 0; i < 2; ++i) {
+        Memory &m = i == 0 ? *mem_ : mem[1];
+        m.writeBuf(codeAddr.toLinear(), code, sizeof(code));
+        cpus[i]->init(codeAddr, stackAddr, sizeof(code));
+        cpuRegs(*cpus[i]).set(REG_DS, dataSeg);
+        cpuRegs(*cpus[i]).set(REG_ES, dataSeg);
+        cpus[i]->run();
+        ASSERT_TRUE(cpus[i]->done());
+    }
+    ASSERT_EQ(cpu_->executed(), table.executed());
+    ASSERT_EQ(cpu_->registers().dump(), table.registers().dump());
+    for (Offset o = dataBase; o < dataBase + 0x400; ++o) ASSERT_EQ(mem_->readByte(o), mem[1].readByte(o));
+
+    const Byte sums[] = { 10, 19, 27, 34, 40, 45, 49, 52, 54, 55 };
+    for (Size i = 0; i < sizeof(sums); ++i) ASSERT_EQ(mem_->readByte(dataBase + 0x100 + i), sums[i]);
+    for (Size i = 0; i < 4; ++i) ASSERT_EQ(mem_->readWord(dataBase + 0x200 + i * 2), 0xa5);
+    ASSERT_EQ(mem_->readWord(dataBase + 0x300), 0xfdc8);
+    ASSERT_EQ(getReg(REG_BX), 0x10a);
+    ASSERT_EQ(getReg(REG_SI), 55);
+    ASSERT_EQ(getReg(REG_DI), 0x208);
+    ASSERT_EQ(getReg(REG_DX), 6);
+    ASSERT_EQ(getReg(REG_CX), 3);
+    ASSERT_EQ(getReg(REG_AX), 0xfd47);
+    ASSERT_EQ(getReg(REG_BP), 0);
+    ASSERT_EQ(getReg(REG_SP), 0x1000);
+    ASSERT_TRUE(flag(FLAG_AUXC));
+}
+
+TEST_F(CpuTest, LazyFlags) {
+    const Byte code[] = {
+        0xb0, 0xff,         // mov al, 0xff
+        0x04, 0x01,         // add al, 1
+        0xfe, 0xc3,         // inc bl
+        0x72, 0x02,         // jc +2
+        0xb7, 0x01,         // mov bh, 1
+        0x9c,               // pushf
+        0x5a,               // pop dx
+        0xb4, 0x05,         // mov ah, 5
+        0x80, 0xdc, 0x06,   // sbb ah, 6
+        0x9f,               // lahf
+        0xcd, 0x20,         // int 0x20
+    };
+    setupCode(code, sizeof(code));
+    setReg(REG_BX, 0);
+    EXPECT_CALL(*int_, interrupt(0x20, _)).WillOnce(Return(INT_TERMINATE));
+    cpu_->run();
+    // inc leaves the carry from the add alone, the other flags come from the inc
+    ASSERT_EQ(getReg(REG_BH), 0);
+    ASSERT_EQ(getReg(REG_BL), 1);
+    const Word arith = FLAG_CARRY | FLAG_PARITY | FLAG_AUXC | FLAG_ZERO | FLAG_SIGN | FLAG_OVER;
+    ASSERT_EQ(getReg(REG_DX) & arith, FLAG_CARRY);
+    // 5 - 6 - carry
+    ASSERT_EQ(getReg(REG_AH), FLAG_SIGN | FLAG_AUXC | FLAG_CARRY);
+    ASSERT_TRUE(flag(FLAG_CARRY));
+    ASSERT_TRUE(flag(FLAG_SIGN));
+    ASSERT_TRUE(flag(FLAG_AUXC));
+    ASSERT_FALSE(flag(FLAG_ZERO));
+    ASSERT_FALSE(flag(FLAG_OVER));
+}
+
+TEST_F(CpuTest, SelfModifyingCode) {
+    const Byte code[] = {
+        0xb9, 0x03, 0x00,                   // mov cx, 3
+        0x31, 0xc0,                         // xor ax, ax
+        0x05, 0x01, 0x00,                   // add ax, 1
+        0x2e, 0xc6, 0x06, 0x06, 0x00, 0x05, // mov byte [cs:6], 5
+        0xe2, 0xf5,                         // loop -11
+        0x2e, 0xc6, 0x06, 0x17, 0x00, 0x42, // mov byte [cs:0x17], 0x42
+        0xb3, 0x00,                         // mov bl, 0
+        0xcd, 0x20,                         // int 0x20
+    };
+    setupCode(code, sizeof(code));
+    const Offset codeLinear = regs_->csip().toLinear();
+    EXPECT_CALL(*int_, interrupt(0x20, _)).WillOnce(Return(INT_TERMINATE));
+    cpu_->run();
+    // the patched immediate takes effect on the next pass through the loop, and right away in the same block
+    ASSERT_EQ(getReg(REG_AX), 1 + 5 + 5);
+    ASSERT_EQ(getReg(REG_BL), 0x42);
+    ASSERT_GT(cpu_->blockCount(), 0);
+    ASSERT_TRUE(mem_->codeTracked(codeLinear + 0x17));
+    ASSERT_FALSE(mem_->codeWritten());
+
+    // code written from outside between runs
+    mem_->writeByte(codeLinear + 0x17, 0x24);
+    ASSERT_TRUE(mem_->codeWritten());
+    setReg(REG_IP, 0x16);
+    EXPECT_CALL(*int_, interrupt(0x20, _)).WillOnce(Return(INT_TERMINATE));
+    cpu_->run();
+    ASSERT_EQ(getReg(REG_BL), 0x24);
+}
+
+TEST_F(CpuTest, SnapshotFork) {
+    const Byte code[] = {
+        0x3d, 0x05, 0x00,                   // cmp ax, 5
+        0x74, 0x07,                         // jz +7
+        0xc6, 0x06, 0x00, 0x01, 0xaa,       // mov byte [0x100], 0xaa
+        0xcd, 0x20,                         // int 0x20
+        0xc6, 0x06, 0x00, 0x01, 0xbb,       // mov byte [0x100], 0xbb
+        0xcd, 0x20,                         // int 0x20
+    };
+    setupCode(code, sizeof(code));
+    setReg(REG_AX, 5);
+    cpu_->step(); // cmp
+    const Offset data = SEG_TO_OFFSET(getReg(REG_DS)) + 0x100;
+    const Byte orig = mem_->readByte(data);
+    const CpuSnapshot snap = cpu_->snapshot();
+    ASSERT_EQ(mem_->dirtyPages(), 0);
+    EXPECT_CALL(*int_, interrupt(0x20, _)).Times(3).WillRepeatedly(Return(INT_TERMINATE));
+
+    // branch taken
+    cpu_->run();
+    ASSERT_EQ(mem_->readByte(data), 0xbb);
+    ASSERT_EQ(mem_->dirtyPages(), 1);
+    ASSERT_EQ(cpu_->executed(), 4);
+
+    // back to the branch, explore the other side
+    cpu_->restore(snap);
+    ASSERT_EQ(mem_->readByte(data), orig);
+    ASSERT_EQ(getReg(REG_IP), 3);
+    ASSERT_EQ(cpu_->executed(), 1);
+    ASSERT_TRUE(flag(FLAG_ZERO));
+    regs_->setFlag(FLAG_ZERO, false);
+    cpu_->run();
+    ASSERT_EQ(mem_->readByte(data), 0xaa);
+
+    // an independent instance forked from the same snapshot
+    Memory forkMem{snap.memory};
+    Cpu_8086 fork{&forkMem, int_, DISPATCH_TABLE};
+    fork.restore(snap);
+    ASSERT_EQ(forkMem.readByte(data), orig);
+    fork.run();
+    ASSERT_EQ(forkMem.readByte(data), 0xbb);
+    ASSERT_EQ(mem_->readByte(data), 0xaa);
+}
+
+TEST_F(CpuTest, Profile) {
+    const Byte code[] = {
+        0xb9, 0x03, 0x00,   // mov cx, 3
+        0xe8, 0x04, 0x00,   // call sub
+        0xe2, 0xfb,         // loop -5
+        0xcd, 0x20,         // int 0x20
+        0x40,               // sub: inc ax
+        0xc3,               // ret
+    };
+    setupCode(code, sizeof(code));
+    const Word cs = getReg(REG_CS);
+    ExecProfile profile{Block{Address{cs, 0}, Address{cs, sizeof(code) - 1}}};
+    cpu_->setProfile(&profile);
+    EXPECT_CALL(*int_, interrupt(0x20, _)).WillOnce(Return(INT_TERMINATE));
+    cpu_->run();
+    ASSERT_EQ(profile.total(), 14);
+    ASSERT_EQ(profile.outside(), 0);
+    ASSERT_EQ(profile.hits(Address{cs, 3}), 3);
+    ASSERT_EQ(profile.hits(Address{cs, 4}), 0);
+    ASSERT_EQ(profile.taken(Address{cs, 6}), 2);
+    ASSERT_EQ(profile.notTaken(Address{cs, 6}), 1);
+    // the instructions are laid out back to back, so they make up a single run spanning all of them
+    const auto runs = profile.executed();
+    ASSERT_EQ(runs.size(), 1);
+    ASSERT_EQ(runs.front(), Block(Address{cs, 0}, Address{cs, sizeof(code) - 1}));
+
+    CodeMap map;
+    Routine &main = map.getMutableRoutine("main");
+    main.extents = Block{Address{cs, 0}, Address{cs, 9}};
+    main.reachable.push_back(main.extents);
+    Routine &sub = map.getMutableRoutine("sub");
+    sub.extents = Block{Address{cs, 10}, Address{cs, 10}};
+    sub.reachable.push_back(sub.extents);
+    const auto stats = profile.routineStats(map);
+    TRACELN(profile.report(map));
+    // the ret is not claimed by the routine
+    ASSERT_EQ(stats.size(), 3);
+    ASSERT_EQ(stats[0].name, "main");
+    ASSERT_EQ(stats[0].instructions, 8);
+    ASSERT_EQ(stats[0].taken, 2);
+    ASSERT_EQ(stats[1].name, "sub");
+    ASSERT_EQ(stats[1].instructions, 3);
+    ASSERT_TRUE(stats[2].name.empty());
+    ASSERT_EQ(stats[2].blocks.size(), 1);
+    ASSERT_EQ(stats[2].blocks.front().block, Block(Address{cs, 11}));
+
+    // the same run in a build where the subroutine executes one more instruction per call
+    ExecProfile other{profile.area()};
+    for (int i = 0; i < 3; ++i) {
+        other.hit(Address{cs, 3}.toLinear());
+        other.hit(Address{cs, 10}.toLinear());
+        other.hit(Address{cs, 10}.toLinear());
+    }
+    const string cmp = profile.compare(map, other, map);
+    TRACELN(cmp);
+    ASSERT_NE(cmp.find("sub: 3 -> 6 (+3)"), string::npos);
+    ASSERT_LT(cmp.find("sub:"), cmp.find("main:"));
+}
+
+TEST_F(CpuTest, Trace) {
+    const Byte code[] = {
+        0xb8, 0x01, 0x00,   // mov ax, 1
+        0xa3, 0x00, 0x01,   // mov [0x100], ax
+        0x01, 0xd8,         // add ax, bx
+        0x50,               // push ax
+        0xcd, 0x20,         // int 0x20
+    };
+    setupCode(code, sizeof(code));
+    setReg(REG_BX, 0x1234);
+    const Word cs = getReg(REG_CS), sp = getReg(REG_SP);
+    const Offset data = SEG_TO_OFFSET(getReg(REG_DS)) + 0x100, stack = SEG_TO_OFFSET(getReg(REG_SS)) + static_cast<Word>(sp - 2);
+    const CpuSnapshot snap = cpu_->snapshot();
+    EXPECT_CALL(*int_, interrupt(0x20, _)).Times(4).WillRepeatedly(Return(INT_TERMINATE));
+
+    // small buffer to go through a couple of flushes
+    stringstream str;
+    TraceWriter writer{str, 16};
+    cpu_->setTrace(&writer);
+    cpu_->run();
+    cpu_->setTrace(nullptr);
+    writer.flush();
+    ASSERT_EQ(writer.records(), 5);
+    ASSERT_EQ(writer.bytes(), str.str().size());
+
+    TraceReader reader{str, 16};
+    vector<TraceRecord> recs;
+    TraceRecord rec;
+    while (reader.next(rec)) recs.push_back(rec);
+    ASSERT_EQ(recs.size(), 5);
+    ASSERT_EQ(recs[0].csip, Address(cs, 0));
+    ASSERT_EQ(recs[0].regs.get(REG_AX), 1);
+    ASSERT_TRUE(recs[0].writes.empty());
+    ASSERT_EQ(recs[1].csip, Address(cs, 3));
+    ASSERT_EQ(recs[1].writes.size(), 1);
+    ASSERT_EQ(recs[1].writes[0].addr, data);
+    ASSERT_EQ(recs[1].writes[0].size, 2);
+    ASSERT_EQ(recs[1].data, vector<Byte>({ 0x01, 0x00 }));
+    ASSERT_EQ(recs[2].regs.get(REG_AX), 0x1235);
+    ASSERT_EQ(recs[3].regs.get(REG_SP), static_cast<Word>(sp - 2));
+    ASSERT_EQ(recs[3].writes[0].addr, stack);
+    ASSERT_EQ(recs[3].data, vector<Byte>({ 0x35, 0x12 }));
+    ASSERT_EQ(recs[4].csip, Address(cs, 9));
+
+    // an identical machine runs the same way
+    Memory forkMem{snap.memory};
+    Cpu_8086 fork{&forkMem, int_, DISPATCH_TABLE};
+    fork.restore(snap);
+    cpu_->restore(snap);
+    TraceDivergence div = traceLockstep(*cpu_, fork);
+    TRACELN(div.toString());
+    ASSERT_FALSE(div.found);
+    ASSERT_EQ(div.index, 5);
+
+    // and so does a replay of the trace
+    cpu_->restore(snap);
+    stringstream replayStr{str.str()};
+    TraceReader replay{replayStr};
+    div = traceReplay(replay, *cpu_);
+    ASSERT_FALSE(div.found);
+    ASSERT_EQ(div.index, 5);
+
+    // the second machine stores into a different variable
+    cpu_->restore(snap);
+    fork.restore(snap);
+    forkMem.writeByte(SEG_TO_OFFSET(cs) + 4, 0x02);
+    div = traceLockstep(*cpu_, fork);
+    TRACELN(div.toString());
+    ASSERT_TRUE(div.found);
+    ASSERT_EQ(div.index, 1);
+    ASSERT_EQ(div.ref.csip, Address(cs, 3));
+    ASSERT_NE(div.reason.find("memory write to"), string::npos);
+}
+
+TEST_F(CpuTest, IdleLoop) {
+    const Byte code[] = {
+        0xba, 0xda, 0x03,               // mov dx, 0x3da
+        0xec,                           // retrace: in al, dx
+        0xa8, 0x08,                     // test al, 8
+        0x74, 0xfb,                     // jz retrace
+        0xb8, 0x40, 0x00,               // mov ax, 0x40
+        0x8e, 0xc0,                     // mov es, ax
+        0x26, 0x8b, 0x1e, 0x6c, 0x00,   // mov bx, [es:0x6c]
+        0x26, 0x3b, 0x1e, 0x6c, 0x00,   // tick: cmp bx, [es:0x6c]
+        0x74, 0xf9,                     // je tick
+        0xe6, 0x61,                     // out 0x61, al
+        0xe4, 0x61,                     // in al, 0x61
+        0xcd, 0x20,                     // int 0x20
+    };
+    setupCode(code, sizeof(code));
+    setReg(REG_AX, 0x1234);
+    Dos dos{mem_};
+    InterruptHandler ints{&dos};
+    Cpu_8086 cpu{mem_, &ints, DISPATCH_TABLE};
+    cpu.restore(cpu_->snapshot());
+    cpu.run();
+    TRACELN("Executed " + to_string(cpu.executed()) + ", skipped " + to_string(cpu.skipped()) + ", clock " + to_string(ints.clock()));
+    ASSERT_TRUE(cpu.done());
+    // both loops went around just enough times to find that they were idle
+    ASSERT_LT(cpu.executed(), 40);
+    ASSERT_GT(cpu.skipped(), 0);
+    ASSERT_GE(ints.clock(), InterruptHandler::TICK_INSTRUCTIONS);
+    ASSERT_EQ(mem_->readWord(InterruptHandler::BDA_TICKS), ints.clock() / InterruptHandler::TICK_INSTRUCTIONS);
+    ASSERT_EQ(cpu.registers().get(REG_AL), 0x40);
+
+    // a loop which changes what it compares is not idle, however short
+    const Byte busy[] = {
+        0xb9, 0x00, 0x10,               // mov cx, 0x1000
+        0x26, 0x3b, 0x0e, 0x6c, 0x00,   // wait: cmp cx, [es:0x6c]
+        0xe2, 0xf9,                     // loop wait
+        0xcd, 0x20,                     // int 0x20
+    };
+    setupCode(busy, sizeof(busy));
+    setReg(REG_ES, 0x40);
+    Cpu_8086 busyCpu{mem_, &ints, DISPATCH_TABLE};
+    busyCpu.restore(cpu_->snapshot());
+    busyCpu.run();
+    ASSERT_EQ(busyCpu.executed(), 0x2002);
+    ASSERT_EQ(busyCpu.skipped(), 0);
+}
+
+TEST_F(CpuTest, TimerTicks) {
+    const Byte code[] = {
+        0xb4, 0x2c,                     // mov ah, 0x2c
+        0xcd, 0x21,                     // int 0x21
+        0xb4, 0x2c,                     // mov ah, 0x2c
+        0xcd, 0x21,                     // int 0x21
+        0xcd, 0x20,                     // int 0x20
+    };
+    setupCode(code, sizeof(code));
+    Dos dos{mem_};
+    InterruptHandler ints{&dos};
+    Cpu_8086 cpu{mem_, &ints, DISPATCH_TABLE};
+    cpu.restore(cpu_->snapshot());
+    cpu.run();
+    ASSERT_TRUE(cpu.done());
+    // every call to get the time moves the clock on, and the BIOS data area keeps up with it
+    ASSERT_EQ(mem_->readWord(InterruptHandler::BDA_TICKS), 2);
+    ASSERT_EQ(mem_->readWord(InterruptHandler::BDA_TICKS + 2), 0);
+}
+
+TEST_F(CpuTest, Watchpoints) {
+    const Byte code[] = {
+        0xb8, 0x34, 0x12,   // mov ax, 0x1234
+        0xa3, 0x00, 0x01,   // mov [0x100], ax
+        0xbe, 0x00, 0x01,   // mov si, 0x100
+        0xbf, 0x00, 0x02,   // mov di, 0x200
+        0xb9, 0x10, 0x00,   // mov cx, 0x10
+        0x1e,               // push ds
+        0x07,               // pop es
+        0xf3, 0xa4,         // rep movsb
+        0xff, 0xd0,         // call ax
+    };
+    setupCode(code, sizeof(code));
+    const Word cs = getReg(REG_CS);
+    const Offset data = SEG_TO_OFFSET(getReg(REG_DS));
+    // records the hits along with the value of ax, stops at the breakpoints
+    struct Recorder : public WatchInterface {
+        vector<WatchHit> hits;
+        vector<Word> ax;
+        bool hit(const WatchHit &hit, const Registers &regs, const Memory &) override {
+            hits.push_back(hit);
+            ax.push_back(regs.get(REG_AX));
+            return hit.kind == WATCH_EXEC;
+        }
+    } rec;
+    Watchpoints watch;
+    watch.add(WATCH_EXEC, Block{Address{cs, 0x13}});
+    watch.add(WATCH_WRITE, Block{data + 0x101, data + 0x101});
+    watch.add(WATCH_READ, Block{data + 0x10f, data + 0x110});
+    ASSERT_TRUE(watch.test(WATCH_READ, data + 0x10e, 2));
+    ASSERT_FALSE(watch.test(WATCH_READ, data + 0x10d, 2));
+    ASSERT_FALSE(watch.test(WATCH_WRITE, data + 0x102, 0x100));
+    cpu_->setWatch(&watch, &rec);
+
+    // the breakpoint stops before the call, the accesses on the way have been reported
+    cpu_->run();
+    ASSERT_TRUE(cpu_->stopped());
+    ASSERT_FALSE(cpu_->done());
+    ASSERT_EQ(getReg(REG_IP), 0x13);
+    ASSERT_EQ(cpu_->executed(), 8);
+    ASSERT_EQ(rec.hits.size(), 3);
+    ASSERT_EQ(rec.hits[0].kind, WATCH_WRITE);
+    ASSERT_EQ(rec.hits[0].csip, Address(cs, 3));
+    ASSERT_EQ(rec.hits[0].addr, data + 0x100);
+    ASSERT_EQ(rec.hits[0].size, 2);
+    // the string move goes through a single copy, reported as a whole
+    ASSERT_EQ(rec.hits[1].kind, WATCH_READ);
+    ASSERT_EQ(rec.hits[1].csip, Address(cs, 0x11));
+    ASSERT_EQ(rec.hits[1].addr, data + 0x100);
+    ASSERT_EQ(rec.hits[1].size, 0x10);
+    ASSERT_EQ(rec.hits[2].kind, WATCH_EXEC);
+    ASSERT_EQ(rec.ax[2], 0x1234);
+
+    // running again goes past the breakpoint, the call pushes the return address into the watched range
+    watch.add(WATCH_WRITE, Block{data + 0xfffe - 0x100, data + 0xffff});
+    setReg(REG_SS, getReg(REG_DS));
+    setReg(REG_SP, 0xff00);
+    cpu_->step();
+    ASSERT_FALSE(cpu_->stopped());
+    ASSERT_EQ(getReg(REG_IP), 0x1234);
+    ASSERT_EQ(rec.hits.size(), 4);
+    ASSERT_EQ(rec.hits[3].kind, WATCH_WRITE);
+    ASSERT_EQ(rec.hits[3].addr, data + 0xfefe);
+
+    // nothing is reported once removed
+    watch.remove(WATCH_WRITE, Block{0, MEM_TOTAL - 1});
+    ASSERT_TRUE(watch.empty(WATCH_WRITE));
+    ASSERT_FALSE(watch.empty(WATCH_READ));
+}
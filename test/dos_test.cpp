@@ -4,11 +4,27 @@
 #include "dos/dos.h"
 #include "dos/mz.h"
 #include "dos/util.h"
+#include "dos/memory.h"
+#include "dos/cpu.h"
+#include "dos/interrupt.h"
+#include "dos/psp.h"
+#include "dos/harness.h"
+#include "dos/error.h"
+#include "dos/output.h"
+#include "dos/pool.h"
+#include "dos/history.h"
+#include "dos/watch.h"
 
 #include <vector>
 #include <numeric>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <atomic>
 
 using namespace std;
+namespace fs = std::filesystem;
 
 TEST(Dos, MzHeader) {
     MzImage mz("../bin/hello.exe");
@@ -26,3 +42,329 @@ TEST(Dos, HexDiff) {
     hexDump(buf1.data(), buf1.size());
     hexDiff(buf1.data(), buf2.data(), 0x17, 0xe3, 0x1234, 0xabcd);
 }
+
+TEST(Dos, RunExe) {
+    Memory mem;
+    Dos dos{&mem};
+    InterruptHandler ints{&dos};
+    Cpu_8086 cpu{&mem, &ints, DISPATCH_TABLE};
+    MzImage mz("../bin/hello.exe");
+    const LoadModule lm = dos.loadExe(mz, "arg");
+    ASSERT_EQ(lm.segment, dos.pspSegment() + BYTES_TO_PARA(PSP_SIZE));
+    ASSERT_EQ(mem.readByte(Address{dos.pspSegment(), 0x80}), 4);
+    ASSERT_EQ(mem.readByte(Address{dos.pspSegment(), 0x85}), '\r');
+    cpu.init(lm.code, lm.stack, lm.size);
+    testing::internal::CaptureStdout();
+    cpu.run();
+    const string out = testing::internal::GetCapturedStdout();
+    // the C runtime expands the newline in text mode
+    ASSERT_EQ(out, "Hello, world!\r\n");
+    ASSERT_EQ(dos.exitCode(), 14);
+}
+
+TEST(Dos, ParallelRuns) {
+    const Size RUNS = 8;
+    struct Run {
+        ostringstream console, log;
+        Size executed = 0;
+        Byte exitCode = 0;
+    };
+    vector<Run> runs(RUNS);
+    const LogPriority level = getOutputLevel();
+    ThreadPool pool{4};
+    ASSERT_EQ(pool.size(), 4);
+    for (Size i = 0; i < RUNS; ++i) pool.submit([&runs, i] {
+        Run &run = runs[i];
+        // every machine logs everything into its own sink
+        LogContext ctx{run.log, LOG_DEBUG};
+        LogScope scope{ctx};
+        Memory mem;
+        Dos dos{&mem};
+        istringstream input;
+        dos.setConsole(input, run.console);
+        InterruptHandler ints{&dos};
+        Cpu_8086 cpu{&mem, &ints, DISPATCH_TABLE};
+        MzImage mz("../bin/hello.exe");
+        const LoadModule lm = dos.loadExe(mz, "");
+        cpu.init(lm.code, lm.stack, lm.size);
+        cpu.run();
+        run.executed = cpu.executed();
+        run.exitCode = dos.exitCode();
+    });
+    pool.wait();
+    for (const Run &run : runs) {
+        ASSERT_EQ(run.console.str(), "Hello, world!\r\n");
+        ASSERT_EQ(run.exitCode, 14);
+        ASSERT_EQ(run.executed, runs[0].executed);
+        ASSERT_NE(run.log.str().find("exited with code 14"), string::npos);
+    }
+    ASSERT_EQ(getOutputLevel(), level);
+
+    // a failed task is reported by the wait
+    pool.submit([] { throw ArgError("task failed"); });
+    ASSERT_THROW(pool.wait(), ArgError);
+    pool.wait();
+}
+
+// records the last write into watched memory with the instruction count
+class LastWriteWatch : public WatchInterface {
+    const Cpu_8086 &cpu_;
+public:
+    Size instruction = 0;
+    Address csip;
+    LastWriteWatch(const Cpu_8086 &cpu) : cpu_(cpu) {}
+    bool hit(const WatchHit &hit, const Registers &, const Memory &) override {
+        instruction = cpu_.executed() - 1;
+        csip = hit.csip;
+        return false;
+    }
+};
+
+TEST(Dos, ExecHistory) {
+    struct Machine {
+        Memory mem;
+        Dos dos{&mem};
+        istringstream input;
+        ostringstream console;
+        InterruptHandler ints{&dos};
+        Cpu_8086 cpu{&mem, &ints, DISPATCH_TABLE};
+        Machine() {
+            dos.setConsole(input, console);
+            MzImage mz("../bin/hello.exe");
+            const LoadModule lm = dos.loadExe(mz, "");
+            cpu.init(lm.code, lm.stack, lm.size);
+        }
+    };
+    Machine m;
+    ExecHistory history{m.cpu, m.dos, m.ints, 10, 4};
+    history.run();
+    ASSERT_TRUE(m.cpu.done());
+    const Size total = m.cpu.executed();
+    ASSERT_GT(total, 100);
+    ASSERT_LE(history.checkpointCount(), 4);
+    ASSERT_GT(history.interval(), 10);
+    const Registers end = m.cpu.registers();
+
+    // the last write into the stack below its final top, compared against watching it on a full run
+    const Offset addr = Address{end.get(REG_SS), static_cast<Word>(end.get(REG_SP) - 2)}.toLinear();
+    Machine ref;
+    Watchpoints watch;
+    watch.add(WATCH_WRITE, Block{addr});
+    LastWriteWatch refWrite{ref.cpu};
+    ref.cpu.setWatch(&watch, &refWrite);
+    ref.cpu.run();
+    ASSERT_EQ(ref.cpu.executed(), total);
+    ASSERT_NE(refWrite.instruction, 0);
+    const auto write = history.lastWrite(addr);
+    ASSERT_TRUE(write.has_value());
+    TRACELN(write->toString());
+    ASSERT_EQ(write->instruction, refWrite.instruction);
+    ASSERT_EQ(write->csip, refWrite.csip);
+    // the query leaves the machine where it was
+    ASSERT_EQ(m.cpu.executed(), total);
+    ASSERT_EQ(m.cpu.registers(), end);
+    ASSERT_TRUE(m.cpu.done());
+
+    // stepping back lands on the same state as a run which stopped there
+    const Size back = total / 3 + 7;
+    history.stepBack(back);
+    ASSERT_EQ(m.cpu.executed(), total - back);
+    Machine stop;
+    stop.cpu.run(total - back);
+    ASSERT_EQ(m.cpu.registers(), stop.cpu.registers());
+    history.stepBack(total);
+    ASSERT_EQ(m.cpu.executed(), 0);
+    ASSERT_EQ(m.console.str(), "Hello, world!\r\n");
+
+    // and runs forward from there the same way
+    history.run(total - back);
+    ASSERT_EQ(m.cpu.registers(), stop.cpu.registers());
+    history.run();
+    ASSERT_TRUE(m.cpu.done());
+    ASSERT_EQ(m.cpu.executed(), total);
+    ASSERT_EQ(m.cpu.registers(), end);
+    ASSERT_EQ(m.dos.exitCode(), 14);
+}
+
+TEST(Dos, FileServices) {
+    const fs::path dir = fs::temp_directory_path() / "mzretools_dos_test";
+    fs::remove_all(dir);
+    fs::create_directories(dir / "Data");
+    Memory mem;
+    Dos dos{&mem, dir.string()};
+    const Address buf{0x1000, 0};
+    const string text = "some file contents";
+    mem.writeBuf(buf.toLinear(), reinterpret_cast<const Byte*>(text.data()), text.size());
+    Word handle = 0, count = 0;
+    ASSERT_EQ(dos.createFile("c:\\data\\test.dat", handle), DOSERR_NONE);
+    ASSERT_GT(handle, Dos::HANDLE_STDPRN);
+    ASSERT_EQ(dos.writeFile(handle, buf, text.size(), count), DOSERR_NONE);
+    ASSERT_EQ(count, text.size());
+    ASSERT_EQ(dos.closeFile(handle), DOSERR_NONE);
+    ASSERT_EQ(dos.closeFile(handle), DOSERR_INVALID_HANDLE);
+    ASSERT_TRUE(fs::exists(dir / "Data" / "TEST.DAT"));
+
+    ASSERT_EQ(dos.openFile("missing.dat", 0, handle), DOSERR_FILE_NOT_FOUND);
+    ASSERT_EQ(dos.changeDir("DATA"), DOSERR_NONE);
+    ASSERT_EQ(dos.currentDir(), "DATA");
+    ASSERT_EQ(dos.openFile("Test.Dat", 2, handle), DOSERR_NONE);
+    DWord pos = 0;
+    ASSERT_EQ(dos.seekFile(handle, 2, static_cast<DWord>(-8), pos), DOSERR_NONE);
+    ASSERT_EQ(pos, text.size() - 8);
+    const Address readBuf{0x2000, 0};
+    ASSERT_EQ(dos.readFile(handle, readBuf, 100, count), DOSERR_NONE);
+    ASSERT_EQ(count, 8);
+    ASSERT_EQ(dos.readString(readBuf, '\0', count), "contents");
+    // zero length write truncates
+    ASSERT_EQ(dos.seekFile(handle, 0, 4, pos), DOSERR_NONE);
+    ASSERT_EQ(dos.writeFile(handle, buf, 0, count), DOSERR_NONE);
+    ASSERT_EQ(dos.closeFile(handle), DOSERR_NONE);
+    ASSERT_EQ(fs::file_size(dir / "Data" / "TEST.DAT"), 4);
+
+    dos.setDta(Address{0x3000, 0});
+    ASSERT_EQ(dos.findFirst("*.DAT", 0), DOSERR_NONE);
+    ASSERT_EQ(dos.readString(Address{0x3000, 0x1e}), "TEST.DAT");
+    ASSERT_EQ(mem.readWord(Address{0x3000, 0x1a}), 4);
+    ASSERT_EQ(dos.findNext(), DOSERR_NO_MORE_FILES);
+    ASSERT_EQ(dos.findFirst("\\*.*", 0), DOSERR_FILE_NOT_FOUND);
+    ASSERT_EQ(dos.findFirst("\\*.*", 0x10), DOSERR_NONE);
+    ASSERT_EQ(dos.readString(Address{0x3000, 0x1e}), "DATA");
+
+    ASSERT_EQ(dos.removeFile("test.dat"), DOSERR_NONE);
+    ASSERT_EQ(dos.removeFile("test.dat"), DOSERR_FILE_NOT_FOUND);
+    fs::remove_all(dir);
+}
+
+TEST(Dos, MemoryServices) {
+    Memory mem;
+    Dos dos{&mem};
+    MzImage mz("../bin/hello.exe");
+    dos.loadExe(mz);
+    const Word psp = dos.pspSegment();
+    Word seg = 0, largest = 0;
+    // the program owns all of the memory at first
+    ASSERT_EQ(dos.allocMemory(0x100, seg, largest), DOSERR_NO_MEMORY);
+    ASSERT_EQ(largest, 0);
+    ASSERT_EQ(dos.resizeMemory(psp, 0x1000, largest), DOSERR_NONE);
+    ASSERT_EQ(dos.allocMemory(0x100, seg, largest), DOSERR_NONE);
+    ASSERT_EQ(seg, psp + 0x1000 + 1);
+    // cannot grow over the next block
+    ASSERT_EQ(dos.resizeMemory(psp, 0x1100, largest), DOSERR_NO_MEMORY);
+    ASSERT_EQ(largest, 0x1000);
+    ASSERT_EQ(dos.freeMemory(seg + 1), DOSERR_INVALID_BLOCK);
+    Word seg2 = 0;
+    ASSERT_EQ(dos.allocMemory(0x10, seg2, largest), DOSERR_NONE);
+    ASSERT_EQ(seg2, seg + 0x100 + 1);
+    ASSERT_EQ(dos.freeMemory(seg), DOSERR_NONE);
+    // first fit reuses the gap
+    ASSERT_EQ(dos.allocMemory(0x80, seg, largest), DOSERR_NONE);
+    ASSERT_EQ(seg, psp + 0x1000 + 1);
+    ASSERT_EQ(dos.allocMemory(0xffff, seg, largest), DOSERR_NO_MEMORY);
+    ASSERT_EQ(largest, 0xa000 - (seg2 + 0x10) - 1);
+}
+
+TEST(Dos, RoutineHarness) {
+    const fs::path mapPath = fs::temp_directory_path() / "mzretools_harness.map";
+    {
+        ofstream map{mapPath};
+        map << "Size 1a43" << endl
+            << "Code1 CODE 0000" << endl
+            << "Data1 DATA 016f default" << endl
+            << "main: Code1 NEAR 0010-001f R0010-001f" << endl
+            << "strlen: Code1 NEAR 1638-1653 R1638-1653" << endl
+            << "isatty: Code1 NEAR 165e-1680 R165e-1680" << endl;
+    }
+    // the program never calls strlen, so the calls start from the loaded state with the default data segment
+    testing::internal::CaptureStdout();
+    auto strlen = make_unique<RoutineHarness>("../bin/hello.exe", mapPath.string(), "strlen");
+    testing::internal::GetCapturedStdout();
+    ASSERT_FALSE(strlen->reached());
+    HarnessInput input;
+    input.args = { 0x42 }; // "Hello, world!\n" in the data segment
+    input.di = 0x1234;
+    const HarnessResult res = strlen->call(input);
+    ASSERT_TRUE(res.returned) << res.error;
+    ASSERT_EQ(res.regs.get(REG_AX), 14);
+    ASSERT_EQ(res.regs.get(REG_DI), 0x1234);
+    ASSERT_EQ(res.stackDelta, 0);
+    // only the saved bp went on the stack, below the arguments
+    ASSERT_TRUE(res.dataWrites.empty());
+    ASSERT_TRUE(res.stackWrites.empty());
+    ASSERT_TRUE(res.otherWrites.empty());
+    // every call starts from the same state
+    ASSERT_EQ(res.compare(strlen->call(input)), "");
+
+    auto main = make_unique<RoutineHarness>("../bin/hello.exe", mapPath.string(), "main");
+    ASSERT_TRUE(main->reached());
+    testing::internal::CaptureStdout();
+    auto isatty = make_unique<RoutineHarness>("../bin/hello.exe", mapPath.string(), "isatty");
+    testing::internal::GetCapturedStdout();
+    input.args = { 1 };
+    const string diff = res.compare(isatty->call(input));
+    TRACELN(diff);
+    ASSERT_NE(diff.find("AX = 0x000e"), string::npos);
+    ASSERT_THROW(make_unique<RoutineHarness>("../bin/hello.exe", mapPath.string(), "nonexistent"), ArgError);
+    fs::remove(mapPath);
+}
+
+// Runs the same seeded trials like mzequiv does with one job and with four, where the trials are split between the threads
+// in an order which depends on the timing, and every thread has its own pair of machines. The results must be the same.
+TEST(Dos, HarnessJobs) {
+    const fs::path mapPath = fs::temp_directory_path() / "mzretools_harness_jobs.map";
+    {
+        ofstream map{mapPath};
+        map << "Size 1a43" << endl
+            << "Code1 CODE 0000" << endl
+            << "Data1 DATA 016f default" << endl
+            << "strlen: Code1 NEAR 1638-1653 R1638-1653" << endl
+            << "isatty: Code1 NEAR 165e-1680 R165e-1680" << endl;
+    }
+    const Size TRIALS = 64;
+    mt19937 rng{1234};
+    vector<HarnessInput> inputs(TRIALS);
+    for (HarnessInput &in : inputs) {
+        // small handles for isatty to go different ways on, anywhere in the data segment for strlen
+        in.args = { static_cast<Word>(rng() % 2 ? rng() % 8 : rng()) };
+        in.ax = rng(); in.bx = rng(); in.cx = rng();
+        in.dx = rng(); in.si = rng(); in.di = rng();
+    }
+    struct Run {
+        vector<HarnessResult> results;
+        vector<string> diffs;
+    };
+    const auto runJobs = [&](const Size jobs) {
+        Run run;
+        run.results.resize(TRIALS);
+        run.diffs.resize(TRIALS);
+        atomic<Size> next{0};
+        ThreadPool pool{jobs};
+        for (Size w = 0; w < pool.size(); ++w) pool.submit([&] {
+            RoutineHarness ref{"../bin/hello.exe", mapPath.string(), "strlen"};
+            RoutineHarness tgt{"../bin/hello.exe", mapPath.string(), "isatty"};
+            NullBuffer discard;
+            ostream nullOut{&discard};
+            istream nullIn{&discard};
+            ref.setConsole(nullIn, nullOut);
+            tgt.setConsole(nullIn, nullOut);
+            for (Size i = next++; i < TRIALS; i = next++) {
+                run.results[i] = ref.call(inputs[i]);
+                run.diffs[i] = run.results[i].compare(tgt.call(inputs[i]));
+            }
+        });
+        pool.wait();
+        return run;
+    };
+    testing::internal::CaptureStdout();
+    const Run single = runJobs(1), multi = runJobs(4);
+    testing::internal::GetCapturedStdout();
+    Size differing = 0;
+    for (Size i = 0; i < TRIALS; ++i) {
+        ASSERT_EQ(single.diffs[i], multi.diffs[i]) << "trial " << i << " with " << inputs[i].toString();
+        ASSERT_EQ(single.results[i].compare(multi.results[i]), "") << "trial " << i;
+        ASSERT_EQ(single.results[i].instructions, multi.results[i].instructions) << "trial " << i;
+        if (!single.diffs[i].empty()) differing++;
+    }
+    // the routines have nothing in common, so the comparison has something to reproduce
+    ASSERT_GT(differing, 0);
+    fs::remove(mapPath);
+}
@@ -309,22 +309,166 @@ TEST_F(MemoryTest, FindPattern) {
     Memory mem;
     mem.writeBuf(0, data, sizeof(data));
 
-    const ByteString pattern1 = { 3, -1, 5, 6, -1};
-    TRACELN("Looking for pattern1: " + numericToHexa(pattern1));
+    const BytePattern pattern1{"03??0506??"};
+    TRACELN("Looking for pattern1: " + pattern1.toString());
     const auto addr1 = mem.find(pattern1, where);
     TRACELN("Found pattern1: " << addr1.toString());
     ASSERT_EQ(addr1.toLinear(), 2);
 
-    const ByteString pattern2 = { 5, 1, -1, 3, 8};
-    TRACELN("Looking for pattern2: " + numericToHexa(pattern2));
+    const BytePattern pattern2{"0501??0308"};
+    TRACELN("Looking for pattern2: " + pattern2.toString());
     const auto addr2 = mem.find(pattern2, where);
     TRACELN("Found pattern2: " << addr2.toString());
     ASSERT_FALSE(addr2.isValid());
 
-    const ByteString pattern3 = { 1, 2, 3, 4, -1, 6, 7, -1, 9, 10 };
-    TRACELN("Looking for pattern3: " + numericToHexa(pattern3));
+    const BytePattern pattern3{"01020304??0607??090a"};
+    TRACELN("Looking for pattern3: " + pattern3.toString());
     const auto addr3 = mem.find(pattern3, where);
     TRACELN("Found pattern3: " << addr3.toString());
     ASSERT_TRUE(addr3.isValid());
     ASSERT_EQ(addr3.toLinear(), 0);
 }
+
+TEST_F(MemoryTest, BytePattern) {
+    const BytePattern p1{"ab12??EA"};
+    ASSERT_EQ(p1.size(), 4);
+    ASSERT_EQ(p1.fixedCount(), 3);
+    ASSERT_TRUE(p1.isWildcard(2));
+    ASSERT_EQ(p1.byte(3), 0xea);
+    ASSERT_EQ(p1.toString(), "ab12??ea");
+    ASSERT_THROW(BytePattern{"ab1"}, ArgError);
+    ASSERT_THROW(BytePattern{"abzz"}, ArgError);
+
+    // built up piecewise, crossing the 8 byte chunks and the 64 bit mask words
+    Byte data[100];
+    for (Size i = 0; i < sizeof(data); ++i) data[i] = static_cast<Byte>(i * 7);
+    BytePattern p2{data + 10, 70};
+    p2.wildcard(20, 3);
+    p2.wildcard(63, 2);
+    p2.append(BytePattern{"????????"});
+    p2.append(data[84]);
+    ASSERT_EQ(p2.size(), 75);
+    ASSERT_EQ(p2.fixedCount(), 66);
+    ASSERT_TRUE(p2.matches(data + 10));
+    Byte changed[100];
+    copy(begin(data), end(data), changed);
+    changed[10 + 21] ^= 0xff; // under a wildcard
+    changed[10 + 71] ^= 0xff;
+    ASSERT_TRUE(p2.matches(changed + 10));
+    changed[10 + 64] ^= 0xff;
+    ASSERT_TRUE(p2.matches(changed + 10));
+    changed[10 + 65] ^= 0x01;
+    ASSERT_FALSE(p2.matches(changed + 10));
+    ASSERT_THROW(p2.wildcard(74, 2), ArgError);
+
+    ASSERT_EQ(p2.find(data, sizeof(data)), 10);
+    ASSERT_EQ(p2.find(changed, sizeof(changed)), BytePattern::npos);
+    ASSERT_EQ(p2.find(data + 11, sizeof(data) - 11), BytePattern::npos);
+    // leading wildcards before the first fixed byte
+    const BytePattern p3{"????" + BytePattern{data + 50, 2}.toString()};
+    ASSERT_EQ(p3.find(data, sizeof(data)), 48);
+    ASSERT_EQ(p3.find(data, 51), BytePattern::npos);
+    ASSERT_EQ(BytePattern{"????"}.find(data, 1), BytePattern::npos);
+    ASSERT_EQ(BytePattern{"????"}.find(data, 2), 0);
+    ASSERT_EQ(BytePattern{"ab12??ea"}, p1);
+}
+
+TEST_F(MemoryTest, CodeTracking) {
+    Memory mem;
+    const Offset code = 0x12345;
+    mem.writeByte(code, 0x90);
+    ASSERT_FALSE(mem.codeWritten());
+    mem.trackCode(code, 100);
+    ASSERT_TRUE(mem.codeTracked(code));
+    ASSERT_TRUE(mem.codeTracked(code + 99));
+    ASSERT_FALSE(mem.codeTracked(code + 100));
+    // writes around the tracked area do not count
+    mem.writeWord(code - 2, 0x1234);
+    mem.fillBytes(code + 100, 0, 50);
+    ASSERT_FALSE(mem.codeWritten());
+    // the write range covers the tracked bytes only
+    mem.fillBytes(code - 10, 0xcc, 20);
+    ASSERT_TRUE(mem.codeWritten());
+    ASSERT_EQ(mem.codeWriteLow(), code);
+    ASSERT_EQ(mem.codeWriteHigh(), code + 9);
+    mem.writeWord(code + 99, 0xabcd);
+    ASSERT_EQ(mem.codeWriteHigh(), code + 99);
+    mem.clearCodeWrites();
+    ASSERT_FALSE(mem.codeWritten());
+    mem.untrackCode(code + 50, 50);
+    mem.copyBuf(code + 60, code, 10);
+    ASSERT_FALSE(mem.codeWritten());
+    mem.writeByte(code + 49, 0);
+    ASSERT_TRUE(mem.codeWritten());
+}
+
+TEST_F(MemoryTest, Snapshot) {
+    Memory mem;
+    const Offset a = 0x10000, b = 0x54321;
+    mem.writeByte(a, 1);
+    const MemorySnapshot s1 = mem.snapshot();
+    ASSERT_TRUE(s1.isValid());
+    ASSERT_EQ(mem.dirtyPages(), 0);
+    mem.writeByte(a, 2);
+    // a word straddling a page boundary dirties both pages
+    mem.writeWord(b - b % MEM_PAGE_SIZE - 1, 0xffff);
+    ASSERT_EQ(mem.dirtyPages(), 3);
+    const MemorySnapshot s2 = mem.snapshot();
+    mem.fillBytes(a, 3, 2 * MEM_PAGE_SIZE);
+    ASSERT_EQ(mem.readByte(a), 3);
+    mem.restore(s1);
+    ASSERT_EQ(mem.readByte(a), 1);
+    ASSERT_EQ(mem.dirtyPages(), 0);
+    mem.restore(s2);
+    ASSERT_EQ(mem.readByte(a), 2);
+    ASSERT_EQ(mem.readWord(b - b % MEM_PAGE_SIZE - 1), 0xffff);
+    // restoring a page marks the translated code in it as written
+    mem.trackCode(a + 10, 1);
+    mem.restore(s1);
+    ASSERT_TRUE(mem.codeWritten());
+    ASSERT_EQ(mem.codeWriteLow(), a + 10);
+    // forked instance is independent from the original
+    Memory fork{s2};
+    ASSERT_EQ(fork.readByte(a), 2);
+    fork.writeByte(a, 4);
+    ASSERT_EQ(mem.readByte(a), 1);
+    ASSERT_THROW(mem.restore(MemorySnapshot{}), MemoryError);
+}
+
+TEST_F(MemoryTest, SparsePages) {
+    const Byte pattern[] = { 0xde, 0xad, 0xbe, 0xef };
+    Memory mem;
+    ASSERT_EQ(mem.touchedPages(), 0);
+    const Offset a = 0x20000 + 5;
+    mem.writeByte(a, 1);
+    ASSERT_EQ(mem.touchedPages(), 1);
+    ASSERT_EQ(mem.readByte(a - 1), pattern[(a - 1) % sizeof pattern]);
+    // a word at the very end does not run off the mapping
+    ASSERT_EQ(*WORD_PTR(mem.base(), MEM_TOTAL - 1) & 0xff, pattern[(MEM_TOTAL - 1) % sizeof pattern]);
+    // only the pages written are copied into another instance or a snapshot
+    Memory copy{mem};
+    ASSERT_EQ(copy.touchedPages(), 1);
+    ASSERT_EQ(copy.readByte(a), 1);
+    copy.writeByte(a, 2);
+    ASSERT_EQ(mem.readByte(a), 1);
+    Memory fork{mem.snapshot()};
+    ASSERT_EQ(fork.touchedPages(), 1);
+    ASSERT_EQ(fork.readByte(a), 1);
+    ASSERT_EQ(fork.readByte(0), pattern[0]);
+    // assignment puts the pages written only in the target back to the pattern
+    Memory other;
+    other.writeByte(0x50000, 3);
+    other = mem;
+    ASSERT_EQ(other.readByte(0x50000), pattern[0x50000 % sizeof pattern]);
+    ASSERT_EQ(other.readByte(a), 1);
+    ASSERT_EQ(other.touchedPages(), 1);
+    // the copies do not log into the vector of the original
+    vector<MemoryWrite> log;
+    mem.logWrites(&log);
+    Memory logged{mem};
+    logged.writeByte(a, 5);
+    other = mem;
+    other.writeByte(a, 6);
+    ASSERT_TRUE(log.empty());
+    mem.logWrites(nullptr);
+}